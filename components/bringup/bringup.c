@@ -0,0 +1,197 @@
+#include "bringup.h"
+#include "wake_timing.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "BRINGUP";
+
+#define DEFAULT_STEP_STACK 4096
+
+typedef struct {
+    const bringup_step_t* step;
+    int index;
+    int64_t t0;
+    bringup_report_t* report;
+} step_ctx_t;
+
+// Static: one run at a time, and the step tasks reference it until they end
+static StaticEventGroup_t done_group_buffer;
+static EventGroupHandle_t done_group = NULL;
+static step_ctx_t contexts[BRINGUP_MAX_STEPS];
+static bringup_report_t scratch_report;
+
+static void step_task(void* param)
+{
+    step_ctx_t* ctx = param;
+    bringup_report_t* report = ctx->report;
+
+    report->start_us[ctx->index] = esp_timer_get_time() - ctx->t0;
+    esp_err_t err = ctx->step->fn(ctx->step->arg);
+    report->end_us[ctx->index] = esp_timer_get_time() - ctx->t0;
+    report->result[ctx->index] = err;
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Step '%s' failed: %s", ctx->step->name, esp_err_to_name(err));
+    }
+
+    xEventGroupSetBits(done_group, BIT(ctx->index));
+    vTaskDelete(NULL);
+}
+
+static bool graph_valid(const bringup_step_t* steps, size_t count)
+{
+    if (!steps || count == 0 || count > BRINGUP_MAX_STEPS) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!steps[i].fn || !steps[i].name || (steps[i].after >> i) != 0) {
+            return false;
+        }
+        if (steps[i].core != BRINGUP_ANY_CORE && (steps[i].core < 0 || steps[i].core >= portNUM_PROCESSORS)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Longest chain of dependent durations; ends at the step whose chain is longest
+static void compute_critical_path(const bringup_step_t* steps, size_t count, bringup_report_t* report)
+{
+    uint32_t chain_us[BRINGUP_MAX_STEPS];
+    int pred[BRINGUP_MAX_STEPS];
+    int last = -1;
+
+    report->work_us = 0;
+    report->total_us = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t duration = report->end_us[i] - report->start_us[i];
+        report->work_us += duration;
+        if (report->end_us[i] > report->total_us) {
+            report->total_us = report->end_us[i];
+        }
+
+        pred[i] = -1;
+        chain_us[i] = duration;
+        for (size_t j = 0; j < i; j++) {
+            if ((steps[i].after & BIT(j)) && chain_us[j] + duration > chain_us[i]) {
+                chain_us[i] = chain_us[j] + duration;
+                pred[i] = j;
+            }
+        }
+        if (last < 0 || chain_us[i] > chain_us[last]) {
+            last = i;
+        }
+    }
+
+    report->critical_us = chain_us[last];
+    report->critical_mask = 0;
+    for (int i = last; i >= 0; i = pred[i]) {
+        report->critical_mask |= BIT(i);
+    }
+}
+
+static void log_report(const bringup_step_t* steps, size_t count, const bringup_report_t* report)
+{
+    char path[96];
+    size_t len = 0;
+
+    path[0] = '\0';
+    for (size_t i = 0; i < count && len < sizeof(path); i++) {
+        if (report->critical_mask & BIT(i)) {
+            len += snprintf(&path[len], sizeof(path) - len, "%s%s", len ? " > " : "", steps[i].name);
+        }
+    }
+
+    ESP_LOGI(TAG, "Bring-up %lu us, critical path %lu us (%s), serial %lu us",
+             report->total_us, report->critical_us, path, report->work_us);
+    for (size_t i = 0; i < count; i++) {
+        ESP_LOGD(TAG, "  %-10s %8lu .. %8lu us", steps[i].name, report->start_us[i], report->end_us[i]);
+    }
+}
+
+esp_err_t bringup_run(const bringup_step_t* steps, size_t count, bringup_report_t* report)
+{
+    if (!graph_valid(steps, count)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!report) {
+        report = &scratch_report;
+    }
+
+    if (!done_group) {
+        done_group = xEventGroupCreateStatic(&done_group_buffer);
+    }
+    xEventGroupClearBits(done_group, BIT(BRINGUP_MAX_STEPS) - 1);
+    memset(report, 0, sizeof(*report));
+
+    const uint32_t all = BIT(count) - 1;
+    uint32_t succeeded = 0;
+    uint32_t failed = 0;
+    uint32_t launched = 0;
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t first_err = ESP_OK;
+
+    while ((succeeded | failed) != all) {
+        // Start everything that became ready, skip what can no longer run
+        for (size_t i = 0; i < count; i++) {
+            if (launched & BIT(i)) {
+                continue;
+            }
+            if (steps[i].after & failed) {
+                launched |= BIT(i);
+                failed |= BIT(i);
+                report->result[i] = ESP_ERR_INVALID_STATE;
+                report->start_us[i] = report->end_us[i] = esp_timer_get_time() - t0;
+                ESP_LOGW(TAG, "Step '%s' skipped", steps[i].name);
+                continue;
+            }
+            if ((steps[i].after & ~succeeded) != 0) {
+                continue;
+            }
+
+            contexts[i] = (step_ctx_t){ .step = &steps[i], .index = i, .t0 = t0, .report = report };
+            launched |= BIT(i);
+            if (xTaskCreatePinnedToCore(step_task, steps[i].name,
+                                        steps[i].stack ? steps[i].stack : DEFAULT_STEP_STACK,
+                                        &contexts[i], priority, NULL,
+                                        steps[i].core == BRINGUP_ANY_CORE ? tskNO_AFFINITY : steps[i].core) != pdPASS) {
+                failed |= BIT(i);
+                report->result[i] = ESP_ERR_NO_MEM;
+                report->start_us[i] = report->end_us[i] = esp_timer_get_time() - t0;
+                ESP_LOGE(TAG, "No task for step '%s'", steps[i].name);
+            }
+        }
+
+        uint32_t running = launched & ~(succeeded | failed);
+        if (!running) {
+            continue;
+        }
+
+        EventBits_t bits = xEventGroupWaitBits(done_group, running, pdTRUE, pdFALSE, portMAX_DELAY);
+        for (size_t i = 0; i < count; i++) {
+            if (bits & running & BIT(i)) {
+                if (report->result[i] == ESP_OK) {
+                    succeeded |= BIT(i);
+                } else {
+                    failed |= BIT(i);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count && first_err == ESP_OK; i++) {
+        first_err = report->result[i];
+    }
+
+    compute_critical_path(steps, count, report);
+    wake_timing_bringup(report->total_us, report->critical_us, report->work_us);
+    log_report(steps, count, report);
+    return first_err;
+}
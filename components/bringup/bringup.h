@@ -0,0 +1,77 @@
+#ifndef BRINGUP_H
+#define BRINGUP_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BRINGUP_MAX_STEPS 16
+#define BRINGUP_ANY_CORE (-1)
+
+/**
+ * @brief One bring-up step, runs in its own task
+ *
+ * @param arg bringup_step_t::arg
+ * @return esp_err_t ESP_OK lets the dependent steps start
+ */
+typedef esp_err_t (*bringup_fn_t)(void* arg);
+
+/**
+ * @brief Node of the bring-up graph
+ */
+typedef struct {
+    const char* name;   ///< Task and log name (string literal)
+    bringup_fn_t fn;    ///< Work of the step
+    void* arg;          ///< Passed to fn
+    uint32_t after;     ///< BIT() mask of earlier steps that must have succeeded first
+    int core;           ///< 0, 1 or BRINGUP_ANY_CORE
+    uint32_t stack;     ///< Task stack in bytes, 0 = 4096
+} bringup_step_t;
+
+/**
+ * @brief Measured schedule of one bringup_run()
+ *
+ * Times in µs relative to the start of the run.
+ */
+typedef struct {
+    uint32_t start_us[BRINGUP_MAX_STEPS];
+    uint32_t end_us[BRINGUP_MAX_STEPS];
+    esp_err_t result[BRINGUP_MAX_STEPS];    ///< ESP_ERR_INVALID_STATE if skipped after a failed dependency
+    uint32_t total_us;                      ///< End of the last step
+    uint32_t critical_us;                   ///< Longest chain of dependent step durations
+    uint32_t work_us;                       ///< Sum of all step durations
+    uint32_t critical_mask;                 ///< BIT() mask of the steps on that chain
+} bringup_report_t;
+
+/**
+ * @brief Run a dependency graph of steps on both cores
+ *
+ * Every step starts as soon as all steps in its after mask have
+ * succeeded, in a task pinned to its core at the caller's priority. Steps
+ * may only depend on steps with a lower index, so the graph is acyclic by
+ * construction. A failed step skips everything that depends on it; the
+ * other branches still run to the end.
+ *
+ * The result is recorded with wake_timing_bringup() and the critical path
+ * is logged.
+ *
+ * @param steps Graph, index = bit position in the after masks
+ * @param count Number of steps, at most BRINGUP_MAX_STEPS
+ * @param report Measured schedule (or NULL)
+ * @return esp_err_t ESP_OK if all steps succeeded, otherwise the result of the failed step with the lowest index
+ *                   ESP_ERR_INVALID_ARG for an invalid graph
+ *                   ESP_ERR_NO_MEM if a step task could not be created
+ *
+ * @note Not reentrant; blocks the caller until all steps have finished
+ */
+esp_err_t bringup_run(const bringup_step_t* steps, size_t count, bringup_report_t* report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRINGUP_H
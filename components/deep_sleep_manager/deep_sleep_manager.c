@@ -1,22 +1,177 @@
 #include "deep_sleep_manager.h"
+#include "dsm_private.h"
 #include "switch.h"
 #include "esp_log.h"
+#include "log_store.h"
 #include "esp_sleep.h"
 #include "driver/gpio.h"
 #include "driver/rtc_io.h"
 #include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_private/esp_clk.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "ulp.h"
+#include "ulp_switch_monitor.h"
+#include "wake_timing.h"
+#include <string.h>
+#include <sys/param.h>
 
 static const char *TAG = "DEEP_SLEEP_MGR";
 
 #define TIMER_WAKEUP_TIME_US (24ULL * 60 * 60 * 1000000)
 
-#define WAKEUP_GPIO_PIN GPIO_NUM_25
+// ULP switch monitor, layout mirrored from ulp/switch_monitor.S
+#define ULP_SAMPLE_PERIOD_US 10000
+#define ULP_EVENT_WORDS 3
+#define ULP_VALUE(x) ((x) & UINT16_MAX)
+
+extern const uint8_t ulp_switch_monitor_bin_start[] asm("_binary_ulp_switch_monitor_bin_start");
+extern const uint8_t ulp_switch_monitor_bin_end[] asm("_binary_ulp_switch_monitor_bin_end");
+
+static RTC_DATA_ATTR dsm_switch_wake_mode_t switch_wake_mode = DSM_SWITCH_WAKE_EXT0;
+static RTC_DATA_ATTR dsm_ulp_config_t ulp_config = {
+    .debounce_ms = 30,
+    .long_press_ms = 2000,
+    .wake_press_count = 3,
+};
+static RTC_DATA_ATTR bool ulp_armed = false;
+static RTC_DATA_ATTR uint64_t ulp_armed_rtc_us = 0;
+
+static dsm_press_stats_t press_stats;
+static bool press_stats_valid = false;
+
+// ULP-Ergebnisse aus dem RTC-Speicher übernehmen und Monitor anhalten
+static void collect_ulp_stats(void)
+{
+    if (!ulp_armed) {
+        return;
+    }
+    
+    ulp_timer_stop();
+    ulp_armed = false;
+    
+    memset(&press_stats, 0, sizeof(press_stats));
+    press_stats.press_count = ULP_VALUE(ulp_press_count);
+    press_stats.wake_reason = (dsm_ulp_wake_reason_t)ULP_VALUE(ulp_wake_reason);
+    press_stats.long_press_active = ULP_VALUE(ulp_long_press) && ULP_VALUE(ulp_stable_level) == 0;
+    press_stats.event_count = MIN(ULP_VALUE(ulp_event_count), DSM_MAX_PRESS_EVENTS);
+    
+    const uint32_t* events = &ulp_events;
+    for (uint32_t i = 0; i < press_stats.event_count; i++) {
+        const uint32_t* ev = &events[i * ULP_EVENT_WORDS];
+        uint64_t start_ticks = ULP_VALUE(ev[0]) | ((uint64_t)ULP_VALUE(ev[1]) << 16);
+        press_stats.events[i].timestamp_us = ulp_armed_rtc_us + start_ticks * ULP_SAMPLE_PERIOD_US;
+        press_stats.events[i].duration_ms = ULP_VALUE(ev[2]) * (ULP_SAMPLE_PERIOD_US / 1000);
+    }
+    
+    // Der ULP speichert erst beim Loslassen; ein gehaltener Long Press zählt
+    // wie beim Wake-Stub mit der bisherigen Haltezeit
+    if (press_stats.long_press_active && press_stats.event_count < DSM_MAX_PRESS_EVENTS) {
+        uint64_t start_ticks = ULP_VALUE(ulp_press_start_lo) | ((uint64_t)ULP_VALUE(ulp_press_start_hi) << 16);
+        uint64_t now_ticks = ULP_VALUE(ulp_tick_lo) | ((uint64_t)ULP_VALUE(ulp_tick_hi) << 16);
+        dsm_press_event_t* held = &press_stats.events[press_stats.event_count++];
+        held->timestamp_us = ulp_armed_rtc_us + start_ticks * ULP_SAMPLE_PERIOD_US;
+        held->duration_ms = (now_ticks - start_ticks) * (ULP_SAMPLE_PERIOD_US / 1000);
+        press_stats.press_count++;
+    }
+    
+    press_stats_valid = true;
+    LOG_STORE_LOGI(TAG, "ULP: %lu Betätigungen, %lu gespeichert, Weckgrund %d",
+                   press_stats.press_count, press_stats.event_count, press_stats.wake_reason);
+}
+
+// ULP laden, konfigurieren und starten; Pin muss bereits RTC GPIO sein
+static esp_err_t arm_ulp_monitor(void)
+{
+    esp_err_t ret = ulp_load_binary(0, ulp_switch_monitor_bin_start,
+                                    (ulp_switch_monitor_bin_end - ulp_switch_monitor_bin_start) / sizeof(uint32_t));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ULP Load failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ulp_debounce_samples = MAX(1, ulp_config.debounce_ms * 1000 / ULP_SAMPLE_PERIOD_US);
+    ulp_long_press_ticks = MIN(UINT16_MAX, ulp_config.long_press_ms * 1000 / ULP_SAMPLE_PERIOD_US);
+    ulp_wake_press_count = MIN(UINT16_MAX, ulp_config.wake_press_count);
+    ulp_stable_level = rtc_gpio_get_level(SWITCH_GPIO);
+    
+    ulp_set_wakeup_period(0, ULP_SAMPLE_PERIOD_US);
+    
+    // Pull-up des Schalters braucht die RTC-Peripherie im Deep Sleep
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    
+    ret = esp_sleep_enable_ulp_wakeup();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ULP Wakeup configuration failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ret = ulp_run(&ulp_entry - RTC_SLOW_MEM);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ULP Start failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ulp_armed_rtc_us = esp_clk_rtc_time();
+    ulp_armed = true;
+    
+    LOG_STORE_LOGI(TAG, "ULP Switch Monitor armed: debounce %lu ms, long press %lu ms, %lu presses",
+                   ulp_config.debounce_ms, ulp_config.long_press_ms, ulp_config.wake_press_count);
+    return ESP_OK;
+}
+
+esp_err_t deep_sleep_manager_set_switch_wake_mode(dsm_switch_wake_mode_t mode, const dsm_ulp_config_t* config)
+{
+    if (mode != DSM_SWITCH_WAKE_EXT0 && mode != DSM_SWITCH_WAKE_ULP && mode != DSM_SWITCH_WAKE_STUB) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    switch_wake_mode = mode;
+    if (config) {
+        ulp_config = *config;
+    }
+    return ESP_OK;
+}
+
+esp_err_t deep_sleep_manager_get_press_stats(dsm_press_stats_t* stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!press_stats_valid) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    *stats = press_stats;
+    return ESP_OK;
+}
 
 esp_err_t deep_sleep_manager_init(void)
 {
     esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+    dsm_awake_init();
+    
+    // Im Deep Sleep gesammelte Betätigungen vor handle_wakeup() sichern
+    collect_ulp_stats();
+    if (dsm_stub_collect(&press_stats)) {
+        press_stats_valid = true;
+    }
+    
+    // Ins Schalter-Journal übernehmen, dort bleiben sie bis zum nächsten Upload
+    if (press_stats_valid) {
+        for (uint32_t i = 0; i < press_stats.event_count; i++) {
+            switch_journal_add(press_stats.events[i].timestamp_us, press_stats.events[i].duration_ms,
+                               SWITCH_JOURNAL_ASLEEP);
+        }
+        // Der gehaltene Long Press steht damit schon im Journal
+        if (press_stats.long_press_active) {
+            switch_journal_skip_held_press();
+        }
+    }
+    
+    // Schlafdauer und Weckgrund in die Energiebilanz übernehmen
+    dsm_energy_on_boot(dsm_wake_class(esp_sleep_get_wakeup_cause()));
     
     esp_err_t ret = switch_init();
     if (ret != ESP_OK) {
@@ -24,84 +179,146 @@ esp_err_t deep_sleep_manager_init(void)
         return ret;
     }
     
-    ESP_LOGI(TAG, "Deep Sleep Manager erfolgreich initialisiert");
+    LOG_STORE_LOGI(TAG, "Deep Sleep Manager erfolgreich initialisiert");
     return ESP_OK;
 }
 
-void handle_wakeup(void (*switch_func)(void), void (*timer_func)(void), void (*boot_rst_func)(void))
+void handle_wakeup_inputs(dsm_input_func_t input_func, void (*timer_func)(void), void (*boot_rst_func)(void))
 {
     esp_sleep_wakeup_cause_t reason = esp_sleep_get_wakeup_cause();
-    ESP_LOGI(TAG, "Wakeup Reason: %d", reason);
+    LOG_STORE_LOGI(TAG, "Wakeup Reason: %d", reason);
+    
+    // Alle Eingänge auf einmal lesen, dann von RTC zu normal konvertieren
+    dsm_input_batch_t batch;
+    dsm_inputs_collect(reason, &batch);
+    dsm_inputs_release(reason);
     
-    // GPIO von RTC zu normal konvertieren wenn nötig
-    if (reason == ESP_SLEEP_WAKEUP_EXT0) {
-        rtc_gpio_deinit(WAKEUP_GPIO_PIN);
-        ESP_LOGI(TAG, "GPIO%d von RTC zu normal konvertiert", WAKEUP_GPIO_PIN);
+    // Ein Aufruf für alle Eingänge, beim Timer-Wakeup vor den Jobs; ein nur
+    // weiterhin aktiver Eingang ist nichts Neues
+    bool inputs_pending = (batch.triggered | batch.changed) != 0;
+    if (inputs_pending) {
+        dsm_inputs_log(&batch);
     }
+    inputs_pending = inputs_pending && input_func != NULL;
     
     switch (reason) {
         case ESP_SLEEP_WAKEUP_EXT0:
-            ESP_LOGI(TAG, "=== SWITCH WAKEUP ===");
-            if (switch_func != NULL) {
-                switch_func();
+            if (press_stats_valid) {
+                LOG_STORE_LOGI(TAG, "=== SWITCH WAKEUP (STUB) ===");
+            } else {
+                LOG_STORE_LOGI(TAG, "=== SWITCH WAKEUP ===");
             }
             break;
             
+        case ESP_SLEEP_WAKEUP_ULP:
+            LOG_STORE_LOGI(TAG, "=== SWITCH WAKEUP (ULP) ===");
+            break;
+            
+        case ESP_SLEEP_WAKEUP_EXT1:
+            LOG_STORE_LOGI(TAG, "=== INPUT WAKEUP ===");
+            break;
+            
         case ESP_SLEEP_WAKEUP_TIMER:
-            ESP_LOGI(TAG, "=== TIMER WAKEUP (24h) ===");
+            LOG_STORE_LOGI(TAG, "=== TIMER WAKEUP ===");
+            if (inputs_pending) {
+                input_func(&batch);
+                inputs_pending = false;
+            }
+            dsm_scheduler_dispatch();
             if (timer_func != NULL) {
                 timer_func();
             }
             break;
             
         case ESP_SLEEP_WAKEUP_UNDEFINED:
-            ESP_LOGI(TAG, "=== SYSTEM BOOT/RESET ===");
+            LOG_STORE_LOGI(TAG, "=== SYSTEM BOOT/RESET ===");
             if (boot_rst_func != NULL) {
                 boot_rst_func();
             }
-			break;
+            break;
             
         default:
-            ESP_LOGI(TAG, "=== UNKNOWN WAKEUP: %d ===", reason);
+            LOG_STORE_LOGI(TAG, "=== UNKNOWN WAKEUP: %d ===", reason);
             break;
     }
+    
+    if (inputs_pending) {
+        input_func(&batch);
+    }
+}
+
+static void (*legacy_switch_func)(void) = NULL;
+
+// Nur der Schalter, wie vor der Eingangstabelle
+static void legacy_input_func(const dsm_input_batch_t* batch)
+{
+    if ((batch->triggered & BIT(DSM_INPUT_SWITCH)) && legacy_switch_func != NULL) {
+        legacy_switch_func();
+    }
+}
+
+void handle_wakeup(void (*switch_func)(void), void (*timer_func)(void), void (*boot_rst_func)(void))
+{
+    legacy_switch_func = switch_func;
+    handle_wakeup_inputs(legacy_input_func, timer_func, boot_rst_func);
 }
 
 void enter_deep_sleep(void)
 {
-    ESP_LOGI(TAG, "Prepare Deep Sleep...");
+    LOG_STORE_LOGI(TAG, "Prepare Deep Sleep...");
     
-    esp_err_t ret = esp_sleep_enable_timer_wakeup(TIMER_WAKEUP_TIME_US);
+    // GPIO light-sleep wakeup and ISR are only meant for the awake phase
+    switch_disable_events();
+    
+    // Frühester Job bestimmt die Schlafdauer, ohne Jobs bleibt es bei 24h
+    uint64_t sleep_us = dsm_scheduler_sleep_us();
+    if (sleep_us == 0) {
+        sleep_us = TIMER_WAKEUP_TIME_US;
+    }
+    
+    esp_err_t ret = esp_sleep_enable_timer_wakeup(sleep_us);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Timer Wakeup Configuration failed: %s", esp_err_to_name(ret));
     } else {
-        ESP_LOGI(TAG, "Timer Wakeup configured: 24 Stunden");
+        LOG_STORE_LOGI(TAG, "Timer Wakeup configured: %llu s", sleep_us / 1000000);
     }
     
-    ESP_LOGI(TAG, "Convert GPIO%d to RTC GPIO for Deep Sleep", WAKEUP_GPIO_PIN);
-    gpio_reset_pin(WAKEUP_GPIO_PIN);
+    LOG_STORE_LOGI(TAG, "Convert GPIO%d to RTC GPIO for Deep Sleep", SWITCH_GPIO);
+    gpio_reset_pin(SWITCH_GPIO);
     
-    ret = rtc_gpio_init(WAKEUP_GPIO_PIN);
+    ret = rtc_gpio_init(SWITCH_GPIO);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "RTC GPIO Init failed: %s", esp_err_to_name(ret));
     }
     
-    rtc_gpio_set_direction(WAKEUP_GPIO_PIN, RTC_GPIO_MODE_INPUT_ONLY);
-    rtc_gpio_pullup_en(WAKEUP_GPIO_PIN);
-    rtc_gpio_pulldown_dis(WAKEUP_GPIO_PIN);
-    ESP_LOGI(TAG, "RTC GPIO Pullup enabled for Pin %d", WAKEUP_GPIO_PIN);
+    rtc_gpio_set_direction(SWITCH_GPIO, RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_pullup_en(SWITCH_GPIO);
+    rtc_gpio_pulldown_dis(SWITCH_GPIO);
+    LOG_STORE_LOGI(TAG, "RTC GPIO Pullup enabled for Pin %d", SWITCH_GPIO);
     
-    ret = esp_sleep_enable_ext0_wakeup(WAKEUP_GPIO_PIN, 0);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "EXT0 Wakeup configuration failed: %s", esp_err_to_name(ret));
+    if (switch_wake_mode == DSM_SWITCH_WAKE_ULP && arm_ulp_monitor() == ESP_OK) {
+        LOG_STORE_LOGI(TAG, "Enter Deep Sleep...");
+        LOG_STORE_LOGI(TAG, "Wakeup Sources: ULP (GPIO%d) or Timer", SWITCH_GPIO);
     } else {
-        ESP_LOGI(TAG, "EXT0 Wakeup configured: Pin %d, Level LOW", WAKEUP_GPIO_PIN);
+        ret = esp_sleep_enable_ext0_wakeup(SWITCH_GPIO, 0);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "EXT0 Wakeup configuration failed: %s", esp_err_to_name(ret));
+        } else {
+            LOG_STORE_LOGI(TAG, "EXT0 Wakeup configured: Pin %d, Level LOW", SWITCH_GPIO);
+        }
+        
+        LOG_STORE_LOGI(TAG, "Enter Deep Sleep...");
+        LOG_STORE_LOGI(TAG, "Wakeup Sources: GPIO%d (LOW) or Timer", SWITCH_GPIO);
     }
     
-    ESP_LOGI(TAG, "Enter Deep Sleep...");
-    ESP_LOGI(TAG, "Wakeup Sources: GPIO%d (LOW) or Timer (24h)", WAKEUP_GPIO_PIN);
+    // Weitere Eingänge gemeinsam über EXT1, unabhängig vom Schalter-Modus
+    dsm_inputs_arm();
     
-    vTaskDelay(pdMS_TO_TICKS(100));
+    // Wake-Stub entscheidet beim nächsten Wakeup, ob die App gebraucht wird
+    dsm_stub_arm(sleep_us, switch_wake_mode == DSM_SWITCH_WAKE_STUB ? &ulp_config : NULL);
     
+    // Konsole wird von esp_deep_sleep_start() selbst geleert
+    dsm_energy_on_sleep();
+    wake_timing_commit();
     esp_deep_sleep_start();
 }
\ No newline at end of file
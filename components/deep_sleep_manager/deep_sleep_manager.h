@@ -4,6 +4,8 @@
 #include "esp_err.h"
 #include "esp_sleep.h"
 #include "driver/gpio.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +17,149 @@ extern "C" {
  */
 typedef esp_sleep_wakeup_cause_t wakeup_reason_t;
 
+#define DSM_MAX_PRESS_EVENTS 8
+#define DSM_MAX_AWAKE_TOKENS 8
+#define DSM_AWAKE_TOKEN_INVALID (-1)
+#define DSM_MAX_JOBS 6
+#define DSM_JOB_NAME_LEN 12
+#define DSM_MAX_INPUTS 6
+#define DSM_INPUT_SWITCH 0      ///< Index des Schalters in der Eingangstabelle
+
+/**
+ * @brief Handle eines Stay-Awake-Tokens
+ */
+typedef int dsm_awake_token_t;
+
+/**
+ * @brief Periodischer Job, wird beim Timer-Wakeup ausgeführt wenn fällig
+ */
+typedef void (*dsm_job_func_t)(void);
+
+/**
+ * @brief Wie der Schalter den Hauptprozessor aus dem Deep Sleep weckt
+ */
+typedef enum {
+    DSM_SWITCH_WAKE_EXT0,   ///< Jeder Kontakt weckt sofort (Standard)
+    DSM_SWITCH_WAKE_ULP,    ///< ULP entprellt und zählt, weckt nur bei Bedingung
+    DSM_SWITCH_WAKE_STUB    ///< EXT0 weckt, der Wake-Stub entprellt und zählt, bootet nur bei Bedingung
+} dsm_switch_wake_mode_t;
+
+/**
+ * @brief Weckbedingungen für den ULP- und den Stub-Modus
+ * Der Hauptprozessor wird auch immer geweckt, wenn der Event-Puffer voll ist.
+ */
+typedef struct {
+    uint32_t debounce_ms;       ///< Pegel muss so lange stabil sein
+    uint32_t long_press_ms;     ///< Wecken bei so langem Halten (0 = aus)
+    uint32_t wake_press_count;  ///< Wecken nach so vielen Betätigungen (0 = aus)
+} dsm_ulp_config_t;
+
+/**
+ * @brief Grund, aus dem der ULP (oder der Wake-Stub) die App geweckt hat
+ */
+typedef enum {
+    DSM_ULP_WAKE_NONE = 0,      ///< Nicht vom ULP geweckt
+    DSM_ULP_WAKE_LONG_PRESS,    ///< Schalter länger als long_press_ms gehalten
+    DSM_ULP_WAKE_PRESS_COUNT,   ///< wake_press_count Betätigungen erreicht
+    DSM_ULP_WAKE_BUFFER_FULL    ///< Event-Puffer voll
+} dsm_ulp_wake_reason_t;
+
+/**
+ * @brief Eine vom ULP oder Wake-Stub aufgezeichnete Betätigung
+ */
+typedef struct {
+    uint64_t timestamp_us;      ///< Beginn, RTC-Zeit seit Power-On (esp_clk_rtc_time)
+    uint32_t duration_ms;       ///< Haltedauer
+} dsm_press_event_t;
+
+/**
+ * @brief Im Deep Sleep gesammelte Schalterstatistik
+ */
+typedef struct {
+    uint32_t press_count;                           ///< Alle Betätigungen, auch nicht gespeicherte
+    uint32_t event_count;                           ///< Gültige Einträge in events
+    bool long_press_active;                         ///< Schalter wird noch gehalten (Long Press)
+    dsm_ulp_wake_reason_t wake_reason;              ///< Weckgrund des ULP
+    dsm_press_event_t events[DSM_MAX_PRESS_EVENTS]; ///< Älteste zuerst
+} dsm_press_stats_t;
+
+/**
+ * @brief Aktiver Pegel eines Eingangs
+ */
+typedef enum {
+    DSM_INPUT_ACTIVE_LOW,   ///< Aktiv bei LOW, Pull-up
+    DSM_INPUT_ACTIVE_HIGH   ///< Aktiv bei HIGH, Pull-down
+} dsm_input_level_t;
+
+/**
+ * @brief Weckeingang zusätzlich zum Schalter (z.B. Tür- oder Sabotagekontakt)
+ */
+typedef struct {
+    const char* name;           ///< Für Log-Ausgaben (muss gültig bleiben)
+    gpio_num_t gpio;            ///< RTC GPIO
+    dsm_input_level_t level;    ///< Pegel, der weckt
+    bool pull;                  ///< Internen Pull zum inaktiven Pegel einschalten
+} dsm_input_config_t;
+
+/**
+ * @brief Alle Eingänge eines Wakeups, als Bitmaske über den Tabellenindex
+ */
+typedef struct {
+    esp_sleep_wakeup_cause_t cause; ///< Weckgrund
+    uint32_t triggered;             ///< Eingänge, die den Wakeup ausgelöst haben
+    uint32_t active;                ///< Eingänge, die beim Aufwachen aktiv waren
+    uint32_t changed;               ///< Eingänge (ohne Schalter), deren Pegel seit dem letzten Wakeup gewechselt hat
+} dsm_input_batch_t;
+
+/**
+ * @brief Wird einmal pro Wakeup mit allen ausgelösten und aktiven Eingängen aufgerufen,
+ *        aber nur wenn ein Eingang ausgelöst oder seinen Pegel gewechselt hat
+ */
+typedef void (*dsm_input_func_t)(const dsm_input_batch_t* batch);
+
+/**
+ * @brief Weckgrund-Klassen für die Energiebilanz
+ */
+typedef enum {
+    DSM_WAKE_CLASS_BOOT,    ///< Power-On, Reset oder unbekannt
+    DSM_WAKE_CLASS_SWITCH,  ///< Schalter oder Eingang (EXT0, EXT1 oder ULP)
+    DSM_WAKE_CLASS_TIMER,   ///< Timer
+    DSM_WAKE_CLASS_COUNT
+} dsm_wake_class_t;
+
+/**
+ * @brief Stromaufnahme je Zustand für die Ladungsschätzung (in µA)
+ */
+typedef struct {
+    uint32_t active_ua;     ///< CPU wach, Funk aus
+    uint32_t radio_ua;      ///< Zusätzlich bei eingeschaltetem WLAN-Funk
+    uint32_t portal_ua;     ///< Zusätzlich während das Setup-Portal läuft
+    uint32_t sleep_ua;      ///< Deep Sleep
+} dsm_current_profile_t;
+
+/**
+ * @brief Kumulierte Zähler seit dem ersten Start (überleben Deep Sleep und Stromausfall)
+ */
+typedef struct {
+    uint64_t awake_us[DSM_WAKE_CLASS_COUNT];    ///< Wachzeit je Weckgrund
+    uint32_t wakes[DSM_WAKE_CLASS_COUNT];       ///< Anzahl Wakes je Weckgrund
+    uint64_t radio_on_us[DSM_WAKE_CLASS_COUNT]; ///< WLAN-Funk eingeschaltet je Weckgrund
+    uint64_t portal_us;                         ///< Setup-Portal aktiv
+    uint64_t sleep_us;                          ///< Im Deep Sleep verbracht
+    double charge_uah;                          ///< Geschätzte Ladung gesamt
+    double wake_charge_uah[DSM_WAKE_CLASS_COUNT]; ///< Geschätzte Ladung je Weckgrund (ohne Sleep)
+} dsm_energy_stats_t;
+
+/**
+ * @brief Stand der Wanduhr-Referenz, Grundlage für die Fehlerabschätzung
+ */
+typedef struct {
+    int64_t ref_unix_us;    ///< Letzte gemeldete Wanduhrzeit
+    uint64_t age_us;        ///< RTC-Zeit seit dieser Meldung
+    int32_t drift_ppm;      ///< Geschätzte Drift, wird bereits ausgeglichen
+    bool drift_valid;       ///< Drift aus mindestens zwei Meldungen geschätzt
+} dsm_wall_clock_info_t;
+
 /**
  * @brief Initialisiert das Deep Sleep Management System
  * 
@@ -24,20 +169,224 @@ esp_err_t deep_sleep_manager_init(void);
 
 /**
  * @brief Startet den Deep Sleep Modus
- * Konfiguriert beide Wakeup-Quellen (GPIO25 und 24h Timer)
+ * Konfiguriert die Wakeup-Quellen (Schalter an SWITCH_GPIO, EXT1 für die
+ * registrierten Eingänge und Timer zum nächsten fälligen Job, ohne
+ * registrierte Jobs 24h) und bereitet den Wake-Stub vor. Der Stub
+ * schläft ohne App-Boot weiter, wenn ein Timer-Wakeup vor dem nächsten Job
+ * liegt oder (im Stub-Modus) ein Kontakt nur gezählt werden muss.
  */
 void enter_deep_sleep(void);
 
+/**
+ * @brief Wählt die Schalter-Weckquelle für die folgenden Deep Sleeps
+ * 
+ * Im ULP-Modus tastet der ULP-Coprozessor SWITCH_GPIO periodisch ab, entprellt,
+ * zählt Betätigungen und weckt den Hauptprozessor nur bei Long Press,
+ * nach N Betätigungen oder bei vollem Puffer. Prellen und kurze Kontakte
+ * kosten so keinen Boot mehr.
+ * 
+ * Im Stub-Modus weckt jeder Kontakt per EXT0, aber nur der Wake-Stub aus
+ * dem RTC Fast Memory läuft: er entprellt, zeichnet die Betätigung auf und
+ * schläft sofort weiter, bis eine der Bedingungen erfüllt ist. Bootloader
+ * und App starten erst dann.
+ * 
+ * @param mode DSM_SWITCH_WAKE_EXT0, DSM_SWITCH_WAKE_ULP oder DSM_SWITCH_WAKE_STUB
+ * @param config Weckbedingungen für den ULP- und Stub-Modus (NULL = Standardwerte)
+ * @return esp_err_t ESP_OK bei Erfolg
+ */
+esp_err_t deep_sleep_manager_set_switch_wake_mode(dsm_switch_wake_mode_t mode, const dsm_ulp_config_t* config);
+
+/**
+ * @brief Liefert die vom ULP oder Wake-Stub im letzten Deep Sleep gesammelten Betätigungen
+ * Gültig für den ganzen Wachzyklus, unabhängig vom Weckgrund. Die gespeicherten
+ * Einträge übernimmt deep_sleep_manager_init() außerdem ins Schalter-Journal.
+ * 
+ * @param stats Zielstruktur
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND wenn weder ULP noch Stub gezählt haben
+ */
+esp_err_t deep_sleep_manager_get_press_stats(dsm_press_stats_t* stats);
+
+/**
+ * @brief Registriert einen periodischen Job im Wake Scheduler
+ * 
+ * Name, Periode und nächste Fälligkeit liegen im RTC-Speicher und
+ * überleben den Deep Sleep; die Funktion muss daher bei jedem Start vor
+ * handle_wakeup() erneut registriert werden. Ein neuer Job ist erstmals
+ * nach einer Periode fällig. Nicht mehr registrierte Jobs werden vor dem
+ * nächsten Deep Sleep verworfen.
+ * 
+ * @param name Eindeutiger Name (max. DSM_JOB_NAME_LEN - 1 Zeichen)
+ * @param period_s Periode in Sekunden (Wanduhrzeit)
+ * @param func Auszuführende Funktion
+ * @return esp_err_t ESP_OK, ESP_ERR_NO_MEM wenn die Tabelle voll ist
+ */
+esp_err_t deep_sleep_manager_add_job(const char* name, uint32_t period_s, dsm_job_func_t func);
+
+/**
+ * @brief Entfernt einen Job aus dem Wake Scheduler
+ * 
+ * @param name Name des Jobs
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND wenn unbekannt
+ */
+esp_err_t deep_sleep_manager_remove_job(const char* name);
+
+/**
+ * @brief Meldet die aktuelle Wanduhrzeit (z.B. nach SNTP-Sync)
+ * 
+ * Aus zwei Meldungen im Abstand von mindestens einer Stunde wird die
+ * Drift des RTC-Takts geschätzt und bei allen Job-Perioden ausgeglichen.
+ * Jede Meldung setzt die Referenz neu; die Fälligkeiten der Jobs werden um
+ * den Fehler der bisherigen Schätzung verschoben und bleiben so auf die
+ * Wanduhrzeit ausgerichtet.
+ * 
+ * @param unix_us Unix-Zeit in Mikrosekunden
+ */
+void deep_sleep_manager_set_wall_clock(int64_t unix_us);
+
+/**
+ * @brief Schätzt die Wanduhrzeit aus der letzten Meldung und der RTC-Zeit
+ * 
+ * @param unix_us Unix-Zeit in Mikrosekunden
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_STATE ohne Wanduhr-Referenz
+ */
+esp_err_t deep_sleep_manager_get_wall_clock(int64_t* unix_us);
+
+/**
+ * @brief Liefert die geschätzte Drift des RTC-Takts
+ * 
+ * @return int32_t ppm, positiv wenn der RTC-Takt vorgeht
+ */
+int32_t deep_sleep_manager_get_drift_ppm(void);
+
+/**
+ * @brief Liefert Alter der Wanduhr-Referenz und Stand der Drift-Schätzung
+ * 
+ * @param info Zielstruktur
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_STATE ohne Wanduhr-Referenz
+ */
+esp_err_t deep_sleep_manager_get_wall_clock_info(dsm_wall_clock_info_t* info);
+
 /**
  * @brief Verarbeitet das Aufwachen und führt entsprechende Funktion aus
  * Sollte als erstes in app_main() aufgerufen werden
+ * Beim Timer-Wakeup werden zuerst alle fälligen Jobs ausgeführt; Jobs, die
+ * kurz danach fällig wären, laufen im selben Wakeup mit.
  * 
- * @param switch_func Funktion die beim Schalter-Wakeup ausgeführt wird
- * @param timer_func Funktion die beim Timer-Wakeup (24h) ausgeführt wird
+ * @param switch_func Funktion die beim Schalter-Wakeup (EXT0 oder ULP) ausgeführt wird
+ * @param timer_func Funktion die beim Timer-Wakeup nach den Jobs ausgeführt wird (oder NULL)
  * @param boot_rst_func Funktion die bei Boot/Reset ausgeführt wird
+ * 
+ * @note Registrierte Eingänge werden nur geloggt, siehe handle_wakeup_inputs()
  */
 void handle_wakeup(void (*switch_func)(void), void (*timer_func)(void), void (*boot_rst_func)(void));
 
+/**
+ * @brief Wie handle_wakeup(), liefert aber alle Eingänge eines Wakeups gebündelt
+ * 
+ * Der Weckgrund bestimmt die auslösenden Eingänge (EXT0/ULP: Schalter,
+ * EXT1: die gemeldeten Pins); zusätzlich wird der Pegel aller Eingänge im
+ * selben Moment gelesen. input_func läuft genau einmal, wenn mindestens ein
+ * Eingang ausgelöst oder seit dem letzten Wakeup seinen Pegel gewechselt hat,
+ * auch beim Timer-Wakeup. Ein weiterhin aktiver Eingang (z.B. offene Tür) ist
+ * kein neues Ereignis. Gleichzeitige
+ * Ereignisse kosten so einen Boot statt mehrerer. Beim Timer-Wakeup läuft
+ * input_func vor den Jobs, damit ein Upload-Job die Ereignisse schon mitnimmt.
+ * 
+ * @param input_func Funktion für die Eingänge dieses Wakeups (oder NULL)
+ * @param timer_func Funktion die beim Timer-Wakeup nach den Jobs ausgeführt wird (oder NULL)
+ * @param boot_rst_func Funktion die bei Boot/Reset ausgeführt wird
+ */
+void handle_wakeup_inputs(dsm_input_func_t input_func, void (*timer_func)(void), void (*boot_rst_func)(void));
+
+/**
+ * @brief Registriert einen weiteren Weckeingang (EXT1)
+ * 
+ * Die Tabelle liegt im RAM und muss bei jedem Start vor handle_wakeup_inputs()
+ * neu befüllt werden; Index DSM_INPUT_SWITCH ist immer der Schalter. EXT1 des
+ * ESP32 weckt nur bei "ein Pin HIGH" oder "alle Pins LOW": mehrere Eingänge
+ * müssen daher aktiv HIGH sein, aktiv LOW geht nur als einziger Eingang.
+ * Ein Eingang, der beim Einschlafen noch aktiv ist, weckt in diesem Deep
+ * Sleep nicht (der Pegel würde sofort wieder wecken).
+ * 
+ * @param config Eingang
+ * @param index Index in der Tabelle und Bit in dsm_input_batch_t (oder NULL)
+ * @return esp_err_t ESP_OK bei Erfolg
+ *                   ESP_ERR_INVALID_ARG ohne Name, kein RTC GPIO oder Pin bereits belegt
+ *                   ESP_ERR_NOT_SUPPORTED wenn der Pegel nicht zu den übrigen Eingängen passt
+ *                   ESP_ERR_NO_MEM wenn die Tabelle voll ist
+ */
+esp_err_t deep_sleep_manager_add_input(const dsm_input_config_t* config, int* index);
+
+/**
+ * @brief Name eines Eingangs
+ * 
+ * @param index Tabellenindex
+ * @return Name, NULL für einen unbekannten Index
+ */
+const char* deep_sleep_manager_input_name(int index);
+
+/**
+ * @brief Setzt die Stromaufnahme je Zustand für die Ladungsschätzung
+ * 
+ * @param profile Stromwerte in µA
+ */
+void deep_sleep_manager_set_current_profile(const dsm_current_profile_t* profile);
+
+/**
+ * @brief Meldet Ein-/Ausschalten des WLAN-Funks (von wifi_setup aufgerufen)
+ * 
+ * @param on true wenn der Funk eingeschaltet wurde
+ */
+void deep_sleep_manager_radio_state(bool on);
+
+/**
+ * @brief Meldet Start/Stop des Setup-Portals (von wifi_setup aufgerufen)
+ * 
+ * @param active true wenn das Portal gestartet wurde
+ */
+void deep_sleep_manager_portal_state(bool active);
+
+/**
+ * @brief Liefert die kumulierten Energiezähler inkl. laufendem Wachzyklus
+ * 
+ * Die Zähler liegen im RTC-Speicher und werden einmal täglich in NVS
+ * gesichert, nach einem Stromausfall geht höchstens ein Tag verloren.
+ * 
+ * @param stats Zielstruktur
+ * @return esp_err_t ESP_OK bei Erfolg
+ */
+esp_err_t deep_sleep_manager_get_energy_stats(dsm_energy_stats_t* stats);
+
+/**
+ * @brief Hält das System wach, bis das Token wieder freigegeben wird
+ * 
+ * Komponenten mit asynchroner Arbeit (Portal, WLAN-Verbindung, Uploads)
+ * holen ein Token beim Start und geben es am Ende frei. Die Hauptaufgabe
+ * wartet mit deep_sleep_manager_wait_idle() und schläft sofort, sobald
+ * kein Token mehr gehalten wird.
+ * 
+ * @param owner Name für Log-Ausgaben (muss gültig bleiben)
+ * @return dsm_awake_token_t Token, DSM_AWAKE_TOKEN_INVALID wenn alle vergeben
+ * 
+ * @note Erst nach deep_sleep_manager_init() verwenden
+ */
+dsm_awake_token_t deep_sleep_manager_stay_awake(const char* owner);
+
+/**
+ * @brief Gibt ein Stay-Awake-Token frei
+ * 
+ * @param token Token von deep_sleep_manager_stay_awake() (ungültige werden ignoriert)
+ */
+void deep_sleep_manager_release_awake(dsm_awake_token_t token);
+
+/**
+ * @brief Blockiert, bis alle Stay-Awake-Tokens freigegeben sind
+ * 
+ * @param timeout_ms Globale Deadline, danach wird trotzdem zurückgekehrt
+ * @return esp_err_t ESP_OK wenn frei, ESP_ERR_TIMEOUT bei Ablauf der Deadline
+ */
+esp_err_t deep_sleep_manager_wait_idle(uint32_t timeout_ms);
+
 #ifdef __cplusplus
 }
 #endif
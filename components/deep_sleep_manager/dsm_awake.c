@@ -0,0 +1,98 @@
+#include "deep_sleep_manager.h"
+#include "dsm_private.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+static const char *TAG = "DSM_AWAKE";
+
+#define AWAKE_IDLE_BIT BIT0
+
+static const char* token_owner[DSM_MAX_AWAKE_TOKENS];
+static uint32_t token_count = 0;
+
+static StaticSemaphore_t token_mutex_buffer;
+static SemaphoreHandle_t token_mutex = NULL;
+static StaticEventGroup_t awake_group_buffer;
+static EventGroupHandle_t awake_group = NULL;
+
+void dsm_awake_init(void)
+{
+    if (token_mutex) {
+        return;
+    }
+    
+    token_mutex = xSemaphoreCreateMutexStatic(&token_mutex_buffer);
+    awake_group = xEventGroupCreateStatic(&awake_group_buffer);
+    xEventGroupSetBits(awake_group, AWAKE_IDLE_BIT);
+}
+
+dsm_awake_token_t deep_sleep_manager_stay_awake(const char* owner)
+{
+    if (!token_mutex) {
+        ESP_LOGE(TAG, "Deep Sleep Manager nicht initialisiert");
+        return DSM_AWAKE_TOKEN_INVALID;
+    }
+    
+    dsm_awake_token_t token = DSM_AWAKE_TOKEN_INVALID;
+    
+    xSemaphoreTake(token_mutex, portMAX_DELAY);
+    for (int i = 0; i < DSM_MAX_AWAKE_TOKENS; i++) {
+        if (!token_owner[i]) {
+            token_owner[i] = owner ? owner : "?";
+            token = i;
+            break;
+        }
+    }
+    if (token != DSM_AWAKE_TOKEN_INVALID && token_count++ == 0) {
+        xEventGroupClearBits(awake_group, AWAKE_IDLE_BIT);
+    }
+    xSemaphoreGive(token_mutex);
+    
+    if (token == DSM_AWAKE_TOKEN_INVALID) {
+        ESP_LOGE(TAG, "Keine Stay-Awake-Tokens frei (%s)", owner ? owner : "?");
+    } else {
+        ESP_LOGD(TAG, "Token %d: %s", token, token_owner[token]);
+    }
+    return token;
+}
+
+void deep_sleep_manager_release_awake(dsm_awake_token_t token)
+{
+    if (!token_mutex || token < 0 || token >= DSM_MAX_AWAKE_TOKENS) {
+        return;
+    }
+    
+    xSemaphoreTake(token_mutex, portMAX_DELAY);
+    if (token_owner[token]) {
+        ESP_LOGD(TAG, "Token %d frei: %s", token, token_owner[token]);
+        token_owner[token] = NULL;
+        if (--token_count == 0) {
+            xEventGroupSetBits(awake_group, AWAKE_IDLE_BIT);
+        }
+    }
+    xSemaphoreGive(token_mutex);
+}
+
+esp_err_t deep_sleep_manager_wait_idle(uint32_t timeout_ms)
+{
+    if (!awake_group) {
+        return ESP_OK;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(awake_group, AWAKE_IDLE_BIT, pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    if (bits & AWAKE_IDLE_BIT) {
+        return ESP_OK;
+    }
+    
+    xSemaphoreTake(token_mutex, portMAX_DELAY);
+    for (int i = 0; i < DSM_MAX_AWAKE_TOKENS; i++) {
+        if (token_owner[i]) {
+            ESP_LOGW(TAG, "Deadline abgelaufen, Token %d noch gehalten: %s", i, token_owner[i]);
+        }
+    }
+    xSemaphoreGive(token_mutex);
+    return ESP_ERR_TIMEOUT;
+}
@@ -0,0 +1,232 @@
+#include "deep_sleep_manager.h"
+#include "dsm_private.h"
+#include "esp_log.h"
+#include "log_store.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_private/esp_clk.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+static const char *TAG = "DSM_ENERGY";
+static const char *NVS_NAMESPACE = "dsm";
+static const char *NVS_ENERGY_KEY = "energy";
+
+#define ENERGY_MAGIC 0x454E4731   // "ENG1"
+#define ENERGY_VERSION 1
+#define ENERGY_PERSIST_INTERVAL_US (24ULL * 60 * 60 * 1000000)
+#define US_PER_HOUR 3600000000.0
+
+// Zählerstände, in RTC gehalten und täglich als Blob in NVS gesichert
+typedef struct {
+    uint32_t version;
+    uint64_t awake_us[DSM_WAKE_CLASS_COUNT];
+    uint32_t wakes[DSM_WAKE_CLASS_COUNT];
+    uint64_t radio_on_us[DSM_WAKE_CLASS_COUNT];
+    uint64_t portal_us;
+    uint64_t sleep_us;
+} dsm_energy_totals_t;
+
+typedef struct {
+    uint32_t magic;
+    dsm_energy_totals_t totals;
+    uint64_t last_persist_rtc_us;
+    uint64_t sleep_entry_rtc_us;
+} dsm_energy_rtc_t;
+
+static RTC_DATA_ATTR dsm_energy_rtc_t energy;
+static RTC_DATA_ATTR dsm_current_profile_t current_profile = {
+    .active_ua = 30000,
+    .radio_ua = 90000,
+    .portal_ua = 0,
+    .sleep_ua = 10,
+};
+
+static dsm_wake_class_t wake_class = DSM_WAKE_CLASS_BOOT;
+static int64_t radio_on_since = -1;
+static int64_t portal_since = -1;
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint64_t sat_add(uint64_t a, uint64_t b)
+{
+    return (a > UINT64_MAX - b) ? UINT64_MAX : a + b;
+}
+
+static void load_from_nvs(void)
+{
+    if (nvs_flash_init() != ESP_OK) {
+        return;
+    }
+    
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    
+    dsm_energy_totals_t saved;
+    size_t size = sizeof(saved);
+    esp_err_t err = nvs_get_blob(nvs_handle, NVS_ENERGY_KEY, &saved, &size);
+    nvs_close(nvs_handle);
+    
+    if (err == ESP_OK && size == sizeof(saved) && saved.version == ENERGY_VERSION) {
+        energy.totals = saved;
+        LOG_STORE_LOGI(TAG, "Energiezähler aus NVS wiederhergestellt");
+    }
+}
+
+static void persist_to_nvs(uint64_t rtc_now)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_OK) {
+        err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Energiezähler nicht gesichert: %s", esp_err_to_name(err));
+        return;
+    }
+    
+    err = nvs_set_blob(nvs_handle, NVS_ENERGY_KEY, &energy.totals, sizeof(energy.totals));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    
+    if (err == ESP_OK) {
+        energy.last_persist_rtc_us = rtc_now;
+        LOG_STORE_LOGI(TAG, "Energiezähler in NVS gesichert");
+    }
+}
+
+dsm_wake_class_t dsm_wake_class(esp_sleep_wakeup_cause_t cause)
+{
+    switch (cause) {
+        case ESP_SLEEP_WAKEUP_EXT0:
+        case ESP_SLEEP_WAKEUP_EXT1:
+        case ESP_SLEEP_WAKEUP_ULP:
+            return DSM_WAKE_CLASS_SWITCH;
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return DSM_WAKE_CLASS_TIMER;
+        default:
+            return DSM_WAKE_CLASS_BOOT;
+    }
+}
+
+void dsm_energy_on_boot(dsm_wake_class_t cls)
+{
+    uint64_t rtc_now = esp_clk_rtc_time();
+    wake_class = cls;
+    
+    if (energy.magic != ENERGY_MAGIC) {
+        // Kaltstart: RTC-Zähler verloren, Stand der letzten Tagessicherung laden
+        memset(&energy, 0, sizeof(energy));
+        energy.magic = ENERGY_MAGIC;
+        energy.totals.version = ENERGY_VERSION;
+        load_from_nvs();
+        energy.last_persist_rtc_us = rtc_now;
+    } else if (energy.sleep_entry_rtc_us) {
+        // Schlafdauer bis zum Start der App (Bootzeit zählt mit)
+        uint64_t app_start_rtc = rtc_now - esp_timer_get_time();
+        if (app_start_rtc > energy.sleep_entry_rtc_us) {
+            energy.totals.sleep_us = sat_add(energy.totals.sleep_us, app_start_rtc - energy.sleep_entry_rtc_us);
+        }
+    }
+    
+    energy.sleep_entry_rtc_us = 0;
+    if (energy.totals.wakes[cls] < UINT32_MAX) {
+        energy.totals.wakes[cls]++;
+    }
+}
+
+void dsm_energy_on_sleep(void)
+{
+    deep_sleep_manager_portal_state(false);
+    deep_sleep_manager_radio_state(false);
+    
+    portENTER_CRITICAL(&energy_lock);
+    energy.totals.awake_us[wake_class] = sat_add(energy.totals.awake_us[wake_class], esp_timer_get_time());
+    portEXIT_CRITICAL(&energy_lock);
+    
+    uint64_t rtc_now = esp_clk_rtc_time();
+    if (rtc_now - energy.last_persist_rtc_us >= ENERGY_PERSIST_INTERVAL_US) {
+        persist_to_nvs(rtc_now);
+    }
+    
+    energy.sleep_entry_rtc_us = esp_clk_rtc_time();
+}
+
+void deep_sleep_manager_set_current_profile(const dsm_current_profile_t* profile)
+{
+    if (profile) {
+        current_profile = *profile;
+    }
+}
+
+void deep_sleep_manager_radio_state(bool on)
+{
+    int64_t now = esp_timer_get_time();
+    
+    portENTER_CRITICAL(&energy_lock);
+    if (on && radio_on_since < 0) {
+        radio_on_since = now;
+    } else if (!on && radio_on_since >= 0) {
+        energy.totals.radio_on_us[wake_class] = sat_add(energy.totals.radio_on_us[wake_class], now - radio_on_since);
+        radio_on_since = -1;
+    }
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+void deep_sleep_manager_portal_state(bool active)
+{
+    int64_t now = esp_timer_get_time();
+    
+    portENTER_CRITICAL(&energy_lock);
+    if (active && portal_since < 0) {
+        portal_since = now;
+    } else if (!active && portal_since >= 0) {
+        energy.totals.portal_us = sat_add(energy.totals.portal_us, now - portal_since);
+        portal_since = -1;
+    }
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+esp_err_t deep_sleep_manager_get_energy_stats(dsm_energy_stats_t* stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    int64_t now = esp_timer_get_time();
+    memset(stats, 0, sizeof(*stats));
+    
+    portENTER_CRITICAL(&energy_lock);
+    for (int i = 0; i < DSM_WAKE_CLASS_COUNT; i++) {
+        stats->awake_us[i] = energy.totals.awake_us[i];
+        stats->wakes[i] = energy.totals.wakes[i];
+        stats->radio_on_us[i] = energy.totals.radio_on_us[i];
+    }
+    stats->portal_us = energy.totals.portal_us;
+    stats->sleep_us = energy.totals.sleep_us;
+    
+    // Laufenden Wachzyklus mitzählen
+    stats->awake_us[wake_class] = sat_add(stats->awake_us[wake_class], now);
+    if (radio_on_since >= 0) {
+        stats->radio_on_us[wake_class] = sat_add(stats->radio_on_us[wake_class], now - radio_on_since);
+    }
+    if (portal_since >= 0) {
+        stats->portal_us = sat_add(stats->portal_us, now - portal_since);
+    }
+    portEXIT_CRITICAL(&energy_lock);
+    
+    for (int i = 0; i < DSM_WAKE_CLASS_COUNT; i++) {
+        stats->wake_charge_uah[i] = ((double)stats->awake_us[i] * current_profile.active_ua +
+                                     (double)stats->radio_on_us[i] * current_profile.radio_ua) / US_PER_HOUR;
+        stats->charge_uah += stats->wake_charge_uah[i];
+    }
+    stats->charge_uah += ((double)stats->portal_us * current_profile.portal_ua +
+                          (double)stats->sleep_us * current_profile.sleep_ua) / US_PER_HOUR;
+    
+    return ESP_OK;
+}
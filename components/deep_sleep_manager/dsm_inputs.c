@@ -0,0 +1,213 @@
+#include "deep_sleep_manager.h"
+#include "dsm_private.h"
+#include "switch.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "log_store.h"
+#include "esp_sleep.h"
+#include "esp_bit_defs.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
+#include <string.h>
+
+static const char *TAG = "DSM_INPUTS";
+
+// Nur im RAM, wird bei jedem Start neu registriert. Der Schalter weckt über
+// EXT0, ULP oder Stub, alle weiteren Eingänge gemeinsam über EXT1.
+static dsm_input_config_t inputs[DSM_MAX_INPUTS] = {
+    [DSM_INPUT_SWITCH] = {
+        .name = "switch",
+        .gpio = SWITCH_GPIO,
+        .level = DSM_INPUT_ACTIVE_LOW,
+        .pull = true,
+    },
+};
+static int input_count = 1;
+
+// Pegel beim letzten Wakeup: ein aktiver Eingang fehlt in der EXT1-Maske und
+// bleibt aktiv, neu ist nur ein Wechsel
+static RTC_DATA_ATTR uint32_t last_active = 0;
+
+static bool input_is_active(const dsm_input_config_t* input, int level)
+{
+    return level == (input->level == DSM_INPUT_ACTIVE_HIGH ? 1 : 0);
+}
+
+esp_err_t deep_sleep_manager_add_input(const dsm_input_config_t* config, int* index)
+{
+    if (!config || !config->name || !rtc_gpio_is_valid_gpio(config->gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < input_count; i++) {
+        if (inputs[i].gpio == config->gpio) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (input_count == DSM_MAX_INPUTS) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    // EXT1 kennt nur ANY_HIGH oder ALL_LOW; ALL_LOW ist nur mit einem Pin ein "oder"
+    if (input_count > 1 &&
+        (config->level == DSM_INPUT_ACTIVE_LOW || inputs[1].level == DSM_INPUT_ACTIVE_LOW)) {
+        ESP_LOGE(TAG, "Eingang %s: mehrere EXT1-Eingänge nur aktiv HIGH", config->name);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    
+    inputs[input_count] = *config;
+    if (index) {
+        *index = input_count;
+    }
+    input_count++;
+    
+    LOG_STORE_LOGI(TAG, "Eingang %s registriert: GPIO%d, aktiv %s", config->name, config->gpio,
+                   config->level == DSM_INPUT_ACTIVE_HIGH ? "HIGH" : "LOW");
+    return ESP_OK;
+}
+
+const char* deep_sleep_manager_input_name(int index)
+{
+    if (index < 0 || index >= input_count) {
+        return NULL;
+    }
+    return inputs[index].name;
+}
+
+void dsm_inputs_collect(esp_sleep_wakeup_cause_t cause, dsm_input_batch_t* batch)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->cause = cause;
+    
+    // Ohne Deep Sleep sind die Pins keine RTC GPIOs und nichts hat geweckt;
+    // nach einem Reset ist der gemeldete Zustand unbekannt
+    if (cause == ESP_SLEEP_WAKEUP_UNDEFINED) {
+        last_active = 0;
+        return;
+    }
+    
+    // Auslösende Eingänge je Weckgrund
+    switch (cause) {
+        case ESP_SLEEP_WAKEUP_EXT0:
+        case ESP_SLEEP_WAKEUP_ULP:
+            batch->triggered = BIT(DSM_INPUT_SWITCH);
+            break;
+    
+        case ESP_SLEEP_WAKEUP_EXT1: {
+            // Alle gleichzeitig aktiven Pins, nicht nur der erste
+            uint64_t pins = esp_sleep_get_ext1_wakeup_status();
+            for (int i = 1; i < input_count; i++) {
+                if (pins & BIT64(inputs[i].gpio)) {
+                    batch->triggered |= BIT(i);
+                }
+            }
+            break;
+        }
+    
+        default:
+            break;
+    }
+    
+    // Pegel aller Eingänge im selben Moment, solange sie noch RTC GPIOs sind
+    for (int i = 0; i < input_count; i++) {
+        if (input_is_active(&inputs[i], rtc_gpio_get_level(inputs[i].gpio))) {
+            batch->active |= BIT(i);
+        }
+    }
+    
+    // Der Schalter meldet sich nur als Auslöser, sein Pegel ist ein Tastendruck
+    batch->changed = (batch->active ^ last_active) & ~BIT(DSM_INPUT_SWITCH);
+    last_active = batch->active;
+}
+
+void dsm_inputs_release(esp_sleep_wakeup_cause_t cause)
+{
+    for (int i = 0; i < input_count; i++) {
+        const dsm_input_config_t* input = &inputs[i];
+    
+        // EXT0, EXT1 und ULP nutzen die Pins als RTC GPIO
+        if (cause != ESP_SLEEP_WAKEUP_UNDEFINED) {
+            rtc_gpio_deinit(input->gpio);
+            LOG_STORE_LOGI(TAG, "GPIO%d von RTC zu normal konvertiert", input->gpio);
+        }
+    
+        // Den Schalter konfiguriert switch_init()
+        if (i == DSM_INPUT_SWITCH) {
+            continue;
+        }
+        gpio_config_t io_config = {
+            .pin_bit_mask = BIT64(input->gpio),
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = input->pull && input->level == DSM_INPUT_ACTIVE_LOW,
+            .pull_down_en = input->pull && input->level == DSM_INPUT_ACTIVE_HIGH,
+        };
+        gpio_config(&io_config);
+    }
+}
+
+void dsm_inputs_arm(void)
+{
+    uint64_t mask = 0;
+    bool pulls = false;
+    
+    for (int i = 1; i < input_count; i++) {
+        const dsm_input_config_t* input = &inputs[i];
+    
+        // Pegelgetriggert: ein noch aktiver Eingang würde sofort wieder wecken
+        bool active = input_is_active(input, gpio_get_level(input->gpio));
+    
+        gpio_reset_pin(input->gpio);
+        esp_err_t ret = rtc_gpio_init(input->gpio);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "RTC GPIO Init für %s fehlgeschlagen: %s", input->name, esp_err_to_name(ret));
+            continue;
+        }
+        rtc_gpio_set_direction(input->gpio, RTC_GPIO_MODE_INPUT_ONLY);
+        if (input->pull && input->level == DSM_INPUT_ACTIVE_LOW) {
+            rtc_gpio_pullup_en(input->gpio);
+            rtc_gpio_pulldown_dis(input->gpio);
+        } else if (input->pull) {
+            rtc_gpio_pulldown_en(input->gpio);
+            rtc_gpio_pullup_dis(input->gpio);
+        } else {
+            rtc_gpio_pullup_dis(input->gpio);
+            rtc_gpio_pulldown_dis(input->gpio);
+        }
+        pulls |= input->pull;
+    
+        if (active) {
+            ESP_LOGW(TAG, "Eingang %s ist aktiv und weckt in diesem Deep Sleep nicht", input->name);
+            continue;
+        }
+        mask |= BIT64(input->gpio);
+    }
+    
+    if (mask == 0) {
+        return;
+    }
+    
+    // Interne Pulls brauchen die RTC-Peripherie im Deep Sleep
+    if (pulls) {
+        esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    }
+    
+    esp_sleep_ext1_wakeup_mode_t mode = inputs[1].level == DSM_INPUT_ACTIVE_HIGH ?
+                                        ESP_EXT1_WAKEUP_ANY_HIGH : ESP_EXT1_WAKEUP_ALL_LOW;
+    esp_err_t ret = esp_sleep_enable_ext1_wakeup_io(mask, mode);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "EXT1 Wakeup configuration failed: %s", esp_err_to_name(ret));
+    } else {
+        LOG_STORE_LOGI(TAG, "EXT1 Wakeup configured: Mask 0x%llx, %s", mask,
+                       mode == ESP_EXT1_WAKEUP_ANY_HIGH ? "any HIGH" : "LOW");
+    }
+}
+
+void dsm_inputs_log(const dsm_input_batch_t* batch)
+{
+    for (int i = 0; i < input_count; i++) {
+        if ((batch->triggered | batch->changed) & BIT(i)) {
+            LOG_STORE_LOGI(TAG, "Eingang %s:%s%s", inputs[i].name,
+                           (batch->triggered & BIT(i)) ? " ausgelöst" : "",
+                           (batch->active & BIT(i)) ? " aktiv" : " inaktiv");
+        }
+    }
+}
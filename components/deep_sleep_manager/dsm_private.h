@@ -0,0 +1,33 @@
+#ifndef DSM_PRIVATE_H
+#define DSM_PRIVATE_H
+
+#include "deep_sleep_manager.h"
+
+// Interne Schnittstellen zwischen den Quelldateien des Deep Sleep Managers
+
+dsm_wake_class_t dsm_wake_class(esp_sleep_wakeup_cause_t cause);
+
+// Energiebilanz: Wachzyklus beginnen / vor dem Deep Sleep abschließen
+void dsm_energy_on_boot(dsm_wake_class_t wake_class);
+void dsm_energy_on_sleep(void);
+
+// Stay-Awake-Tokens: Mutex und Event Group anlegen
+void dsm_awake_init(void);
+
+// Wake Scheduler: fällige Jobs ausführen / Schlafdauer bis zum nächsten Job (0 = keine Jobs)
+void dsm_scheduler_dispatch(void);
+uint64_t dsm_scheduler_sleep_us(void);
+
+// Wake-Stub: vor dem Deep Sleep vorbereiten (press_config NULL = Kontakte nicht im Stub zählen) /
+// gesammelte Betätigungen übernehmen (false wenn der Stub nicht gezählt hat)
+void dsm_stub_arm(uint64_t sleep_us, const dsm_ulp_config_t* press_config);
+bool dsm_stub_collect(dsm_press_stats_t* stats);
+
+// Eingangstabelle: Eingänge des Wakeups auslesen / aus RTC GPIO lösen /
+// EXT1 für die Eingänge außer dem Schalter vor dem Deep Sleep vorbereiten
+void dsm_inputs_collect(esp_sleep_wakeup_cause_t cause, dsm_input_batch_t* batch);
+void dsm_inputs_release(esp_sleep_wakeup_cause_t cause);
+void dsm_inputs_arm(void);
+void dsm_inputs_log(const dsm_input_batch_t* batch);
+
+#endif // DSM_PRIVATE_H
@@ -0,0 +1,266 @@
+#include "deep_sleep_manager.h"
+#include "dsm_private.h"
+#include "esp_log.h"
+#include "log_store.h"
+#include "esp_attr.h"
+#include "esp_private/esp_clk.h"
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "DSM_SCHED";
+
+#define SCHEDULER_MAGIC 0x53434831  // "SCH1"
+
+// Jobs, die innerhalb dieses Fensters nach dem frühesten fällig sind, laufen im selben Wakeup
+#define JOB_MERGE_WINDOW_US (120ULL * 1000000)
+// Kürzeste Schlafdauer, wenn ein Job bereits überfällig ist
+#define MIN_SLEEP_US (1ULL * 1000000)
+// Mindestabstand zweier Wanduhr-Meldungen für eine Drift-Schätzung
+#define DRIFT_MIN_INTERVAL_US (60ULL * 60 * 1000000)
+#define DRIFT_MAX_PPM 100000
+
+typedef struct {
+    char name[DSM_JOB_NAME_LEN];
+    uint32_t period_s;
+    uint64_t deadline_rtc_us;
+} dsm_job_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    dsm_job_slot_t jobs[DSM_MAX_JOBS];
+    int64_t wall_ref_us;
+    uint64_t wall_ref_rtc_us;
+    bool wall_ref_valid;
+    bool drift_valid;
+    int32_t drift_ppm;
+    int64_t drift_anchor_us;        // Ältere Meldung, gegen die die Drift gemessen wird
+    uint64_t drift_anchor_rtc_us;
+} dsm_scheduler_rtc_t;
+
+static RTC_DATA_ATTR dsm_scheduler_rtc_t sched;
+
+// Funktionszeiger nur im RAM, werden bei jedem Start neu registriert
+static dsm_job_func_t job_funcs[DSM_MAX_JOBS];
+
+static void scheduler_check_init(void)
+{
+    if (sched.magic != SCHEDULER_MAGIC) {
+        memset(&sched, 0, sizeof(sched));
+        sched.magic = SCHEDULER_MAGIC;
+    }
+}
+
+// Periode in Wanduhrzeit in RTC-Zeit umrechnen (Drift-Ausgleich)
+static uint64_t period_rtc_us(uint32_t period_s)
+{
+    int64_t period_us = (int64_t)period_s * 1000000 + (int64_t)period_s * sched.drift_ppm;
+    return MAX(period_us, 1);
+}
+
+static int find_job(const char* name)
+{
+    for (int i = 0; i < DSM_MAX_JOBS; i++) {
+        if (sched.jobs[i].name[0] && strncmp(sched.jobs[i].name, name, DSM_JOB_NAME_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t deep_sleep_manager_add_job(const char* name, uint32_t period_s, dsm_job_func_t func)
+{
+    if (!name || !name[0] || strlen(name) >= DSM_JOB_NAME_LEN || period_s == 0 || !func) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    scheduler_check_init();
+    
+    int index = find_job(name);
+    if (index < 0) {
+        for (int i = 0; i < DSM_MAX_JOBS && index < 0; i++) {
+            if (!sched.jobs[i].name[0]) {
+                index = i;
+            }
+        }
+        if (index < 0) {
+            ESP_LOGE(TAG, "Job-Tabelle voll, '%s' nicht registriert", name);
+            return ESP_ERR_NO_MEM;
+        }
+        
+        strncpy(sched.jobs[index].name, name, DSM_JOB_NAME_LEN - 1);
+        sched.jobs[index].period_s = period_s;
+        sched.jobs[index].deadline_rtc_us = esp_clk_rtc_time() + period_rtc_us(period_s);
+        LOG_STORE_LOGI(TAG, "Job '%s' neu, Periode %lu s", name, period_s);
+    } else if (sched.jobs[index].period_s != period_s) {
+        // Geänderte Periode gilt ab jetzt
+        sched.jobs[index].period_s = period_s;
+        sched.jobs[index].deadline_rtc_us = esp_clk_rtc_time() + period_rtc_us(period_s);
+    }
+    
+    job_funcs[index] = func;
+    return ESP_OK;
+}
+
+esp_err_t deep_sleep_manager_remove_job(const char* name)
+{
+    if (!name) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    scheduler_check_init();
+    
+    int index = find_job(name);
+    if (index < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    memset(&sched.jobs[index], 0, sizeof(sched.jobs[index]));
+    job_funcs[index] = NULL;
+    return ESP_OK;
+}
+
+// Wanduhr-Schätzung für einen RTC-Zeitpunkt
+static int64_t wall_at(uint64_t rtc_us)
+{
+    int64_t rtc_elapsed = (int64_t)(rtc_us - sched.wall_ref_rtc_us);
+    return sched.wall_ref_us + rtc_elapsed - rtc_elapsed / 1000000 * sched.drift_ppm;
+}
+
+void deep_sleep_manager_set_wall_clock(int64_t unix_us)
+{
+    scheduler_check_init();
+    
+    uint64_t rtc_now = esp_clk_rtc_time();
+    
+    if (!sched.wall_ref_valid) {
+        sched.drift_anchor_us = unix_us;
+        sched.drift_anchor_rtc_us = rtc_now;
+    } else {
+        // Fälligkeiten sind Wanduhr-Zeitpunkte: um den Fehler der alten Schätzung verschieben
+        int64_t error = unix_us - wall_at(rtc_now);
+        for (int i = 0; i < DSM_MAX_JOBS; i++) {
+            if (sched.jobs[i].name[0]) {
+                sched.jobs[i].deadline_rtc_us -= error;
+            }
+        }
+        if (error > 1000000 || error < -1000000) {
+            LOG_STORE_LOGI(TAG, "Wanduhr um %lld ms korrigiert", error / 1000);
+        }
+        
+        int64_t rtc_elapsed = (int64_t)(rtc_now - sched.drift_anchor_rtc_us);
+        int64_t wall_elapsed = unix_us - sched.drift_anchor_us;
+        
+        // Zu kurze Abstände geben keine brauchbare Schätzung, Anker dann behalten
+        if (wall_elapsed >= (int64_t)DRIFT_MIN_INTERVAL_US) {
+            int64_t ppm = (rtc_elapsed - wall_elapsed) * 1000000 / wall_elapsed;
+            if (ppm > DRIFT_MAX_PPM || ppm < -DRIFT_MAX_PPM) {
+                ESP_LOGW(TAG, "Unplausible Drift %lld ppm verworfen", ppm);
+            } else {
+                // Gleitender Mittelwert, neue Messung mit 1/4 gewichtet
+                sched.drift_ppm = sched.drift_valid ? (int32_t)((3 * (int64_t)sched.drift_ppm + ppm) / 4) : (int32_t)ppm;
+                sched.drift_valid = true;
+                LOG_STORE_LOGI(TAG, "RTC-Drift: %ld ppm (Messung %lld ppm)", sched.drift_ppm, ppm);
+            }
+            sched.drift_anchor_us = unix_us;
+            sched.drift_anchor_rtc_us = rtc_now;
+        }
+    }
+    
+    sched.wall_ref_us = unix_us;
+    sched.wall_ref_rtc_us = rtc_now;
+    sched.wall_ref_valid = true;
+}
+
+esp_err_t deep_sleep_manager_get_wall_clock(int64_t* unix_us)
+{
+    if (!unix_us) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (sched.magic != SCHEDULER_MAGIC || !sched.wall_ref_valid) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    *unix_us = wall_at(esp_clk_rtc_time());
+    return ESP_OK;
+}
+
+esp_err_t deep_sleep_manager_get_wall_clock_info(dsm_wall_clock_info_t* info)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (sched.magic != SCHEDULER_MAGIC || !sched.wall_ref_valid) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    info->ref_unix_us = sched.wall_ref_us;
+    info->age_us = esp_clk_rtc_time() - sched.wall_ref_rtc_us;
+    info->drift_ppm = sched.drift_ppm;
+    info->drift_valid = sched.drift_valid;
+    return ESP_OK;
+}
+
+int32_t deep_sleep_manager_get_drift_ppm(void)
+{
+    return (sched.magic == SCHEDULER_MAGIC) ? sched.drift_ppm : 0;
+}
+
+void dsm_scheduler_dispatch(void)
+{
+    if (sched.magic != SCHEDULER_MAGIC) {
+        return;
+    }
+    
+    uint64_t now = esp_clk_rtc_time();
+    uint64_t horizon = now + JOB_MERGE_WINDOW_US;
+    
+    for (int i = 0; i < DSM_MAX_JOBS; i++) {
+        dsm_job_slot_t* job = &sched.jobs[i];
+        if (!job->name[0] || job->deadline_rtc_us > horizon) {
+            continue;
+        }
+        
+        if (job_funcs[i]) {
+            LOG_STORE_LOGI(TAG, "Job '%s' fällig", job->name);
+            job_funcs[i]();
+        } else {
+            ESP_LOGW(TAG, "Job '%s' ohne Funktion übersprungen", job->name);
+        }
+        
+        // Nächste Fälligkeit im Raster halten, verpasste Perioden nicht nachholen
+        uint64_t period = period_rtc_us(job->period_s);
+        job->deadline_rtc_us += period;
+        if (job->deadline_rtc_us <= horizon) {
+            job->deadline_rtc_us = now + period;
+        }
+    }
+}
+
+uint64_t dsm_scheduler_sleep_us(void)
+{
+    if (sched.magic != SCHEDULER_MAGIC) {
+        return 0;
+    }
+    
+    uint64_t earliest = UINT64_MAX;
+    
+    for (int i = 0; i < DSM_MAX_JOBS; i++) {
+        if (!sched.jobs[i].name[0]) {
+            continue;
+        }
+        if (!job_funcs[i]) {
+            // In diesem Start nicht mehr registriert
+            LOG_STORE_LOGI(TAG, "Job '%s' verworfen", sched.jobs[i].name);
+            memset(&sched.jobs[i], 0, sizeof(sched.jobs[i]));
+            continue;
+        }
+        earliest = MIN(earliest, sched.jobs[i].deadline_rtc_us);
+    }
+    
+    if (earliest == UINT64_MAX) {
+        return 0;
+    }
+    
+    uint64_t now = esp_clk_rtc_time();
+    return (earliest > now + MIN_SLEEP_US) ? earliest - now : MIN_SLEEP_US;
+}
@@ -0,0 +1,213 @@
+#include "deep_sleep_manager.h"
+#include "dsm_private.h"
+#include "esp_log.h"
+#include "log_store.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_wake_stub.h"
+#include "esp_rom_sys.h"
+#include "esp_private/esp_clk.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+#include "soc/soc.h"
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "DSM_STUB";
+
+#define STUB_MAGIC 0x44535331       // "DSS1"
+
+// RTC_GPIO6 ist GPIO25 (SWITCH_GPIO); rtc_io_num_map liegt im Flash und ist im Stub nicht erreichbar
+#define STUB_RTCIO_NUM 6
+#define STUB_POLL_US 1000
+// Obergrenze für das Warten auf Loslassen, wenn kein Long Press konfiguriert ist
+#define STUB_MAX_HOLD_MS 5000
+// Restschlafdauer, unter der der Stub die App bootet statt erneut zu schlafen
+#define STUB_MIN_SLEEP_US (1ULL * 1000000)
+
+typedef struct {
+    uint64_t start_ticks;
+    uint64_t duration_ticks;
+} dsm_stub_event_t;
+
+// Vom Hauptprogramm vor dem Deep Sleep vorbereitet, vom Stub fortgeschrieben.
+// Alle Zeiten in RTC-Ticks, damit der Stub ohne Division auskommt.
+typedef struct {
+    uint32_t magic;
+    bool count_presses;         // EXT0-Kontakte im Stub zählen (DSM_SWITCH_WAKE_STUB)
+    uint32_t cal;               // Periode des RTC-Takts (Q13.19 µs), beim Einschlafen
+    uint64_t armed_ticks;
+    uint64_t armed_rtc_us;
+    uint64_t deadline_ticks;    // Timer-Weckzeit des Hauptprogramms
+    uint64_t min_sleep_ticks;
+    uint64_t debounce_ticks;
+    uint64_t hold_ticks;
+    uint32_t wake_press_count;
+    bool long_press_enabled;
+    
+    uint32_t stub_wakes;        // Ohne App-Boot erledigte Wakes
+    uint32_t press_count;
+    uint32_t event_count;
+    bool long_press_active;
+    dsm_ulp_wake_reason_t wake_reason;
+    dsm_stub_event_t events[DSM_MAX_PRESS_EVENTS];
+} dsm_stub_rtc_t;
+
+static RTC_DATA_ATTR dsm_stub_rtc_t stub;
+
+// Entspricht rtc_time_get(), das im Stub nicht verfügbar ist
+static uint64_t RTC_IRAM_ATTR stub_rtc_ticks(void)
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+        esp_rom_delay_us(1);
+    }
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+    return READ_PERI_REG(RTC_CNTL_TIME0_REG) | ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32);
+}
+
+static bool RTC_IRAM_ATTR stub_switch_released(void)
+{
+    return (GET_PERI_REG_BITS2(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT, RTC_GPIO_IN_NEXT_S) >> STUB_RTCIO_NUM) & 1;
+}
+
+// Kontakt entprellen und zählen; true wenn die App gebraucht wird
+static bool RTC_IRAM_ATTR stub_count_press(void)
+{
+    uint64_t start = stub_rtc_ticks();
+    uint64_t released_at = 0;
+    uint64_t now = start;
+    
+    // Warten bis der Schalter stabil losgelassen ist
+    while (true) {
+        now = stub_rtc_ticks();
+        if (!stub_switch_released()) {
+            released_at = 0;
+        } else if (released_at == 0) {
+            released_at = now;
+        } else if (now - released_at >= stub.debounce_ticks) {
+            break;
+        }
+    
+        if (now - start >= stub.hold_ticks) {
+            // Long Press (oder festhängender Schalter): App übernimmt das Warten
+            stub.long_press_active = true;
+            stub.wake_reason = DSM_ULP_WAKE_LONG_PRESS;
+            released_at = now;
+            break;
+        }
+        esp_rom_delay_us(STUB_POLL_US);
+    }
+    
+    uint64_t duration = released_at - start;
+    if (!stub.long_press_active && duration < stub.debounce_ticks) {
+        return false; // Prellen, keine Betätigung
+    }
+    
+    stub.press_count++;
+    if (stub.event_count < DSM_MAX_PRESS_EVENTS) {
+        stub.events[stub.event_count].start_ticks = start;
+        stub.events[stub.event_count].duration_ticks = duration;
+        stub.event_count++;
+    }
+    
+    if (stub.long_press_active) {
+        return true;
+    }
+    if (stub.event_count == DSM_MAX_PRESS_EVENTS) {
+        stub.wake_reason = DSM_ULP_WAKE_BUFFER_FULL;
+        return true;
+    }
+    if (stub.wake_press_count && stub.press_count >= stub.wake_press_count) {
+        stub.wake_reason = DSM_ULP_WAKE_PRESS_COUNT;
+        return true;
+    }
+    return false;
+}
+
+// Läuft nach jedem Deep Sleep aus dem RTC Fast Memory, noch vor Bootloader und App.
+// Nur RTC-Code, RTC-Daten und ROM-Funktionen verwenden.
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    if (stub.magic == STUB_MAGIC) {
+        uint32_t cause = esp_wake_stub_get_wakeup_cause();
+        bool boot_app = true;
+    
+        if (cause & RTC_EXT1_TRIG_EN) {
+            // Eingänge der Tabelle wertet immer die App aus, auch bei gleichzeitigem Kontakt
+            boot_app = true;
+        } else if ((cause & RTC_EXT0_TRIG_EN) && stub.count_presses) {
+            boot_app = stub_count_press();
+        } else if (cause & RTC_TIMER_TRIG_EN) {
+            // Früher Timer-Wakeup: der nächste Job ist noch nicht fällig
+            boot_app = false;
+        }
+    
+        uint64_t now = stub_rtc_ticks();
+        if (!boot_app && now + stub.min_sleep_ticks < stub.deadline_ticks) {
+            stub.stub_wakes++;
+            esp_wake_stub_set_wakeup_time(((stub.deadline_ticks - now) * stub.cal) >> RTC_CLK_CAL_FRACT);
+            esp_wake_stub_sleep(&esp_wake_deep_sleep);
+        }
+    }
+    
+    esp_default_wake_deep_sleep();
+}
+
+void dsm_stub_arm(uint64_t sleep_us, const dsm_ulp_config_t* press_config)
+{
+    memset(&stub, 0, sizeof(stub));
+    
+    stub.cal = esp_clk_slowclk_cal_get();
+    stub.armed_ticks = rtc_time_get();
+    stub.armed_rtc_us = esp_clk_rtc_time();
+    stub.deadline_ticks = stub.armed_ticks + rtc_time_us_to_slowclk(sleep_us, stub.cal);
+    stub.min_sleep_ticks = rtc_time_us_to_slowclk(STUB_MIN_SLEEP_US, stub.cal);
+    
+    if (press_config) {
+        uint32_t hold_ms = press_config->long_press_ms ? press_config->long_press_ms : STUB_MAX_HOLD_MS;
+        stub.count_presses = true;
+        stub.debounce_ticks = rtc_time_us_to_slowclk((uint64_t)press_config->debounce_ms * 1000, stub.cal);
+        stub.hold_ticks = rtc_time_us_to_slowclk((uint64_t)hold_ms * 1000, stub.cal);
+        stub.wake_press_count = press_config->wake_press_count;
+        stub.long_press_enabled = press_config->long_press_ms != 0;
+    }
+    
+    stub.magic = STUB_MAGIC;
+}
+
+bool dsm_stub_collect(dsm_press_stats_t* stats)
+{
+    if (stub.magic != STUB_MAGIC) {
+        return false;
+    }
+    stub.magic = 0;
+    
+    if (stub.stub_wakes) {
+        LOG_STORE_LOGI(TAG, "Wake-Stub: %lu Wakes ohne App-Boot", stub.stub_wakes);
+    }
+    if (!stub.count_presses) {
+        return false;
+    }
+    
+    memset(stats, 0, sizeof(*stats));
+    stats->press_count = stub.press_count;
+    stats->event_count = MIN(stub.event_count, DSM_MAX_PRESS_EVENTS);
+    stats->long_press_active = stub.long_press_active && !stub_switch_released();
+    stats->wake_reason = stub.wake_reason;
+    if (stub.wake_reason == DSM_ULP_WAKE_LONG_PRESS && !stub.long_press_enabled) {
+        stats->wake_reason = DSM_ULP_WAKE_NONE; // Nur die Haltegrenze erreicht
+    }
+    
+    for (uint32_t i = 0; i < stats->event_count; i++) {
+        const dsm_stub_event_t* ev = &stub.events[i];
+        stats->events[i].timestamp_us = stub.armed_rtc_us +
+                                        rtc_time_slowclk_to_us(ev->start_ticks - stub.armed_ticks, stub.cal);
+        stats->events[i].duration_ms = rtc_time_slowclk_to_us(ev->duration_ticks, stub.cal) / 1000;
+    }
+    
+    LOG_STORE_LOGI(TAG, "Stub: %lu Betätigungen, %lu gespeichert, Weckgrund %d",
+                   stats->press_count, stats->event_count, stats->wake_reason);
+    return true;
+}
@@ -0,0 +1,379 @@
+#include "event_queue.h"
+#include "deep_sleep_manager.h"
+#include "flash_ring.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_partition.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "EVENT_QUEUE";
+
+// Flash layout: the partition is a ring of fixed-size blocks, 8 per sector
+#define EVQ_PARTITION_LABEL "evtq"
+#define EVQ_PARTITION_SUBTYPE 0x41
+#define EVQ_BLOCK_SIZE 512
+#define EVQ_BLOCK_MAGIC 0x45565131 // "EVQ1"
+#define EVQ_UNACKED 0xFFFFFFFF     // Erased state, cleared to 0 by the ack
+
+#define EVQ_RTC_MAGIC 0x45525431   // "ERT1"
+
+typedef enum {
+    BATCH_FLASH,
+    BATCH_RTC,
+    BATCH_DONE
+} batch_phase_t;
+
+// The ack word follows the ring header, outside its CRC, and is written on
+// its own later
+typedef struct {
+    flash_ring_header_t ring;
+    uint32_t ack;
+} evq_block_header_t;
+
+#define EVQ_BLOCK_PAYLOAD (EVQ_BLOCK_SIZE - sizeof(evq_block_header_t))
+
+// The block being filled; it becomes flash block next_seq when full
+typedef struct {
+    uint32_t magic;
+    flash_ring_pos_t pos;
+    uint32_t fill;
+    uint32_t count;
+    uint32_t dropped;
+    uint8_t block[EVQ_BLOCK_PAYLOAD];
+} evq_rtc_state_t;
+
+// Not initialized at boot so queued records also survive panics and software resets
+static RTC_NOINIT_ATTR evq_rtc_state_t rtc_state;
+
+static void count_dropped(uint32_t first, uint32_t count);
+
+static flash_ring_t evq_ring = {
+    .magic = EVQ_BLOCK_MAGIC,
+    .block_size = EVQ_BLOCK_SIZE,
+    .header_size = sizeof(evq_block_header_t),
+    .pos = &rtc_state.pos,
+    .before_erase = count_dropped,
+};
+static SemaphoreHandle_t evq_mutex = NULL;
+
+static bool block_pending(uint32_t block, evq_block_header_t* header)
+{
+    return flash_ring_read_header(&evq_ring, block, &header->ring) && header->ack == EVQ_UNACKED;
+}
+
+// Unacknowledged blocks of a sector the ring is about to erase
+static void count_dropped(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        evq_block_header_t header;
+        if (block_pending(first + i, &header)) {
+            rtc_state.dropped += header.ring.count;
+        }
+    }
+}
+
+static bool rtc_state_valid(void)
+{
+    return rtc_state.magic == EVQ_RTC_MAGIC &&
+           rtc_state.fill <= EVQ_BLOCK_PAYLOAD &&
+           rtc_state.count <= rtc_state.fill / EVENT_QUEUE_RECORD_HEADER;
+}
+
+// Records of the first length bytes of the RTC block
+static uint32_t count_records(uint32_t length)
+{
+    uint32_t count = 0;
+    for (uint32_t pos = 0; pos + EVENT_QUEUE_RECORD_HEADER <= length; count++) {
+        pos += EVENT_QUEUE_RECORD_HEADER + rtc_state.block[pos + 1];
+    }
+    return count;
+}
+
+esp_err_t event_queue_init(void)
+{
+    if (evq_mutex) {
+        return ESP_OK;
+    }
+
+    bool rtc_valid = rtc_state_valid();
+    if (!rtc_valid) {
+        memset(&rtc_state, 0, sizeof(rtc_state));
+        rtc_state.magic = EVQ_RTC_MAGIC;
+    }
+
+    flash_ring_open(&evq_ring, (esp_partition_subtype_t)EVQ_PARTITION_SUBTYPE, EVQ_PARTITION_LABEL, rtc_valid);
+
+    evq_mutex = xSemaphoreCreateMutex();
+    if (!evq_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (evq_ring.partition) {
+        ESP_LOGI(TAG, "Event queue initialized: %lu flash blocks, next seq %lu, %u bytes pending",
+                 evq_ring.block_count, rtc_state.pos.next_seq, (unsigned)event_queue_pending());
+    } else {
+        ESP_LOGW(TAG, "No '%s' partition, keeping RTC block only", EVQ_PARTITION_LABEL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t event_queue_push(uint8_t type, const void* payload, size_t len)
+{
+    if (type == EVENT_QUEUE_TYPE_PADDING || len > EVENT_QUEUE_MAX_PAYLOAD || (len && !payload)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!evq_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t flags = 0;
+    int64_t time_us = 0;
+    if (deep_sleep_manager_get_wall_clock(&time_us) == ESP_OK) {
+        flags |= EVENT_QUEUE_FLAG_WALL_CLOCK;
+    } else {
+        time_us = esp_clk_rtc_time();
+    }
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(evq_mutex, portMAX_DELAY);
+
+    // Records never span blocks: a full block goes to flash first
+    size_t size = EVENT_QUEUE_RECORD_HEADER + len;
+    if (rtc_state.fill + size > EVQ_BLOCK_PAYLOAD) {
+        if (evq_ring.partition) {
+            ret = flash_ring_write(&evq_ring, rtc_state.block, rtc_state.fill, rtc_state.count);
+        }
+        if (ret == ESP_OK) {
+            if (!evq_ring.partition) {
+                rtc_state.dropped += rtc_state.count;
+            }
+            rtc_state.fill = 0;
+            rtc_state.count = 0;
+        }
+    }
+
+    if (ret == ESP_OK) {
+        uint8_t* dst = &rtc_state.block[rtc_state.fill];
+        dst[0] = type;
+        dst[1] = len;
+        dst[2] = flags;
+        dst[3] = 0;
+        for (int i = 0; i < 8; i++) {
+            dst[4 + i] = (uint64_t)time_us >> (8 * i);
+        }
+        if (len) {
+            memcpy(&dst[EVENT_QUEUE_RECORD_HEADER], payload, len);
+        }
+        rtc_state.fill += size;
+        rtc_state.count++;
+    } else {
+        // Keep the older data, drop the new
+        rtc_state.dropped++;
+    }
+
+    xSemaphoreGive(evq_mutex);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Writing event block failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+esp_err_t event_queue_batch_begin(event_queue_batch_t* batch, size_t max_length)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->phase = BATCH_DONE;
+    if (!evq_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(evq_mutex, portMAX_DELAY);
+
+    // Acks truncate from the oldest end, so pending blocks are one run up to the newest
+    bool full = false;
+    for (uint32_t i = 0; i < evq_ring.block_count; i++) {
+        uint32_t block = (rtc_state.pos.next_block + i) % evq_ring.block_count;
+        evq_block_header_t header;
+        if (!block_pending(block, &header)) {
+            continue;
+        }
+        if (batch->length + header.ring.length > max_length) {
+            full = true;
+            break;
+        }
+        if (batch->blocks == 0) {
+            batch->block = block;
+            batch->first_seq = header.ring.seq;
+        }
+        batch->blocks = header.ring.seq - batch->first_seq + 1;
+        batch->length += header.ring.length;
+    }
+
+    batch->rtc_seq = rtc_state.pos.next_seq;
+    if (!full && batch->length + rtc_state.fill <= max_length) {
+        batch->rtc_length = rtc_state.fill;
+        batch->length += rtc_state.fill;
+        if (batch->blocks == 0) {
+            batch->first_seq = rtc_state.pos.next_seq;
+        }
+    }
+
+    xSemaphoreGive(evq_mutex);
+
+    if (batch->length == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    batch->phase = batch->blocks ? BATCH_FLASH : BATCH_RTC;
+    batch->block_length = batch->blocks ? 0 : batch->rtc_length;
+    return ESP_OK;
+}
+
+// Move to the next block of the batch; a block rewritten meanwhile ends it
+static void batch_next_source(event_queue_batch_t* batch)
+{
+    batch->offset = 0;
+    batch->block_length = 0;
+
+    if (batch->phase == BATCH_FLASH) {
+        while (batch->index < batch->blocks) {
+            uint32_t block = (batch->block + batch->index) % evq_ring.block_count;
+            uint32_t seq = batch->first_seq + batch->index;
+            batch->index++;
+
+            flash_ring_header_t header;
+            if (!flash_ring_read_header(&evq_ring, block, &header) || header.seq != seq) {
+                batch->phase = BATCH_DONE;
+                return;
+            }
+            if (header.length > 0) {
+                batch->block_length = header.length;
+                return;
+            }
+        }
+
+        batch->phase = BATCH_RTC;
+        batch->block_length = batch->rtc_length;
+    } else {
+        batch->phase = BATCH_DONE;
+    }
+}
+
+size_t event_queue_batch_read(event_queue_batch_t* batch, void* buf, size_t len)
+{
+    uint8_t* dst = (uint8_t*)buf;
+    size_t copied = 0;
+
+    // The first flash block is loaded lazily
+    if (batch->phase == BATCH_FLASH && batch->index == 0) {
+        batch_next_source(batch);
+    }
+
+    while (copied < len && batch->read < batch->length) {
+        if (batch->phase == BATCH_DONE) {
+            // Padding up to the announced length
+            size_t n = MIN(len - copied, batch->length - batch->read);
+            memset(dst + copied, EVENT_QUEUE_TYPE_PADDING, n);
+            batch->read += n;
+            copied += n;
+            break;
+        }
+        if (batch->offset >= batch->block_length) {
+            batch_next_source(batch);
+            continue;
+        }
+
+        size_t n = MIN(len - copied, batch->block_length - batch->offset);
+        n = MIN(n, batch->length - batch->read);
+
+        if (batch->phase == BATCH_FLASH) {
+            uint32_t block = (batch->block + batch->index - 1) % evq_ring.block_count;
+            size_t addr = flash_ring_payload_addr(&evq_ring, block) + batch->offset;
+            if (esp_partition_read(evq_ring.partition, addr, dst + copied, n) != ESP_OK) {
+                batch->phase = BATCH_DONE;
+                continue;
+            }
+        } else {
+            xSemaphoreTake(evq_mutex, portMAX_DELAY);
+            bool moved = rtc_state.pos.next_seq != batch->rtc_seq;
+            if (!moved) {
+                memcpy(dst + copied, &rtc_state.block[batch->offset], n);
+            }
+            xSemaphoreGive(evq_mutex);
+            if (moved) {
+                batch->phase = BATCH_DONE;
+                continue;
+            }
+        }
+
+        batch->offset += n;
+        batch->read += n;
+        copied += n;
+    }
+
+    return copied;
+}
+
+esp_err_t event_queue_batch_ack(const event_queue_batch_t* batch)
+{
+    if (!evq_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(evq_mutex, portMAX_DELAY);
+
+    for (uint32_t i = 0; i < batch->blocks && ret == ESP_OK; i++) {
+        uint32_t block = (batch->block + i) % evq_ring.block_count;
+        evq_block_header_t header;
+        // Skip blocks the ring has overwritten since batch_begin
+        if (!block_pending(block, &header) || header.ring.seq != batch->first_seq + i) {
+            continue;
+        }
+        uint32_t ack = 0;
+        ret = esp_partition_write(evq_ring.partition, block * EVQ_BLOCK_SIZE + offsetof(evq_block_header_t, ack),
+                                  &ack, sizeof(ack));
+    }
+
+    // RTC records stay queued if their block went to flash meanwhile (sent again next time)
+    if (ret == ESP_OK && batch->rtc_length && rtc_state.pos.next_seq == batch->rtc_seq) {
+        uint32_t acked = count_records(batch->rtc_length);
+        memmove(rtc_state.block, &rtc_state.block[batch->rtc_length], rtc_state.fill - batch->rtc_length);
+        rtc_state.fill -= batch->rtc_length;
+        rtc_state.count -= acked;
+    }
+
+    xSemaphoreGive(evq_mutex);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Acknowledging event blocks failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+size_t event_queue_pending(void)
+{
+    if (!evq_mutex) {
+        return 0;
+    }
+
+    size_t pending = 0;
+    xSemaphoreTake(evq_mutex, portMAX_DELAY);
+    for (uint32_t block = 0; block < evq_ring.block_count; block++) {
+        evq_block_header_t header;
+        if (block_pending(block, &header)) {
+            pending += header.ring.length;
+        }
+    }
+    pending += rtc_state.fill;
+    xSemaphoreGive(evq_mutex);
+    return pending;
+}
+
+uint32_t event_queue_get_dropped(void)
+{
+    return rtc_state.dropped;
+}
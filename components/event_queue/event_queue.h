@@ -0,0 +1,122 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVENT_QUEUE_MAX_PAYLOAD 32     ///< Payload bytes per record
+#define EVENT_QUEUE_RECORD_HEADER 12   ///< Encoded record header size
+
+/**
+ * @brief Record type 0 is reserved: padding, a decoder stops at it
+ */
+#define EVENT_QUEUE_TYPE_PADDING 0
+
+/**
+ * @brief Record flag: time_us is Unix time, otherwise RTC time since power-on
+ */
+#define EVENT_QUEUE_FLAG_WALL_CLOCK 0x01
+
+/**
+ * @brief Drain cursor over the records not yet acknowledged, oldest first
+ *
+ * Encoded records are 12 header bytes (type, payload length, flags, 0,
+ * time_us as little-endian int64) followed by the payload.
+ *
+ * Lives on the caller's stack; no heap is used while reading.
+ */
+typedef struct {
+    uint32_t first_seq;    ///< Sequence number of the first block, lets the server drop duplicates
+    size_t length;         ///< Encoded record bytes in this batch
+    size_t read;           ///< Bytes produced so far
+    uint32_t phase;        ///< Internal: flash blocks, then RTC block
+    uint32_t block;        ///< Internal: ring index of the first flash block
+    uint32_t blocks;       ///< Internal: flash blocks in the batch
+    uint32_t rtc_seq;      ///< Internal: sequence number the RTC block will get
+    uint32_t rtc_length;   ///< Internal: RTC block bytes in the batch
+    uint32_t index;        ///< Internal: flash blocks opened so far
+    uint32_t offset;       ///< Internal: read offset in the current block
+    uint32_t block_length; ///< Internal: payload length of the current block
+} event_queue_batch_t;
+
+/**
+ * @brief Initialize the event queue
+ *
+ * Records are collected in one block in RTC slow memory and written to the
+ * "evtq" flash partition only when the block is full. The partition is a
+ * ring of sector-aligned blocks written strictly in sequence, so every
+ * sector is erased equally often. Records survive deep sleep and software
+ * resets; flash blocks also survive power loss.
+ *
+ * @return esp_err_t ESP_OK on success
+ *
+ * @note Without an "evtq" partition only the RTC block is kept
+ */
+esp_err_t event_queue_init(void);
+
+/**
+ * @brief Append a record
+ *
+ * Timestamped with the wall clock if deep_sleep_manager has a reference,
+ * otherwise with the RTC time.
+ *
+ * @param type Application defined type, 1..255
+ * @param payload Payload bytes (may be NULL if len is 0)
+ * @param len Payload length, at most EVENT_QUEUE_MAX_PAYLOAD
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE before init
+ *
+ * @note Writes to flash when the RTC block fills, so it may block for a few ms
+ */
+esp_err_t event_queue_push(uint8_t type, const void* payload, size_t len);
+
+/**
+ * @brief Select the oldest unacknowledged records for upload
+ *
+ * Whole blocks only, so max_length should be at least one flash block (512 bytes).
+ *
+ * @param batch Cursor to initialize
+ * @param max_length Upper bound for batch->length
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if nothing (that fits) is pending
+ */
+esp_err_t event_queue_batch_begin(event_queue_batch_t* batch, size_t max_length);
+
+/**
+ * @brief Copy the next chunk of the batch
+ *
+ * Exactly batch->length bytes are produced in total; if blocks were
+ * overwritten meanwhile the rest is EVENT_QUEUE_TYPE_PADDING.
+ *
+ * @return size_t Bytes copied, 0 at the end of the batch
+ */
+size_t event_queue_batch_read(event_queue_batch_t* batch, void* buf, size_t len);
+
+/**
+ * @brief Drop the records of an uploaded batch
+ *
+ * Flash blocks are marked acknowledged in place (bits cleared, no erase).
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t event_queue_batch_ack(const event_queue_batch_t* batch);
+
+/**
+ * @brief Bytes waiting for upload (flash and RTC)
+ */
+size_t event_queue_pending(void);
+
+/**
+ * @brief Records lost because the ring overwrote unacknowledged blocks or a write failed
+ */
+uint32_t event_queue_get_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVENT_QUEUE_H
@@ -0,0 +1,102 @@
+#include "flash_ring.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+
+static uint32_t header_crc(const flash_ring_header_t* header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)header, offsetof(flash_ring_header_t, crc));
+}
+
+static bool read_header(const flash_ring_t* ring, uint32_t block, flash_ring_header_t* header, size_t size)
+{
+    if (esp_partition_read(ring->partition, block * ring->block_size, header, size) != ESP_OK) {
+        return false;
+    }
+    return header->magic == ring->magic &&
+           header->crc == header_crc(header) &&
+           header->length <= flash_ring_payload_max(ring);
+}
+
+bool flash_ring_read_header(const flash_ring_t* ring, uint32_t block, flash_ring_header_t* header)
+{
+    return read_header(ring, block, header, ring->header_size);
+}
+
+// Find the newest block so writing continues after it
+static void scan(flash_ring_t* ring)
+{
+    uint32_t newest_seq = 0;
+    int32_t newest_block = -1;
+
+    for (uint32_t block = 0; block < ring->block_count; block++) {
+        flash_ring_header_t header;
+        if (read_header(ring, block, &header, sizeof(header)) && (newest_block < 0 || header.seq > newest_seq)) {
+            newest_seq = header.seq;
+            newest_block = block;
+        }
+    }
+
+    if (newest_block < 0) {
+        ring->pos->next_seq = 0;
+        ring->pos->next_block = 0;
+    } else {
+        ring->pos->next_seq = newest_seq + 1;
+        ring->pos->next_block = (newest_block + 1) % ring->block_count;
+    }
+}
+
+esp_err_t flash_ring_open(flash_ring_t* ring, esp_partition_subtype_t subtype, const char* label, bool pos_valid)
+{
+    ring->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, subtype, label);
+    if (!ring->partition) {
+        ring->block_count = 0;
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ring->block_count = ring->partition->size / ring->block_size;
+    // RTC write position is only trusted across deep sleep
+    if (!pos_valid || esp_reset_reason() != ESP_RST_DEEPSLEEP || ring->pos->next_block >= ring->block_count) {
+        scan(ring);
+    }
+    return ESP_OK;
+}
+
+esp_err_t flash_ring_write(flash_ring_t* ring, const void* data, uint32_t length, uint32_t count)
+{
+    uint32_t block = ring->pos->next_block;
+    size_t offset = block * ring->block_size;
+    uint32_t blocks_per_sector = FLASH_RING_SECTOR_SIZE / ring->block_size;
+    esp_err_t ret;
+
+    // Entering a new sector drops its oldest blocks in one erase
+    if (block % blocks_per_sector == 0) {
+        if (ring->before_erase) {
+            ring->before_erase(block, blocks_per_sector);
+        }
+        ret = esp_partition_erase_range(ring->partition, offset, FLASH_RING_SECTOR_SIZE);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    ret = esp_partition_write(ring->partition, offset + ring->header_size, data, length);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    flash_ring_header_t header = {
+        .magic = ring->magic,
+        .seq = ring->pos->next_seq,
+        .length = length,
+        .count = count,
+    };
+    header.crc = header_crc(&header);
+    ret = esp_partition_write(ring->partition, offset, &header, sizeof(header));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ring->pos->next_seq++;
+    ring->pos->next_block = (block + 1) % ring->block_count;
+    return ESP_OK;
+}
@@ -0,0 +1,104 @@
+#ifndef FLASH_RING_H
+#define FLASH_RING_H
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_RING_SECTOR_SIZE 4096
+
+/**
+ * @brief Header at the start of every block
+ *
+ * Written after the payload, so a valid header marks a complete block.
+ * Owner words may follow it up to header_size; they are outside the CRC,
+ * stay erased when the block is written and are programmed by the owner
+ * later (e.g. an ack).
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;       ///< Increases by one per block, the newest block is the write position
+    uint32_t length;    ///< Payload bytes
+    uint32_t count;     ///< Owner-defined, e.g. records in the payload
+    uint32_t crc;       ///< Over the fields above
+} flash_ring_header_t;
+
+/**
+ * @brief Write position, kept by the owner in RTC memory
+ */
+typedef struct {
+    uint32_t next_seq;
+    uint32_t next_block;
+} flash_ring_pos_t;
+
+/**
+ * @brief Partition used as a ring of fixed-size blocks
+ *
+ * Entering a sector erases it as a whole, dropping its oldest blocks.
+ */
+typedef struct {
+    uint32_t magic;             ///< Block magic
+    uint32_t block_size;        ///< Divides FLASH_RING_SECTOR_SIZE
+    uint32_t header_size;       ///< sizeof(flash_ring_header_t) plus owner words
+    flash_ring_pos_t* pos;      ///< Write position, in RTC memory
+    /// Called before blocks first .. first + count - 1 are erased, may be NULL
+    void (*before_erase)(uint32_t first, uint32_t count);
+    const esp_partition_t* partition;   ///< Set by flash_ring_open()
+    uint32_t block_count;               ///< Set by flash_ring_open()
+} flash_ring_t;
+
+/**
+ * @brief Find the partition and restore the write position
+ *
+ * The position in RTC memory is only trusted across deep sleep; after any
+ * other reset, or if it is invalid, the newest block is searched in flash.
+ *
+ * @param pos_valid The owner's RTC state passed its checks
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND without partition
+ */
+esp_err_t flash_ring_open(flash_ring_t* ring, esp_partition_subtype_t subtype, const char* label, bool pos_valid);
+
+/**
+ * @brief Read and check the header of a block
+ *
+ * @param header Receives header_size bytes, owner words included
+ * @return true if the block holds a complete payload
+ */
+bool flash_ring_read_header(const flash_ring_t* ring, uint32_t block, flash_ring_header_t* header);
+
+/**
+ * @brief Append a block at the write position and advance it
+ *
+ * @param length At most flash_ring_payload_max() bytes
+ * @param count Stored in the header
+ * @return esp_err_t ESP_OK on success, the position is kept on failure
+ */
+esp_err_t flash_ring_write(flash_ring_t* ring, const void* data, uint32_t length, uint32_t count);
+
+/**
+ * @brief Payload bytes per block
+ */
+static inline uint32_t flash_ring_payload_max(const flash_ring_t* ring)
+{
+    return ring->block_size - ring->header_size;
+}
+
+/**
+ * @brief Partition offset of the payload of a block
+ */
+static inline size_t flash_ring_payload_addr(const flash_ring_t* ring, uint32_t block)
+{
+    return block * ring->block_size + ring->header_size;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_RING_H
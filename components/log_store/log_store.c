@@ -0,0 +1,408 @@
+#include "log_store.h"
+#include "flash_ring.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "LOG_STORE";
+
+// Flash layout: the partition is a ring of fixed-size slots, 4 per sector
+#define LOG_PARTITION_LABEL "logs"
+#define LOG_PARTITION_SUBTYPE 0x40
+#define LOG_SLOT_SIZE 1024
+#define LOG_SLOT_MAGIC 0x4C4F4732 // "LOG2", flash_ring header
+
+// RTC layout: two batches, one being filled while the other waits for flash
+#define LOG_RTC_MAGIC 0x4C525431  // "LRT1"
+#define LOG_RTC_BATCHES 2
+#define LOG_LINE_MAX 192
+
+// Tokenized records: marker, id and timestamp varints, argument length
+#define TOKEN_HEADER_MAX (1 + 5 + 5 + 1)
+#define TOKEN_ARGS_MAX 64
+#define TOKEN_STRING_MAX 32
+
+#define FLUSH_TASK_STACK 3072
+#define FLUSH_TASK_PRIO 1
+
+typedef enum {
+    ITER_FLASH,
+    ITER_RTC_PENDING,
+    ITER_RTC_ACTIVE,
+    ITER_DONE
+} iter_phase_t;
+
+#define LOG_BATCH_SIZE (LOG_SLOT_SIZE - sizeof(flash_ring_header_t))
+
+typedef struct {
+    uint32_t magic;
+    flash_ring_pos_t pos;
+    uint32_t active;
+    uint32_t fill[LOG_RTC_BATCHES];
+    uint32_t pending;   // bit mask of full batches waiting for flash
+    uint32_t dropped;
+    uint8_t batch[LOG_RTC_BATCHES][LOG_BATCH_SIZE];
+} log_rtc_ring_t;
+
+// Not initialized at boot so the log also survives panics and software resets
+static RTC_NOINIT_ATTR log_rtc_ring_t rtc_ring;
+
+static flash_ring_t log_ring = {
+    .magic = LOG_SLOT_MAGIC,
+    .block_size = LOG_SLOT_SIZE,
+    .header_size = sizeof(flash_ring_header_t),
+    .pos = &rtc_ring.pos,
+};
+static vprintf_like_t previous_vprintf = NULL;
+static TaskHandle_t flush_task_handle = NULL;
+static SemaphoreHandle_t flush_mutex = NULL;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool rtc_ring_valid(void)
+{
+    if (rtc_ring.magic != LOG_RTC_MAGIC || rtc_ring.active >= LOG_RTC_BATCHES) {
+        return false;
+    }
+    for (int i = 0; i < LOG_RTC_BATCHES; i++) {
+        if (rtc_ring.fill[i] > LOG_BATCH_SIZE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hand the active batch over to the flush task; caller holds ring_lock
+static bool rotate_batch(void)
+{
+    uint32_t other = rtc_ring.active ^ 1;
+    if (rtc_ring.pending & BIT(other)) {
+        return false;
+    }
+    rtc_ring.pending |= BIT(rtc_ring.active);
+    rtc_ring.active = other;
+    rtc_ring.fill[other] = 0;
+    return true;
+}
+
+static void ring_append(const char* data, size_t len)
+{
+    bool notify = false;
+
+    portENTER_CRITICAL(&ring_lock);
+    while (len > 0) {
+        uint32_t active = rtc_ring.active;
+        size_t room = LOG_BATCH_SIZE - rtc_ring.fill[active];
+        if (room == 0) {
+            if (!rotate_batch()) {
+                // Flush task is behind: keep the older data, drop the new
+                rtc_ring.dropped += len;
+                break;
+            }
+            notify = true;
+            continue;
+        }
+
+        size_t n = MIN(room, len);
+        memcpy(&rtc_ring.batch[active][rtc_ring.fill[active]], data, n);
+        rtc_ring.fill[active] += n;
+        data += n;
+        len -= n;
+
+        if (rtc_ring.fill[active] == LOG_BATCH_SIZE && rotate_batch()) {
+            notify = true;
+        }
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (notify && flush_task_handle) {
+        xTaskNotifyGive(flush_task_handle);
+    }
+}
+
+static int log_store_vprintf(const char* fmt, va_list args)
+{
+    char line[LOG_LINE_MAX];
+    va_list copy;
+
+    va_copy(copy, args);
+    int len = vsnprintf(line, sizeof(line), fmt, copy);
+    va_end(copy);
+
+    if (len > 0) {
+        if (len >= (int)sizeof(line)) {
+            // Keep lines separated even when truncated
+            len = sizeof(line) - 1;
+            line[len - 1] = '\n';
+        }
+        ring_append(line, len);
+    }
+
+    return previous_vprintf(fmt, args);
+}
+
+static size_t put_varint(uint8_t* dst, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        dst[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    dst[n++] = (uint8_t)value;
+    return n;
+}
+
+void log_store_write_token(uint32_t id, uint32_t types, ...)
+{
+    // rtc_ring is only valid once log_store_init() has checked it
+    if (!previous_vprintf) {
+        return;
+    }
+
+    uint8_t record[TOKEN_HEADER_MAX + TOKEN_ARGS_MAX];
+    uint8_t* args = &record[TOKEN_HEADER_MAX];
+    size_t used = 0;
+    uint32_t count = types & 0xF;
+    va_list list;
+
+    va_start(list, types);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t type = (types >> (4 + 2 * i)) & 0x3;
+        // Encoded on its own first, an argument only goes in if it fits as a
+        // whole; the decoder stops at the recorded length
+        uint8_t value_buf[10];  // 64-bit varint or a double
+        size_t len;
+
+        if (type == LOG_STORE_ARG_INT) {
+            len = put_varint(value_buf, va_arg(list, uint32_t));
+        } else if (type == LOG_STORE_ARG_INT64) {
+            len = put_varint(value_buf, va_arg(list, uint64_t));
+        } else if (type == LOG_STORE_ARG_DOUBLE) {
+            double value = va_arg(list, double);
+            memcpy(value_buf, &value, sizeof(value));
+            len = sizeof(value);
+        } else {
+            // Strings are cut to what is left rather than dropped
+            const char* str = va_arg(list, const char*);
+            if (used == TOKEN_ARGS_MAX) {
+                break;
+            }
+            size_t room = TOKEN_ARGS_MAX - used - 1;
+            size_t str_len = str ? strnlen(str, room < TOKEN_STRING_MAX ? room : TOKEN_STRING_MAX) : 0;
+            args[used++] = str_len;
+            if (str_len > 0) {
+                memcpy(&args[used], str, str_len);
+                used += str_len;
+            }
+            continue;
+        }
+
+        if (used + len > TOKEN_ARGS_MAX) {
+            break;
+        }
+        memcpy(&args[used], value_buf, len);
+        used += len;
+    }
+    va_end(list);
+
+    // Header is built right in front of the arguments
+    uint8_t header[TOKEN_HEADER_MAX];
+    size_t header_len = 0;
+    header[header_len++] = LOG_STORE_TOKEN_MARKER;
+    header_len += put_varint(&header[header_len], id);
+    header_len += put_varint(&header[header_len], esp_log_timestamp());
+    header[header_len++] = used;
+
+    uint8_t* start = args - header_len;
+    memcpy(start, header, header_len);
+    ring_append((const char*)start, header_len + used);
+}
+
+static void flush_task(void* param)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        log_store_flush();
+    }
+}
+
+esp_err_t log_store_init(void)
+{
+    if (previous_vprintf) {
+        return ESP_OK;
+    }
+
+    bool rtc_valid = rtc_ring_valid();
+    if (!rtc_valid) {
+        memset(&rtc_ring, 0, sizeof(rtc_ring));
+        rtc_ring.magic = LOG_RTC_MAGIC;
+    }
+
+    flash_ring_open(&log_ring, (esp_partition_subtype_t)LOG_PARTITION_SUBTYPE, LOG_PARTITION_LABEL, rtc_valid);
+
+    flush_mutex = xSemaphoreCreateMutex();
+    if (!flush_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(flush_task, "log_flush", FLUSH_TASK_STACK, NULL,
+                    FLUSH_TASK_PRIO, &flush_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    previous_vprintf = esp_log_set_vprintf(log_store_vprintf);
+
+    if (log_ring.partition) {
+        ESP_LOGI(TAG, "Log store initialized: %lu flash slots, next seq %lu",
+                 log_ring.block_count, rtc_ring.pos.next_seq);
+    } else {
+        ESP_LOGW(TAG, "No '%s' partition, keeping RTC ring only", LOG_PARTITION_LABEL);
+    }
+
+    // Batches completed late in the previous wake
+    if (rtc_ring.pending) {
+        xTaskNotifyGive(flush_task_handle);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t log_store_flush(void)
+{
+    if (!flush_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(flush_mutex, portMAX_DELAY);
+
+    portENTER_CRITICAL(&ring_lock);
+    uint32_t batch = rtc_ring.active ^ 1;
+    bool pending = rtc_ring.pending & BIT(batch);
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (pending) {
+        // A pending batch is not touched by the log hook, write it unlocked
+        if (log_ring.partition) {
+            ret = flash_ring_write(&log_ring, rtc_ring.batch[batch], rtc_ring.fill[batch], 0);
+        }
+
+        portENTER_CRITICAL(&ring_lock);
+        rtc_ring.pending &= ~BIT(batch);
+        portEXIT_CRITICAL(&ring_lock);
+    }
+
+    xSemaphoreGive(flush_mutex);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Flushing log batch failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+void log_store_iter_begin(log_store_iter_t* it)
+{
+    memset(it, 0, sizeof(*it));
+    it->phase = ITER_FLASH;
+    it->slot = rtc_ring.pos.next_block;  // oldest slot follows the newest
+    it->remaining = log_ring.block_count;
+
+    for (uint32_t slot = 0; slot < log_ring.block_count; slot++) {
+        flash_ring_header_t header;
+        if (flash_ring_read_header(&log_ring, slot, &header)) {
+            it->total += header.length;
+        }
+    }
+
+    portENTER_CRITICAL(&ring_lock);
+    uint32_t pending = rtc_ring.active ^ 1;
+    if (rtc_ring.pending & BIT(pending)) {
+        it->total += rtc_ring.fill[pending];
+    }
+    it->total += rtc_ring.fill[rtc_ring.active];
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+// Move to the next non-empty source: flash slots, pending batch, active batch
+static void iter_next_source(log_store_iter_t* it)
+{
+    it->offset = 0;
+    it->length = 0;
+
+    if (it->phase == ITER_FLASH) {
+        while (it->remaining > 0) {
+            uint32_t slot = it->slot;
+            it->slot = (slot + 1) % log_ring.block_count;
+            it->remaining--;
+
+            flash_ring_header_t header;
+            if (flash_ring_read_header(&log_ring, slot, &header) && header.length > 0) {
+                it->addr = flash_ring_payload_addr(&log_ring, slot);
+                it->length = header.length;
+                return;
+            }
+        }
+
+        it->phase = ITER_RTC_PENDING;
+        portENTER_CRITICAL(&ring_lock);
+        it->batch = rtc_ring.active ^ 1;
+        if (rtc_ring.pending & BIT(it->batch)) {
+            it->length = rtc_ring.fill[it->batch];
+        }
+        portEXIT_CRITICAL(&ring_lock);
+    } else if (it->phase == ITER_RTC_PENDING) {
+        it->phase = ITER_RTC_ACTIVE;
+        portENTER_CRITICAL(&ring_lock);
+        it->batch = rtc_ring.active;
+        it->length = rtc_ring.fill[it->batch];
+        portEXIT_CRITICAL(&ring_lock);
+    } else {
+        it->phase = ITER_DONE;
+    }
+}
+
+size_t log_store_iter_read(log_store_iter_t* it, void* buf, size_t len)
+{
+    uint8_t* dst = (uint8_t*)buf;
+    size_t copied = 0;
+
+    while (copied < len) {
+        if (it->offset >= it->length) {
+            if (it->phase == ITER_DONE) {
+                break;
+            }
+            iter_next_source(it);
+            continue;
+        }
+
+        size_t n = MIN(len - copied, it->length - it->offset);
+
+        if (it->phase == ITER_FLASH) {
+            if (esp_partition_read(log_ring.partition, it->addr + it->offset, dst + copied, n) != ESP_OK) {
+                it->phase = ITER_DONE;
+                it->length = 0;
+                break;
+            }
+        } else {
+            portENTER_CRITICAL(&ring_lock);
+            memcpy(dst + copied, &rtc_ring.batch[it->batch][it->offset], n);
+            portEXIT_CRITICAL(&ring_lock);
+        }
+
+        it->offset += n;
+        copied += n;
+    }
+
+    return copied;
+}
+
+uint32_t log_store_get_dropped(void)
+{
+    return rtc_ring.dropped;
+}
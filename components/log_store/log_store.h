@@ -0,0 +1,177 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Marker byte of a tokenized record in the log
+ *
+ * Never part of UTF-8 text, so records and text lines can share the ring:
+ * 0xFF, varint token id, varint timestamp in ms, uint8 argument length,
+ * arguments. Integers are varints of their raw bits, doubles 8 bytes,
+ * strings a length byte and up to 32 characters. Arguments take up to 64
+ * bytes; a string is cut to the space left, later arguments that do not fit
+ * are left out.
+ */
+#define LOG_STORE_TOKEN_MARKER 0xFF
+
+/// Argument types recorded with each token, two bits per argument
+#define LOG_STORE_ARG_INT 0
+#define LOG_STORE_ARG_INT64 1
+#define LOG_STORE_ARG_DOUBLE 2
+#define LOG_STORE_ARG_STRING 3
+
+/**
+ * @brief Log to the store as a tokenized record, replacing ESP_LOGx
+ *
+ * The format string and tag go to the .log_tokens section of the ELF, which
+ * is not loaded; the device appends only the token id, a timestamp and the
+ * raw arguments to the ring, and prints nothing to the console.
+ * tools/log_decode.py expands the records with the ELF of the build.
+ *
+ * @note tag must be the module's TAG variable, at most 8 arguments
+ * @note Without CONFIG_LOG_STORE_TOKENIZED these are plain ESP_LOGx
+ */
+#if CONFIG_LOG_STORE_TOKENIZED
+#define LOG_STORE_LOGE(tag, fmt, ...) LOG_STORE_TOKEN(ESP_LOG_ERROR, 'E', tag, fmt, ##__VA_ARGS__)
+#define LOG_STORE_LOGW(tag, fmt, ...) LOG_STORE_TOKEN(ESP_LOG_WARN, 'W', tag, fmt, ##__VA_ARGS__)
+#define LOG_STORE_LOGI(tag, fmt, ...) LOG_STORE_TOKEN(ESP_LOG_INFO, 'I', tag, fmt, ##__VA_ARGS__)
+#define LOG_STORE_LOGD(tag, fmt, ...) LOG_STORE_TOKEN(ESP_LOG_DEBUG, 'D', tag, fmt, ##__VA_ARGS__)
+#else
+#define LOG_STORE_LOGE(tag, fmt, ...) ESP_LOGE(tag, fmt, ##__VA_ARGS__)
+#define LOG_STORE_LOGW(tag, fmt, ...) ESP_LOGW(tag, fmt, ##__VA_ARGS__)
+#define LOG_STORE_LOGI(tag, fmt, ...) ESP_LOGI(tag, fmt, ##__VA_ARGS__)
+#define LOG_STORE_LOGD(tag, fmt, ...) ESP_LOGD(tag, fmt, ##__VA_ARGS__)
+#endif
+
+// The entry's address in .log_tokens (placed at 0 by log_tokens.ld) is the id.
+// sizeof(printf(...)) keeps -Wformat checking without emitting the string.
+#define LOG_STORE_TOKEN(level, letter, tag, fmt, ...) do {                          \
+    _Static_assert(LOG_STORE_ARG_COUNT(__VA_ARGS__) <= 8, "too many arguments");    \
+    (void)sizeof(printf(fmt, ##__VA_ARGS__));                                       \
+    if (LOG_LOCAL_LEVEL >= (level)) {                                               \
+        static const struct {                                                       \
+            const void* tag_ref;                                                    \
+            uint32_t types;                                                         \
+            char level_letter;                                                      \
+            char text[sizeof(fmt)];                                                 \
+        } log_token __attribute__((section(".log_tokens"), used, aligned(4))) = {   \
+            &(tag), LOG_STORE_ARG_TYPES(__VA_ARGS__), letter, fmt                   \
+        };                                                                          \
+        log_store_write_token((uintptr_t)&log_token, log_token.types, ##__VA_ARGS__); \
+    }                                                                               \
+} while (0)
+
+#define LOG_STORE_ARG_TYPE(x) _Generic((x),                                         \
+    char*: LOG_STORE_ARG_STRING, const char*: LOG_STORE_ARG_STRING,                 \
+    long long: LOG_STORE_ARG_INT64, unsigned long long: LOG_STORE_ARG_INT64,        \
+    float: LOG_STORE_ARG_DOUBLE, double: LOG_STORE_ARG_DOUBLE,                      \
+    default: LOG_STORE_ARG_INT)
+
+#define LOG_STORE_ARG_COUNT(...) LOG_STORE_ARG_COUNT_(0, ##__VA_ARGS__, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_STORE_ARG_COUNT_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, n, ...) n
+
+// Argument count in bits 0-3, then the type of each argument
+#define LOG_STORE_ARG_TYPES(...) LOG_STORE_ARG_TYPES_(LOG_STORE_ARG_COUNT(__VA_ARGS__), \
+                                                      ##__VA_ARGS__, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+#define LOG_STORE_ARG_TYPES_(n, a1, a2, a3, a4, a5, a6, a7, a8, ...) ((n) |           \
+    LOG_STORE_ARG_TYPE(a1) << 4 | LOG_STORE_ARG_TYPE(a2) << 6 |                     \
+    LOG_STORE_ARG_TYPE(a3) << 8 | LOG_STORE_ARG_TYPE(a4) << 10 |                    \
+    LOG_STORE_ARG_TYPE(a5) << 12 | LOG_STORE_ARG_TYPE(a6) << 14 |                   \
+    LOG_STORE_ARG_TYPE(a7) << 16 | LOG_STORE_ARG_TYPE(a8) << 18)
+
+/**
+ * @brief Read-out cursor over the stored log, oldest data first
+ *
+ * Lives on the caller's stack; no heap is used while iterating.
+ */
+typedef struct {
+    uint32_t phase;     ///< Internal: flash slots, then RTC batches
+    uint32_t slot;      ///< Internal: next flash slot to visit
+    uint32_t remaining; ///< Internal: flash slots left to visit
+    uint32_t addr;      ///< Internal: partition offset of current slot payload
+    uint32_t batch;     ///< Internal: RTC batch index of current batch
+    uint32_t offset;    ///< Internal: read offset inside current slot/batch
+    uint32_t length;    ///< Internal: payload length of current slot/batch
+    size_t total;       ///< Total bytes available when iteration started
+} log_store_iter_t;
+
+/**
+ * @brief Initialize the log store and start capturing ESP_LOGx output
+ *
+ * Hooks esp_log_set_vprintf() so every log line is still printed to the
+ * console and additionally appended to a ring in RTC slow memory. The RTC
+ * ring survives deep sleep; full batches are written to the "logs" flash
+ * partition by a low-priority flush task in large sector-aligned writes.
+ *
+ * @return esp_err_t ESP_OK on success
+ *
+ * @note Call as early as possible in app_main() to capture the whole wake
+ * @note Without a "logs" partition the store keeps the RTC ring only
+ */
+esp_err_t log_store_init(void);
+
+/**
+ * @brief Write all completed RTC batches to flash
+ *
+ * The partially filled batch stays in RTC memory and is continued on the
+ * next wake, so no flash write per line or per wake is needed.
+ *
+ * @return esp_err_t ESP_OK on success or when nothing is pending
+ *
+ * @note Call before enter_deep_sleep() so no completed batch is dropped
+ */
+esp_err_t log_store_flush(void);
+
+/**
+ * @brief Start reading the stored log from the oldest byte
+ *
+ * @param it Iterator to initialize, it->total holds the number of bytes
+ */
+void log_store_iter_begin(log_store_iter_t* it);
+
+/**
+ * @brief Copy the next chunk of log data into a caller-provided buffer
+ *
+ * Flash data is read straight into buf, so the log can be streamed to an
+ * uploader in small chunks without holding it in heap.
+ *
+ * @param it Iterator from log_store_iter_begin()
+ * @param buf Destination buffer
+ * @param len Size of buf in bytes
+ * @return size_t Bytes copied, 0 once the end of the log is reached
+ */
+size_t log_store_iter_read(log_store_iter_t* it, void* buf, size_t len);
+
+/**
+ * @brief Append a tokenized record to the ring, use LOG_STORE_LOGx instead
+ *
+ * @param id Address of the token entry in .log_tokens
+ * @param types Argument count and types, see LOG_STORE_ARG_TYPES()
+ *
+ * @note Dropped until log_store_init() has run
+ */
+void log_store_write_token(uint32_t id, uint32_t types, ...);
+
+/**
+ * @brief Get number of bytes dropped because the flush task fell behind
+ *
+ * @return uint32_t Dropped bytes since cold boot
+ */
+uint32_t log_store_get_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_STORE_H
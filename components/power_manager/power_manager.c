@@ -0,0 +1,255 @@
+#include "power_manager.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "POWER_MANAGER";
+
+struct power_manager_lock {
+    const char* name;
+    power_manager_lock_type_t type;
+    esp_pm_lock_handle_t pm_lock;   // NULL without CONFIG_PM_ENABLE
+    uint32_t depth;
+    uint32_t acquisitions;
+    int64_t since_us;
+    uint64_t held_us;
+};
+
+static struct power_manager_lock locks[POWER_MANAGER_MAX_LOCKS];
+static size_t lock_count = 0;
+
+// Accounting, also touched from ISRs and the light sleep exit
+static uint32_t type_depth[POWER_MANAGER_LOCK_TYPE_COUNT];
+static power_manager_state_t state = POWER_MANAGER_STATE_MIN;
+static int64_t state_since_us = 0;
+static uint64_t state_us[POWER_MANAGER_STATE_COUNT];
+static uint64_t sleep_us = 0;
+static uint32_t sleep_count = 0;
+static bool active = false;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Caller holds stats_lock
+static inline void IRAM_ATTR update_state(int64_t now)
+{
+    power_manager_state_t next = type_depth[POWER_MANAGER_LOCK_CPU_MAX] ? POWER_MANAGER_STATE_CPU_MAX :
+                                 type_depth[POWER_MANAGER_LOCK_APB_MAX] ? POWER_MANAGER_STATE_APB_MAX :
+                                 POWER_MANAGER_STATE_MIN;
+    if (next != state) {
+        state_us[state] += now - state_since_us;
+        state = next;
+        state_since_us = now;
+    }
+}
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+// Runs in the idle task right after waking, with the scheduler stopped
+static esp_err_t IRAM_ATTR sleep_exit_cb(int64_t slept_us, void* arg)
+{
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    sleep_us += slept_us;
+    sleep_count++;
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+    return ESP_OK;
+}
+#endif
+
+esp_err_t power_manager_init(const power_manager_config_t* config)
+{
+    power_manager_config_t cfg = config ? *config : (power_manager_config_t){0};
+    if (!cfg.max_freq_mhz) {
+        cfg.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+    }
+    if (!cfg.min_freq_mhz) {
+        cfg.min_freq_mhz = CONFIG_XTAL_FREQ;
+    }
+#if !CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    if (cfg.light_sleep) {
+        ESP_LOGW(TAG, "No tickless idle, light sleep stays off");
+        cfg.light_sleep = false;
+    }
+#endif
+
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = cfg.max_freq_mhz,
+        .min_freq_mhz = cfg.min_freq_mhz,
+        .light_sleep_enable = cfg.light_sleep,
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGW(TAG, "Power management not enabled, fixed CPU clock");
+        return err;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "DFS configuration failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    if (cfg.light_sleep) {
+        esp_pm_sleep_cbs_register_config_t cbs = {
+            .exit_cb = sleep_exit_cb,
+        };
+        err = esp_pm_light_sleep_register_cbs(&cbs);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "No light sleep accounting: %s", esp_err_to_name(err));
+        }
+    }
+#endif
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    memset(state_us, 0, sizeof(state_us));
+    sleep_us = 0;
+    sleep_count = 0;
+    state_since_us = now;
+    active = true;
+    portEXIT_CRITICAL(&stats_lock);
+
+    ESP_LOGI(TAG, "DFS %lu..%lu MHz, light sleep %s", cfg.min_freq_mhz, cfg.max_freq_mhz,
+             cfg.light_sleep ? "on" : "off");
+    return ESP_OK;
+}
+
+esp_err_t power_manager_lock_create(power_manager_lock_type_t type, const char* name,
+                                    power_manager_lock_handle_t* lock)
+{
+    static const esp_pm_lock_type_t pm_types[POWER_MANAGER_LOCK_TYPE_COUNT] = {
+        [POWER_MANAGER_LOCK_CPU_MAX] = ESP_PM_CPU_FREQ_MAX,
+        [POWER_MANAGER_LOCK_APB_MAX] = ESP_PM_APB_FREQ_MAX,
+        [POWER_MANAGER_LOCK_NO_SLEEP] = ESP_PM_NO_LIGHT_SLEEP,
+    };
+
+    if (type >= POWER_MANAGER_LOCK_TYPE_COUNT || !lock) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    struct power_manager_lock* slot = lock_count < POWER_MANAGER_MAX_LOCKS ? &locks[lock_count++] : NULL;
+    portEXIT_CRITICAL(&stats_lock);
+    if (!slot) {
+        ESP_LOGE(TAG, "No lock slot left for %s", name ? name : "?");
+        return ESP_ERR_NO_MEM;
+    }
+
+    slot->name = name ? name : "?";
+    slot->type = type;
+    esp_err_t err = esp_pm_lock_create(pm_types[type], 0, slot->name, &slot->pm_lock);
+    if (err != ESP_OK) {
+        // Without CONFIG_PM_ENABLE the lock only counts its hold time
+        slot->pm_lock = NULL;
+        if (err != ESP_ERR_NOT_SUPPORTED) {
+            ESP_LOGW(TAG, "PM lock %s: %s", slot->name, esp_err_to_name(err));
+        }
+    }
+
+    *lock = slot;
+    return ESP_OK;
+}
+
+void IRAM_ATTR power_manager_acquire(power_manager_lock_handle_t lock)
+{
+    if (!lock) {
+        return;
+    }
+
+    // Clock up first, so the work after return already runs fast
+    if (lock->pm_lock) {
+        esp_pm_lock_acquire(lock->pm_lock);
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    if (lock->depth++ == 0) {
+        lock->since_us = now;
+        lock->acquisitions++;
+        type_depth[lock->type]++;
+        update_state(now);
+    }
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+}
+
+void IRAM_ATTR power_manager_release(power_manager_lock_handle_t lock)
+{
+    if (!lock) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    bool held = false;
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    if (lock->depth > 0) {
+        held = true;
+        if (--lock->depth == 0) {
+            lock->held_us += now - lock->since_us;
+            type_depth[lock->type]--;
+            update_state(now);
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+
+    if (held && lock->pm_lock) {
+        esp_pm_lock_release(lock->pm_lock);
+    }
+}
+
+esp_err_t power_manager_get_stats(power_manager_stats_t* stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    memcpy(stats->state_us, state_us, sizeof(stats->state_us));
+    stats->state_us[state] += now - state_since_us;
+    stats->state_us[POWER_MANAGER_STATE_LIGHT_SLEEP] = sleep_us;
+    stats->light_sleep_count = sleep_count;
+    stats->active = active;
+    portEXIT_CRITICAL(&stats_lock);
+
+    // Light sleep only happens while no lock is held, so it is part of the MIN time
+    uint64_t slept_us = stats->state_us[POWER_MANAGER_STATE_LIGHT_SLEEP];
+    uint64_t* min_us = &stats->state_us[POWER_MANAGER_STATE_MIN];
+    *min_us -= (*min_us > slept_us) ? slept_us : *min_us;
+    return ESP_OK;
+}
+
+void power_manager_dump(void)
+{
+    static const char* state_names[POWER_MANAGER_STATE_COUNT] = {"cpu max", "apb max", "min", "light sleep"};
+    static const char* type_names[POWER_MANAGER_LOCK_TYPE_COUNT] = {"cpu", "apb", "nosleep"};
+    power_manager_stats_t stats;
+
+    power_manager_get_stats(&stats);
+    uint64_t total_us = 0;
+    for (int i = 0; i < POWER_MANAGER_STATE_COUNT; i++) {
+        total_us += stats.state_us[i];
+    }
+
+    ESP_LOGI(TAG, "Power states (%s):", stats.active ? "DFS" : "fixed clock");
+    for (int i = 0; i < POWER_MANAGER_STATE_COUNT; i++) {
+        ESP_LOGI(TAG, "  %-12s %8llu ms %3u%%", state_names[i], stats.state_us[i] / 1000,
+                 total_us ? (unsigned)(stats.state_us[i] * 100 / total_us) : 0);
+    }
+    ESP_LOGI(TAG, "  %lu light sleep periods", stats.light_sleep_count);
+
+    for (size_t i = 0; i < lock_count; i++) {
+        const struct power_manager_lock* lock = &locks[i];
+        uint64_t held_us = lock->held_us;
+        if (lock->depth) {
+            held_us += esp_timer_get_time() - lock->since_us;
+        }
+        ESP_LOGI(TAG, "  lock %-12s %-7s %6lu x %8llu ms%s", lock->name, type_names[lock->type],
+                 lock->acquisitions, held_us / 1000, lock->depth ? " (held)" : "");
+    }
+
+#if CONFIG_PM_PROFILING
+    // Exact per-mode times of esp_pm, including the locks of the WiFi driver
+    esp_pm_dump_locks(stdout);
+#endif
+}
@@ -0,0 +1,124 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POWER_MANAGER_MAX_LOCKS 8
+
+/**
+ * @brief What a lock keeps the chip from doing while held
+ */
+typedef enum {
+    POWER_MANAGER_LOCK_CPU_MAX,     ///< CPU stays at max_freq_mhz
+    POWER_MANAGER_LOCK_APB_MAX,     ///< APB stays at 80 MHz, so the CPU at 80 MHz or more
+    POWER_MANAGER_LOCK_NO_SLEEP,    ///< No automatic light sleep, clock may still drop
+    POWER_MANAGER_LOCK_TYPE_COUNT
+} power_manager_lock_type_t;
+
+/**
+ * @brief Power state, the strongest lock type held decides
+ */
+typedef enum {
+    POWER_MANAGER_STATE_CPU_MAX,    ///< A CPU_MAX lock is held
+    POWER_MANAGER_STATE_APB_MAX,    ///< An APB_MAX lock, no CPU_MAX lock
+    POWER_MANAGER_STATE_MIN,        ///< At most NO_SLEEP locks, CPU at min_freq_mhz
+    POWER_MANAGER_STATE_LIGHT_SLEEP,///< Automatic light sleep
+    POWER_MANAGER_STATE_COUNT
+} power_manager_state_t;
+
+/**
+ * @brief DFS and light sleep policy
+ */
+typedef struct {
+    uint32_t max_freq_mhz;          ///< 0 = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+    uint32_t min_freq_mhz;          ///< 0 = XTAL frequency
+    bool light_sleep;               ///< Light sleep whenever no lock prevents it
+} power_manager_config_t;
+
+/**
+ * @brief Time per power state since power_manager_init()
+ *
+ * The states follow the locks of this layer. The WiFi driver holds its own
+ * locks while the radio is on; deep_sleep_manager reports the radio time.
+ */
+typedef struct {
+    uint64_t state_us[POWER_MANAGER_STATE_COUNT];
+    uint32_t light_sleep_count;     ///< Light sleep periods
+    bool active;                    ///< DFS configured (false without CONFIG_PM_ENABLE)
+} power_manager_stats_t;
+
+typedef struct power_manager_lock* power_manager_lock_handle_t;
+
+/**
+ * @brief Configure dynamic frequency scaling and automatic light sleep
+ *
+ * Between the locks the CPU runs at min_freq_mhz, and with light_sleep the
+ * chip enters light sleep in idle until the next timer or GPIO wakeup. Take
+ * locks only around real work, not around waits.
+ *
+ * @param config Policy (NULL = defaults without light sleep)
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_NOT_SUPPORTED without CONFIG_PM_ENABLE; locks still work, but change nothing
+ *                   Other ESP error codes from esp_pm_configure()
+ *
+ * @note Light sleep needs CONFIG_FREERTOS_USE_TICKLESS_IDLE
+ */
+esp_err_t power_manager_init(const power_manager_config_t* config);
+
+/**
+ * @brief Create a named lock
+ *
+ * May be called before power_manager_init().
+ *
+ * @param type What the lock prevents while held
+ * @param name Name in power_manager_dump() (string literal, not copied)
+ * @param lock Created lock
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_INVALID_ARG for an invalid type or NULL lock
+ *                   ESP_ERR_NO_MEM if all POWER_MANAGER_MAX_LOCKS are in use
+ */
+esp_err_t power_manager_lock_create(power_manager_lock_type_t type, const char* name,
+                                    power_manager_lock_handle_t* lock);
+
+/**
+ * @brief Take a lock, nests with further power_manager_acquire() calls
+ *
+ * @param lock Lock (NULL is ignored)
+ *
+ * @note Safe from ISRs
+ */
+void power_manager_acquire(power_manager_lock_handle_t lock);
+
+/**
+ * @brief Release one power_manager_acquire() of a lock
+ *
+ * @param lock Lock (NULL is ignored)
+ *
+ * @note Safe from ISRs
+ */
+void power_manager_release(power_manager_lock_handle_t lock);
+
+/**
+ * @brief Time spent per power state so far
+ *
+ * @param stats Destination
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG if stats is NULL
+ */
+esp_err_t power_manager_get_stats(power_manager_stats_t* stats);
+
+/**
+ * @brief Log the state times and the hold time of every lock
+ */
+void power_manager_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POWER_MANAGER_H
@@ -0,0 +1,101 @@
+#include "rtc_copy.h"
+#include "esp_log.h"
+#include "esp_app_desc.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+static const char *TAG = "RTC_COPY";
+
+void rtc_copy_stamp(rtc_copy_stamp_t* stamp, uint32_t magic)
+{
+    stamp->magic = magic;
+    memcpy(stamp->build_id, esp_app_get_description()->app_elf_sha256, sizeof(stamp->build_id));
+}
+
+bool rtc_copy_stamp_valid(const rtc_copy_stamp_t* stamp, uint32_t magic)
+{
+    const esp_app_desc_t* app = esp_app_get_description();
+    return stamp->magic == magic &&
+           memcmp(stamp->build_id, app->app_elf_sha256, sizeof(stamp->build_id)) == 0;
+}
+
+static uint32_t blob_crc(const rtc_copy_blob_t* copy, const void* data)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)data, copy->size - sizeof(uint32_t));
+}
+
+static bool blob_valid(const rtc_copy_blob_t* copy, const void* data)
+{
+    uint16_t version;
+    uint32_t crc;
+    memcpy(&version, data, sizeof(version));
+    memcpy(&crc, (const uint8_t*)data + copy->size - sizeof(crc), sizeof(crc));
+    return version == copy->version &&
+           crc == blob_crc(copy, data) &&
+           (!copy->check || copy->check(data));
+}
+
+bool rtc_copy_blob_warm(const rtc_copy_blob_t* copy)
+{
+    return rtc_copy_stamp_valid(copy->stamp, copy->magic) && blob_valid(copy, copy->data);
+}
+
+esp_err_t rtc_copy_blob_open(const rtc_copy_blob_t* copy, nvs_open_mode_t mode, nvs_handle_t* handle)
+{
+    esp_err_t err = copy->nvs_init();
+    if (err == ESP_OK) {
+        err = nvs_open(copy->nvs_namespace, mode, handle);
+    }
+    if (err != ESP_OK && !(err == ESP_ERR_NVS_NOT_FOUND && mode == NVS_READONLY)) {
+        ESP_LOGE(TAG, "Failed to open NVS '%s': %s", copy->nvs_namespace, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t rtc_copy_blob_read(const rtc_copy_blob_t* copy, nvs_handle_t handle)
+{
+    size_t size = copy->size;
+    esp_err_t err = nvs_get_blob(handle, copy->key, copy->data, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        memset(copy->data, 0, copy->size);
+        return err;
+    }
+    if (err != ESP_OK || size != copy->size || !blob_valid(copy, copy->data)) {
+        ESP_LOGW(TAG, "Stored '%s' invalid, ignoring it", copy->key);
+        memset(copy->data, 0, copy->size);
+    }
+    return ESP_OK;
+}
+
+void rtc_copy_blob_seal(const rtc_copy_blob_t* copy)
+{
+    memcpy(copy->data, &copy->version, sizeof(copy->version));
+    uint32_t crc = blob_crc(copy, copy->data);
+    memcpy((uint8_t*)copy->data + copy->size - sizeof(crc), &crc, sizeof(crc));
+    rtc_copy_stamp(copy->stamp, copy->magic);
+}
+
+esp_err_t rtc_copy_blob_save(const rtc_copy_blob_t* copy, bool erase)
+{
+    rtc_copy_blob_seal(copy);
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = rtc_copy_blob_open(copy, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = erase ? nvs_erase_key(nvs_handle, copy->key)
+                    : nvs_set_blob(nvs_handle, copy->key, copy->data, copy->size);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    
+    if (err != ESP_OK) {
+        copy->stamp->magic = 0; // RTC copy no longer matches flash, reload on next wake
+        ESP_LOGE(TAG, "Failed to save '%s': %s", copy->key, esp_err_to_name(err));
+    }
+    return err;
+}
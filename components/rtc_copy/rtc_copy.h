@@ -0,0 +1,99 @@
+#ifndef RTC_COPY_H
+#define RTC_COPY_H
+
+#include "esp_err.h"
+#include "nvs.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Header of data kept in RTC memory across deep sleep
+ *
+ * Ties the data to the firmware build that wrote it, so a new image never
+ * trusts a layout it does not know.
+ */
+typedef struct {
+    uint32_t magic;         ///< Layout magic of the owner, 0 = invalid
+    uint8_t build_id[8];    ///< First bytes of the app ELF SHA256
+} rtc_copy_stamp_t;
+
+/**
+ * @brief Mark RTC data as written by the running build
+ */
+void rtc_copy_stamp(rtc_copy_stamp_t* stamp, uint32_t magic);
+
+/**
+ * @brief true if the stamp carries magic and the build ID of the running build
+ */
+bool rtc_copy_stamp_valid(const rtc_copy_stamp_t* stamp, uint32_t magic);
+
+/**
+ * @brief NVS blob whose decoded form stays in RTC memory
+ *
+ * The blob starts with a uint16_t layout version and ends with a uint32_t
+ * CRC over all bytes before it. Both are kept up to date by this module;
+ * warm wakes use the RTC copy without opening NVS.
+ */
+typedef struct {
+    const char* nvs_namespace;
+    const char* key;
+    uint16_t version;                   ///< Layout version stored in the blob
+    uint32_t magic;                     ///< Stamp magic of the RTC copy
+    rtc_copy_stamp_t* stamp;            ///< Stamp of the copy, in RTC memory
+    void* data;                         ///< The copy, in RTC memory
+    size_t size;                        ///< Blob size including version and CRC
+    bool (*check)(const void* data);    ///< Range checks beyond version and CRC, may be NULL
+    esp_err_t (*nvs_init)(void);        ///< Brings NVS up before the first open
+} rtc_copy_blob_t;
+
+/**
+ * @brief true if the RTC copy is still valid for this firmware
+ */
+bool rtc_copy_blob_warm(const rtc_copy_blob_t* copy);
+
+/**
+ * @brief Initialize NVS and open the namespace of the blob
+ *
+ * Logs failures other than a missing namespace on a read-only open.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if nothing
+ *         was ever stored in the namespace
+ */
+esp_err_t rtc_copy_blob_open(const rtc_copy_blob_t* copy, nvs_open_mode_t mode, nvs_handle_t* handle);
+
+/**
+ * @brief Read the blob from NVS into the RTC copy with a single nvs_get_blob()
+ *
+ * A stored blob that fails the checks is logged and dropped. The copy is
+ * left unstamped; call rtc_copy_blob_seal() once it is complete.
+ *
+ * @return esp_err_t ESP_OK (also for a dropped blob, the copy is zeroed),
+ *         ESP_ERR_NVS_NOT_FOUND if the key is missing (copy zeroed)
+ */
+esp_err_t rtc_copy_blob_read(const rtc_copy_blob_t* copy, nvs_handle_t handle);
+
+/**
+ * @brief Set version and CRC of the RTC copy and stamp it for this build
+ */
+void rtc_copy_blob_seal(const rtc_copy_blob_t* copy);
+
+/**
+ * @brief Seal the RTC copy and write it to NVS
+ *
+ * On failure the stamp is cleared, so the next wake reloads from flash.
+ *
+ * @param erase Erase the key instead of writing the blob
+ * @return esp_err_t ESP_OK once committed
+ */
+esp_err_t rtc_copy_blob_save(const rtc_copy_blob_t* copy, bool erase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RTC_COPY_H
@@ -1,12 +1,52 @@
 #include "switch.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
-#define SWITCH_PIN GPIO_NUM_25
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_private/esp_clk.h"
+#include "power_manager.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "freertos/event_groups.h"
+
+#define SWITCH_DEBOUNCE_MS 30
+#define SWITCH_RELEASED_BIT BIT0
+
+static const char *TAG = "SWITCH";
+
+static switch_event_cb_t event_cb = NULL;
+static void *event_cb_arg = NULL;
+static TimerHandle_t debounce_timer = NULL;
+static EventGroupHandle_t switch_event_group = NULL;
+static bool events_enabled = false;
+static bool debounced_closed = false;
+static volatile bool edge_pending = false;
+static volatile int64_t edge_time_us = 0;
+static int64_t press_start_us = 0;
+static int64_t last_press_duration_us = 0;
+// Held from an edge until the debounce has settled, not while waiting for one
+static power_manager_lock_handle_t debounce_pm_lock = NULL;
+
+// Ring of completed presses; RTC_DATA_ATTR keeps it across deep sleep only
+typedef struct {
+    uint32_t head;      // index of the oldest entry
+    uint32_t count;
+    uint32_t next_seq;
+    uint32_t dropped;
+    switch_journal_entry_t entries[SWITCH_JOURNAL_SIZE];
+} switch_journal_t;
+
+static RTC_DATA_ATTR switch_journal_t journal;
+static portMUX_TYPE journal_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t urgent_ms = 0;
+static volatile bool urgent_pending = false;
+static bool skip_held_press = false;
 
 
 esp_err_t switch_init(void){
     gpio_config_t io_config = {
-        .pin_bit_mask = (1ULL << (int)SWITCH_PIN),
+        .pin_bit_mask = (1ULL << (int)SWITCH_GPIO),
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_ENABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE
@@ -16,11 +56,251 @@ esp_err_t switch_init(void){
         ESP_LOGE("SWITCH", "GPIO configuration failed with error: %d", ret);
         return ret;
     }
-    ESP_LOGI("SWITCH", "GPIO configuration successful, SWITCH_PIN is configured as input with pull-up");
+    ESP_LOGI("SWITCH", "GPIO configuration successful, SWITCH_GPIO is configured as input with pull-up");
     return ESP_OK;
 }
 
 bool switch_is_closed(void) {
-	return (gpio_get_level(SWITCH_PIN) == 0);
+	return (gpio_get_level(SWITCH_GPIO) == 0);
+
+}
+
+// Level trigger opposite to the debounced state doubles as light-sleep wakeup
+static void arm_trigger(void)
+{
+    gpio_wakeup_enable(SWITCH_GPIO, debounced_closed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    gpio_intr_enable(SWITCH_GPIO);
+}
+
+static void switch_isr(void *arg)
+{
+    // Level interrupt: mask until the debounce timer has looked at the pin
+    gpio_intr_disable(SWITCH_GPIO);
+
+    if (!edge_pending) {
+        edge_pending = true;
+        edge_time_us = esp_timer_get_time();
+        power_manager_acquire(debounce_pm_lock);
+    }
+
+    BaseType_t woken = pdFALSE;
+    xTimerResetFromISR(debounce_timer, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void debounce_cb(TimerHandle_t timer)
+{
+    bool closed = switch_is_closed();
+    int64_t edge_us = edge_time_us;
+    bool had_edge = edge_pending;
+    edge_pending = false;
+
+    if (closed != debounced_closed) {
+        debounced_closed = closed;
+        if (closed) {
+            press_start_us = edge_us;
+            xEventGroupClearBits(switch_event_group, SWITCH_RELEASED_BIT);
+        } else {
+            last_press_duration_us = edge_us - press_start_us;
+            // esp_timer starts at boot, RTC time keeps running through deep sleep
+            uint64_t start_rtc_us = esp_clk_rtc_time() - (esp_timer_get_time() - press_start_us);
+            if (!skip_held_press) {
+                switch_journal_add(start_rtc_us, last_press_duration_us / 1000, SWITCH_JOURNAL_AWAKE);
+            }
+            skip_held_press = false;
+            xEventGroupSetBits(switch_event_group, SWITCH_RELEASED_BIT);
+        }
+
+        if (event_cb) {
+            event_cb(closed ? SWITCH_EVENT_PRESSED : SWITCH_EVENT_RELEASED,
+                     closed ? 0 : last_press_duration_us, event_cb_arg);
+        }
+    }
+
+    arm_trigger();
+    if (had_edge) {
+        power_manager_release(debounce_pm_lock);
+    }
+}
+
+esp_err_t switch_enable_events(switch_event_cb_t cb, void *arg)
+{
+    event_cb = cb;
+    event_cb_arg = arg;
+
+    if (events_enabled) {
+        return ESP_OK;
+    }
+
+    if (!switch_event_group) {
+        switch_event_group = xEventGroupCreate();
+        debounce_timer = xTimerCreate("sw_debounce", pdMS_TO_TICKS(SWITCH_DEBOUNCE_MS),
+                                      pdFALSE, NULL, debounce_cb);
+        if (!switch_event_group || !debounce_timer) {
+            ESP_LOGE(TAG, "Failed to allocate switch event resources");
+            return ESP_ERR_NO_MEM;
+        }
+        power_manager_lock_create(POWER_MANAGER_LOCK_NO_SLEEP, "switch", &debounce_pm_lock);
+    }
+
+    // A switch wake means the press started with the boot (esp_timer time 0)
+    debounced_closed = switch_is_closed();
+    press_start_us = 0;
+    skip_held_press = skip_held_press && debounced_closed;
+    if (debounced_closed) {
+        xEventGroupClearBits(switch_event_group, SWITCH_RELEASED_BIT);
+    } else {
+        xEventGroupSetBits(switch_event_group, SWITCH_RELEASED_BIT);
+    }
+
+    esp_err_t ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "GPIO ISR service install failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = gpio_isr_handler_add(SWITCH_GPIO, switch_isr, NULL);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "GPIO ISR handler add failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    esp_sleep_enable_gpio_wakeup();
+    events_enabled = true;
+    arm_trigger();
+
+    ESP_LOGI(TAG, "Switch events enabled (debounce %d ms, closed: %d)", SWITCH_DEBOUNCE_MS, debounced_closed);
+    return ESP_OK;
+}
+
+void switch_disable_events(void)
+{
+    if (!events_enabled) {
+        return;
+    }
+
+    gpio_intr_disable(SWITCH_GPIO);
+    gpio_isr_handler_remove(SWITCH_GPIO);
+    gpio_wakeup_disable(SWITCH_GPIO);
+    gpio_set_intr_type(SWITCH_GPIO, GPIO_INTR_DISABLE);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+    xTimerStop(debounce_timer, portMAX_DELAY);
+    if (edge_pending) {
+        power_manager_release(debounce_pm_lock);
+    }
+    edge_pending = false;
+    events_enabled = false;
+    event_cb = NULL;
+    event_cb_arg = NULL;
+}
+
+esp_err_t switch_wait_for_release(uint32_t timeout_ms, int64_t *press_duration_us)
+{
+    if (!events_enabled) {
+        esp_err_t ret = switch_enable_events(event_cb, event_cb_arg);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    TickType_t ticks = (timeout_ms == SWITCH_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    EventBits_t bits = xEventGroupWaitBits(switch_event_group, SWITCH_RELEASED_BIT,
+                                           pdFALSE, pdTRUE, ticks);
+
+    if (press_duration_us) {
+        *press_duration_us = switch_get_press_duration_us();
+    }
+
+    return (bits & SWITCH_RELEASED_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+int64_t switch_get_press_duration_us(void)
+{
+    if (events_enabled && debounced_closed) {
+        return esp_timer_get_time() - press_start_us;
+    }
+    return last_press_duration_us;
+}
+
+void switch_journal_add(uint64_t timestamp_us, uint32_t duration_ms, switch_journal_source_t source)
+{
+    portENTER_CRITICAL(&journal_lock);
+    if (journal.count == SWITCH_JOURNAL_SIZE) {
+        journal.head = (journal.head + 1) % SWITCH_JOURNAL_SIZE;
+        journal.count--;
+        journal.dropped++;
+    }
+    switch_journal_entry_t *entry = &journal.entries[(journal.head + journal.count) % SWITCH_JOURNAL_SIZE];
+    entry->timestamp_us = timestamp_us;
+    entry->duration_ms = duration_ms;
+    entry->source = source;
+    journal.count++;
+    journal.next_seq++;
+    if (urgent_ms && duration_ms >= urgent_ms) {
+        urgent_pending = true;
+    }
+    portEXIT_CRITICAL(&journal_lock);
+}
+
+uint32_t switch_journal_count(void)
+{
+    return journal.count;
+}
+
+esp_err_t switch_journal_get(uint32_t index, switch_journal_entry_t *entry)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&journal_lock);
+    if (index < journal.count) {
+        *entry = journal.entries[(journal.head + index) % SWITCH_JOURNAL_SIZE];
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&journal_lock);
+    return ret;
+}
+
+uint32_t switch_journal_first_seq(void)
+{
+    portENTER_CRITICAL(&journal_lock);
+    uint32_t seq = journal.next_seq - journal.count;
+    portEXIT_CRITICAL(&journal_lock);
+    return seq;
+}
+
+void switch_journal_ack(uint32_t end_seq)
+{
+    portENTER_CRITICAL(&journal_lock);
+    // Entries dropped since the upload read them count as acknowledged
+    uint32_t count = end_seq - (journal.next_seq - journal.count);
+    if ((int32_t)count > 0) {
+        count = count < journal.count ? count : journal.count;
+        journal.head = (journal.head + count) % SWITCH_JOURNAL_SIZE;
+        journal.count -= count;
+    }
+    portEXIT_CRITICAL(&journal_lock);
+}
+
+uint32_t switch_journal_get_dropped(void)
+{
+    return journal.dropped;
+}
+
+void switch_journal_skip_held_press(void)
+{
+    skip_held_press = true;
+}
+
+void switch_journal_set_urgent_ms(uint32_t ms)
+{
+    urgent_ms = ms;
+}
 
+bool switch_journal_take_urgent(void)
+{
+    bool urgent = urgent_pending;
+    urgent_pending = false;
+    return urgent;
 }
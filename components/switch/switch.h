@@ -3,10 +3,74 @@
 #define SWITCH_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
+#include "driver/gpio.h"
+
+// Must be an RTC GPIO: it wakes from deep sleep (EXT0, ULP and wake stub use RTC_GPIO6)
+#define SWITCH_GPIO GPIO_NUM_25
+
+#define SWITCH_WAIT_FOREVER UINT32_MAX
+
+typedef enum {
+	SWITCH_EVENT_PRESSED,
+	SWITCH_EVENT_RELEASED
+} switch_event_t;
+
+// duration_us: hold time on SWITCH_EVENT_RELEASED, 0 on SWITCH_EVENT_PRESSED
+// Runs in the FreeRTOS timer task - keep it short and non-blocking
+typedef void (*switch_event_cb_t)(switch_event_t event, int64_t duration_us, void *arg);
 
 esp_err_t switch_init(void);
 bool switch_is_closed(void);
 
+// Edge interrupt + debounce; the pin also arms GPIO light-sleep wakeup so an
+// idle wait costs light-sleep current once power management is enabled
+esp_err_t switch_enable_events(switch_event_cb_t cb, void *arg);
+void switch_disable_events(void);
+
+// Blocks (no polling) until the switch is released or timeout_ms expires.
+// Returns ESP_ERR_TIMEOUT if still closed; press_duration_us may be NULL.
+esp_err_t switch_wait_for_release(uint32_t timeout_ms, int64_t *press_duration_us);
+
+// Current hold time while closed, otherwise duration of the last press
+int64_t switch_get_press_duration_us(void);
+
+// Journal: every completed press in an RTC ring, kept across deep sleep until
+// the upload has acknowledged it. Recording needs no radio.
+#define SWITCH_JOURNAL_SIZE 32
+
+typedef enum {
+	SWITCH_JOURNAL_AWAKE,   // debounced by switch_enable_events() while awake
+	SWITCH_JOURNAL_ASLEEP   // recorded by the ULP or wake stub during deep sleep
+} switch_journal_source_t;
+
+typedef struct {
+	uint64_t timestamp_us;  // press start, RTC time since power-on (esp_clk_rtc_time)
+	uint32_t duration_ms;
+	uint8_t source;         // switch_journal_source_t
+} switch_journal_entry_t;
+
+// Appends a press; when full the oldest entry is dropped and counted
+void switch_journal_add(uint64_t timestamp_us, uint32_t duration_ms, switch_journal_source_t source);
+uint32_t switch_journal_count(void);
+// index 0 is the oldest entry
+esp_err_t switch_journal_get(uint32_t index, switch_journal_entry_t *entry);
+// Sequence number of the oldest entry; entries are numbered from cold boot on
+uint32_t switch_journal_first_seq(void);
+// Drops all entries before end_seq, e.g. first_seq + count of an acknowledged upload
+void switch_journal_ack(uint32_t end_seq);
+// Entries lost to a full ring since cold boot
+uint32_t switch_journal_get_dropped(void);
+// The press still held at wake was already journaled during deep sleep (long
+// press seen by the ULP or wake stub); its release adds no second entry
+void switch_journal_skip_held_press(void);
+
+// Urgent rule: a press held at least urgent_ms (0 = off) should not wait for
+// the next scheduled upload. Not persistent, set it before deep_sleep_manager_init().
+void switch_journal_set_urgent_ms(uint32_t urgent_ms);
+// True once after an urgent press was recorded
+bool switch_journal_take_urgent(void);
+
 
 #endif //SWITCH_H
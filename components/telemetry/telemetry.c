@@ -0,0 +1,476 @@
+#include "telemetry.h"
+#include "tm_cbor.h"
+#include "tm_conn.h"
+#include "tm_ota.h"
+#include "deep_sleep_manager.h"
+#include "log_store.h"
+#include "event_queue.h"
+#include "switch.h"
+#include "wake_timing.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "TELEMETRY";
+
+#define TELEMETRY_DEFAULT_PORT 443
+#define TELEMETRY_DEFAULT_TIMEOUT_MS (10 * 1000)
+#define TELEMETRY_DEFAULT_OTA_BUDGET_MS (20 * 1000)
+#define TELEMETRY_CONTENT_TYPE "application/cbor"
+
+#define UPLOAD_TASK_STACK 8192  // mbedtls handshake plus the CBOR staging buffer
+#define UPLOAD_TASK_PRIO 5
+#define LOG_CHUNK_SIZE 256
+#define EVENT_BATCH_MAX_LEN (32 * 1024)
+#define EVENT_BATCHES_MAX 4  // Covers a full event partition
+
+#define UPLOAD_DONE_BIT BIT0
+
+// Everything except the log and timing history, which are read straight from their stores
+typedef struct {
+    uint8_t mac[6];
+    uint8_t app_sha256[32];
+    bool app_valid;
+    uint64_t rtc_us;
+    int64_t wall_us;
+    bool wall_valid;
+    int32_t drift_ppm;
+    dsm_energy_stats_t energy;
+    bool energy_valid;
+    dsm_press_stats_t presses;
+    bool presses_valid;
+    size_t log_total;
+    uint32_t log_dropped;
+    uint32_t journal_first_seq;
+    uint32_t journal_count;
+    uint32_t journal_dropped;
+    switch_journal_entry_t journal[SWITCH_JOURNAL_SIZE];
+} telemetry_snapshot_t;
+
+static telemetry_config_t config;
+static telemetry_done_cb_t done_cb = NULL;
+static EventGroupHandle_t upload_events = NULL;
+static TaskHandle_t upload_task_handle = NULL;
+static dsm_awake_token_t upload_token = DSM_AWAKE_TOKEN_INVALID;
+static esp_err_t upload_result = ESP_ERR_INVALID_STATE;
+static bool upload_started = false;
+static bool update_requested = false;
+
+// Static: both encoder passes of one upload must see the same values, and the
+// staging buffer stays off the task stack
+static telemetry_snapshot_t snapshot;
+static tm_cbor_writer_t writer;
+
+static void take_snapshot(telemetry_snapshot_t* snap, log_store_iter_t* log_iter)
+{
+    memset(snap, 0, sizeof(*snap));
+    esp_read_mac(snap->mac, ESP_MAC_WIFI_STA);
+    snap->app_valid = tm_ota_running_sha256(snap->app_sha256) == ESP_OK;
+    snap->rtc_us = esp_clk_rtc_time();
+    snap->wall_valid = deep_sleep_manager_get_wall_clock(&snap->wall_us) == ESP_OK;
+    snap->drift_ppm = deep_sleep_manager_get_drift_ppm();
+    snap->energy_valid = deep_sleep_manager_get_energy_stats(&snap->energy) == ESP_OK;
+    snap->presses_valid = deep_sleep_manager_get_press_stats(&snap->presses) == ESP_OK;
+
+    log_store_iter_begin(log_iter);
+    snap->log_total = log_iter->total;
+    snap->log_dropped = log_store_get_dropped();
+
+    // Copied, the timer task may journal a press between the two encoder passes
+    snap->journal_first_seq = switch_journal_first_seq();
+    while (snap->journal_count < SWITCH_JOURNAL_SIZE &&
+           switch_journal_get(snap->journal_count, &snap->journal[snap->journal_count]) == ESP_OK) {
+        snap->journal_count++;
+    }
+    snap->journal_dropped = switch_journal_get_dropped();
+}
+
+static void encode_energy(tm_cbor_writer_t* w, const dsm_energy_stats_t* energy)
+{
+    tm_cbor_array(w, 3 * DSM_WAKE_CLASS_COUNT + 3);
+    for (int i = 0; i < DSM_WAKE_CLASS_COUNT; i++) {
+        tm_cbor_uint(w, energy->awake_us[i]);
+    }
+    for (int i = 0; i < DSM_WAKE_CLASS_COUNT; i++) {
+        tm_cbor_uint(w, energy->wakes[i]);
+    }
+    for (int i = 0; i < DSM_WAKE_CLASS_COUNT; i++) {
+        tm_cbor_uint(w, energy->radio_on_us[i]);
+    }
+    tm_cbor_uint(w, energy->portal_us);
+    tm_cbor_uint(w, energy->sleep_us);
+    tm_cbor_uint(w, (uint64_t)(energy->charge_uah * 1000.0));
+}
+
+static void encode_presses(tm_cbor_writer_t* w, const dsm_press_stats_t* presses)
+{
+    tm_cbor_array(w, 1 + presses->event_count);
+    tm_cbor_uint(w, presses->press_count);
+    for (uint32_t i = 0; i < presses->event_count; i++) {
+        tm_cbor_array(w, 2);
+        tm_cbor_uint(w, presses->events[i].timestamp_us);
+        tm_cbor_uint(w, presses->events[i].duration_ms);
+    }
+}
+
+static void encode_journal(tm_cbor_writer_t* w, const telemetry_snapshot_t* snap)
+{
+    tm_cbor_array(w, 1 + snap->journal_count);
+    tm_cbor_uint(w, snap->journal_dropped);
+    for (uint32_t i = 0; i < snap->journal_count; i++) {
+        tm_cbor_array(w, 3);
+        tm_cbor_uint(w, snap->journal[i].timestamp_us);
+        tm_cbor_uint(w, snap->journal[i].duration_ms);
+        tm_cbor_uint(w, snap->journal[i].source);
+    }
+}
+
+static void encode_timing(tm_cbor_writer_t* w)
+{
+    wake_timing_record_t record;
+    size_t count = 0;
+
+    for (int reason = 0; reason < WAKE_TIMING_REASON_COUNT; reason++) {
+        for (uint32_t age = 0; wake_timing_get(reason, age, &record) == ESP_OK; age++) {
+            count++;
+        }
+    }
+
+    tm_cbor_array(w, count);
+    for (int reason = 0; reason < WAKE_TIMING_REASON_COUNT; reason++) {
+        for (uint32_t age = 0; wake_timing_get(reason, age, &record) == ESP_OK; age++) {
+            tm_cbor_array(w, 4);
+            tm_cbor_uint(w, record.wake_index);
+            tm_cbor_uint(w, record.reason);
+            tm_cbor_array(w, 2 * record.mark_count);
+            for (int i = 0; i < record.mark_count; i++) {
+                tm_cbor_text(w, record.marks[i].name);
+                tm_cbor_uint(w, record.marks[i].time_us);
+            }
+            tm_cbor_array(w, 3);
+            tm_cbor_uint(w, record.bringup_us);
+            tm_cbor_uint(w, record.critical_us);
+            tm_cbor_uint(w, record.work_us);
+        }
+    }
+}
+
+// Exactly snap->log_total bytes; if the ring moved on meanwhile the rest is zero padded
+static void encode_log(tm_cbor_writer_t* w, const telemetry_snapshot_t* snap, log_store_iter_t* log_iter)
+{
+    tm_cbor_bytes_head(w, snap->log_total);
+
+    if (!w->sink) {
+        tm_cbor_raw(w, NULL, snap->log_total);
+        return;
+    }
+
+    uint8_t chunk[LOG_CHUNK_SIZE];
+    size_t remaining = snap->log_total;
+    while (remaining && w->err == ESP_OK) {
+        size_t want = MIN(remaining, sizeof(chunk));
+        size_t got = log_store_iter_read(log_iter, chunk, want);
+        if (got < want) {
+            memset(&chunk[got], 0, want - got);
+        }
+        tm_cbor_raw(w, chunk, want);
+        remaining -= want;
+    }
+}
+
+static void encode_payload(tm_cbor_writer_t* w, const telemetry_snapshot_t* snap, log_store_iter_t* log_iter)
+{
+    tm_cbor_map(w, 8 + snap->wall_valid + snap->energy_valid + snap->presses_valid + snap->app_valid);
+
+    tm_cbor_uint(w, TELEMETRY_KEY_VERSION);
+    tm_cbor_uint(w, TELEMETRY_FORMAT_VERSION);
+    tm_cbor_uint(w, TELEMETRY_KEY_DEVICE);
+    tm_cbor_bytes(w, snap->mac, sizeof(snap->mac));
+    tm_cbor_uint(w, TELEMETRY_KEY_RTC_TIME);
+    tm_cbor_uint(w, snap->rtc_us);
+    if (snap->wall_valid) {
+        tm_cbor_uint(w, TELEMETRY_KEY_WALL_CLOCK);
+        tm_cbor_int(w, snap->wall_us);
+    }
+    tm_cbor_uint(w, TELEMETRY_KEY_DRIFT);
+    tm_cbor_int(w, snap->drift_ppm);
+    if (snap->energy_valid) {
+        tm_cbor_uint(w, TELEMETRY_KEY_ENERGY);
+        encode_energy(w, &snap->energy);
+    }
+    if (snap->presses_valid) {
+        tm_cbor_uint(w, TELEMETRY_KEY_PRESSES);
+        encode_presses(w, &snap->presses);
+    }
+    tm_cbor_uint(w, TELEMETRY_KEY_TIMING);
+    encode_timing(w);
+    tm_cbor_uint(w, TELEMETRY_KEY_LOG);
+    encode_log(w, snap, log_iter);
+    tm_cbor_uint(w, TELEMETRY_KEY_LOG_DROPPED);
+    tm_cbor_uint(w, snap->log_dropped);
+    tm_cbor_uint(w, TELEMETRY_KEY_SWITCH);
+    encode_journal(w, snap);
+    if (snap->app_valid) {
+        tm_cbor_uint(w, TELEMETRY_KEY_APP);
+        tm_cbor_bytes(w, snap->app_sha256, sizeof(snap->app_sha256));
+    }
+}
+
+static esp_err_t conn_sink(void* ctx, const uint8_t* data, size_t len)
+{
+    return tm_conn_write(data, len);
+}
+
+// Reads the 2xx-or-not answer and drops its body, keeping the connection usable
+static esp_err_t read_response(int* status)
+{
+    size_t body_length = 0;
+    esp_err_t err = tm_conn_response(status, &body_length);
+    if (err == ESP_OK) {
+        err = tm_conn_skip(body_length);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "No valid response: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t post_payload(void)
+{
+    log_store_iter_t log_iter;
+    tm_cbor_writer_t* w = &writer;
+
+    take_snapshot(&snapshot, &log_iter);
+
+    // Counting pass for the Content-Length
+    tm_cbor_init(w, NULL, NULL);
+    encode_payload(w, &snapshot, NULL);
+    size_t length = w->length;
+
+    esp_err_t err = tm_conn_request("POST", config.path, TELEMETRY_CONTENT_TYPE, length);
+    if (err == ESP_OK) {
+        tm_cbor_init(w, conn_sink, NULL);
+        encode_payload(w, &snapshot, &log_iter);
+        err = tm_cbor_finish(w);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int status = 0;
+    err = read_response(&status);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Payload of %u bytes sent, HTTP %d", (unsigned)length, status);
+    if (status < 200 || status >= 300) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    switch_journal_ack(snapshot.journal_first_seq + snapshot.journal_count);
+    return ESP_OK;
+}
+
+static void encode_events(tm_cbor_writer_t* w, event_queue_batch_t* batch, uint32_t dropped)
+{
+    tm_cbor_map(w, 4);
+    tm_cbor_uint(w, TELEMETRY_EVENT_KEY_DEVICE);
+    tm_cbor_bytes(w, snapshot.mac, sizeof(snapshot.mac));
+    tm_cbor_uint(w, TELEMETRY_EVENT_KEY_FIRST_SEQ);
+    tm_cbor_uint(w, batch->first_seq);
+    tm_cbor_uint(w, TELEMETRY_EVENT_KEY_RECORDS);
+    tm_cbor_bytes_head(w, batch->length);
+
+    if (!w->sink) {
+        tm_cbor_raw(w, NULL, batch->length);
+    } else {
+        uint8_t chunk[LOG_CHUNK_SIZE];
+        size_t got;
+        while (w->err == ESP_OK && (got = event_queue_batch_read(batch, chunk, sizeof(chunk))) > 0) {
+            tm_cbor_raw(w, chunk, got);
+        }
+    }
+
+    tm_cbor_uint(w, TELEMETRY_EVENT_KEY_DROPPED);
+    tm_cbor_uint(w, dropped);
+}
+
+// Oldest first; a failed batch stays queued for the next connection
+static esp_err_t post_events(void)
+{
+    tm_cbor_writer_t* w = &writer;
+
+    for (int i = 0; i < EVENT_BATCHES_MAX; i++) {
+        event_queue_batch_t batch;
+        if (event_queue_batch_begin(&batch, EVENT_BATCH_MAX_LEN) != ESP_OK) {
+            return ESP_OK;
+        }
+        uint32_t dropped = event_queue_get_dropped();
+
+        tm_cbor_init(w, NULL, NULL);
+        encode_events(w, &batch, dropped);
+        size_t length = w->length;
+
+        esp_err_t err = tm_conn_request("POST", config.events_path, TELEMETRY_CONTENT_TYPE, length);
+        if (err == ESP_OK) {
+            tm_cbor_init(w, conn_sink, NULL);
+            encode_events(w, &batch, dropped);
+            err = tm_cbor_finish(w);
+        }
+
+        int status = 0;
+        if (err == ESP_OK) {
+            err = read_response(&status);
+        }
+        if (err == ESP_OK && (status < 200 || status >= 300)) {
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        ESP_LOGI(TAG, "Event batch from seq %lu sent (%u bytes)", batch.first_seq, (unsigned)batch.length);
+        err = event_queue_batch_ack(&batch);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+static void upload_task(void* param)
+{
+    uint16_t port = config.port ? config.port : TELEMETRY_DEFAULT_PORT;
+    uint32_t timeout_ms = config.timeout_ms ? config.timeout_ms : TELEMETRY_DEFAULT_TIMEOUT_MS;
+
+    esp_err_t err = tm_conn_open(config.host, port, timeout_ms);
+    if (err == ESP_OK) {
+        err = post_payload();
+        if (err == ESP_OK && config.events_path) {
+            err = post_events();
+        }
+        // Last on the connection: a deferred download leaves the rest of its body unread
+        if (err == ESP_OK && update_requested && config.ota_path) {
+            tm_ota_run(config.ota_path, config.ota_budget_ms ? config.ota_budget_ms : TELEMETRY_DEFAULT_OTA_BUDGET_MS);
+            wake_timing_mark("ota");
+        }
+        tm_conn_close();
+    }
+    wake_timing_mark("upload");
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Upload failed: %s", esp_err_to_name(err));
+    }
+
+    upload_result = err;
+    xEventGroupSetBits(upload_events, UPLOAD_DONE_BIT);
+    if (done_cb) {
+        done_cb(err);
+    }
+
+    // Released after the callback, so radio teardown still counts as awake work
+    upload_task_handle = NULL;
+    deep_sleep_manager_release_awake(upload_token);
+    upload_token = DSM_AWAKE_TOKEN_INVALID;
+    vTaskDelete(NULL);
+}
+
+esp_err_t telemetry_init(const telemetry_config_t* cfg)
+{
+    if (!cfg || !cfg->host || !cfg->host[0] || !cfg->path) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!upload_events) {
+        upload_events = xEventGroupCreate();
+        if (!upload_events) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    config = *cfg;
+    return ESP_OK;
+}
+
+bool telemetry_enabled(void)
+{
+    return config.host != NULL;
+}
+
+esp_err_t telemetry_start(telemetry_done_cb_t done)
+{
+    return telemetry_start_ex(done, false);
+}
+
+esp_err_t telemetry_start_ex(telemetry_done_cb_t done, bool update)
+{
+    if (!upload_events || !config.host || upload_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    done_cb = done;
+    update_requested = update;
+    upload_started = true;
+    upload_result = ESP_ERR_TIMEOUT;
+    xEventGroupClearBits(upload_events, UPLOAD_DONE_BIT);
+
+    upload_token = deep_sleep_manager_stay_awake("telemetry");
+    if (xTaskCreate(upload_task, "telemetry", UPLOAD_TASK_STACK, NULL, UPLOAD_TASK_PRIO,
+                    &upload_task_handle) != pdPASS) {
+        upload_task_handle = NULL;
+        upload_started = false;
+        deep_sleep_manager_release_awake(upload_token);
+        upload_token = DSM_AWAKE_TOKEN_INVALID;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_wait(uint32_t timeout_ms)
+{
+    if (!upload_events || !upload_started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(upload_events, UPLOAD_DONE_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    return (bits & UPLOAD_DONE_BIT) ? upload_result : ESP_ERR_TIMEOUT;
+}
+
+size_t telemetry_payload_size(void)
+{
+    static tm_cbor_writer_t counter;    // Count-only, but the stage is part of the struct
+    static telemetry_snapshot_t snap;   // Holds a copy of the switch journal, too big for the caller's stack
+    log_store_iter_t log_iter;
+
+    take_snapshot(&snap, &log_iter);
+    tm_cbor_init(&counter, NULL, NULL);
+    encode_payload(&counter, &snap, NULL);
+    return counter.length;
+}
+
+esp_err_t telemetry_get_ota_status(telemetry_ota_status_t* status)
+{
+    if (!status) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    tm_ota_get_status(status);
+    return ESP_OK;
+}
+
+bool telemetry_ota_pending_verify(void)
+{
+    return tm_ota_pending_verify();
+}
+
+void telemetry_ota_confirm(void)
+{
+    tm_ota_confirm();
+}
@@ -0,0 +1,234 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_FORMAT_VERSION 1  ///< Value of TELEMETRY_KEY_VERSION
+
+/**
+ * @brief Top-level keys of the payload
+ *
+ * The payload is one CBOR map with small integer keys, sent as
+ * "application/cbor". Optional entries are left out when not available.
+ */
+typedef enum {
+    TELEMETRY_KEY_VERSION = 0,  ///< uint: TELEMETRY_FORMAT_VERSION
+    TELEMETRY_KEY_DEVICE,       ///< bytes(6): WiFi station MAC
+    TELEMETRY_KEY_RTC_TIME,     ///< uint: RTC time in µs when the payload was built
+    TELEMETRY_KEY_WALL_CLOCK,   ///< int: Unix time in µs (optional, needs a wall-clock reference)
+    TELEMETRY_KEY_DRIFT,        ///< int: estimated RTC drift in ppm
+    TELEMETRY_KEY_ENERGY,       ///< array (optional): per wake class boot/switch/timer awake_us[3], wakes[3],
+                                ///< radio_on_us[3], then portal_us, sleep_us, charge in nAh
+    TELEMETRY_KEY_PRESSES,      ///< array (optional): press_count, then [timestamp_us, duration_ms] per event
+    TELEMETRY_KEY_TIMING,       ///< array: [wake_index, reason, [name, time_us, ...],
+                                ///< [bringup_us, critical_us, work_us]] per stored wake
+    TELEMETRY_KEY_LOG,          ///< bytes: log ring, oldest byte first (text and LOG_STORE_LOGx records)
+    TELEMETRY_KEY_LOG_DROPPED,  ///< uint: log bytes dropped since cold boot
+    TELEMETRY_KEY_SWITCH,       ///< array: journal entries dropped since cold boot, then
+                                ///< [timestamp_us, duration_ms, source] per journaled press
+    TELEMETRY_KEY_APP,          ///< bytes(32) (optional): SHA-256 of the running image, the base for deltas
+} telemetry_key_t;
+
+/**
+ * @brief Keys of one event batch, POSTed to events_path after the payload
+ */
+typedef enum {
+    TELEMETRY_EVENT_KEY_DEVICE = 0, ///< bytes(6): WiFi station MAC
+    TELEMETRY_EVENT_KEY_FIRST_SEQ,  ///< uint: event_queue block sequence the batch starts at
+    TELEMETRY_EVENT_KEY_RECORDS,    ///< bytes: event_queue records, oldest first, padding to the end
+    TELEMETRY_EVENT_KEY_DROPPED,    ///< uint: records dropped since cold boot
+} telemetry_event_key_t;
+
+#define TELEMETRY_OTA_MAGIC 0x41544F54     ///< "TOTA"
+#define TELEMETRY_OTA_BLOCK_SIZE (16 * 1024)
+#define TELEMETRY_OTA_DICT_MAX (16 * 1024)
+
+/**
+ * @brief Head of the update container served at ota_path, little endian
+ *
+ * The image is cut into TELEMETRY_OTA_BLOCK_SIZE blocks, each one a raw
+ * deflate stream of its own behind a telemetry_ota_block_t, so a download
+ * can resume at any block. A block may use a range of the running image as
+ * preset dictionary; unchanged code then costs a few bytes of back
+ * references, which makes the container a delta against base_sha256.
+ * The server answers 404 when it has no update for the device.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                 ///< TELEMETRY_OTA_MAGIC
+    uint32_t header_len;            ///< Container offset of the first block
+    uint32_t block_size;            ///< TELEMETRY_OTA_BLOCK_SIZE
+    uint32_t image_size;            ///< Bytes of the decompressed image
+    uint32_t block_count;           ///< image_size / block_size, rounded up
+    uint8_t image_sha256[32];       ///< Digest appended to the image, as esp_partition_get_sha256() reports it
+    uint8_t base_sha256[32];        ///< Image the dictionaries are taken from, all zero = no dictionaries
+} telemetry_ota_header_t;
+
+/**
+ * @brief Head of one block in the container
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t length;                ///< Deflate bytes following this head
+    uint32_t base_offset;           ///< Dictionary start in the running image
+    uint32_t base_length;           ///< Dictionary length (max. TELEMETRY_OTA_DICT_MAX), 0 = none
+} telemetry_ota_block_t;
+
+/**
+ * @brief Result of the OTA stage of the last upload
+ */
+typedef enum {
+    TELEMETRY_OTA_IDLE,             ///< No OTA stage ran in this wake
+    TELEMETRY_OTA_UP_TO_DATE,       ///< No update offered, or it is the running image
+    TELEMETRY_OTA_DEFERRED,         ///< Budget spent, the download continues with the next update stage
+    TELEMETRY_OTA_READY,            ///< Image verified and set as boot partition, restart to run it
+    TELEMETRY_OTA_REJECTED,         ///< Offered image failed verification before, not downloaded again
+    TELEMETRY_OTA_FAILED,           ///< Error in this wake, the progress is kept
+} telemetry_ota_state_t;
+
+typedef struct {
+    telemetry_ota_state_t state;
+    uint32_t blocks_done;           ///< Blocks of the pending image in flash
+    uint32_t block_count;           ///< Blocks of the pending image, 0 = none pending
+    uint32_t bytes_received;        ///< Container bytes downloaded in this wake
+    uint32_t stage_ms;              ///< Duration of the OTA stage in this wake
+} telemetry_ota_status_t;
+
+/**
+ * @brief Upload endpoint
+ *
+ * @note The strings are not copied and must stay valid
+ */
+typedef struct {
+    const char* host;       ///< Server name (TLS SNI and certificate check)
+    uint16_t port;          ///< TCP port, 0 = 443
+    const char* path;       ///< Request target of the POST
+    const char* events_path; ///< Request target of the event batches, NULL = leave the event queue alone
+    uint32_t timeout_ms;    ///< Timeout per socket read, 0 = 10 s
+    const char* ota_path;   ///< Request target of the update container, NULL = no OTA stage
+    uint32_t ota_budget_ms; ///< Time the OTA stage may keep the radio on per wake, 0 = 20 s
+} telemetry_config_t;
+
+/**
+ * @brief Completion callback, runs in the upload task
+ *
+ * @param result ESP_OK when the server acknowledged the payload and all event batches with 2xx
+ */
+typedef void (*telemetry_done_cb_t)(esp_err_t result);
+
+/**
+ * @brief Set the upload endpoint
+ *
+ * @param config Endpoint configuration
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG without (or with an empty) host, or without path
+ */
+esp_err_t telemetry_init(const telemetry_config_t* config);
+
+/**
+ * @brief Whether telemetry_init() accepted an endpoint
+ *
+ * Without one, telemetry_start() always fails; callers skip the connect and
+ * keep their data local instead.
+ *
+ * @return bool true once an upload can be started
+ */
+bool telemetry_enabled(void);
+
+/**
+ * @brief Upload this wake's payload in the background
+ *
+ * Builds one CBOR payload from the energy counters, clock state, switch
+ * presses and journal, wake timing records and the log store, and POSTs it over a single
+ * HTTPS connection. The TLS session is cached in RTC memory, so the next
+ * wake resumes it with an abbreviated handshake. The body is encoded twice,
+ * once to count the Content-Length and once streamed straight from the
+ * sources to the connection, so it is never held in heap. Journaled switch
+ * presses are dropped from the journal once the payload was acknowledged.
+ *
+ * With config->events_path set, the event queue is drained on the same
+ * connection afterwards, in batches of up to 32 KB; each batch is dropped
+ * from the queue once the server answered 2xx.
+ *
+ * Holds a stay-awake token until done has returned; done is the place to
+ * tear the radio down (e.g. wifi_setup_disconnect()).
+ *
+ * @param done Completion callback (or NULL)
+ * @return esp_err_t ESP_OK if the upload was started
+ *                   ESP_ERR_INVALID_STATE without telemetry_init() or while an upload runs
+ *                   ESP_ERR_NO_MEM if the task could not be created
+ *
+ * @note Needs an IP connection, e.g. from wifi_setup_connect()
+ */
+esp_err_t telemetry_start(telemetry_done_cb_t done);
+
+/**
+ * @brief Like telemetry_start(), optionally followed by the OTA stage
+ *
+ * With update set and config->ota_path configured, the OTA stage runs on the
+ * same connection after the event batches. It downloads the blocks still
+ * missing of the offered image until it is complete or ota_budget_ms has
+ * passed, then closes the connection. The written blocks are recorded in RTC
+ * memory and NVS, so an interrupted download resumes on the next update
+ * stage, also after a power loss. The stage runs under the stay-awake token
+ * of the upload, so the device sleeps as soon as the budget is spent and
+ * done has torn the radio down. A failed OTA stage does not change result.
+ *
+ * @param done Completion callback (or NULL)
+ * @param update Run the OTA stage after a successful upload
+ * @return esp_err_t see telemetry_start()
+ */
+esp_err_t telemetry_start_ex(telemetry_done_cb_t done, bool update);
+
+/**
+ * @brief Result of the OTA stage and progress of the pending image
+ *
+ * @param status Destination
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG if status is NULL
+ */
+esp_err_t telemetry_get_ota_status(telemetry_ota_status_t* status);
+
+/**
+ * @brief Whether the running image is an update that was not confirmed yet
+ *
+ * @return bool true while the image is on probation (ESP_OTA_IMG_PENDING_VERIFY)
+ */
+bool telemetry_ota_pending_verify(void);
+
+/**
+ * @brief Keep the running image after an update
+ *
+ * With CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE a new image boots on probation;
+ * the bootloader goes back to the previous one if the image resets before it
+ * is confirmed. Deep sleep wakes pass the bootloader too, so an image that
+ * goes to sleep unconfirmed is rolled back on its next wake. Confirm only once
+ * the image has shown it can still reach the server, i.e. after an
+ * acknowledged upload; otherwise it could never fetch its own fix. Does
+ * nothing for an already confirmed image.
+ */
+void telemetry_ota_confirm(void);
+
+/**
+ * @brief Block until the upload started by telemetry_start() has finished
+ *
+ * @param timeout_ms Maximum time to wait
+ * @return esp_err_t Result of the upload, ESP_ERR_TIMEOUT if it is still running
+ */
+esp_err_t telemetry_wait(uint32_t timeout_ms);
+
+/**
+ * @brief Size of the payload if it was built now
+ *
+ * @return size_t Encoded size in bytes
+ */
+size_t telemetry_payload_size(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_H
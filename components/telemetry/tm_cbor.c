@@ -0,0 +1,140 @@
+#include "tm_cbor.h"
+#include <string.h>
+
+// Major types
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE  21
+
+void tm_cbor_init(tm_cbor_writer_t* w, tm_cbor_sink_t sink, void* ctx)
+{
+    w->sink = sink;
+    w->ctx = ctx;
+    w->length = 0;
+    w->err = ESP_OK;
+    w->fill = 0;
+}
+
+static void stage_flush(tm_cbor_writer_t* w)
+{
+    if (w->fill && w->err == ESP_OK) {
+        w->err = w->sink(w->ctx, w->stage, w->fill);
+    }
+    w->fill = 0;
+}
+
+void tm_cbor_raw(tm_cbor_writer_t* w, const void* data, size_t len)
+{
+    w->length += len;
+    if (!w->sink || w->err != ESP_OK) {
+        return;
+    }
+
+    const uint8_t* src = data;
+    while (len) {
+        size_t n = sizeof(w->stage) - w->fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&w->stage[w->fill], src, n);
+        w->fill += n;
+        src += n;
+        len -= n;
+        if (w->fill == sizeof(w->stage)) {
+            stage_flush(w);
+        }
+    }
+}
+
+// Initial byte plus shortest big-endian argument
+static void put_head(tm_cbor_writer_t* w, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t len;
+
+    if (value < 24) {
+        head[0] = (major << 5) | value;
+        len = 1;
+    } else if (value <= UINT8_MAX) {
+        head[0] = (major << 5) | 24;
+        len = 2;
+    } else if (value <= UINT16_MAX) {
+        head[0] = (major << 5) | 25;
+        len = 3;
+    } else if (value <= UINT32_MAX) {
+        head[0] = (major << 5) | 26;
+        len = 5;
+    } else {
+        head[0] = (major << 5) | 27;
+        len = 9;
+    }
+
+    for (size_t i = len - 1; i > 0; i--) {
+        head[i] = value & 0xFF;
+        value >>= 8;
+    }
+    tm_cbor_raw(w, head, len);
+}
+
+void tm_cbor_uint(tm_cbor_writer_t* w, uint64_t value)
+{
+    put_head(w, CBOR_UINT, value);
+}
+
+void tm_cbor_int(tm_cbor_writer_t* w, int64_t value)
+{
+    if (value >= 0) {
+        put_head(w, CBOR_UINT, value);
+    } else {
+        put_head(w, CBOR_NINT, (uint64_t)(-1 - value));
+    }
+}
+
+void tm_cbor_bool(tm_cbor_writer_t* w, bool value)
+{
+    uint8_t b = (CBOR_SIMPLE << 5) | (value ? CBOR_TRUE : CBOR_FALSE);
+    tm_cbor_raw(w, &b, 1);
+}
+
+void tm_cbor_text(tm_cbor_writer_t* w, const char* str)
+{
+    size_t len = strlen(str);
+    put_head(w, CBOR_TEXT, len);
+    tm_cbor_raw(w, str, len);
+}
+
+void tm_cbor_bytes(tm_cbor_writer_t* w, const void* data, size_t len)
+{
+    put_head(w, CBOR_BYTES, len);
+    tm_cbor_raw(w, data, len);
+}
+
+void tm_cbor_bytes_head(tm_cbor_writer_t* w, size_t len)
+{
+    put_head(w, CBOR_BYTES, len);
+}
+
+void tm_cbor_array(tm_cbor_writer_t* w, size_t count)
+{
+    put_head(w, CBOR_ARRAY, count);
+}
+
+void tm_cbor_map(tm_cbor_writer_t* w, size_t pairs)
+{
+    put_head(w, CBOR_MAP, pairs);
+}
+
+esp_err_t tm_cbor_finish(tm_cbor_writer_t* w)
+{
+    if (w->sink) {
+        stage_flush(w);
+    }
+    return w->err;
+}
@@ -0,0 +1,77 @@
+#ifndef TM_CBOR_H
+#define TM_CBOR_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TM_CBOR_STAGE_SIZE 512
+
+/**
+ * @brief Output function of a writer, called with full staging buffers
+ */
+typedef esp_err_t (*tm_cbor_sink_t)(void* ctx, const uint8_t* data, size_t len);
+
+/**
+ * @brief Minimal streaming CBOR (RFC 8949) writer
+ *
+ * Output is staged in a small buffer and handed to the sink in chunks, the
+ * encoded document is never held in memory as a whole. Without a sink the
+ * writer only counts, so the same encoder run yields the Content-Length.
+ * The first error sticks and turns all later calls into no-ops.
+ */
+typedef struct {
+    tm_cbor_sink_t sink;    ///< NULL = count only
+    void* ctx;              ///< Passed to sink
+    size_t length;          ///< Bytes encoded so far
+    esp_err_t err;          ///< First sink error
+    size_t fill;            ///< Internal: bytes in stage
+    uint8_t stage[TM_CBOR_STAGE_SIZE]; ///< Internal: staging buffer
+} tm_cbor_writer_t;
+
+/**
+ * @brief Start a writer
+ *
+ * @param w Writer to initialize
+ * @param sink Output function, NULL for a counting pass
+ * @param ctx Passed to sink
+ */
+void tm_cbor_init(tm_cbor_writer_t* w, tm_cbor_sink_t sink, void* ctx);
+
+void tm_cbor_uint(tm_cbor_writer_t* w, uint64_t value);
+void tm_cbor_int(tm_cbor_writer_t* w, int64_t value);
+void tm_cbor_bool(tm_cbor_writer_t* w, bool value);
+void tm_cbor_text(tm_cbor_writer_t* w, const char* str);
+void tm_cbor_bytes(tm_cbor_writer_t* w, const void* data, size_t len);
+void tm_cbor_array(tm_cbor_writer_t* w, size_t count);
+void tm_cbor_map(tm_cbor_writer_t* w, size_t pairs);
+
+/**
+ * @brief Byte string header only, the len content bytes follow with tm_cbor_raw()
+ */
+void tm_cbor_bytes_head(tm_cbor_writer_t* w, size_t len);
+
+/**
+ * @brief Append raw bytes (content of a byte string started with tm_cbor_bytes_head())
+ *
+ * @note In a counting pass data may be NULL
+ */
+void tm_cbor_raw(tm_cbor_writer_t* w, const void* data, size_t len);
+
+/**
+ * @brief Hand the remaining staged bytes to the sink
+ *
+ * @return esp_err_t ESP_OK or the first sink error
+ */
+esp_err_t tm_cbor_finish(tm_cbor_writer_t* w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TM_CBOR_H
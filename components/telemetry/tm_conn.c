@@ -0,0 +1,325 @@
+#include "tm_conn.h"
+#include "wake_timing.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "esp_crt_bundle.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *TAG = "TM_CONN";
+
+#define SESSION_MAGIC 0x544D5331  // "TMS1"
+#define SESSION_MAX_LEN 512       // Ticket plus session state, without peer certificate
+#define HOST_MAX_LEN 64
+#define HEAD_MAX_LEN 512
+
+// TLS session of the last connection, survives deep sleep in RTC slow memory
+typedef struct {
+    uint32_t magic;
+    char host[HOST_MAX_LEN];
+    uint16_t port;
+    uint16_t length;
+    uint8_t data[SESSION_MAX_LEN];
+    uint32_t crc;
+} tm_session_cache_t;
+
+static RTC_DATA_ATTR tm_session_cache_t session_cache;
+
+static mbedtls_net_context net;
+static mbedtls_ssl_context ssl;
+static mbedtls_ssl_config conf;
+static mbedtls_entropy_context entropy;
+static mbedtls_ctr_drbg_context drbg;
+static bool is_open = false;
+static char conn_host[HOST_MAX_LEN];
+
+static uint32_t session_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&session_cache, offsetof(tm_session_cache_t, crc));
+}
+
+static bool session_cached(const char* host, uint16_t port)
+{
+    return session_cache.magic == SESSION_MAGIC &&
+           session_cache.crc == session_crc() &&
+           session_cache.port == port &&
+           strncmp(session_cache.host, host, sizeof(session_cache.host)) == 0;
+}
+
+static void session_offer(const char* host, uint16_t port)
+{
+    if (!session_cached(host, port)) {
+        return;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_session_load(&session, session_cache.data, session_cache.length) == 0 &&
+        mbedtls_ssl_set_session(&ssl, &session) == 0) {
+        ESP_LOGI(TAG, "Offering cached TLS session");
+    } else {
+        session_cache.magic = 0;
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
+static void session_save(const char* host, uint16_t port)
+{
+    mbedtls_ssl_session session;
+    size_t length = 0;
+
+    session_cache.magic = 0;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(&ssl, &session) == 0 &&
+        mbedtls_ssl_session_save(&session, session_cache.data, sizeof(session_cache.data), &length) == 0) {
+        strncpy(session_cache.host, host, sizeof(session_cache.host) - 1);
+        session_cache.host[sizeof(session_cache.host) - 1] = '\0';
+        session_cache.port = port;
+        session_cache.length = length;
+        session_cache.magic = SESSION_MAGIC;
+        session_cache.crc = session_crc();
+    } else {
+        ESP_LOGW(TAG, "TLS session not cached");
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
+static void conn_free(void)
+{
+    mbedtls_net_free(&net);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    is_open = false;
+}
+
+esp_err_t tm_conn_open(const char* host, uint16_t port, uint32_t timeout_ms)
+{
+    if (is_open || !host || strlen(host) >= HOST_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    strcpy(conn_host, host);
+    mbedtls_net_init(&net);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    is_open = true;
+
+    int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, NULL, 0);
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS setup failed: -0x%04x", -ret);
+        conn_free();
+        return ESP_FAIL;
+    }
+
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+    mbedtls_ssl_conf_read_timeout(&conf, timeout_ms);
+    mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    esp_crt_bundle_attach(&conf);
+
+    ret = mbedtls_ssl_setup(&ssl, &conf);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&ssl, host);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS setup failed: -0x%04x", -ret);
+        conn_free();
+        return ESP_FAIL;
+    }
+
+    char port_str[6];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    ret = mbedtls_net_connect(&net, host, port_str, MBEDTLS_NET_PROTO_TCP);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Connect to %s:%u failed: -0x%04x", host, port, -ret);
+        conn_free();
+        return ESP_FAIL;
+    }
+    mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+    wake_timing_mark("tcp");
+
+    session_offer(host, port);
+
+    while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            ESP_LOGE(TAG, "TLS handshake failed: -0x%04x", -ret);
+            session_cache.magic = 0;
+            conn_free();
+            return ESP_FAIL;
+        }
+    }
+    wake_timing_mark("tls");
+
+    // The session is taken right after the handshake, before any application data
+    session_save(host, port);
+
+    ESP_LOGI(TAG, "Connected to %s:%u (%s)", host, port, mbedtls_ssl_get_ciphersuite(&ssl));
+    return ESP_OK;
+}
+
+esp_err_t tm_conn_write(const void* data, size_t len)
+{
+    const uint8_t* src = data;
+
+    while (len) {
+        int ret = mbedtls_ssl_write(&ssl, src, len);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "TLS write failed: -0x%04x", -ret);
+            return ESP_FAIL;
+        }
+        src += ret;
+        len -= ret;
+    }
+    return ESP_OK;
+}
+
+esp_err_t tm_conn_request(const char* method, const char* path, const char* content_type, size_t content_length)
+{
+    char head[HEAD_MAX_LEN];
+    int len = snprintf(head, sizeof(head),
+                       "%s %s HTTP/1.1\r\n"
+                       "Host: %s\r\n"
+                       "Connection: keep-alive\r\n",
+                       method, path, conn_host);
+
+    if (content_type && len > 0 && len < (int)sizeof(head)) {
+        len += snprintf(&head[len], sizeof(head) - len,
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %u\r\n",
+                        content_type, (unsigned)content_length);
+    }
+    if (len > 0 && len < (int)sizeof(head)) {
+        len += snprintf(&head[len], sizeof(head) - len, "\r\n");
+    }
+    if (len <= 0 || len >= (int)sizeof(head)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return tm_conn_write(head, len);
+}
+
+esp_err_t tm_conn_get_range(const char* path, size_t from, size_t to)
+{
+    char head[HEAD_MAX_LEN];
+    int len = snprintf(head, sizeof(head),
+                       "GET %s HTTP/1.1\r\n"
+                       "Host: %s\r\n"
+                       "Connection: keep-alive\r\n",
+                       path, conn_host);
+
+    if (len > 0 && len < (int)sizeof(head)) {
+        if (to) {
+            len += snprintf(&head[len], sizeof(head) - len, "Range: bytes=%u-%u\r\n\r\n",
+                            (unsigned)from, (unsigned)to);
+        } else {
+            len += snprintf(&head[len], sizeof(head) - len, "Range: bytes=%u-\r\n\r\n", (unsigned)from);
+        }
+    }
+    if (len <= 0 || len >= (int)sizeof(head)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return tm_conn_write(head, len);
+}
+
+int tm_conn_read(void* buf, size_t len)
+{
+    while (true) {
+        int ret = mbedtls_ssl_read(&ssl, buf, len);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            return 0;
+        }
+        return ret;
+    }
+}
+
+esp_err_t tm_conn_response(int* status, size_t* content_length)
+{
+    char line[128];
+    size_t fill = 0;
+    bool status_seen = false;
+    bool length_seen = false;
+
+    // Head byte by byte; mbedtls already holds the decrypted record, so this is cheap
+    while (true) {
+        char c;
+        int ret = tm_conn_read(&c, 1);
+        if (ret == MBEDTLS_ERR_SSL_TIMEOUT) {
+            return ESP_ERR_TIMEOUT;
+        }
+        if (ret <= 0) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        if (c != '\n') {
+            if (c != '\r' && fill < sizeof(line) - 1) {
+                line[fill++] = c;
+            }
+            continue;
+        }
+        line[fill] = '\0';
+
+        if (fill == 0) {
+            break; // Empty line ends the head
+        }
+        if (!status_seen) {
+            if (sscanf(line, "HTTP/1.%*d %d", status) != 1) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            status_seen = true;
+        } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            *content_length = strtoul(&line[15], NULL, 10);
+            length_seen = true;
+        }
+        fill = 0;
+    }
+
+    // Without Content-Length (e.g. chunked) the keep-alive framing is lost
+    return length_seen ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+}
+
+esp_err_t tm_conn_skip(size_t len)
+{
+    uint8_t buf[64];
+
+    while (len) {
+        int ret = tm_conn_read(buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (ret <= 0) {
+            return ESP_FAIL;
+        }
+        len -= ret;
+    }
+    return ESP_OK;
+}
+
+void tm_conn_close(void)
+{
+    if (!is_open) {
+        return;
+    }
+
+    mbedtls_ssl_close_notify(&ssl);
+    conn_free();
+}
@@ -0,0 +1,90 @@
+#ifndef TM_CONN_H
+#define TM_CONN_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Open the TLS connection to host:port
+ *
+ * Offers the session saved in RTC memory after the last handshake, so a
+ * reconnect after deep sleep needs an abbreviated handshake only. The server
+ * certificate is checked against the ESP-IDF certificate bundle.
+ *
+ * @param host Server name, also used for SNI and certificate checks
+ * @param port TCP port
+ * @param timeout_ms Timeout of every socket read
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t tm_conn_open(const char* host, uint16_t port, uint32_t timeout_ms);
+
+/**
+ * @brief Write all len bytes to the connection
+ *
+ * @return esp_err_t ESP_OK, ESP_FAIL on a TLS or socket error
+ */
+esp_err_t tm_conn_write(const void* data, size_t len);
+
+/**
+ * @brief Send the HTTP/1.1 request line and headers
+ *
+ * The connection is kept alive, so several requests share one handshake.
+ *
+ * @param method "POST", "GET", ...
+ * @param path Request target
+ * @param content_type Content-Type of the body, NULL without body
+ * @param content_length Body length in bytes, the caller writes the body next
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t tm_conn_request(const char* method, const char* path, const char* content_type, size_t content_length);
+
+/**
+ * @brief Send a GET for a byte range of path
+ *
+ * @param path Request target
+ * @param from First byte
+ * @param to Last byte (inclusive), 0 = to the end
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t tm_conn_get_range(const char* path, size_t from, size_t to);
+
+/**
+ * @brief Read the response head
+ *
+ * @param status HTTP status code
+ * @param content_length Body length from the Content-Length header
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_RESPONSE without usable status
+ *                   line or Content-Length, ESP_ERR_TIMEOUT on read timeout
+ */
+esp_err_t tm_conn_response(int* status, size_t* content_length);
+
+/**
+ * @brief Read up to len body bytes
+ *
+ * @return int Bytes read, 0 at end of connection, negative on error
+ */
+int tm_conn_read(void* buf, size_t len);
+
+/**
+ * @brief Read and drop len body bytes
+ */
+esp_err_t tm_conn_skip(size_t len);
+
+/**
+ * @brief Send close_notify and release the connection
+ *
+ * @note The session for the next wake stays cached in RTC memory
+ */
+void tm_conn_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TM_CONN_H
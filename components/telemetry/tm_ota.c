@@ -0,0 +1,449 @@
+#include "tm_ota.h"
+#include "tm_conn.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp32/rom/miniz.h"
+#include "nvs.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "TM_OTA";
+
+#define PROGRESS_MAGIC 0x544D4F31   // "TMO1"
+#define NVS_NAMESPACE "tm_ota"
+#define NVS_KEY_PROGRESS "progress"
+#define SHA256_LEN 32
+#define FLASH_SECTOR_SIZE 4096
+#define IN_CHUNK_SIZE 1024
+
+// Download position of the pending image; the RTC copy follows every block,
+// the NVS copy is written once per stage and covers a power loss
+typedef struct {
+    uint32_t magic;
+    uint8_t image_sha256[SHA256_LEN];     // Pending image, all zero = none
+    uint8_t rejected_sha256[SHA256_LEN];  // Failed verification, not downloaded again
+    uint32_t target_address;
+    uint32_t block_count;
+    uint32_t blocks_done;
+    uint32_t next_offset;                 // Container offset of the next block head
+    uint32_t crc;
+} tm_ota_progress_t;
+
+// Inflate state and output window, on the heap only while a download runs
+typedef struct {
+    tinfl_decompressor inflator;
+    uint8_t window[TELEMETRY_OTA_DICT_MAX + TELEMETRY_OTA_BLOCK_SIZE];
+    uint8_t in[IN_CHUNK_SIZE];
+} tm_ota_work_t;
+
+static RTC_DATA_ATTR tm_ota_progress_t progress;
+static bool progress_dirty = false;
+
+// Reloaded with the RTC data on every reset, and only a reset changes the image
+static RTC_DATA_ATTR uint8_t running_sha256[SHA256_LEN];
+static RTC_DATA_ATTR bool running_sha256_valid = false;
+
+static telemetry_ota_status_t status;
+
+static uint32_t progress_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&progress, offsetof(tm_ota_progress_t, crc));
+}
+
+static void progress_commit(void)
+{
+    progress.magic = PROGRESS_MAGIC;
+    progress.crc = progress_crc();
+    progress_dirty = true;
+}
+
+static void progress_load(void)
+{
+    if (progress.magic == PROGRESS_MAGIC && progress.crc == progress_crc()) {
+        return;
+    }
+
+    // RTC memory lost (power-on): fall back to the position of the last stage
+    nvs_handle_t nvs;
+    size_t length = sizeof(progress);
+    bool loaded = false;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        loaded = nvs_get_blob(nvs, NVS_KEY_PROGRESS, &progress, &length) == ESP_OK &&
+                 length == sizeof(progress) && progress.magic == PROGRESS_MAGIC && progress.crc == progress_crc();
+        nvs_close(nvs);
+    }
+    if (!loaded) {
+        memset(&progress, 0, sizeof(progress));
+        progress_commit();
+        progress_dirty = false;
+    } else {
+        ESP_LOGI(TAG, "Download position from NVS: %lu/%lu blocks", progress.blocks_done, progress.block_count);
+    }
+}
+
+static void progress_save(void)
+{
+    if (!progress_dirty) {
+        return;
+    }
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, NVS_KEY_PROGRESS, &progress, sizeof(progress));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Download position not saved to NVS: %s", esp_err_to_name(err));
+        return;
+    }
+    progress_dirty = false;
+}
+
+static void progress_forget_image(void)
+{
+    memset(progress.image_sha256, 0, sizeof(progress.image_sha256));
+    progress.target_address = 0;
+    progress.block_count = 0;
+    progress.blocks_done = 0;
+    progress.next_offset = 0;
+    progress_commit();
+}
+
+static bool sha_is_zero(const uint8_t* sha)
+{
+    for (int i = 0; i < SHA256_LEN; i++) {
+        if (sha[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t read_exact(void* buf, size_t len)
+{
+    uint8_t* dst = buf;
+
+    while (len) {
+        int ret = tm_conn_read(dst, len);
+        if (ret <= 0) {
+            return ESP_FAIL;
+        }
+        dst += ret;
+        len -= ret;
+    }
+    return ESP_OK;
+}
+
+// Range response head; 206 only, a server without range support would send the whole container
+static esp_err_t range_response(size_t* length)
+{
+    int http = 0;
+    esp_err_t err = tm_conn_response(&http, length);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (http == 404) {
+        tm_conn_skip(*length);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (http != 206) {
+        ESP_LOGW(TAG, "Unexpected answer to range request: HTTP %d", http);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t fetch_header(const char* path, telemetry_ota_header_t* header)
+{
+    size_t length = 0;
+    esp_err_t err = tm_conn_get_range(path, 0, sizeof(*header) - 1);
+    if (err == ESP_OK) {
+        err = range_response(&length);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (length != sizeof(*header)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    err = read_exact(header, sizeof(*header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    status.bytes_received += sizeof(*header);
+
+    if (header->magic != TELEMETRY_OTA_MAGIC || header->header_len < sizeof(*header) ||
+        header->block_size != TELEMETRY_OTA_BLOCK_SIZE || header->image_size == 0 ||
+        header->block_count != (header->image_size + header->block_size - 1) / header->block_size) {
+        ESP_LOGE(TAG, "Invalid container header");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    return ESP_OK;
+}
+
+// One raw deflate stream of length bytes into buf[dict_len ..]; buf[0 .. dict_len) is the dictionary
+static esp_err_t inflate_block(tm_ota_work_t* work, uint8_t* buf, size_t dict_len, size_t out_len, uint32_t length)
+{
+    const size_t end = dict_len + out_len;
+    size_t out_pos = dict_len;
+    tinfl_status st = TINFL_STATUS_NEEDS_MORE_INPUT;
+
+    tinfl_init(&work->inflator);
+    while (length && st == TINFL_STATUS_NEEDS_MORE_INPUT) {
+        size_t want = MIN(length, sizeof(work->in));
+        if (read_exact(work->in, want) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        length -= want;
+        status.bytes_received += want;
+
+        size_t in_size = want;
+        size_t out_size = end - out_pos;
+        st = tinfl_decompress(&work->inflator, work->in, &in_size, buf, &buf[out_pos], &out_size,
+                              TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (length ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+        out_pos += out_size;
+        if (st == TINFL_STATUS_DONE && in_size != want) {
+            break; // Trailing bytes after the stream
+        }
+    }
+
+    if (st != TINFL_STATUS_DONE || length || out_pos != end) {
+        ESP_LOGE(TAG, "Block does not inflate to %u bytes (status %d)", (unsigned)out_len, st);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t download_blocks(const char* path, const telemetry_ota_header_t* header,
+                                 const esp_partition_t* running, const esp_partition_t* target,
+                                 int64_t deadline_us)
+{
+    size_t length = 0;
+    esp_err_t err = tm_conn_get_range(path, progress.next_offset, 0);
+    if (err == ESP_OK) {
+        err = range_response(&length);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    tm_ota_work_t* work = malloc(sizeof(*work));
+    if (!work) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t* out = &work->window[TELEMETRY_OTA_DICT_MAX];
+    while (progress.blocks_done < header->block_count) {
+        if (esp_timer_get_time() >= deadline_us) {
+            status.state = TELEMETRY_OTA_DEFERRED;
+            break;
+        }
+
+        telemetry_ota_block_t block;
+        err = read_exact(&block, sizeof(block));
+        if (err != ESP_OK) {
+            break;
+        }
+        status.bytes_received += sizeof(block);
+
+        size_t offset = progress.blocks_done * TELEMETRY_OTA_BLOCK_SIZE;
+        size_t out_len = MIN(TELEMETRY_OTA_BLOCK_SIZE, header->image_size - offset);
+        if (block.base_length > TELEMETRY_OTA_DICT_MAX || block.base_offset > running->size ||
+            block.base_length > running->size - block.base_offset) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        if (block.base_length) {
+            err = esp_partition_read(running, block.base_offset, out - block.base_length, block.base_length);
+            if (err != ESP_OK) {
+                break;
+            }
+        }
+
+        err = inflate_block(work, out - block.base_length, block.base_length, out_len, block.length);
+        if (err == ESP_OK) {
+            size_t erase_len = (out_len + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+            err = esp_partition_erase_range(target, offset, erase_len);
+        }
+        if (err == ESP_OK) {
+            err = esp_partition_write(target, offset, out, out_len);
+        }
+        if (err != ESP_OK) {
+            break;
+        }
+
+        progress.blocks_done++;
+        progress.next_offset += sizeof(block) + block.length;
+        progress_commit();
+    }
+
+    free(work);
+    return err;
+}
+
+// Complete image: the digest check also reads back every written block
+static esp_err_t finish_image(const esp_partition_t* target, const telemetry_ota_header_t* header)
+{
+    uint8_t sha256[SHA256_LEN];
+    esp_err_t err = esp_partition_get_sha256(target, sha256);
+    if (err == ESP_OK && memcmp(sha256, header->image_sha256, SHA256_LEN) != 0) {
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(target);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Downloaded image rejected: %s", esp_err_to_name(err));
+        memcpy(progress.rejected_sha256, header->image_sha256, SHA256_LEN);
+        progress_forget_image();
+        status.state = TELEMETRY_OTA_REJECTED;
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Update written to %s, active after restart", target->label);
+    progress_forget_image();
+    status.state = TELEMETRY_OTA_READY;
+    return ESP_OK;
+}
+
+static esp_err_t run_stage(const char* path, int64_t deadline_us)
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+    if (!running || !target) {
+        ESP_LOGE(TAG, "No OTA partition to update");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    telemetry_ota_header_t header;
+    esp_err_t err = fetch_header(path, &header);
+    if (err == ESP_ERR_NOT_FOUND) {
+        status.state = TELEMETRY_OTA_UP_TO_DATE;
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t running_sha[SHA256_LEN];
+    err = tm_ota_running_sha256(running_sha);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(header.image_sha256, running_sha, SHA256_LEN) == 0) {
+        status.state = TELEMETRY_OTA_UP_TO_DATE;
+        return ESP_OK;
+    }
+    if (memcmp(header.image_sha256, progress.rejected_sha256, SHA256_LEN) == 0) {
+        status.state = TELEMETRY_OTA_REJECTED;
+        return ESP_OK;
+    }
+    if (!sha_is_zero(header.base_sha256) && memcmp(header.base_sha256, running_sha, SHA256_LEN) != 0) {
+        ESP_LOGW(TAG, "Delta is for another base image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (header.image_size > target->size) {
+        ESP_LOGE(TAG, "Image of %lu bytes does not fit %s", header.image_size, target->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // A different image or target partition starts over at the first block
+    if (memcmp(header.image_sha256, progress.image_sha256, SHA256_LEN) != 0 ||
+        progress.target_address != target->address || progress.block_count != header.block_count) {
+        memcpy(progress.image_sha256, header.image_sha256, SHA256_LEN);
+        progress.target_address = target->address;
+        progress.block_count = header.block_count;
+        progress.blocks_done = 0;
+        progress.next_offset = header.header_len;
+        progress_commit();
+        ESP_LOGI(TAG, "New image offered: %lu bytes in %lu blocks%s", header.image_size, header.block_count,
+                 sha_is_zero(header.base_sha256) ? "" : " (delta)");
+    } else {
+        ESP_LOGI(TAG, "Resuming download at block %lu/%lu", progress.blocks_done, progress.block_count);
+    }
+
+    if (progress.blocks_done < header.block_count) {
+        err = download_blocks(path, &header, running, target, deadline_us);
+        if (err != ESP_OK || progress.blocks_done < header.block_count) {
+            return err;
+        }
+    }
+    return finish_image(target, &header);
+}
+
+esp_err_t tm_ota_run(const char* path, uint32_t budget_ms)
+{
+    int64_t start_us = esp_timer_get_time();
+
+    memset(&status, 0, sizeof(status));
+    status.state = TELEMETRY_OTA_FAILED;
+    progress_load();
+
+    esp_err_t err = run_stage(path, start_us + (int64_t)budget_ms * 1000);
+    if (err != ESP_OK) {
+        status.state = TELEMETRY_OTA_FAILED;
+        ESP_LOGW(TAG, "OTA stage failed: %s", esp_err_to_name(err));
+    }
+
+    // Once per stage instead of per block, flash wear of NVS stays low
+    progress_save();
+
+    status.blocks_done = progress.blocks_done;
+    status.block_count = progress.block_count;
+    status.stage_ms = (esp_timer_get_time() - start_us) / 1000;
+    ESP_LOGI(TAG, "OTA stage: state %d, %lu/%lu blocks, %lu bytes in %lu ms", status.state, status.blocks_done,
+             status.block_count, status.bytes_received, status.stage_ms);
+    return err;
+}
+
+void tm_ota_get_status(telemetry_ota_status_t* out)
+{
+    *out = status;
+}
+
+esp_err_t tm_ota_running_sha256(uint8_t sha256[32])
+{
+    if (!running_sha256_valid) {
+        // Reads the whole image, too slow for every wake
+        esp_err_t err = esp_partition_get_sha256(esp_ota_get_running_partition(), running_sha256);
+        if (err != ESP_OK) {
+            return err;
+        }
+        running_sha256_valid = true;
+    }
+
+    memcpy(sha256, running_sha256, SHA256_LEN);
+    return ESP_OK;
+}
+
+bool tm_ota_pending_verify(void)
+{
+    esp_ota_img_states_t state;
+
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+void tm_ota_confirm(void)
+{
+    if (tm_ota_pending_verify()) {
+        esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "Updated image confirmed");
+        } else {
+            ESP_LOGE(TAG, "Image not confirmed: %s", esp_err_to_name(err));
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef TM_OTA_H
+#define TM_OTA_H
+
+#include "telemetry.h"
+#include "esp_err.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Continue or start an update download on the open connection
+ *
+ * Fetches the container header of path with a small range request; if it
+ * offers an image other than the running one, downloads the remaining blocks
+ * with one open-ended range request until the image is complete or budget_ms
+ * has passed. Every written block is recorded in RTC memory, the position is
+ * saved to NVS when the stage ends. A complete image is verified and set as
+ * the boot partition.
+ *
+ * @param path Request target of the container
+ * @param budget_ms Time the stage may take
+ * @return esp_err_t ESP_OK if up to date, deferred or ready, otherwise the error of this wake
+ *
+ * @note Leaves the rest of the body unread when deferring; close the connection afterwards
+ */
+esp_err_t tm_ota_run(const char* path, uint32_t budget_ms);
+
+/**
+ * @brief Outcome of the last tm_ota_run() and progress of the pending image
+ */
+void tm_ota_get_status(telemetry_ota_status_t* status);
+
+/**
+ * @brief SHA-256 of the running image, computed once after reset and kept in RTC memory
+ *
+ * @return esp_err_t ESP_OK, or the error of esp_partition_get_sha256()
+ */
+esp_err_t tm_ota_running_sha256(uint8_t sha256[32]);
+
+/**
+ * @brief Running image still on probation, see telemetry_ota_pending_verify()
+ */
+bool tm_ota_pending_verify(void);
+
+/**
+ * @brief Mark a freshly updated image as good, see telemetry_ota_confirm()
+ */
+void tm_ota_confirm(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TM_OTA_H
@@ -0,0 +1,198 @@
+#include "time_service.h"
+#include "deep_sleep_manager.h"
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_netif_sntp.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include <sys/time.h>
+
+static const char *TAG = "TIME_SERVICE";
+
+#define DEFAULT_SERVER "pool.ntp.org"
+#define DEFAULT_MAX_ERROR_MS 1000
+#define DEFAULT_DRIFT_UNCERTAINTY_PPM 50
+#define DEFAULT_UNCALIBRATED_PPM 1000
+#define DEFAULT_TIMEOUT_MS (10 * 1000)
+
+// Error right after a sync: SNTP over WiFi, half a round trip plus jitter
+#define SYNC_ERROR_US (50 * 1000)
+
+#define SYNC_IDLE_BIT BIT0
+
+static time_service_config_t config;
+static EventGroupHandle_t sync_events = NULL;
+static esp_timer_handle_t timeout_timer = NULL;
+static dsm_awake_token_t sync_token = DSM_AWAKE_TOKEN_INVALID;
+static bool sntp_running = false;
+static portMUX_TYPE sync_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Sync callback and timeout race for the token; whoever comes first ends the sync
+static bool end_sync(void)
+{
+    portENTER_CRITICAL(&sync_lock);
+    dsm_awake_token_t token = sync_token;
+    sync_token = DSM_AWAKE_TOKEN_INVALID;
+    portEXIT_CRITICAL(&sync_lock);
+
+    if (token == DSM_AWAKE_TOKEN_INVALID) {
+        return false;
+    }
+    xEventGroupSetBits(sync_events, SYNC_IDLE_BIT);
+    deep_sleep_manager_release_awake(token);
+    return true;
+}
+
+// Runs in the lwIP thread, the system time is already set
+static void sntp_sync_cb(struct timeval* tv)
+{
+    int64_t unix_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    uint64_t error_us = time_service_predicted_error_us();
+
+    deep_sleep_manager_set_wall_clock(unix_us);
+    esp_timer_stop(timeout_timer);
+    if (end_sync()) {
+        if (error_us == UINT64_MAX) {
+            ESP_LOGI(TAG, "First SNTP sync");
+        } else {
+            ESP_LOGI(TAG, "SNTP sync, predicted error was %llu ms", error_us / 1000);
+        }
+    }
+}
+
+static void timeout_cb(void* arg)
+{
+    if (end_sync()) {
+        ESP_LOGW(TAG, "SNTP sync timed out");
+    }
+}
+
+static void start_sync(void)
+{
+    // A previous exchange (timed out or done) still owns the SNTP client
+    if (sntp_running) {
+        esp_netif_sntp_deinit();
+        sntp_running = false;
+    }
+
+    dsm_awake_token_t token = deep_sleep_manager_stay_awake("sntp");
+    if (token == DSM_AWAKE_TOKEN_INVALID) {
+        return;
+    }
+    sync_token = token;
+    xEventGroupClearBits(sync_events, SYNC_IDLE_BIT);
+
+    esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG(config.server);
+    sntp_config.sync_cb = sntp_sync_cb;
+    esp_err_t err = esp_netif_sntp_init(&sntp_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "SNTP start failed: %s", esp_err_to_name(err));
+        end_sync();
+        return;
+    }
+    sntp_running = true;
+    esp_timer_start_once(timeout_timer, (uint64_t)config.timeout_ms * 1000);
+}
+
+static void got_ip_handler(void* arg, esp_event_base_t base, int32_t id, void* data)
+{
+    if (sync_token != DSM_AWAKE_TOKEN_INVALID || !time_service_sync_needed()) {
+        return;
+    }
+    start_sync();
+}
+
+esp_err_t time_service_init(const time_service_config_t* cfg)
+{
+    if (sync_events) {
+        return ESP_OK;
+    }
+
+    config = cfg ? *cfg : (time_service_config_t){0};
+    if (!config.server) {
+        config.server = DEFAULT_SERVER;
+    }
+    if (!config.max_error_ms) {
+        config.max_error_ms = DEFAULT_MAX_ERROR_MS;
+    }
+    if (!config.drift_uncertainty_ppm) {
+        config.drift_uncertainty_ppm = DEFAULT_DRIFT_UNCERTAINTY_PPM;
+    }
+    if (!config.uncalibrated_ppm) {
+        config.uncalibrated_ppm = DEFAULT_UNCALIBRATED_PPM;
+    }
+    if (!config.timeout_ms) {
+        config.timeout_ms = DEFAULT_TIMEOUT_MS;
+    }
+
+    // Corrected time for this wake, from the RTC and the drift estimate
+    int64_t unix_us;
+    if (deep_sleep_manager_get_wall_clock(&unix_us) == ESP_OK) {
+        struct timeval tv = {
+            .tv_sec = unix_us / 1000000,
+            .tv_usec = unix_us % 1000000,
+        };
+        settimeofday(&tv, NULL);
+    }
+
+    sync_events = xEventGroupCreate();
+    if (!sync_events) {
+        return ESP_ERR_NO_MEM;
+    }
+    xEventGroupSetBits(sync_events, SYNC_IDLE_BIT);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = timeout_cb,
+        .name = "sntp_timeout",
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &timeout_timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+    err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, got_ip_handler, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint64_t error_us = time_service_predicted_error_us();
+    if (error_us == UINT64_MAX) {
+        ESP_LOGI(TAG, "No wall clock yet, syncing on the next connect");
+    } else {
+        ESP_LOGI(TAG, "Predicted error %llu ms (bound %lu ms)", error_us / 1000, config.max_error_ms);
+    }
+    return ESP_OK;
+}
+
+uint64_t time_service_predicted_error_us(void)
+{
+    dsm_wall_clock_info_t info;
+    if (deep_sleep_manager_get_wall_clock_info(&info) != ESP_OK) {
+        return UINT64_MAX;
+    }
+
+    uint32_t ppm = info.drift_valid ? config.drift_uncertainty_ppm : config.uncalibrated_ppm;
+    return SYNC_ERROR_US + info.age_us / 1000000 * ppm;
+}
+
+bool time_service_sync_needed(void)
+{
+    return time_service_predicted_error_us() > (uint64_t)config.max_error_ms * 1000;
+}
+
+esp_err_t time_service_wait(uint32_t timeout_ms)
+{
+    if (!sync_events) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(sync_events, SYNC_IDLE_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    return (bits & SYNC_IDLE_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
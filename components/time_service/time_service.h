@@ -0,0 +1,70 @@
+#ifndef TIME_SERVICE_H
+#define TIME_SERVICE_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Sync policy
+ *
+ * @note The server string is not copied and must stay valid
+ */
+typedef struct {
+    const char* server;             ///< SNTP server, NULL = "pool.ntp.org"
+    uint32_t max_error_ms;          ///< Sync once the predicted error exceeds this, 0 = 1 s
+    uint32_t drift_uncertainty_ppm; ///< Residual error with a drift estimate, 0 = 50 ppm
+    uint32_t uncalibrated_ppm;      ///< Error without a drift estimate, 0 = 1000 ppm
+    uint32_t timeout_ms;            ///< Give up on a sync after this, 0 = 10 s
+} time_service_config_t;
+
+/**
+ * @brief Initialize the time service
+ *
+ * Sets the system time (gettimeofday(), log timestamps) from the wall-clock
+ * estimate of deep_sleep_manager, which keeps the last sync and the RTC
+ * drift in RTC memory. Then watches for WiFi station connects: an SNTP
+ * exchange runs only on an existing connection and only when the predicted
+ * error of the estimate exceeds config->max_error_ms. Every sync is passed
+ * to deep_sleep_manager_set_wall_clock(), which refines the drift and keeps
+ * the job deadlines aligned to wall-clock time.
+ *
+ * @param config Sync policy (NULL = defaults)
+ * @return esp_err_t ESP_OK on success
+ *
+ * @note Call after deep_sleep_manager_init() and before connecting
+ */
+esp_err_t time_service_init(const time_service_config_t* config);
+
+/**
+ * @brief Predicted error of the current wall-clock estimate
+ *
+ * @return uint64_t Error bound in µs, UINT64_MAX without any sync so far
+ */
+uint64_t time_service_predicted_error_us(void);
+
+/**
+ * @brief Whether the next connect will run an SNTP exchange
+ */
+bool time_service_sync_needed(void);
+
+/**
+ * @brief Block until a running sync has finished
+ *
+ * Holds off a radio teardown until the exchange is done; returns at once
+ * when no sync is running.
+ *
+ * @param timeout_ms Maximum time to wait
+ * @return esp_err_t ESP_OK, ESP_ERR_TIMEOUT if the sync is still running
+ */
+esp_err_t time_service_wait(uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIME_SERVICE_H
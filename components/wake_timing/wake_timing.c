@@ -0,0 +1,283 @@
+#include "wake_timing.h"
+#include "rtc_copy.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+static const char *TAG = "WAKE_TIMING";
+
+#define HISTORY_MAGIC 0x57544832  // "WTH2"
+
+// RTC form of wake_timing_record_t: a name is an index into history.names
+// instead of a 4-byte pointer per mark, 120 instead of 180 bytes per record
+typedef struct {
+    uint32_t wake_index;
+    uint8_t reason;
+    uint8_t mark_count;
+    uint16_t dropped;
+    uint8_t mark_names[WAKE_TIMING_MAX_MARKS];
+    uint32_t mark_us[WAKE_TIMING_MAX_MARKS];
+    uint32_t bringup_us;
+    uint32_t critical_us;
+    uint32_t work_us;
+} stored_record_t;
+
+typedef struct {
+    rtc_copy_stamp_t stamp;
+    uint32_t wake_counter;
+    uint8_t next[WAKE_TIMING_REASON_COUNT];
+    uint8_t count[WAKE_TIMING_REASON_COUNT];
+    uint8_t name_count;
+    const char* names[WAKE_TIMING_MAX_NAMES];   // Only valid for the build in stamp
+    stored_record_t records[WAKE_TIMING_REASON_COUNT][WAKE_TIMING_HISTORY];
+} wake_timing_history_t;
+
+static RTC_DATA_ATTR wake_timing_history_t history;
+static wake_timing_record_t current;
+static bool initialized = false;
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static wake_timing_reason_t classify_wakeup(void)
+{
+    switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_EXT0:
+        case ESP_SLEEP_WAKEUP_EXT1:
+        case ESP_SLEEP_WAKEUP_ULP:
+            return WAKE_TIMING_REASON_SWITCH;
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return WAKE_TIMING_REASON_TIMER;
+        default:
+            return WAKE_TIMING_REASON_BOOT;
+    }
+}
+
+void wake_timing_init(void)
+{
+    if (initialized) {
+        return;
+    }
+
+    if (!rtc_copy_stamp_valid(&history.stamp, HISTORY_MAGIC)) {
+        memset(&history, 0, sizeof(history));
+        rtc_copy_stamp(&history.stamp, HISTORY_MAGIC);
+    }
+
+    memset(&current, 0, sizeof(current));
+    current.wake_index = history.wake_counter++;
+    current.reason = classify_wakeup();
+    initialized = true;
+}
+
+// limit < WAKE_TIMING_MAX_MARKS keeps the remaining slots free
+static void add_mark(const char* name, uint8_t limit)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    if (!initialized) {
+        wake_timing_init();
+    }
+
+    portENTER_CRITICAL(&timing_lock);
+    if (current.mark_count < limit) {
+        current.marks[current.mark_count].name = name;
+        current.marks[current.mark_count].time_us = now;
+        current.mark_count++;
+    } else {
+        current.dropped++;
+    }
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+void wake_timing_mark(const char* name)
+{
+    add_mark(name, WAKE_TIMING_MAX_MARKS - 1);
+}
+
+void wake_timing_bringup(uint32_t bringup_us, uint32_t critical_us, uint32_t work_us)
+{
+    if (!initialized) {
+        wake_timing_init();
+    }
+
+    portENTER_CRITICAL(&timing_lock);
+    current.bringup_us = bringup_us;
+    current.critical_us = critical_us;
+    current.work_us = work_us;
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+// Index of name in history.names, added if new; equal literals of different
+// files need not share one address
+static int name_index(const char* name)
+{
+    for (int i = 0; i < history.name_count; i++) {
+        if (history.names[i] == name || strcmp(history.names[i], name) == 0) {
+            return i;
+        }
+    }
+    if (history.name_count == WAKE_TIMING_MAX_NAMES) {
+        return -1;
+    }
+    history.names[history.name_count] = name;
+    return history.name_count++;
+}
+
+void wake_timing_commit(void)
+{
+    add_mark("sleep", WAKE_TIMING_MAX_MARKS);
+
+    // Only this call changes the name table, nothing marks any more
+    portENTER_CRITICAL(&timing_lock);
+    wake_timing_record_t wake = current;
+    portEXIT_CRITICAL(&timing_lock);
+
+    stored_record_t stored = {
+        .wake_index = wake.wake_index,
+        .reason = wake.reason,
+        .dropped = wake.dropped,
+        .bringup_us = wake.bringup_us,
+        .critical_us = wake.critical_us,
+        .work_us = wake.work_us,
+    };
+    for (int i = 0; i < wake.mark_count; i++) {
+        int index = name_index(wake.marks[i].name);
+        if (index < 0) {
+            stored.dropped++;
+            continue;
+        }
+        stored.mark_names[stored.mark_count] = index;
+        stored.mark_us[stored.mark_count] = wake.marks[i].time_us;
+        stored.mark_count++;
+    }
+
+    portENTER_CRITICAL(&timing_lock);
+    uint8_t reason = stored.reason;
+    history.records[reason][history.next[reason]] = stored;
+    history.next[reason] = (history.next[reason] + 1) % WAKE_TIMING_HISTORY;
+    if (history.count[reason] < WAKE_TIMING_HISTORY) {
+        history.count[reason]++;
+    }
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+esp_err_t wake_timing_get(wake_timing_reason_t reason, uint32_t age, wake_timing_record_t* record)
+{
+    if (reason >= WAKE_TIMING_REASON_COUNT || !record) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (history.stamp.magic != HISTORY_MAGIC || age >= history.count[reason]) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t index = (history.next[reason] + WAKE_TIMING_HISTORY - 1 - age) % WAKE_TIMING_HISTORY;
+    const stored_record_t* stored = &history.records[reason][index];
+
+    memset(record, 0, sizeof(*record));
+    record->wake_index = stored->wake_index;
+    record->reason = stored->reason;
+    record->mark_count = stored->mark_count;
+    record->dropped = stored->dropped;
+    for (int i = 0; i < stored->mark_count; i++) {
+        record->marks[i].name = history.names[stored->mark_names[i]];
+        record->marks[i].time_us = stored->mark_us[i];
+    }
+    record->bringup_us = stored->bringup_us;
+    record->critical_us = stored->critical_us;
+    record->work_us = stored->work_us;
+    return ESP_OK;
+}
+
+static size_t put_u32(uint8_t* buf, size_t pos, uint32_t value)
+{
+    if (buf) {
+        buf[pos] = value & 0xFF;
+        buf[pos + 1] = (value >> 8) & 0xFF;
+        buf[pos + 2] = (value >> 16) & 0xFF;
+        buf[pos + 3] = (value >> 24) & 0xFF;
+    }
+    return pos + 4;
+}
+
+size_t wake_timing_serialize(uint8_t* buf, size_t len)
+{
+    size_t pos = 0;
+
+    // Size pass first, so a too small buffer is never partially written
+    if (buf) {
+        size_t needed = wake_timing_serialize(NULL, 0);
+        if (needed > len) {
+            return 0;
+        }
+    }
+
+    for (int reason = 0; reason < WAKE_TIMING_REASON_COUNT; reason++) {
+        for (int age = history.count[reason] - 1; age >= 0; age--) {
+            wake_timing_record_t record;
+            if (wake_timing_get(reason, age, &record) != ESP_OK) {
+                continue;
+            }
+
+            pos = put_u32(buf, pos, record.wake_index);
+            if (buf) {
+                buf[pos] = record.reason;
+                buf[pos + 1] = record.mark_count;
+            }
+            pos += 2;
+
+            for (int i = 0; i < record.mark_count; i++) {
+                size_t name_len = strnlen(record.marks[i].name, UINT8_MAX);
+                if (buf) {
+                    buf[pos] = name_len;
+                    memcpy(&buf[pos + 1], record.marks[i].name, name_len);
+                }
+                pos += 1 + name_len;
+                pos = put_u32(buf, pos, record.marks[i].time_us);
+            }
+
+            pos = put_u32(buf, pos, record.bringup_us);
+            pos = put_u32(buf, pos, record.critical_us);
+            pos = put_u32(buf, pos, record.work_us);
+        }
+    }
+
+    return pos;
+}
+
+static void dump_record(const char* label, const wake_timing_record_t* record)
+{
+    ESP_LOGI(TAG, "%s wake #%lu (reason %u, %u marks, %u dropped)", label,
+             record->wake_index, record->reason, record->mark_count, record->dropped);
+
+    uint32_t previous = 0;
+    for (int i = 0; i < record->mark_count; i++) {
+        const wake_timing_mark_t* mark = &record->marks[i];
+        ESP_LOGI(TAG, "  %-12s %8lu us (+%lu us)", mark->name, mark->time_us, mark->time_us - previous);
+        previous = mark->time_us;
+    }
+
+    if (record->bringup_us) {
+        ESP_LOGI(TAG, "  bring-up %lu us, critical path %lu us, serial %lu us",
+                 record->bringup_us, record->critical_us, record->work_us);
+    }
+}
+
+void wake_timing_dump(void)
+{
+    static const char* labels[WAKE_TIMING_REASON_COUNT] = {"BOOT", "SWITCH", "TIMER"};
+
+    if (initialized) {
+        dump_record("Current", &current);
+    }
+
+    for (int reason = 0; reason < WAKE_TIMING_REASON_COUNT; reason++) {
+        for (uint32_t age = 0; age < WAKE_TIMING_HISTORY; age++) {
+            wake_timing_record_t record;
+            if (wake_timing_get(reason, age, &record) == ESP_OK) {
+                dump_record(labels[reason], &record);
+            }
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef WAKE_TIMING_H
+#define WAKE_TIMING_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WAKE_TIMING_MAX_MARKS 20   ///< Checkpoints kept per wake, the last one is kept for "sleep"
+#define WAKE_TIMING_HISTORY 4      ///< Wakes kept per wake reason
+#define WAKE_TIMING_MAX_NAMES 24   ///< Distinct checkpoint names per firmware build
+
+/**
+ * @brief Wake reason classes the history is kept for
+ */
+typedef enum {
+    WAKE_TIMING_REASON_BOOT,    ///< Power-on, reset or any other cause
+    WAKE_TIMING_REASON_SWITCH,  ///< Switch or input wake (EXT0, EXT1 or ULP)
+    WAKE_TIMING_REASON_TIMER,   ///< Timer wake
+    WAKE_TIMING_REASON_COUNT
+} wake_timing_reason_t;
+
+/**
+ * @brief One named checkpoint
+ */
+typedef struct {
+    const char* name;   ///< String literal, only valid for the firmware that recorded it
+    uint32_t time_us;   ///< esp_timer time since application start
+} wake_timing_mark_t;
+
+/**
+ * @brief All checkpoints of one wake, from application start to deep sleep
+ */
+typedef struct {
+    uint32_t wake_index;    ///< Running wake counter since cold boot
+    uint8_t reason;         ///< wake_timing_reason_t
+    uint8_t mark_count;     ///< Valid entries in marks
+    uint16_t dropped;       ///< Checkpoints that did not fit
+    wake_timing_mark_t marks[WAKE_TIMING_MAX_MARKS];
+    uint32_t bringup_us;    ///< Parallel bring-up: achieved duration, 0 if none ran
+    uint32_t critical_us;   ///< Parallel bring-up: longest dependency chain
+    uint32_t work_us;       ///< Parallel bring-up: sum of all step durations (serial time)
+} wake_timing_record_t;
+
+/**
+ * @brief Start recording the current wake
+ *
+ * Classifies the wake reason and drops the RTC history if it was recorded by
+ * a different firmware build (checkpoint name pointers would be invalid).
+ *
+ * @note Called implicitly by the first wake_timing_mark()
+ */
+void wake_timing_init(void);
+
+/**
+ * @brief Record a named checkpoint with the current esp_timer time
+ *
+ * The RTC history keeps each name once, as a one-byte index. Beyond
+ * WAKE_TIMING_MAX_NAMES distinct names, checkpoints with a new name count as
+ * dropped when the wake is stored.
+ *
+ * @param name String literal naming the phase that just finished
+ *
+ * @note Cheap and safe to call from any task
+ */
+void wake_timing_mark(const char* name);
+
+/**
+ * @brief Record the result of a parallel bring-up in the current wake
+ *
+ * bringup_us against critical_us shows how close the schedule came to the
+ * dependency limit, against work_us what running on both cores saved.
+ *
+ * @param bringup_us Achieved duration from the first step start to the last step end
+ * @param critical_us Longest chain of dependent step durations
+ * @param work_us Sum of all step durations
+ */
+void wake_timing_bringup(uint32_t bringup_us, uint32_t critical_us, uint32_t work_us);
+
+/**
+ * @brief Finish the current wake and store it in the RTC history
+ *
+ * Adds a final "sleep" checkpoint, which always fits: wake_timing_mark()
+ * leaves the last slot free for it. The record survives deep sleep.
+ *
+ * @note Called by enter_deep_sleep() right before esp_deep_sleep_start()
+ */
+void wake_timing_commit(void);
+
+/**
+ * @brief Get a recorded wake from the RTC history
+ *
+ * @param reason Wake reason class
+ * @param age 0 = most recent wake of that class, up to WAKE_TIMING_HISTORY - 1
+ * @param record Destination
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if no such wake is recorded
+ */
+esp_err_t wake_timing_get(wake_timing_reason_t reason, uint32_t age, wake_timing_record_t* record);
+
+/**
+ * @brief Serialize the whole history for upload
+ *
+ * Format, little endian, per record (oldest first within each class):
+ * wake_index u32, reason u8, mark_count u8, then per mark:
+ * name_len u8, name bytes, time_us u32, then bringup_us u32,
+ * critical_us u32, work_us u32.
+ *
+ * @param buf Destination, NULL to only compute the required size
+ * @param len Size of buf
+ * @return size_t Bytes written (or required when buf is NULL), 0 if buf is too small
+ */
+size_t wake_timing_serialize(uint8_t* buf, size_t len);
+
+/**
+ * @brief Log the current wake and the history with per-phase durations
+ */
+void wake_timing_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WAKE_TIMING_H
@@ -0,0 +1,206 @@
+#include "captive_dns.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "lwip/sockets.h"
+#include <string.h>
+
+static const char *TAG = "CAPTIVE_DNS";
+
+#define DNS_PORT 53
+#define DNS_HEADER_LEN 12
+#define DNS_ANSWER_LEN 16
+#define DNS_MAX_PACKET 512
+#define DNS_TTL_S 60
+#define DNS_POLL_MS 500  // Receive timeout, bounds the stop latency
+#define DNS_TASK_PRIORITY 4
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_OPCODE 0x7800
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_RD 0x0100
+#define DNS_RCODE_NOTIMP 4
+#define DNS_TYPE_A 1
+#define DNS_CLASS_IN 1
+
+static volatile bool dns_running = false;
+static TaskHandle_t dns_task_handle = NULL;
+// Given by the task once it is done with its stack, it then waits to be deleted
+static SemaphoreHandle_t dns_done = NULL;
+static StaticSemaphore_t dns_done_buffer;
+static uint32_t dns_min_free_stack = 0;
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+static StaticTask_t dns_task_buffer;
+static StackType_t dns_task_stack[CAPTIVE_DNS_TASK_STACK];
+#endif
+static esp_ip4_addr_t answer_ip;
+
+// Single task, so the packet buffer does not need to live on its stack
+static uint8_t packet[DNS_MAX_PACKET];
+
+static inline uint16_t get_u16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+static inline void put_u16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+// Turn the query in packet into a response, returns its length or 0 to drop it
+static size_t build_response(size_t len)
+{
+    if (len < DNS_HEADER_LEN) {
+        return 0;
+    }
+    
+    uint16_t flags = get_u16(&packet[2]);
+    uint16_t qdcount = get_u16(&packet[4]);
+    if ((flags & DNS_FLAG_QR) || qdcount != 1) {
+        return 0;
+    }
+    
+    // Walk the question name (labels only, no compression in queries)
+    size_t pos = DNS_HEADER_LEN;
+    while (pos < len && packet[pos] != 0) {
+        if (packet[pos] & 0xC0) {
+            return 0;
+        }
+        pos += packet[pos] + 1;
+    }
+    pos += 1 + 4; // terminator, QTYPE, QCLASS
+    if (pos > len) {
+        return 0;
+    }
+    
+    uint16_t qtype = get_u16(&packet[pos - 4]);
+    uint16_t qclass = get_u16(&packet[pos - 2]);
+    bool is_query = (flags & DNS_FLAG_OPCODE) == 0;
+    bool answer = is_query && qtype == DNS_TYPE_A && qclass == DNS_CLASS_IN;
+    
+    // Header: response, authoritative, keep RD; drop authority/additional (e.g. EDNS)
+    put_u16(&packet[2], DNS_FLAG_QR | DNS_FLAG_AA | (flags & (DNS_FLAG_OPCODE | DNS_FLAG_RD)) |
+                        (is_query ? 0 : DNS_RCODE_NOTIMP));
+    put_u16(&packet[6], answer ? 1 : 0);
+    put_u16(&packet[8], 0);
+    put_u16(&packet[10], 0);
+    
+    if (!answer) {
+        return pos;
+    }
+    if (pos + DNS_ANSWER_LEN > sizeof(packet)) {
+        return 0;
+    }
+    
+    uint8_t* a = &packet[pos];
+    put_u16(&a[0], 0xC000 | DNS_HEADER_LEN); // Name: pointer to the question
+    put_u16(&a[2], DNS_TYPE_A);
+    put_u16(&a[4], DNS_CLASS_IN);
+    put_u16(&a[6], 0);
+    put_u16(&a[8], DNS_TTL_S);
+    put_u16(&a[10], 4);
+    memcpy(&a[12], &answer_ip.addr, 4);     // Already in network byte order
+    
+    return pos + DNS_ANSWER_LEN;
+}
+
+static void dns_task(void* param)
+{
+    int sock = (int)(intptr_t)param;
+    
+    while (dns_running) {
+        struct sockaddr_in client;
+        socklen_t client_len = sizeof(client);
+        int len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr*)&client, &client_len);
+        if (len < 0) {
+            continue; // Receive timeout, re-check dns_running
+        }
+        
+        size_t out_len = build_response(len);
+        if (out_len) {
+            sendto(sock, packet, out_len, 0, (struct sockaddr*)&client, client_len);
+        }
+    }
+    
+    close(sock);
+    ESP_LOGI(TAG, "DNS responder stopped");
+    
+    uint32_t free_stack = uxTaskGetStackHighWaterMark(NULL);
+    if (!dns_min_free_stack || free_stack < dns_min_free_stack) {
+        dns_min_free_stack = free_stack;
+    }
+    
+    // Deleting itself would leave the stack and TCB to the idle task for a
+    // while; captive_dns_stop() deletes it instead, so a restart can reuse them
+    xSemaphoreGive(dns_done);
+    vTaskSuspend(NULL);
+}
+
+esp_err_t captive_dns_start(esp_ip4_addr_t ip)
+{
+    if (dns_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!dns_done) {
+        dns_done = xSemaphoreCreateBinaryStatic(&dns_done_buffer);
+    }
+    
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket: %d", errno);
+        return ESP_FAIL;
+    }
+    
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DNS_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "Failed to bind port %d: %d", DNS_PORT, errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+    
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = DNS_POLL_MS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    answer_ip = ip;
+    dns_running = true;
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+    dns_task_handle = xTaskCreateStatic(dns_task, "captive_dns", CAPTIVE_DNS_TASK_STACK, (void*)(intptr_t)sock,
+                                        DNS_TASK_PRIORITY, dns_task_stack, &dns_task_buffer);
+#else
+    if (xTaskCreate(dns_task, "captive_dns", CAPTIVE_DNS_TASK_STACK, (void*)(intptr_t)sock,
+                    DNS_TASK_PRIORITY, &dns_task_handle) != pdPASS) {
+        dns_task_handle = NULL;
+    }
+#endif
+    if (!dns_task_handle) {
+        dns_running = false;
+        close(sock);
+        return ESP_ERR_NO_MEM;
+    }
+    
+    ESP_LOGI(TAG, "DNS responder running, all names resolve to " IPSTR, IP2STR(&ip));
+    return ESP_OK;
+}
+
+void captive_dns_stop(void)
+{
+    if (!dns_task_handle) {
+        return;
+    }
+    
+    // The task notices within DNS_POLL_MS and closes the socket
+    dns_running = false;
+    xSemaphoreTake(dns_done, portMAX_DELAY);
+    // Deleted while still running on the other core, the TCB would again wait
+    // for the idle task
+    while (eTaskGetState(dns_task_handle) != eSuspended) {
+        vTaskDelay(1);
+    }
+    vTaskDelete(dns_task_handle);
+    dns_task_handle = NULL;
+}
+
+uint32_t captive_dns_min_free_stack(void)
+{
+    return dns_min_free_stack;
+}
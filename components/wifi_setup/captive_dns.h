@@ -0,0 +1,46 @@
+#ifndef CAPTIVE_DNS_H
+#define CAPTIVE_DNS_H
+
+#include "esp_err.h"
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTIVE_DNS_TASK_STACK 3072
+
+/**
+ * @brief Start the captive-portal DNS responder
+ *
+ * A small UDP task on port 53 answers every A query with the given
+ * address, so every hostname resolves to the setup portal and the OS
+ * connectivity check lands on the portal's HTTP server.
+ *
+ * @param ip Address returned for every query (the soft-AP address)
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if already running
+ */
+esp_err_t captive_dns_start(esp_ip4_addr_t ip);
+
+/**
+ * @brief Stop the captive-portal DNS responder
+ *
+ * Waits until the task has closed its socket and is deleted, up to the
+ * 500 ms receive timeout, so captive_dns_start() can follow right away.
+ *
+ * @note Safe to call when not running
+ */
+void captive_dns_stop(void);
+
+/**
+ * @brief Lowest free stack of the responder task since boot
+ *
+ * @return uint32_t Free bytes at the high-watermark, 0 if the task has not ended yet
+ */
+uint32_t captive_dns_min_free_stack(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAPTIVE_DNS_H
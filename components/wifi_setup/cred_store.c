@@ -0,0 +1,262 @@
+#include "cred_store.h"
+#include "rtc_copy.h"
+#include "wake_timing.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "CRED_STORE";
+
+// Single-network keys of older firmware, migrated on first load
+static const char *NVS_LEGACY_SSID_KEY = "ssid";
+static const char *NVS_LEGACY_PASSWORD_KEY = "password";
+
+#define CRED_STORE_VERSION 1
+#define WARM_MAGIC 0x57435331  // "WCS1"
+
+typedef struct {
+    uint16_t version;
+    uint16_t count;
+    uint32_t success_seq;
+    cred_store_entry_t entries[WIFI_SETUP_MAX_NETWORKS];
+    uint32_t crc;
+} cred_blob_t;
+
+_Static_assert(offsetof(cred_blob_t, crc) + sizeof(uint32_t) == sizeof(cred_blob_t), "CRC must end the blob");
+
+// Decoded network list, survives deep sleep so warm wakes never read flash
+typedef struct {
+    rtc_copy_stamp_t stamp;
+    cred_blob_t blob;
+} cred_warm_t;
+
+static RTC_DATA_ATTR cred_warm_t warm;
+static bool loaded = false;
+static bool nvs_ready = false;
+
+static bool blob_check(const void* data)
+{
+    return ((const cred_blob_t*)data)->count <= WIFI_SETUP_MAX_NETWORKS;
+}
+
+static const rtc_copy_blob_t networks_copy = {
+    .nvs_namespace = "wifi_setup",
+    .key = "networks",
+    .version = CRED_STORE_VERSION,
+    .magic = WARM_MAGIC,
+    .stamp = &warm.stamp,
+    .data = &warm.blob,
+    .size = sizeof(warm.blob),
+    .check = blob_check,
+    .nvs_init = cred_store_nvs_init,
+};
+
+static esp_err_t blob_save(void)
+{
+    return rtc_copy_blob_save(&networks_copy, false);
+}
+
+static void migrate_legacy(nvs_handle_t nvs_handle)
+{
+    cred_store_entry_t* entry = &warm.blob.entries[0];
+    size_t ssid_len = sizeof(entry->ssid);
+    size_t password_len = sizeof(entry->password);
+    
+    if (nvs_get_str(nvs_handle, NVS_LEGACY_SSID_KEY, entry->ssid, &ssid_len) != ESP_OK || ssid_len <= 1) {
+        memset(entry, 0, sizeof(*entry));
+        return;
+    }
+    if (nvs_get_str(nvs_handle, NVS_LEGACY_PASSWORD_KEY, entry->password, &password_len) != ESP_OK) {
+        entry->password[0] = '\0';
+    }
+    warm.blob.count = 1;
+    
+    if (blob_save() == ESP_OK) {
+        nvs_handle_t rw_handle;
+        if (rtc_copy_blob_open(&networks_copy, NVS_READWRITE, &rw_handle) == ESP_OK) {
+            nvs_erase_key(rw_handle, NVS_LEGACY_SSID_KEY);
+            nvs_erase_key(rw_handle, NVS_LEGACY_PASSWORD_KEY);
+            nvs_commit(rw_handle);
+            nvs_close(rw_handle);
+        }
+        ESP_LOGI(TAG, "Migrated stored network '%s'", entry->ssid);
+    }
+}
+
+esp_err_t cred_store_nvs_init(void)
+{
+    if (nvs_ready) {
+        return ESP_OK;
+    }
+    
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(TAG, "NVS partition unusable (%s), erasing", esp_err_to_name(err));
+        warm.stamp.magic = 0;
+        err = nvs_flash_erase();
+        if (err == ESP_OK) {
+            err = nvs_flash_init();
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "NVS init failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    
+    nvs_ready = true;
+    wake_timing_mark("nvs_init");
+    return ESP_OK;
+}
+
+esp_err_t cred_store_load(void)
+{
+    if (loaded) {
+        return ESP_OK;
+    }
+    
+    // Warm wake: the RTC copy is still valid for this firmware
+    if (rtc_copy_blob_warm(&networks_copy)) {
+        loaded = true;
+        return ESP_OK;
+    }
+    
+    memset(&warm, 0, sizeof(warm));
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = rtc_copy_blob_open(&networks_copy, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        if (rtc_copy_blob_read(&networks_copy, nvs_handle) == ESP_ERR_NVS_NOT_FOUND) {
+            migrate_legacy(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+    // A missing namespace means nothing was stored yet
+    
+    rtc_copy_blob_seal(&networks_copy);
+    loaded = true;
+    return ESP_OK;
+}
+
+size_t cred_store_count(void)
+{
+    return warm.blob.count;
+}
+
+const cred_store_entry_t* cred_store_get(size_t index)
+{
+    return (index < warm.blob.count) ? &warm.blob.entries[index] : NULL;
+}
+
+static int find_index(const char* ssid)
+{
+    for (int i = 0; i < warm.blob.count; i++) {
+        if (strncmp(warm.blob.entries[i].ssid, ssid, WIFI_SSID_MAX_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const cred_store_entry_t* cred_store_find(const char* ssid)
+{
+    int index = find_index(ssid);
+    return (index >= 0) ? &warm.blob.entries[index] : NULL;
+}
+
+size_t cred_store_preferred(void)
+{
+    if (warm.blob.count == 0) {
+        return SIZE_MAX;
+    }
+    
+    size_t best = 0;
+    for (size_t i = 1; i < warm.blob.count; i++) {
+        if (warm.blob.entries[i].last_success > warm.blob.entries[best].last_success) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+esp_err_t cred_store_add(const char* ssid, const char* password)
+{
+    int index = find_index(ssid);
+    
+    if (index < 0 && warm.blob.count < WIFI_SETUP_MAX_NETWORKS) {
+        index = warm.blob.count++;
+    } else if (index < 0) {
+        // Full: replace the network that has not worked for the longest time
+        index = 0;
+        for (int i = 1; i < warm.blob.count; i++) {
+            if (warm.blob.entries[i].last_success < warm.blob.entries[index].last_success) {
+                index = i;
+            }
+        }
+        ESP_LOGW(TAG, "Network list full, replacing '%s'", warm.blob.entries[index].ssid);
+    }
+    
+    cred_store_entry_t* entry = &warm.blob.entries[index];
+    if (strncmp(entry->ssid, ssid, WIFI_SSID_MAX_LEN) != 0) {
+        memset(entry, 0, sizeof(*entry));
+        strncpy(entry->ssid, ssid, sizeof(entry->ssid) - 1);
+    }
+    memset(entry->password, 0, sizeof(entry->password));
+    strncpy(entry->password, password, sizeof(entry->password) - 1);
+    
+    return blob_save();
+}
+
+esp_err_t cred_store_remove(const char* ssid)
+{
+    int index = find_index(ssid);
+    if (index < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    memmove(&warm.blob.entries[index], &warm.blob.entries[index + 1],
+            (warm.blob.count - index - 1) * sizeof(warm.blob.entries[0]));
+    warm.blob.count--;
+    memset(&warm.blob.entries[warm.blob.count], 0, sizeof(warm.blob.entries[0]));
+    
+    return blob_save();
+}
+
+esp_err_t cred_store_clear(void)
+{
+    memset(&warm, 0, sizeof(warm));
+    loaded = true;
+    
+    esp_err_t err = rtc_copy_blob_save(&networks_copy, true);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    nvs_handle_t nvs_handle;
+    err = rtc_copy_blob_open(&networks_copy, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        nvs_erase_key(nvs_handle, NVS_LEGACY_SSID_KEY);
+        nvs_erase_key(nvs_handle, NVS_LEGACY_PASSWORD_KEY);
+        err = nvs_commit(nvs_handle);
+        nvs_close(nvs_handle);
+    }
+    return err;
+}
+
+void cred_store_mark_success(const char* ssid)
+{
+    int index = find_index(ssid);
+    if (index < 0) {
+        return;
+    }
+    if ((size_t)index == cred_store_preferred() && warm.blob.entries[index].last_success) {
+        return; // Already ranked first
+    }
+    
+    warm.blob.entries[index].last_success = ++warm.blob.success_seq;
+    blob_save();
+}
@@ -0,0 +1,100 @@
+#ifndef CRED_STORE_H
+#define CRED_STORE_H
+
+#include "esp_err.h"
+#include "wifi_setup.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief One stored network
+ */
+typedef struct {
+    char ssid[WIFI_SSID_MAX_LEN];         ///< Network name (SSID)
+    char password[WIFI_PASSWORD_MAX_LEN]; ///< Network password
+    uint32_t last_success;                ///< Success sequence number of the last connect, 0 = never
+} cred_store_entry_t;
+
+/**
+ * @brief Initialize the NVS flash partition on first use
+ *
+ * Erases and re-initializes a partition that is full or has a newer
+ * layout. Later calls are no-ops.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t cred_store_nvs_init(void);
+
+/**
+ * @brief Load the network list with a single nvs_get_blob()
+ *
+ * The decoded list is kept in RTC memory, validated by its CRC and the
+ * firmware build ID; wakes from deep sleep use it without touching flash.
+ * Migrates the single-network "ssid"/"password" keys of older firmware
+ * into the blob on first use. Later calls are no-ops.
+ *
+ * @return esp_err_t ESP_OK on success (also when no network is stored)
+ */
+esp_err_t cred_store_load(void);
+
+/**
+ * @brief Number of stored networks
+ */
+size_t cred_store_count(void);
+
+/**
+ * @brief Stored network by index (0 .. cred_store_count() - 1), NULL if out of range
+ */
+const cred_store_entry_t* cred_store_get(size_t index);
+
+/**
+ * @brief Stored network by SSID, NULL if unknown
+ */
+const cred_store_entry_t* cred_store_find(const char* ssid);
+
+/**
+ * @brief Index of the network that connected most recently (0 if none ever did)
+ *
+ * @return size_t Index, or SIZE_MAX if no network is stored
+ */
+size_t cred_store_preferred(void);
+
+/**
+ * @brief Add a network or update the password of a known SSID
+ *
+ * When the list is full, the network with the oldest successful connect
+ * is replaced.
+ *
+ * @return esp_err_t ESP_OK on success, NVS error code otherwise
+ */
+esp_err_t cred_store_add(const char* ssid, const char* password);
+
+/**
+ * @brief Remove a network, the others are kept
+ *
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if unknown, NVS error code otherwise
+ */
+esp_err_t cred_store_remove(const char* ssid);
+
+/**
+ * @brief Remove all networks
+ */
+esp_err_t cred_store_clear(void);
+
+/**
+ * @brief Record a successful connect for ranking
+ *
+ * Only written to flash when the most recently successful network changes,
+ * so reconnecting to the same network does not wear the flash.
+ */
+void cred_store_mark_success(const char* ssid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CRED_STORE_H
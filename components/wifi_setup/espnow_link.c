@@ -0,0 +1,303 @@
+#include "espnow_link.h"
+#include "cred_store.h"
+#include "rtc_copy.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "mbedtls/md.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "ESPNOW_LINK";
+static const char *NVS_SEQ_KEY = "gw_seq";
+
+#define GATEWAY_VERSION 1
+#define WARM_MAGIC 0x4C4E4531       // "ENL1"
+#define SEQ_RESERVE 64              // Sequence numbers per NVS write
+
+#define ESPNOW_LINK_ATTEMPTS 3
+#define ESPNOW_LINK_ACK_MS 30       // Gateway answers within a few ms on a quiet channel
+
+#define LINK_ACK_BIT BIT0
+#define LINK_SEND_FAIL_BIT BIT1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t kind;
+    uint8_t type;
+    uint8_t length;
+    uint8_t reserved;
+    uint32_t seq;
+    uint8_t device[6];
+} link_header_t;
+
+typedef struct __attribute__((packed)) {
+    link_header_t header;
+    uint8_t body[WIFI_SETUP_REPORT_MAX_PAYLOAD + ESPNOW_LINK_TAG_LEN]; // payload, tag right after it
+} link_report_t;
+
+typedef struct __attribute__((packed)) {
+    link_header_t header;
+    uint8_t tag[ESPNOW_LINK_TAG_LEN];
+} link_ack_t;
+
+typedef struct {
+    uint16_t version;
+    uint16_t paired;
+    wifi_setup_gateway_t gateway;
+    uint32_t crc;
+} gateway_blob_t;
+
+_Static_assert(offsetof(gateway_blob_t, crc) + sizeof(uint32_t) == sizeof(gateway_blob_t), "CRC must end the blob");
+
+// Gateway and sequence survive deep sleep; seq below seq_reserved is covered by NVS
+typedef struct {
+    rtc_copy_stamp_t stamp;
+    gateway_blob_t blob;
+    uint32_t seq;
+    uint32_t seq_reserved;
+} link_warm_t;
+
+static RTC_DATA_ATTR link_warm_t warm;
+static bool loaded = false;
+
+// Shared with the WiFi task callbacks while a report is pending
+static EventGroupHandle_t link_events = NULL;
+static StaticEventGroup_t link_events_buffer;
+static volatile uint32_t pending_seq;
+static uint8_t device_mac[6];
+
+static const rtc_copy_blob_t gateway_copy = {
+    .nvs_namespace = "wifi_setup",
+    .key = "gateway",
+    .version = GATEWAY_VERSION,
+    .magic = WARM_MAGIC,
+    .stamp = &warm.stamp,
+    .data = &warm.blob,
+    .size = sizeof(warm.blob),
+    .nvs_init = cred_store_nvs_init,
+};
+
+esp_err_t espnow_link_load(void)
+{
+    if (loaded) {
+        return ESP_OK;
+    }
+    
+    // Warm wake: the RTC copy is still valid for this firmware
+    if (rtc_copy_blob_warm(&gateway_copy) && warm.seq <= warm.seq_reserved) {
+        loaded = true;
+        return ESP_OK;
+    }
+    
+    memset(&warm, 0, sizeof(warm));
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = rtc_copy_blob_open(&gateway_copy, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        rtc_copy_blob_read(&gateway_copy, nvs_handle);
+    
+        // Continue after everything the last cold boot may have used
+        nvs_get_u32(nvs_handle, NVS_SEQ_KEY, &warm.seq_reserved);
+        nvs_close(nvs_handle);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+    warm.seq = warm.seq_reserved;
+    
+    rtc_copy_blob_seal(&gateway_copy);
+    loaded = true;
+    return ESP_OK;
+}
+
+const wifi_setup_gateway_t* espnow_link_gateway(void)
+{
+    return warm.blob.paired ? &warm.blob.gateway : NULL;
+}
+
+esp_err_t espnow_link_pair(const wifi_setup_gateway_t* gateway)
+{
+    esp_err_t err = espnow_link_load();
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    warm.blob.paired = 1;
+    warm.blob.gateway = *gateway;
+    return rtc_copy_blob_save(&gateway_copy, false);
+}
+
+esp_err_t espnow_link_unpair(void)
+{
+    esp_err_t err = espnow_link_load();
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    memset(&warm.blob, 0, sizeof(warm.blob));
+    return rtc_copy_blob_save(&gateway_copy, true);
+}
+
+// One NVS write per SEQ_RESERVE reports, so a reset never reuses a sequence number
+static esp_err_t seq_reserve(void)
+{
+    if (warm.seq < warm.seq_reserved) {
+        return ESP_OK;
+    }
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = rtc_copy_blob_open(&gateway_copy, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t reserved = warm.seq + SEQ_RESERVE;
+    err = nvs_set_u32(nvs_handle, NVS_SEQ_KEY, reserved);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    if (err == ESP_OK) {
+        warm.seq_reserved = reserved;
+    }
+    return err;
+}
+
+static void sign(const void* data, size_t len, uint8_t tag[ESPNOW_LINK_TAG_LEN])
+{
+    uint8_t mac[32];
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), warm.blob.gateway.key,
+                    sizeof(warm.blob.gateway.key), data, len, mac);
+    memcpy(tag, mac, ESPNOW_LINK_TAG_LEN);
+}
+
+// WiFi task: only a MAC-level failure, success is decided by the ACK
+static void send_cb(const esp_now_send_info_t* tx_info, esp_now_send_status_t status)
+{
+    if (status != ESP_NOW_SEND_SUCCESS) {
+        xEventGroupSetBits(link_events, LINK_SEND_FAIL_BIT);
+    }
+}
+
+// WiFi task: accept only a correctly signed ACK of the pending report
+static void recv_cb(const esp_now_recv_info_t* info, const uint8_t* data, int len)
+{
+    if (len != sizeof(link_ack_t) || memcmp(info->src_addr, warm.blob.gateway.mac, 6) != 0) {
+        return;
+    }
+    
+    link_ack_t ack;
+    memcpy(&ack, data, sizeof(ack));
+    if (ack.header.magic != ESPNOW_LINK_MAGIC || ack.header.kind != ESPNOW_LINK_KIND_ACK ||
+        ack.header.seq != pending_seq || memcmp(ack.header.device, device_mac, 6) != 0) {
+        return;
+    }
+    
+    uint8_t tag[ESPNOW_LINK_TAG_LEN];
+    uint8_t diff = 0;
+    sign(&ack, offsetof(link_ack_t, tag), tag);
+    for (int i = 0; i < ESPNOW_LINK_TAG_LEN; i++) {
+        diff |= tag[i] ^ ack.tag[i];
+    }
+    if (diff == 0) {
+        xEventGroupSetBits(link_events, LINK_ACK_BIT);
+    }
+}
+
+esp_err_t espnow_link_send(uint8_t type, const void* payload, size_t len)
+{
+    if (len > WIFI_SETUP_REPORT_MAX_PAYLOAD || (len > 0 && !payload)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = espnow_link_load();
+    if (err != ESP_OK) {
+        return err;
+    }
+    const wifi_setup_gateway_t* gateway = espnow_link_gateway();
+    if (!gateway) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = seq_reserve();
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!link_events) {
+        link_events = xEventGroupCreateStatic(&link_events_buffer);
+    }
+    
+    // Spent even without ACK: the gateway may have seen it
+    link_report_t frame = {
+        .header = {
+            .magic = ESPNOW_LINK_MAGIC,
+            .kind = ESPNOW_LINK_KIND_REPORT,
+            .type = type,
+            .length = len,
+            .seq = warm.seq++,
+        },
+    };
+    esp_read_mac(device_mac, ESP_MAC_WIFI_STA);
+    memcpy(frame.header.device, device_mac, sizeof(device_mac));
+    if (len > 0) {
+        memcpy(frame.body, payload, len);
+    }
+    size_t frame_len = sizeof(link_header_t) + len;
+    sign(&frame, frame_len, &frame.body[len]);
+    frame_len += ESPNOW_LINK_TAG_LEN;
+    pending_seq = frame.header.seq;
+    
+    esp_now_peer_info_t peer = {
+        .channel = gateway->channel,
+        .ifidx = WIFI_IF_STA,
+        .encrypt = false,
+    };
+    memcpy(peer.peer_addr, gateway->mac, sizeof(peer.peer_addr));
+    
+    err = esp_wifi_set_channel(gateway->channel, WIFI_SECOND_CHAN_NONE);
+    if (err == ESP_OK) {
+        err = esp_now_init();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "ESP-NOW start failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    esp_now_register_send_cb(send_cb);
+    esp_now_register_recv_cb(recv_cb);
+    err = esp_now_add_peer(&peer);
+    
+    int64_t start_us = esp_timer_get_time();
+    int attempts = 0;
+    if (err == ESP_OK) {
+        err = ESP_ERR_TIMEOUT;
+        while (attempts < ESPNOW_LINK_ATTEMPTS) {
+            attempts++;
+            xEventGroupClearBits(link_events, LINK_ACK_BIT | LINK_SEND_FAIL_BIT);
+            if (esp_now_send(gateway->mac, (const uint8_t*)&frame, frame_len) != ESP_OK) {
+                continue;
+            }
+    
+            // A missing MAC-level ACK retries right away instead of waiting out the window
+            EventBits_t bits = xEventGroupWaitBits(link_events, LINK_ACK_BIT | LINK_SEND_FAIL_BIT,
+                                                   pdTRUE, pdFALSE, pdMS_TO_TICKS(ESPNOW_LINK_ACK_MS));
+            if (bits & LINK_ACK_BIT) {
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    esp_now_deinit();
+    
+    uint32_t elapsed_us = esp_timer_get_time() - start_us;
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Report %lu (type %u) acknowledged: %d attempts, %lu us",
+                 frame.header.seq, type, attempts, elapsed_us);
+    } else {
+        ESP_LOGW(TAG, "Report %lu (type %u) not acknowledged after %d attempts: %s",
+                 frame.header.seq, type, attempts, esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,76 @@
+#ifndef ESPNOW_LINK_H
+#define ESPNOW_LINK_H
+
+#include "esp_err.h"
+#include "wifi_setup.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Frames, little endian, first 8 bytes of HMAC-SHA256(key, frame before
+ * the tag) as tag:
+ *   report: magic "ENR1", kind 1, type, length, 0, seq, device MAC, payload, tag
+ *   ack:    magic "ENR1", kind 2, type, 0, 0, seq, device MAC, tag
+ * seq grows across deep sleep and resets, the gateway drops anything not
+ * newer than the last report of the device and ACKs repeats again.
+ */
+#define ESPNOW_LINK_MAGIC 0x31524E45    // "ENR1"
+#define ESPNOW_LINK_KIND_REPORT 1
+#define ESPNOW_LINK_KIND_ACK 2
+#define ESPNOW_LINK_TAG_LEN 8
+
+/**
+ * @brief Load the paired gateway with a single nvs_get_blob()
+ *
+ * Kept in RTC memory, validated by CRC; wakes from deep sleep use it
+ * without touching flash. Later calls are no-ops.
+ *
+ * @return esp_err_t ESP_OK on success (also when no gateway is paired)
+ */
+esp_err_t espnow_link_load(void);
+
+/**
+ * @brief Paired gateway, NULL if none
+ */
+const wifi_setup_gateway_t* espnow_link_gateway(void);
+
+/**
+ * @brief Store a gateway, replacing the previous one
+ *
+ * @return esp_err_t ESP_OK on success, NVS error code otherwise
+ */
+esp_err_t espnow_link_pair(const wifi_setup_gateway_t* gateway);
+
+/**
+ * @brief Forget the gateway
+ */
+esp_err_t espnow_link_unpair(void);
+
+/**
+ * @brief Send one signed report and wait for the gateway's ACK
+ *
+ * Tunes the started station to the gateway channel, then sends the frame
+ * up to ESPNOW_LINK_ATTEMPTS times, each waiting ESPNOW_LINK_ACK_MS for
+ * the ACK. ESP-NOW is deinitialized again before returning.
+ *
+ * @param type Event type, same numbering as the event queue
+ * @param payload Payload bytes
+ * @param len Payload length, at most WIFI_SETUP_REPORT_MAX_PAYLOAD
+ * @return esp_err_t ESP_OK once acknowledged
+ *                   ESP_ERR_TIMEOUT if no valid ACK arrived
+ *                   ESP_ERR_NOT_FOUND if no gateway is paired
+ *                   Other ESP error codes for driver or NVS failures
+ *
+ * @note The WiFi driver must be started in station mode and not associated
+ */
+esp_err_t espnow_link_send(uint8_t type, const void* payload, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ESPNOW_LINK_H
@@ -0,0 +1,150 @@
+#include "form_parser.h"
+#include <string.h>
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Key complete: look up the destination for the following value
+static void select_field(form_parser_t* parser)
+{
+    parser->key[parser->key_len] = '\0';
+    parser->current = NULL;
+    parser->value_len = 0;
+    
+    if (parser->key_overflow) {
+        return;
+    }
+    
+    for (size_t i = 0; i < parser->field_count; i++) {
+        form_field_t* field = &parser->fields[i];
+        if (strcmp(field->key, parser->key) == 0) {
+            parser->current = field;
+            field->found = true;
+            field->truncated = false;
+            if (field->size) {
+                field->dest[0] = '\0';
+            }
+            return;
+        }
+    }
+}
+
+// Pair complete: reset for the next key
+static void next_pair(form_parser_t* parser)
+{
+    if (!parser->in_value) {
+        // Key without '=', treat as empty value
+        select_field(parser);
+    }
+    
+    parser->current = NULL;
+    parser->key_len = 0;
+    parser->key_overflow = false;
+    parser->in_value = false;
+}
+
+// One decoded byte of key or value
+static void emit(form_parser_t* parser, char c)
+{
+    if (!parser->in_value) {
+        if (parser->key_len < FORM_PARSER_MAX_KEY_LEN) {
+            parser->key[parser->key_len++] = c;
+        } else {
+            parser->key_overflow = true;
+        }
+        return;
+    }
+    
+    form_field_t* field = parser->current;
+    if (!field) {
+        return;
+    }
+    
+    if (parser->value_len + 1 < field->size) {
+        field->dest[parser->value_len++] = c;
+        field->dest[parser->value_len] = '\0';
+    } else {
+        field->truncated = true;
+    }
+}
+
+void form_parser_init(form_parser_t* parser, form_field_t* fields, size_t field_count)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->fields = fields;
+    parser->field_count = field_count;
+    
+    for (size_t i = 0; i < field_count; i++) {
+        fields[i].found = false;
+        fields[i].truncated = false;
+        if (fields[i].size) {
+            fields[i].dest[0] = '\0';
+        }
+    }
+}
+
+esp_err_t form_parser_feed(form_parser_t* parser, const char* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        
+        if (parser->pct_digits) {
+            int value = hex_value(c);
+            if (value < 0) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            parser->pct_value = (parser->pct_value << 4) | value;
+            if (++parser->pct_digits == 3) {
+                parser->pct_digits = 0;
+                if (parser->pct_value == 0) {
+                    return ESP_ERR_INVALID_ARG;
+                }
+                emit(parser, (char)parser->pct_value);
+            }
+            continue;
+        }
+        
+        switch (c) {
+            case '&':
+                next_pair(parser);
+                break;
+            case '=':
+                if (!parser->in_value) {
+                    select_field(parser);
+                    parser->in_value = true;
+                } else {
+                    emit(parser, c);
+                }
+                break;
+            case '+':
+                emit(parser, ' ');
+                break;
+            case '%':
+                parser->pct_digits = 1;
+                parser->pct_value = 0;
+                break;
+            default:
+                emit(parser, c);
+                break;
+        }
+    }
+    
+    return ESP_OK;
+}
+
+esp_err_t form_parser_finish(form_parser_t* parser)
+{
+    if (parser->pct_digits) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    if (parser->in_value || parser->key_len) {
+        next_pair(parser);
+    }
+    return ESP_OK;
+}
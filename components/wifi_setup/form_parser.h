@@ -0,0 +1,83 @@
+#ifndef FORM_PARSER_H
+#define FORM_PARSER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FORM_PARSER_MAX_KEY_LEN 31
+
+/**
+ * @brief Destination for one form field
+ *
+ * The value is URL-decoded straight into dest and always NUL-terminated.
+ */
+typedef struct {
+    const char* key;    ///< Field name to match (exact, case-sensitive)
+    char* dest;         ///< Destination buffer
+    size_t size;        ///< Size of dest in bytes, including the terminator
+    bool found;         ///< Set once the field was seen in the body
+    bool truncated;     ///< Set if the value did not fit into dest
+} form_field_t;
+
+/**
+ * @brief Incremental application/x-www-form-urlencoded parser state
+ *
+ * Lives on the caller's stack; no heap is used. All members are internal.
+ */
+typedef struct {
+    form_field_t* fields;
+    size_t field_count;
+    form_field_t* current;                  ///< Field receiving the current value, NULL = skip
+    size_t value_len;
+    char key[FORM_PARSER_MAX_KEY_LEN + 1];
+    size_t key_len;
+    bool key_overflow;
+    bool in_value;
+    uint8_t pct_digits;                     ///< Hex digits collected after '%' (0-2)
+    uint8_t pct_value;
+} form_parser_t;
+
+/**
+ * @brief Initialize a parser for one request body
+ *
+ * Clears dest, found and truncated of every field.
+ *
+ * @param parser Parser state
+ * @param fields Fields to extract; unknown keys in the body are skipped
+ * @param field_count Number of entries in fields
+ */
+void form_parser_init(form_parser_t* parser, form_field_t* fields, size_t field_count);
+
+/**
+ * @brief Feed the next chunk of the body
+ *
+ * Chunks may split keys, values and %XX escapes at any byte. '+' decodes
+ * to a space. A repeated key overwrites the earlier value.
+ *
+ * @param parser Parser state
+ * @param data Chunk data
+ * @param len Chunk length in bytes
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_INVALID_ARG on a malformed escape or an encoded NUL byte
+ */
+esp_err_t form_parser_feed(form_parser_t* parser, const char* data, size_t len);
+
+/**
+ * @brief Finish parsing after the last chunk
+ *
+ * @param parser Parser state
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if the body ends inside an escape
+ */
+esp_err_t form_parser_finish(form_parser_t* parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FORM_PARSER_H
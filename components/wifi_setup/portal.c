@@ -0,0 +1,176 @@
+#include "portal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char setup_html_head[] =
+"<!DOCTYPE html>"
+"<html><head>"
+"<title>ESP32 WiFi Setup</title>"
+"<meta name='viewport' content='width=device-width,initial-scale=1'>"
+"<link rel='stylesheet' href='" PORTAL_CSS_URI "'>"
+"</head><body>"
+"<div class='container'>"
+"<h1>📶 WiFi Setup</h1>"
+"<div class='info'>Connect ESP32 to your WiFi network. Password required: <strong>";
+// setup password
+static const char setup_html_form[] =
+"</strong></div>"
+"<form action='/save' method='post'>"
+"<input type='password' name='setup_pwd' placeholder='Setup Password' required maxlength='8'>"
+"<input type='text' name='ssid' placeholder='WiFi Network Name (add or update)' maxlength='31'>"
+"<input type='password' name='password' placeholder='WiFi Password' maxlength='63'>";
+static const char setup_html_gateway_head[] =
+"<div class='info'>Optional: pair an ESP-NOW gateway for instant reports. This device: <strong>";
+// device MAC
+static const char setup_html_gateway[] =
+"</strong></div>"
+"<input type='text' name='gw_mac' placeholder='Gateway MAC (aa:bb:cc:dd:ee:ff)' maxlength='17'>"
+"<input type='number' name='gw_channel' placeholder='Gateway channel (1-13)' min='1' max='13'>"
+"<input type='password' name='gw_key' placeholder='Gateway key (32 hex digits)' maxlength='32'>";
+// saved networks (only if any)
+static const char setup_html_networks_head[] =
+"<select name='remove'><option value=''>Keep all saved networks</option>";
+static const char setup_html_networks_tail[] =
+"</select>";
+static const char setup_html_csrf[] =
+"<input type='hidden' name='csrf' value='";
+// CSRF token
+static const char setup_html_tail[] =
+"'>"
+"<button type='submit'>Save & Connect</button>"
+"</form>"
+"</div></body></html>";
+
+#define WRITE_FRAGMENT(fragment) write(ctx, fragment, sizeof(fragment) - 1)
+
+// SSIDs are user data: escape them before putting them into the page
+static esp_err_t write_html_escaped(portal_write_t write, void* ctx, const char* str)
+{
+    char buf[64];
+    size_t len = 0;
+    esp_err_t err = ESP_OK;
+    
+    for (; *str && err == ESP_OK; str++) {
+        const char* entity = NULL;
+        switch (*str) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '\'': entity = "&#39;"; break;
+            case '"': entity = "&quot;"; break;
+        }
+        
+        size_t add = entity ? strlen(entity) : 1;
+        if (len + add > sizeof(buf)) {
+            err = write(ctx, buf, len);
+            len = 0;
+        }
+        if (entity) {
+            memcpy(&buf[len], entity, add);
+        } else {
+            buf[len] = *str;
+        }
+        len += add;
+    }
+    
+    if (err == ESP_OK && len) {
+        err = write(ctx, buf, len);
+    }
+    return err;
+}
+
+esp_err_t portal_render_setup(const portal_setup_page_t* page, portal_write_t write, void* ctx)
+{
+    char csrf_hex[9];
+    snprintf(csrf_hex, sizeof(csrf_hex), "%08lx", (unsigned long)page->csrf_token);
+    
+    esp_err_t err = WRITE_FRAGMENT(setup_html_head);
+    if (err == ESP_OK) err = write(ctx, page->setup_password, strlen(page->setup_password));
+    if (err == ESP_OK) err = WRITE_FRAGMENT(setup_html_form);
+    if (err == ESP_OK) err = WRITE_FRAGMENT(setup_html_gateway_head);
+    if (err == ESP_OK) err = write(ctx, page->device_mac, strlen(page->device_mac));
+    if (err == ESP_OK) err = WRITE_FRAGMENT(setup_html_gateway);
+    if (err == ESP_OK && page->ssid_count > 0) {
+        err = WRITE_FRAGMENT(setup_html_networks_head);
+        for (size_t i = 0; i < page->ssid_count && err == ESP_OK; i++) {
+            err = write(ctx, "<option value='", strlen("<option value='"));
+            if (err == ESP_OK) err = write_html_escaped(write, ctx, page->ssids[i]);
+            if (err == ESP_OK) err = write(ctx, "'>Remove ", strlen("'>Remove "));
+            if (err == ESP_OK) err = write_html_escaped(write, ctx, page->ssids[i]);
+            if (err == ESP_OK) err = write(ctx, "</option>", strlen("</option>"));
+        }
+        if (err == ESP_OK) err = WRITE_FRAGMENT(setup_html_networks_tail);
+    }
+    if (err == ESP_OK) err = WRITE_FRAGMENT(setup_html_csrf);
+    if (err == ESP_OK) err = write(ctx, csrf_hex, sizeof(csrf_hex) - 1);
+    if (err == ESP_OK) err = WRITE_FRAGMENT(setup_html_tail);
+    
+    return err;
+}
+
+void portal_save_form_init(portal_save_form_t* form)
+{
+    const form_field_t fields[PORTAL_FIELD_COUNT] = {
+        [PORTAL_FIELD_SETUP_PWD] = {.key = "setup_pwd", .dest = form->setup_pwd, .size = sizeof(form->setup_pwd)},
+        [PORTAL_FIELD_CSRF] = {.key = "csrf", .dest = form->csrf, .size = sizeof(form->csrf)},
+        [PORTAL_FIELD_SSID] = {.key = "ssid", .dest = form->creds.ssid, .size = sizeof(form->creds.ssid)},
+        [PORTAL_FIELD_PASSWORD] = {.key = "password", .dest = form->creds.password, .size = sizeof(form->creds.password)},
+        [PORTAL_FIELD_REMOVE] = {.key = "remove", .dest = form->remove_ssid, .size = sizeof(form->remove_ssid)},
+        [PORTAL_FIELD_GW_MAC] = {.key = "gw_mac", .dest = form->gw_mac, .size = sizeof(form->gw_mac)},
+        [PORTAL_FIELD_GW_CHANNEL] = {.key = "gw_channel", .dest = form->gw_channel, .size = sizeof(form->gw_channel)},
+        [PORTAL_FIELD_GW_KEY] = {.key = "gw_key", .dest = form->gw_key, .size = sizeof(form->gw_key)},
+    };
+    
+    memcpy(form->fields, fields, sizeof(fields));
+    form_parser_init(&form->parser, form->fields, PORTAL_FIELD_COUNT);
+}
+
+bool portal_save_form_truncated(const portal_save_form_t* form)
+{
+    for (size_t i = 0; i < PORTAL_FIELD_COUNT; i++) {
+        if (form->fields[i].truncated) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_hex(const char* str, uint8_t* out, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        char byte[3] = { str[2 * i], str[2 * i] ? str[2 * i + 1] : '\0', '\0' };
+        char* end;
+        out[i] = strtoul(byte, &end, 16);
+        if (end != &byte[2]) {
+            return false;
+        }
+    }
+    return str[2 * len] == '\0';
+}
+
+bool portal_parse_gateway(const portal_save_form_t* form, wifi_setup_gateway_t* gateway)
+{
+    const char* mac = form->gw_mac;
+    char digits[13];
+    size_t n = 0;
+    for (size_t i = 0; mac[i]; i++) {
+        if (i % 3 == 2) {
+            if (mac[i] != ':' && mac[i] != '-') {
+                return false;
+            }
+        } else if (n < sizeof(digits) - 1) {
+            digits[n++] = mac[i];
+        } else {
+            return false;
+        }
+    }
+    digits[n] = '\0';
+    
+    char* end;
+    unsigned long ch = strtoul(form->gw_channel, &end, 10);
+    gateway->channel = ch;
+    return strlen(mac) == 17 && parse_hex(digits, gateway->mac, sizeof(gateway->mac)) &&
+           end != form->gw_channel && *end == '\0' && ch >= 1 && ch <= 13 &&
+           parse_hex(form->gw_key, gateway->key, sizeof(gateway->key));
+}
@@ -0,0 +1,110 @@
+#ifndef PORTAL_H
+#define PORTAL_H
+
+#include "esp_err.h"
+#include "form_parser.h"
+#include "wifi_setup.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Setup portal page and form, without HTTP server or WiFi so the same code
+ * runs in the host tests (host_test/).
+ */
+
+#define PORTAL_CSS_URI "/s.css"
+
+/**
+ * @brief Sink for rendered page bytes, e.g. httpd_resp_send_chunk()
+ *
+ * @return esp_err_t ESP_OK to continue, anything else stops rendering
+ */
+typedef esp_err_t (*portal_write_t)(void* ctx, const char* data, size_t len);
+
+/**
+ * @brief Dynamic values of the setup page
+ */
+typedef struct {
+    const char* setup_password;     ///< Shown on the page, required to submit
+    const char* device_mac;         ///< STA MAC as "aa:bb:cc:dd:ee:ff", entered on the gateway
+    uint32_t csrf_token;            ///< Echoed back by the form
+    const char* const* ssids;       ///< Saved networks, offered for removal
+    size_t ssid_count;
+} portal_setup_page_t;
+
+/**
+ * @brief Fields of the form posted to /save
+ */
+enum {
+    PORTAL_FIELD_SETUP_PWD,
+    PORTAL_FIELD_CSRF,
+    PORTAL_FIELD_SSID,
+    PORTAL_FIELD_PASSWORD,
+    PORTAL_FIELD_REMOVE,
+    PORTAL_FIELD_GW_MAC,
+    PORTAL_FIELD_GW_CHANNEL,
+    PORTAL_FIELD_GW_KEY,
+    PORTAL_FIELD_COUNT
+};
+
+/**
+ * @brief Destination buffers and parser for one /save request
+ *
+ * Fits on the handler task stack; fields[] points into the struct itself.
+ */
+typedef struct {
+    char setup_pwd[16];
+    char csrf[16];
+    wifi_credentials_t creds;
+    char remove_ssid[WIFI_SSID_MAX_LEN];
+    char gw_mac[18];
+    char gw_channel[4];
+    char gw_key[2 * WIFI_SETUP_GATEWAY_KEY_LEN + 1];
+    form_field_t fields[PORTAL_FIELD_COUNT];
+    form_parser_t parser;
+} portal_save_form_t;
+
+/**
+ * @brief Render the setup page in flash-resident fragments around the dynamic values
+ *
+ * SSIDs are HTML-escaped, everything else is inserted as is.
+ *
+ * @param page Dynamic values
+ * @param write Sink, called once per fragment
+ * @param ctx Passed to write
+ * @return esp_err_t ESP_OK on success, otherwise the first error of write
+ */
+esp_err_t portal_render_setup(const portal_setup_page_t* page, portal_write_t write, void* ctx);
+
+/**
+ * @brief Prepare a form for one request body
+ *
+ * Feed the body with form_parser_feed(&form->parser, ...) and
+ * form_parser_finish(&form->parser).
+ */
+void portal_save_form_init(portal_save_form_t* form);
+
+/**
+ * @brief True if any field was longer than its buffer
+ */
+bool portal_save_form_truncated(const portal_save_form_t* form);
+
+/**
+ * @brief Gateway fields of a parsed form: "aa:bb:cc:dd:ee:ff", channel 1-13, 32 hex digits
+ *
+ * @param form Parsed form with gw_mac set
+ * @param gateway Destination
+ * @return true if all three fields are valid
+ */
+bool portal_parse_gateway(const portal_save_form_t* form, wifi_setup_gateway_t* gateway);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PORTAL_H
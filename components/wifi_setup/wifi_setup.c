@@ -1,28 +1,108 @@
 #include "wifi_setup.h"
+#include "form_parser.h"
+#include "portal.h"
+#include "cred_store.h"
+#include "espnow_link.h"
+#include "captive_dns.h"
 #include "pw_generator.h"
+#include "rtc_copy.h"
+#include "wake_timing.h"
+#include "deep_sleep_manager.h"
+#include "power_manager.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
+#include "esp_timer.h"
 #include "esp_http_server.h"
-#include "nvs_flash.h"
-#include "nvs.h"
+#include "sdkconfig.h"
 #include "esp_netif.h"
+#include "esp_mac.h"
 #include "esp_random.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_task.h"
+#include "dhcpserver/dhcpserver.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 
 static const char *TAG = "WIFI_SETUP";
-static const char *NVS_NAMESPACE = "wifi_setup";
-static const char *NVS_SSID_KEY = "ssid";
-static const char *NVS_PASSWORD_KEY = "password";
+
+// Timeout service: one-shot esp_timers, expiry is handled by the worker
+typedef enum {
+    WIFI_TIMEOUT_PORTAL,    // Portal unused for too long
+    WIFI_TIMEOUT_LINGER,    // Auto-disconnect after connect (stay_connected = false)
+    WIFI_TIMEOUT_FAST,      // Fast reconnect budget
+    WIFI_TIMEOUT_BUDGET,    // Overall connect budget across all candidate networks
+    WIFI_TIMEOUT_RETRY,     // Backoff before the next attempt on the same network
+    WIFI_TIMEOUT_HANDOFF,   // Portal response sent, swap the AP for the station
+    WIFI_TIMEOUT_COUNT
+} wifi_timeout_t;
 
 // Event group bits
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
+#define WIFI_PORTAL_DONE_BIT BIT2
+
+// Worker: the only task that runs the state machine, everything else enqueues
+typedef enum {
+    CMD_START_PORTAL,       // wifi_setup_start_portal()
+    CMD_STOP_PORTAL,        // wifi_setup_stop_portal()
+    CMD_CREDENTIALS,        // Portal saved a network
+    CMD_CONNECT,            // wifi_setup_connect_ex()
+    CMD_DISCONNECT,         // wifi_setup_disconnect()
+    CMD_TIMEOUT,            // Timer expiry, from the esp_timer task
+    CMD_WIFI_EVENT,         // WIFI_EVENT, from the default event loop
+    CMD_GOT_IP,             // IP_EVENT_STA_GOT_IP, from the default event loop
+    CMD_REPORT,             // wifi_setup_report()
+} wifi_cmd_type_t;
+
+typedef struct {
+    wifi_cmd_type_t type;
+    int64_t time_us;                // Enqueue time, the attempt metrics use it
+    SemaphoreHandle_t done;         // Given once executed, NULL = fire and forget
+    esp_err_t* result;
+    union {
+        wifi_setup_callback_t portal_callback;
+        struct {
+            wifi_setup_callback_t callback;
+            bool stay_connected;
+            bool has_profile;
+            wifi_setup_connect_profile_t profile;
+        } connect;
+        struct {
+            wifi_timeout_t id;
+            uint32_t generation;
+        } timeout;
+        struct {
+            int32_t id;
+            uint16_t reason;        // STA_DISCONNECTED only
+        } wifi;
+        esp_netif_ip_info_t ip_info;
+        struct {
+            uint8_t type;
+            uint8_t len;
+            uint8_t payload[WIFI_SETUP_REPORT_MAX_PAYLOAD];
+        } report;
+    };
+} wifi_cmd_t;
+
+#define WORKER_STACK 4096
+#define WORKER_PRIORITY (ESP_TASKD_EVENT_PRIO - 1)  // Below the event loop, which only enqueues now
+#define WORKER_CORE 0                               // Beside the WiFi driver task
+#define WORKER_QUEUE_LEN 16
+#define HANDOFF_DELAY_MS 1000                       // Let the success page go out before the AP stops
+
+static TaskHandle_t worker_task = NULL;
+static QueueHandle_t worker_queue = NULL;
 
 static httpd_handle_t server = NULL;
 static esp_netif_t* ap_netif = NULL;
@@ -32,51 +112,189 @@ static wifi_setup_state_t current_state = WIFI_SETUP_STATE_IDLE;
 static EventGroupHandle_t wifi_event_group;
 static int wifi_retry_num = 0;
 static char setup_password[SETUP_PASSWORD_LEN + 1];
-static TaskHandle_t timeout_task_handle = NULL;
+
+// Values derived once per firmware/device, survive deep sleep in RTC slow memory
+#define WARM_CTX_MAGIC 0x57534331           // "WSC1"
+
+typedef struct {
+    rtc_copy_stamp_t stamp;
+    char setup_password[SETUP_PASSWORD_LEN + 1];
+    uint32_t crc;
+} warm_ctx_t;
+
+static RTC_DATA_ATTR warm_ctx_t warm_ctx;
+static esp_timer_handle_t timeout_timers[WIFI_TIMEOUT_COUNT];
+static uint32_t timeout_generation[WIFI_TIMEOUT_COUNT];
+static bool timeout_service_ready = false;
 static bool stay_connected_flag = false;
+static dsm_awake_token_t radio_token = DSM_AWAKE_TOKEN_INVALID;
+
+// Full clock only while there is work: a connect until decided, a portal request
+static power_manager_lock_handle_t connect_pm_lock = NULL;
+static power_manager_lock_handle_t httpd_pm_lock = NULL;
+static bool connect_pm_held = false;
+static dsm_awake_token_t handoff_token = DSM_AWAKE_TOKEN_INVALID;
 static uint32_t current_csrf_token = 0;
 
 static uint32_t generate_csrf_token(void);
 static void cleanup_wifi_resources(void);
+static void wifi_event_handler(void* arg, esp_event_base_t event_base,
+                               int32_t event_id, void* event_data);
+static void fast_connect_fallback(void);
+static void start_candidate_search(uint8_t last_channel);
+static void retry_candidate(void);
+static void portal_stop(void);
+static void disconnect(void);
+static void handoff_connect(void);
+static void worker_post(const wifi_cmd_t* cmd);
+static esp_err_t worker_execute(wifi_cmd_t* cmd);
 
 // Timeout settings
-#define PORTAL_TIMEOUT_MS (5 * 60 * 1000)  // 5 minutes for portal
+#define PORTAL_TIMEOUT_MS (2 * 60 * 1000)  // 2 minutes for portal, the captive popup opens it right away
 #define CONNECT_TIMEOUT_MS (30 * 1000)     // 30 seconds after credentials entered
+#define CONNECT_BUDGET_MS (30 * 1000)      // All candidate networks together
+
+// Connect profile defaults, the behaviour of wifi_setup_connect()
+#define RETRY_BUDGET_MS (5 * 1000)         // Per candidate network
+#define RETRY_BACKOFF_MS 250               // First retry delay, doubled per retry
+#define LISTEN_INTERVAL_DEFAULT 3          // Beacons, WIFI_SETUP_PS_MAX_MODEM only
+
+// Multi-network candidate selection
+#define RECENT_SUCCESS_BONUS_DB 10         // RSSI bonus for the network that connected last
+#define SCAN_MAX_APS 16
+
+typedef struct {
+    uint8_t index;          // Credential store index
+    bool seen;              // Found in the scan; bssid/channel valid
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t bssid[6];
+} connect_candidate_t;
+
+static connect_candidate_t candidates[WIFI_SETUP_MAX_NETWORKS];
+static size_t candidate_count = 0;
+static size_t candidate_pos = 0;
+static bool scan_pending = false;
+static uint8_t scan_channel = 0;      // Channel of the running scan, 0 = all
+
+// Profile of the running connect, retry state of the current candidate
+static wifi_setup_connect_profile_t profile;
+static int64_t candidate_start_us = 0;
+static uint32_t retry_delay_ms = 0;
+
+// Per-attempt metrics of the last connect; attempt is NULL once they overflow
+static wifi_setup_connect_metrics_t metrics;
+static bool metrics_started = false;
+static wifi_setup_attempt_t* attempt = NULL;
+static int64_t connect_start_us = 0;
+static int64_t attempt_start_us = 0;
+static int64_t assoc_done_us = 0;
+static int64_t scan_start_us = 0;
+static uint32_t pending_scan_us = 0;
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define PORTAL_HTTPD_STACK 4096            // HTTPD_DEFAULT_CONFIG() value
+
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+// Nothing of the component stays on the heap between portal sessions
+static StaticEventGroup_t wifi_event_group_buffer;
+static StaticTask_t worker_task_buffer;
+static StackType_t worker_stack[WORKER_STACK];
+static StaticQueue_t worker_queue_buffer;
+static uint8_t worker_queue_storage[WORKER_QUEUE_LEN * sizeof(wifi_cmd_t)];
+static wifi_ap_record_t scan_records[SCAN_MAX_APS];
+#endif
+
+// Stack high-watermarks of this wake, index = tracked_tasks
+static const struct {
+    const char* name;
+    uint32_t stack_size;
+} tracked_tasks[WIFI_SETUP_MEMORY_TASKS] = {
+    {"captive_dns", CAPTIVE_DNS_TASK_STACK},
+    {"wifi_setup", WORKER_STACK},
+    {"httpd", PORTAL_HTTPD_STACK},
+    {"sys_evt", CONFIG_ESP_SYSTEM_EVENT_TASK_STACK_SIZE},   // All event handlers
+    {"tiT", CONFIG_LWIP_TCPIP_TASK_STACK_SIZE},
+    {"esp_timer", CONFIG_ESP_TIMER_TASK_STACK_SIZE},        // Timeouts post from here
+    {"wifi", 0},                                            // Driver task, size set in the blob
+    {"main", CONFIG_ESP_MAIN_TASK_STACK_SIZE},
+};
+enum { TRACK_DNS, TRACK_WORKER, TRACK_HTTPD, TRACK_EVENT, TRACK_TCPIP, TRACK_TIMER, TRACK_WIFI, TRACK_MAIN };
+static uint32_t task_min_free[WIFI_SETUP_MEMORY_TASKS];
+static bool task_sampled[WIFI_SETUP_MEMORY_TASKS];
+static portMUX_TYPE memory_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Caller holds memory_lock
+static void memory_record(size_t index, uint32_t free_bytes)
+{
+    if (!task_sampled[index] || free_bytes < task_min_free[index]) {
+        task_min_free[index] = free_bytes;
+    }
+    task_sampled[index] = true;
+}
+
+// task NULL = the calling task; the high-watermark is in bytes on ESP-IDF
+static void memory_sample(size_t index, TaskHandle_t task)
+{
+    uint32_t free_bytes = uxTaskGetStackHighWaterMark(task);
+    portENTER_CRITICAL(&memory_lock);
+    memory_record(index, free_bytes);
+    portEXIT_CRITICAL(&memory_lock);
+}
+
+static void memory_sample_named(size_t index)
+{
+    TaskHandle_t task = xTaskGetHandle(tracked_tasks[index].name);
+    if (task) {
+        memory_sample(index, task);
+    }
+}
+
+// Fast reconnect settings
+#define FAST_CONNECT_DEFAULT_BUDGET_MS 1500 // Fall back to full connect after this
+#define FAST_CONNECT_MAX_REUSE 7            // Force a DHCP renewal after this many fast connects
+#define FAST_CACHE_MAGIC 0x46434331         // "FCC1"
+
+// Fast reconnect cache, survives deep sleep in RTC slow memory
+typedef struct {
+    uint32_t magic;
+    char ssid[WIFI_SSID_MAX_LEN];
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t authmode;
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+    uint32_t reuse_count;
+    uint32_t crc;
+} fast_connect_cache_t;
+
+static RTC_DATA_ATTR fast_connect_cache_t fast_cache;
+static uint32_t fast_connect_budget_ms = FAST_CONNECT_DEFAULT_BUDGET_MS;
+static bool fast_attempt = false;
+static uint8_t fast_network = 0;
 
 // Security: Rate limiting
 static uint32_t last_save_attempt = 0;
 static int save_attempt_count = 0;
 #define MAX_SAVE_ATTEMPTS 5
 #define RATE_LIMIT_WINDOW_MS 60000
+#define FORM_MAX_BODY_LEN 2048
+
+#define PORTAL_URL "http://192.168.4.1/"
+
+// Generated from www/setup.css by the component CMakeLists
+extern const uint8_t setup_css_gz_start[] asm("_binary_setup_css_gz_start");
+extern const uint8_t setup_css_gz_end[] asm("_binary_setup_css_gz_end");
+
+static const char* removed_html = 
+"<!DOCTYPE html><html><head><title>Removed</title><meta name='viewport' content='width=device-width,initial-scale=1'>"
+"<meta http-equiv='refresh' content='2;url=/'></head>"
+"<body style='font-family:Arial;text-align:center;padding:50px'>Network removed</body></html>";
 
-// Simplified HTML with CSRF protection
-static const char* setup_html_template = 
-"<!DOCTYPE html>"
-"<html><head>"
-"<title>ESP32 WiFi Setup</title>"
-"<meta name='viewport' content='width=device-width,initial-scale=1'>"
-"<style>"
-"body{font-family:Arial;margin:40px;background:#f0f0f0}"
-".container{max-width:400px;margin:0 auto;background:white;padding:30px;border-radius:10px;box-shadow:0 2px 10px rgba(0,0,0,0.1)}"
-"h1{color:#333;text-align:center;margin-bottom:30px}"
-"input{width:100%%;padding:12px;margin:8px 0;border:1px solid #ddd;border-radius:5px;box-sizing:border-box;font-size:16px}"
-"button{width:100%%;padding:15px;background:#007bff;color:white;border:none;border-radius:5px;font-size:16px;cursor:pointer;margin-top:10px}"
-"button:hover{background:#0056b3}"
-".info{background:#e7f3ff;padding:15px;border-radius:5px;margin-bottom:20px;color:#31708f;font-size:14px}"
-".error{background:#f8d7da;padding:15px;border-radius:5px;margin-bottom:20px;color:#721c24;font-size:14px}"
-"</style>"
-"</head><body>"
-"<div class='container'>"
-"<h1>📶 WiFi Setup</h1>"
-"<div class='info'>Connect ESP32 to your WiFi network. Password required: <strong>%s</strong></div>"
-"<form action='/save' method='post'>"
-"<input type='password' name='setup_pwd' placeholder='Setup Password' required maxlength='8'>"
-"<input type='text' name='ssid' placeholder='WiFi Network Name' required maxlength='31'>"
-"<input type='password' name='password' placeholder='WiFi Password' required maxlength='63'>"
-"<input type='hidden' name='csrf' value='%08x'>"
-"<button type='submit'>Save & Connect</button>"
-"</form>"
-"</div></body></html>";
+static const char* paired_html = 
+"<!DOCTYPE html><html><head><title>Paired</title><meta name='viewport' content='width=device-width,initial-scale=1'>"
+"<meta http-equiv='refresh' content='2;url=/'></head>"
+"<body style='font-family:Arial;text-align:center;padding:50px'>Gateway paired</body></html>";
 
 static const char* success_html = 
 "<!DOCTYPE html><html><head><title>Success</title><meta name='viewport' content='width=device-width,initial-scale=1'>"
@@ -84,86 +302,510 @@ static const char* success_html =
 ".success{background:#d4edda;padding:20px;border-radius:5px;color:#155724;max-width:400px;margin:0 auto}</style></head>"
 "<body><div class='success'><h2>✅ Success!</h2>Connecting to WiFi...</div></body></html>";
 
-// Timeout task for automatic WiFi disable
-static void timeout_task(void* param) {
-    uint32_t timeout_ms = (uint32_t)(uintptr_t)param;
-    
-    ESP_LOGI(TAG, "WiFi timeout set for %lu ms", timeout_ms);
-    vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+// Runs in the esp_timer task; hand the expiry over to the worker with its arm generation
+static void timeout_timer_cb(void* arg) {
+    wifi_cmd_t cmd = {
+        .type = CMD_TIMEOUT,
+        .time_us = esp_timer_get_time(),
+        .timeout = { .id = (wifi_timeout_t)(uintptr_t)arg },
+    };
+    cmd.timeout.generation = timeout_generation[cmd.timeout.id];
+    worker_post(&cmd);
+}
+
+// Timeout expiry on the worker
+static void timeout_expired(wifi_timeout_t id, uint32_t generation) {
+    if (id >= WIFI_TIMEOUT_COUNT || generation != timeout_generation[id]) {
+        return; // Cancelled or re-armed after it fired
+    }
     
-    if (current_state == WIFI_SETUP_STATE_CONNECTED && !stay_connected_flag) {
+    if (id == WIFI_TIMEOUT_LINGER && current_state == WIFI_SETUP_STATE_CONNECTED && !stay_connected_flag) {
         ESP_LOGI(TAG, "WiFi timeout - disconnecting");
-        wifi_setup_disconnect();
-        if (setup_callback) {
-            setup_callback(false, NULL); // Notify timeout
-        }
-    } else if (current_state == WIFI_SETUP_STATE_PORTAL_RUNNING) {
+        disconnect(); // Notifies the callback
+    } else if (id == WIFI_TIMEOUT_HANDOFF && current_state == WIFI_SETUP_STATE_PORTAL_RUNNING) {
+        handoff_connect();
+    } else if (id == WIFI_TIMEOUT_PORTAL && current_state == WIFI_SETUP_STATE_PORTAL_RUNNING) {
         ESP_LOGI(TAG, "Portal timeout - stopping portal");
-        wifi_setup_stop_portal();
+        portal_stop();
         current_state = WIFI_SETUP_STATE_DISABLED;
+        xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT | WIFI_PORTAL_DONE_BIT);
+        if (setup_callback) {
+            setup_callback(false, NULL, WIFI_SETUP_PATH_NONE); // Notify timeout
+        }
+    } else if (id == WIFI_TIMEOUT_FAST && current_state == WIFI_SETUP_STATE_CONNECTING && fast_attempt) {
+        ESP_LOGW(TAG, "Fast reconnect budget exceeded");
+        fast_connect_fallback();
+    } else if (id == WIFI_TIMEOUT_RETRY && current_state == WIFI_SETUP_STATE_CONNECTING && !scan_pending) {
+        retry_candidate();
+    } else if (id == WIFI_TIMEOUT_BUDGET && current_state == WIFI_SETUP_STATE_CONNECTING) {
+        ESP_LOGE(TAG, "Connect budget exceeded - giving up");
+        cleanup_wifi_resources(); // Sets WIFI_FAIL_BIT
+        current_state = WIFI_SETUP_STATE_FAILED;
         if (setup_callback) {
-            setup_callback(false, NULL); // Notify timeout
+            setup_callback(false, NULL, WIFI_SETUP_PATH_NONE);
         }
     }
+}
+
+// Create the timers once
+static esp_err_t timeout_service_init(void) {
+    static const char* names[WIFI_TIMEOUT_COUNT] = {"wifi_portal", "wifi_linger", "wifi_fast", "wifi_budget",
+                                                    "wifi_retry", "wifi_handoff"};
+    
+    if (timeout_service_ready) {
+        return ESP_OK;
+    }
+    
+    for (int i = 0; i < WIFI_TIMEOUT_COUNT; i++) {
+        esp_timer_create_args_t args = {
+            .callback = timeout_timer_cb,
+            .arg = (void*)(uintptr_t)i,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = names[i],
+        };
+        esp_err_t err = esp_timer_create(&args, &timeout_timers[i]);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    
+    timeout_service_ready = true;
+    return ESP_OK;
+}
+
+// Cancel a pending timeout; an expiry already queued for the worker is dropped too
+static void timeout_cancel(wifi_timeout_t id) {
+    if (timeout_timers[id]) {
+        esp_timer_stop(timeout_timers[id]);
+        timeout_generation[id]++;
+    }
+}
+
+// (Re-)arm a one-shot timeout
+static void timeout_arm(wifi_timeout_t id, uint32_t timeout_ms) {
+    if (!timeout_timers[id]) {
+        return;
+    }
+    
+    timeout_cancel(id);
+    esp_timer_start_once(timeout_timers[id], (uint64_t)timeout_ms * 1000);
+    ESP_LOGI(TAG, "WiFi timeout set for %lu ms", timeout_ms);
+}
+
+static void timeout_cancel_all(void) {
+    for (int i = 0; i < WIFI_TIMEOUT_COUNT; i++) {
+        timeout_cancel(i);
+    }
+}
+
+// netif, default event loop and timeout service; safe to call repeatedly
+static esp_err_t network_init(void) {
+    esp_err_t err = esp_netif_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
     
-    timeout_task_handle = NULL;
-    vTaskDelete(NULL);
+    return timeout_service_init();
+}
+
+// WiFi driver with RAM-only config storage; every path sets its config explicitly
+static esp_err_t wifi_driver_init(void) {
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    cfg.nvs_enable = 0;
+    return esp_wifi_init(&cfg);
 }
 
-// Start timeout task
-static void start_timeout_task(uint32_t timeout_ms) {
-    if (timeout_task_handle) {
-        vTaskDelete(timeout_task_handle);
-        timeout_task_handle = NULL;
+// Radio start with PHY calibration; keeps NVS out of the driver init so that can run beside it
+static esp_err_t wifi_radio_start(void) {
+#if CONFIG_ESP_PHY_CALIBRATION_AND_DATA_STORAGE
+    // PHY calibration data lives in NVS, the only flash access left on warm wakes
+    esp_err_t err = cred_store_nvs_init();
+    if (err != ESP_OK) {
+        return err;
     }
+#endif
     
-    xTaskCreate(timeout_task, "wifi_timeout", 2048, 
-                (void*)(uintptr_t)timeout_ms, 3, &timeout_task_handle);
+    return esp_wifi_start();
+}
+
+// Connect work from radio start until IP or failure
+static void connect_work(bool busy) {
+    if (busy == connect_pm_held) {
+        return;
+    }
+    connect_pm_held = busy;
+    if (busy) {
+        power_manager_acquire(connect_pm_lock);
+    } else {
+        power_manager_release(connect_pm_lock);
+    }
 }
 
-// Stop timeout task
-static void stop_timeout_task(void) {
-    if (timeout_task_handle) {
-        vTaskDelete(timeout_task_handle);
-        timeout_task_handle = NULL;
-        ESP_LOGI(TAG, "Timeout task stopped");
+// Radio on/off: energy accounting and keep the system awake while WiFi is up
+static void radio_state(bool on) {
+    deep_sleep_manager_radio_state(on);
+    
+    if (on && radio_token == DSM_AWAKE_TOKEN_INVALID) {
+        radio_token = deep_sleep_manager_stay_awake("wifi");
+    } else if (!on) {
+        deep_sleep_manager_release_awake(radio_token);
+        radio_token = DSM_AWAKE_TOKEN_INVALID;
     }
 }
 
 
 
-// URL decode function
-static void url_decode(char* str) {
-    char* src = str;
-    char* dst = str;
+static uint32_t fast_cache_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&fast_cache, offsetof(fast_connect_cache_t, crc));
+}
+
+static bool fast_cache_valid(const char* ssid)
+{
+    if (fast_connect_budget_ms == 0 || fast_cache.magic != FAST_CACHE_MAGIC) {
+        return false;
+    }
+    if (fast_cache.crc != fast_cache_crc()) {
+        ESP_LOGW(TAG, "Fast reconnect cache corrupted");
+        return false;
+    }
+    if (fast_cache.reuse_count >= FAST_CONNECT_MAX_REUSE) {
+        ESP_LOGI(TAG, "Fast reconnect cache used %lu times, renewing lease", fast_cache.reuse_count);
+        return false;
+    }
+    return strncmp(fast_cache.ssid, ssid, sizeof(fast_cache.ssid)) == 0;
+}
+
+static void fast_cache_store(const esp_netif_ip_info_t* ip_info, bool refreshed)
+{
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
     
-    while (*src) {
-        if (*src == '+') {
-            *dst++ = ' ';
-        } else if (*src == '%' && src[1] && src[2]) {
-            int high = (src[1] >= '0' && src[1] <= '9') ? src[1] - '0' : 
-                       (src[1] >= 'A' && src[1] <= 'F') ? src[1] - 'A' + 10 :
-                       (src[1] >= 'a' && src[1] <= 'f') ? src[1] - 'a' + 10 : 0;
-            int low = (src[2] >= '0' && src[2] <= '9') ? src[2] - '0' : 
-                      (src[2] >= 'A' && src[2] <= 'F') ? src[2] - 'A' + 10 :
-                      (src[2] >= 'a' && src[2] <= 'f') ? src[2] - 'a' + 10 : 0;
-            *dst++ = (high << 4) | low;
-            src += 3;
-            continue;
-        } else {
-            *dst++ = *src;
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        return;
+    }
+    
+    uint32_t reuse_count = refreshed ? 0 : fast_cache.reuse_count + 1;
+    
+    memset(&fast_cache, 0, sizeof(fast_cache));
+    fast_cache.magic = FAST_CACHE_MAGIC;
+    strncpy(fast_cache.ssid, (const char*)wifi_config.sta.ssid, sizeof(fast_cache.ssid) - 1);
+    memcpy(fast_cache.bssid, ap_info.bssid, sizeof(fast_cache.bssid));
+    fast_cache.channel = ap_info.primary;
+    fast_cache.authmode = ap_info.authmode;
+    fast_cache.ip_info = *ip_info;
+    fast_cache.reuse_count = reuse_count;
+    
+    esp_netif_dns_info_t dns_info;
+    if (sta_netif && esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK) {
+        fast_cache.dns = dns_info.ip.u_addr.ip4;
+    }
+    
+    fast_cache.crc = fast_cache_crc();
+}
+
+void wifi_setup_invalidate_fast_connect(void)
+{
+    memset(&fast_cache, 0, sizeof(fast_cache));
+}
+
+void wifi_setup_set_fast_connect_budget(uint32_t budget_ms)
+{
+    fast_connect_budget_ms = budget_ms;
+}
+
+// Open a new metrics record for the next esp_wifi_connect()
+static void attempt_begin(uint8_t network, uint8_t channel, int8_t rssi, bool fast)
+{
+    attempt_start_us = esp_timer_get_time();
+    assoc_done_us = 0;
+    
+    portENTER_CRITICAL(&metrics_lock);
+    if (metrics.attempt_count < WIFI_SETUP_MAX_ATTEMPTS) {
+        attempt = &metrics.attempts[metrics.attempt_count++];
+        *attempt = (wifi_setup_attempt_t){
+            .network = network,
+            .channel = channel,
+            .rssi = rssi,
+            .fast = fast,
+            .scan_us = pending_scan_us,
+        };
+    } else {
+        attempt = NULL;
+        if (metrics.dropped < UINT8_MAX) {
+            metrics.dropped++;
         }
-        src++;
     }
-    *dst = '\0';
+    portEXIT_CRITICAL(&metrics_lock);
+    pending_scan_us = 0;
+}
+
+// Close the metrics of the running connect and log them
+static void metrics_finish(bool success)
+{
+    if (!metrics_started || metrics.done) {
+        return;
+    }
+    
+    portENTER_CRITICAL(&metrics_lock);
+    metrics.done = true;
+    metrics.success = success;
+    metrics.total_us = esp_timer_get_time() - connect_start_us;
+    attempt = NULL;
+    portEXIT_CRITICAL(&metrics_lock);
+    
+    ESP_LOGI(TAG, "Connect %s after %lu ms, %u attempts", success ? "succeeded" : "failed",
+             metrics.total_us / 1000, metrics.attempt_count + metrics.dropped);
+    for (uint8_t i = 0; i < metrics.attempt_count; i++) {
+        const wifi_setup_attempt_t* a = &metrics.attempts[i];
+        ESP_LOGI(TAG, "  #%u net %u ch %u%s: scan %lu, assoc %lu, dhcp %lu ms, reason %u", i + 1,
+                 a->network, a->channel, a->fast ? " fast" : "",
+                 a->scan_us / 1000, a->assoc_us / 1000, a->dhcp_us / 1000, a->reason);
+    }
+}
+
+// Configure the candidate at pos and start associating
+static void apply_candidate(size_t pos)
+{
+    const connect_candidate_t* candidate = &candidates[pos];
+    const cred_store_entry_t* entry = cred_store_get(candidate->index);
+    if (!entry) {
+        return;
+    }
+    
+    wifi_config_t wifi_config = {};
+    strncpy((char*)wifi_config.sta.ssid, entry->ssid, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, entry->password, sizeof(wifi_config.sta.password));
+    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    wifi_config.sta.threshold.rssi = profile.min_rssi;
+    wifi_config.sta.scan_method = profile.scan == WIFI_SETUP_SCAN_ALL_CHANNEL ? WIFI_ALL_CHANNEL_SCAN : WIFI_FAST_SCAN;
+    wifi_config.sta.sort_method = profile.sort == WIFI_SETUP_SORT_SECURITY ? WIFI_CONNECT_AP_BY_SECURITY : WIFI_CONNECT_AP_BY_SIGNAL;
+    if (stay_connected_flag && profile.power_save == WIFI_SETUP_PS_MAX_MODEM) {
+        wifi_config.sta.listen_interval = profile.listen_interval;
+    }
+    if (candidate->seen) {
+        // Already located by the scan, skip the driver's own scan
+        memcpy(wifi_config.sta.bssid, candidate->bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = candidate->channel;
+    }
+    
+    ESP_LOGI(TAG, "Trying network %u/%u: %s (RSSI %d)", (unsigned)(pos + 1), (unsigned)candidate_count,
+             entry->ssid, candidate->seen ? candidate->rssi : 0);
+    
+    candidate_pos = pos;
+    wifi_retry_num = 0;
+    candidate_start_us = esp_timer_get_time();
+    retry_delay_ms = profile.retry_backoff_ms;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    attempt_begin(candidate->index, wifi_config.sta.channel, candidate->seen ? candidate->rssi : 0, false);
+    esp_wifi_connect();
+}
+
+// Backoff expired: next attempt on the same candidate
+static void retry_candidate(void)
+{
+    const connect_candidate_t* candidate = &candidates[candidate_pos];
+    
+    wifi_retry_num++;
+    ESP_LOGI(TAG, "Retry connecting to WiFi... (%d, next backoff %lu ms)", wifi_retry_num, retry_delay_ms * 2);
+    retry_delay_ms *= 2;
+    attempt_begin(candidate->index, candidate->seen ? candidate->channel : 0,
+                  candidate->seen ? candidate->rssi : 0, false);
+    esp_wifi_connect();
+}
+
+// AP record a beats b under the profile's sort method
+static bool ap_better(const wifi_ap_record_t* a, const connect_candidate_t* b, wifi_auth_mode_t b_auth)
+{
+    if (profile.sort == WIFI_SETUP_SORT_SECURITY && a->authmode != b_auth) {
+        return a->authmode > b_auth;
+    }
+    return a->rssi > b->rssi;
+}
+
+// Channel of the last connection from the fast reconnect cache, 0 = unknown
+static uint8_t known_channel(void)
+{
+    if (fast_cache.magic != FAST_CACHE_MAGIC || fast_cache.crc != fast_cache_crc()) {
+        return 0;
+    }
+    return fast_cache.channel;
+}
+
+// Candidate scan on one channel, 0 = all channels
+static bool start_scan(uint8_t channel)
+{
+    wifi_scan_config_t scan_config = {
+        .channel = channel,
+    };
+    
+    scan_pending = true;
+    scan_channel = channel;
+    scan_start_us = esp_timer_get_time();
+    if (esp_wifi_scan_start(&scan_config, false) != ESP_OK) {
+        scan_pending = false;
+        return false;
+    }
+    ESP_LOGI(TAG, "Scanning for %u stored networks (channel %u)", (unsigned)cred_store_count(), channel);
+    return true;
+}
+
+// Order the stored networks by scan RSSI plus a bonus for the last successful one;
+// false if a wider scan was started instead
+static bool rank_candidates(void)
+{
+    size_t preferred = cred_store_preferred();
+    int score[WIFI_SETUP_MAX_NETWORKS];
+    
+    candidate_count = cred_store_count();
+    for (size_t i = 0; i < candidate_count; i++) {
+        memset(&candidates[i], 0, sizeof(candidates[i]));
+        candidates[i].index = i;
+    }
+    
+    wifi_auth_mode_t authmode[WIFI_SETUP_MAX_NETWORKS] = {0};
+    size_t seen_count = 0;
+    uint16_t ap_count = SCAN_MAX_APS;
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+    wifi_ap_record_t* records = scan_records;
+#else
+    wifi_ap_record_t* records = malloc(sizeof(wifi_ap_record_t) * SCAN_MAX_APS);
+#endif
+    if (records && esp_wifi_scan_get_ap_records(&ap_count, records) == ESP_OK) {
+        for (uint16_t r = 0; r < ap_count; r++) {
+            if (profile.min_rssi && records[r].rssi < profile.min_rssi) {
+                continue;
+            }
+            for (size_t i = 0; i < candidate_count; i++) {
+                const cred_store_entry_t* entry = cred_store_get(i);
+                if (strncmp((const char*)records[r].ssid, entry->ssid, WIFI_SSID_MAX_LEN) != 0) {
+                    continue;
+                }
+                if (!candidates[i].seen || ap_better(&records[r], &candidates[i], authmode[i])) {
+                    seen_count += !candidates[i].seen;
+                    authmode[i] = records[r].authmode;
+                    candidates[i].seen = true;
+                    candidates[i].rssi = records[r].rssi;
+                    candidates[i].channel = records[r].primary;
+                    memcpy(candidates[i].bssid, records[r].bssid, sizeof(candidates[i].bssid));
+                }
+            }
+        }
+    } else {
+        esp_wifi_clear_ap_list();
+    }
+#if !CONFIG_WIFI_SETUP_STATIC_ALLOC
+    free(records);
+#endif
+    
+    // Nothing of ours on the known channel: try again across all channels
+    if (seen_count == 0 && scan_channel != 0) {
+        ESP_LOGI(TAG, "No stored network on channel %u, scanning all channels", scan_channel);
+        if (start_scan(0)) {
+            return false;
+        }
+    }
+    
+    // Not seen (hidden or out of range) goes last, still worth a try
+    for (size_t i = 0; i < candidate_count; i++) {
+        score[i] = candidates[i].seen ? candidates[i].rssi : INT16_MIN;
+        if (i == preferred && cred_store_get(i)->last_success) {
+            score[i] += RECENT_SUCCESS_BONUS_DB;
+        }
+    }
+    
+    // Insertion sort, at most WIFI_SETUP_MAX_NETWORKS entries
+    for (size_t i = 1; i < candidate_count; i++) {
+        connect_candidate_t c = candidates[i];
+        int sc = score[i];
+        size_t j = i;
+        while (j > 0 && score[j - 1] < sc) {
+            candidates[j] = candidates[j - 1];
+            score[j] = score[j - 1];
+            j--;
+        }
+        candidates[j] = c;
+        score[j] = sc;
+    }
+    return true;
+}
+
+// Pick the network to use: scan when there is a choice or the profile asks for
+// it, otherwise leave the search to the driver. last_channel is the channel of
+// the last connection, 0 = unknown.
+static void start_candidate_search(uint8_t last_channel)
+{
+    if (cred_store_count() > 1 || profile.scan != WIFI_SETUP_SCAN_FAST) {
+        uint8_t channel = profile.scan == WIFI_SETUP_SCAN_KNOWN_CHANNEL ? last_channel : 0;
+        if (start_scan(channel)) {
+            return;
+        }
+    }
+    
+    // Single network (or scan failed): stored order, most recently successful first
+    size_t preferred = cred_store_preferred();
+    candidate_count = cred_store_count();
+    for (size_t i = 0; i < candidate_count; i++) {
+        memset(&candidates[i], 0, sizeof(candidates[i]));
+        candidates[i].index = (preferred + i) % candidate_count;
+    }
+    if (candidate_count) {
+        apply_candidate(0);
+    }
+}
+
+// Abandon the cached BSSID/static IP and retry with a full scan and DHCP
+static void fast_connect_fallback(void)
+{
+    ESP_LOGW(TAG, "Fast reconnect failed - falling back to full connect");
+    fast_attempt = false;
+    // The AP is most likely still on its channel, keep it for the scan
+    uint8_t last_channel = known_channel();
+    wifi_setup_invalidate_fast_connect();
+    
+    esp_wifi_disconnect();
+    
+    if (sta_netif) {
+        esp_netif_dhcpc_start(sta_netif);
+    }
+    
+    start_candidate_search(last_channel);
+}
+
+// Portal handoff over or abandoned
+static void handoff_release(void)
+{
+    timeout_cancel(WIFI_TIMEOUT_HANDOFF);
+    deep_sleep_manager_release_awake(handoff_token);
+    handoff_token = DSM_AWAKE_TOKEN_INVALID;
 }
 
 static void cleanup_wifi_resources(void)
 {
-    stop_timeout_task();
+    timeout_cancel_all();
+    handoff_release();
+    metrics_finish(false);
+    connect_work(false);
     
     if (current_state != WIFI_SETUP_STATE_DISABLED) {
+        // Wake up connect waiters, the attempt cannot succeed any more
+        xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        if (current_state == WIFI_SETUP_STATE_CONNECTING) {
+            xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT | WIFI_PORTAL_DONE_BIT);
+        }
+        
         esp_wifi_stop();
+        radio_state(false);
+        memory_sample_named(TRACK_WIFI);
         esp_wifi_deinit();
         
         if (sta_netif) {
@@ -186,84 +828,204 @@ static uint32_t generate_csrf_token(void)
 	ESP_LOGE(TAG, "Failed to generate CSRF Token!");
 }
 
-// WiFi event handler
+// Default event loop: copy what the worker needs and return, the loop stays free for everyone else
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                int32_t event_id, void* event_data)
 {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (wifi_retry_num < 3 && current_state == WIFI_SETUP_STATE_CONNECTING) {
+    wifi_cmd_t cmd = { .time_us = esp_timer_get_time() };
+    
+    if (event_base == IP_EVENT) {
+        cmd.type = CMD_GOT_IP;
+        cmd.ip_info = ((ip_event_got_ip_t*)event_data)->ip_info;
+    } else if (event_id == WIFI_EVENT_STA_START || event_id == WIFI_EVENT_SCAN_DONE ||
+               event_id == WIFI_EVENT_STA_CONNECTED || event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        cmd.type = CMD_WIFI_EVENT;
+        cmd.wifi.id = event_id;
+        if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
+            cmd.wifi.reason = ((wifi_event_sta_disconnected_t*)event_data)->reason;
+        }
+    } else {
+        return;
+    }
+    worker_post(&cmd);
+}
+
+// WiFi and IP events on the worker
+static void wifi_event_process(const wifi_cmd_t* cmd)
+{
+    // Queued before the teardown unregistered the handler
+    if (current_state != WIFI_SETUP_STATE_CONNECTING && current_state != WIFI_SETUP_STATE_CONNECTED) {
+        return;
+    }
+    
+    int32_t event_id = cmd->type == CMD_WIFI_EVENT ? cmd->wifi.id : -1;
+    if (event_id == WIFI_EVENT_STA_START) {
+        if (fast_attempt) {
+            attempt_begin(fast_network, fast_cache.channel, 0, true);
             esp_wifi_connect();
-            wifi_retry_num++;
-            ESP_LOGI(TAG, "Retry connecting to WiFi... (%d/3)", wifi_retry_num);
         } else {
-            xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
+            start_candidate_search(known_channel());
+        }
+    } else if (event_id == WIFI_EVENT_SCAN_DONE) {
+        if (scan_pending && current_state == WIFI_SETUP_STATE_CONNECTING) {
+            scan_pending = false;
+            pending_scan_us += cmd->time_us - scan_start_us;
+            if (rank_candidates()) {
+                apply_candidate(0);
+            }
+        }
+    } else if (event_id == WIFI_EVENT_STA_CONNECTED) {
+        wake_timing_mark("wifi_assoc");
+        assoc_done_us = cmd->time_us;
+        if (attempt) {
+            attempt->assoc_us = assoc_done_us - attempt_start_us;
+        }
+        if (fast_attempt && sta_netif) {
+            // Apply cached lease; this posts IP_EVENT_STA_GOT_IP without a DHCP exchange
+            esp_netif_set_ip_info(sta_netif, &fast_cache.ip_info);
+            if (fast_cache.dns.addr) {
+                esp_netif_dns_info_t dns_info = {0};
+                dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+                dns_info.ip.u_addr.ip4 = fast_cache.dns;
+                esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+            }
+        }
+    } else if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        int64_t candidate_us = cmd->time_us - candidate_start_us;
+        if (attempt && !scan_pending && current_state == WIFI_SETUP_STATE_CONNECTING) {
+            attempt->reason = cmd->wifi.reason;
+        }
+        
+        if (scan_pending && current_state == WIFI_SETUP_STATE_CONNECTING) {
+            // Leftover from the abandoned fast attempt, the scan decides what comes next
+        } else if (fast_attempt && current_state == WIFI_SETUP_STATE_CONNECTING) {
+            timeout_cancel(WIFI_TIMEOUT_FAST);
+            fast_connect_fallback();
+        } else if (candidate_us + retry_delay_ms * 1000LL < profile.retry_budget_ms * 1000LL &&
+                   current_state == WIFI_SETUP_STATE_CONNECTING) {
+            // Backoff on a timer, retry_candidate() runs on expiry
+            timeout_arm(WIFI_TIMEOUT_RETRY, retry_delay_ms);
+        } else if (candidate_pos + 1 < candidate_count && current_state == WIFI_SETUP_STATE_CONNECTING) {
+            apply_candidate(candidate_pos + 1);
+        } else {
             ESP_LOGE(TAG, "Failed to connect to WiFi");
             current_state = WIFI_SETUP_STATE_FAILED;
+            xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT | WIFI_PORTAL_DONE_BIT);
             
             // Auto-disconnect after failure
-            vTaskDelay(pdMS_TO_TICKS(1000));
             cleanup_wifi_resources();
         }
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "Connected! IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    } else if (cmd->type == CMD_GOT_IP && current_state == WIFI_SETUP_STATE_CONNECTING) {
+        const esp_netif_ip_info_t* ip_info = &cmd->ip_info;
+        wake_timing_mark("got_ip");
+        if (attempt && assoc_done_us) {
+            attempt->dhcp_us = cmd->time_us - assoc_done_us;
+        }
+        metrics_finish(true);
+        connect_work(false);
+        wifi_setup_connect_path_t path = fast_attempt ? WIFI_SETUP_PATH_FAST : WIFI_SETUP_PATH_FULL;
+        ESP_LOGI(TAG, "Connected! IP: " IPSTR " (%s path)", IP2STR(&ip_info->ip),
+                 path == WIFI_SETUP_PATH_FAST ? "fast" : "full");
+        ESP_LOGI(TAG, "Gateway: " IPSTR ", Netmask: " IPSTR,
+                 IP2STR(&ip_info->gw), IP2STR(&ip_info->netmask));
+        esp_netif_dns_info_t dns_info;
+        if (sta_netif && esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK) {
+            ESP_LOGI(TAG, "DNS: " IPSTR, IP2STR(&dns_info.ip.u_addr.ip4));
+        }
         wifi_retry_num = 0;
+        fast_attempt = false;
         current_state = WIFI_SETUP_STATE_CONNECTED;
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_PORTAL_DONE_BIT);
+        
+        // Remember AP and lease for the next wake, rank this network first
+        fast_cache_store(ip_info, path == WIFI_SETUP_PATH_FULL);
+        cred_store_mark_success(fast_cache.ssid);
         
         // Start timeout for auto-disconnect (unless staying connected)
+        timeout_cancel(WIFI_TIMEOUT_FAST);
+        timeout_cancel(WIFI_TIMEOUT_BUDGET);
+        timeout_cancel(WIFI_TIMEOUT_RETRY);
         if (!stay_connected_flag) {
-            start_timeout_task(CONNECT_TIMEOUT_MS);
+            timeout_arm(WIFI_TIMEOUT_LINGER, CONNECT_TIMEOUT_MS);
         }
         
         if (setup_callback) {
-            setup_callback(true, &event->ip_info);
+            esp_netif_ip_info_t info = *ip_info;
+            setup_callback(true, &info, path);
         }
     }
 }
 
 // HTTP GET handler
+// Portal handlers run at full clock, the server idles at the DFS minimum in between
+static esp_err_t locked_handler(httpd_req_t *req)
+{
+    esp_err_t (*handler)(httpd_req_t*) = (esp_err_t (*)(httpd_req_t*))req->user_ctx;
+    
+    power_manager_acquire(httpd_pm_lock);
+    esp_err_t err = handler(req);
+    power_manager_release(httpd_pm_lock);
+    return err;
+}
+
+static esp_err_t httpd_write(void* ctx, const char* data, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t*)ctx, data, len);
+}
+
 static esp_err_t setup_get_handler(httpd_req_t *req)
 {
     current_csrf_token = generate_csrf_token();
     
-    char html_buffer[2048];
-    snprintf(html_buffer, sizeof(html_buffer), setup_html_template, 
-             setup_password, current_csrf_token);
+    // Entered on the gateway together with the key
+    uint8_t mac[6] = {0};
+    char mac_str[18];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(mac_str, sizeof(mac_str), MACSTR, MAC2STR(mac));
+    
+    const char* ssids[WIFI_SETUP_MAX_NETWORKS];
+    portal_setup_page_t page = {
+        .setup_password = setup_password,
+        .device_mac = mac_str,
+        .csrf_token = current_csrf_token,
+        .ssids = ssids,
+    };
+    if (cred_store_load() == ESP_OK) {
+        for (; page.ssid_count < cred_store_count() && page.ssid_count < WIFI_SETUP_MAX_NETWORKS; page.ssid_count++) {
+            ssids[page.ssid_count] = cred_store_get(page.ssid_count)->ssid;
+        }
+    }
     
-    // Security headers
+    // Security headers; the page holds the setup password and CSRF token, never cache it
     httpd_resp_set_hdr(req, "X-Frame-Options", "DENY");
     httpd_resp_set_hdr(req, "X-Content-Type-Options", "nosniff");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
     httpd_resp_set_type(req, "text/html");
     
-    return httpd_resp_send(req, html_buffer, strlen(html_buffer));
+    esp_err_t err = portal_render_setup(&page, httpd_write, req);
+    if (err == ESP_OK) err = httpd_resp_send_chunk(req, NULL, 0);
+    
+    return err;
 }
 
-static void wifi_connect_task(void* param)
+// OS connectivity checks and any unknown URL: redirect to the setup page so the captive popup opens
+static esp_err_t redirect_get_handler(httpd_req_t *req)
 {
-    vTaskDelay(pdMS_TO_TICKS(1000)); // Let response send
+    httpd_resp_set_status(req, "302 Found");
+    httpd_resp_set_hdr(req, "Location", PORTAL_URL);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
     
-    // Stop portal and connect to WiFi
-    current_state = WIFI_SETUP_STATE_CONNECTING;
-    wifi_setup_stop_portal();
-    
-    // Get credentials and connect
-    wifi_credentials_t* creds = (wifi_credentials_t*)param;
-    stay_connected_flag = false; // Default: auto-disconnect after timeout
-    
-    // Connect using the new function
-    esp_err_t connect_err = wifi_setup_connect(setup_callback, false);
-    if (connect_err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to start WiFi connection");
-        if (setup_callback) {
-            setup_callback(false, NULL);
-        }
-    }
+    return httpd_resp_send(req, NULL, 0);
+}
+
+// Static stylesheet, precompressed and cacheable
+static esp_err_t css_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/css");
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=86400");
     
-    free(param);
-    vTaskDelete(NULL);
+    return httpd_resp_send(req, (const char*)setup_css_gz_start, setup_css_gz_end - setup_css_gz_start);
 }
 
 // HTTP POST handler with security checks
@@ -284,194 +1046,304 @@ static esp_err_t save_post_handler(httpd_req_t *req)
     }
     last_save_attempt = now;
     
-    char buf[512];
-    int ret = httpd_req_recv(req, buf, MIN(req->content_len, sizeof(buf) - 1));
-    if (ret <= 0) {
+    // Parse form data chunk by chunk as it arrives
+    portal_save_form_t form;
+    
+    if (req->content_len == 0 || req->content_len > FORM_MAX_BODY_LEN) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid data");
         return ESP_FAIL;
     }
-    buf[ret] = '\0';
     
-    // Parse form data
-    char setup_pwd[16] = {0};
-    char csrf_str[16] = {0};
-    wifi_credentials_t creds = {0};
+    portal_save_form_init(&form);
     
-    // Extract setup password
-    char *setup_pwd_start = strstr(buf, "setup_pwd=");
-    if (setup_pwd_start) {
-        setup_pwd_start += 10;
-        char *setup_pwd_end = strchr(setup_pwd_start, '&');
-        int len = setup_pwd_end ? setup_pwd_end - setup_pwd_start : strlen(setup_pwd_start);
-        len = len > 15 ? 15 : len;
-        strncpy(setup_pwd, setup_pwd_start, len);
-        url_decode(setup_pwd);
+    char buf[128];
+    size_t remaining = req->content_len;
+    esp_err_t parse_err = ESP_OK;
+    while (remaining > 0 && parse_err == ESP_OK) {
+        int ret = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)));
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ESP_FAIL; // Connection closed, nothing to answer
+        }
+        parse_err = form_parser_feed(&form.parser, buf, ret);
+        remaining -= ret;
+    }
+    if (parse_err == ESP_OK) {
+        parse_err = form_parser_finish(&form.parser);
+    }
+    if (parse_err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid data");
+        return ESP_FAIL;
     }
     
     // Verify setup password
-    if (strcmp(setup_pwd, setup_password) != 0) {
+    if (strcmp(form.setup_pwd, setup_password) != 0) {
         ESP_LOGW(TAG, "Invalid setup password");
         httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Invalid password");
         return ESP_FAIL;
     }
     
-    // Extract CSRF token
-    char *csrf_start = strstr(buf, "csrf=");
-    if (csrf_start) {
-        csrf_start += 5;
-        char *csrf_end = strchr(csrf_start, '&');
-        int len = csrf_end ? csrf_end - csrf_start : strlen(csrf_start);
-        len = len > 15 ? 15 : len;
-        strncpy(csrf_str, csrf_start, len);
-    }
-    
-    uint32_t received_csrf = strtoul(csrf_str, NULL, 16);
+    uint32_t received_csrf = strtoul(form.csrf, NULL, 16);
     if (received_csrf != current_csrf_token) {
         ESP_LOGW(TAG, "CSRF token mismatch");
         httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Invalid request");
         return ESP_FAIL;
     }
     
-    // Extract WiFi credentials
-    char *ssid_start = strstr(buf, "ssid=");
-    char *password_start = strstr(buf, "password=");
-    
-    if (!ssid_start || !password_start) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing data");
+    if (portal_save_form_truncated(&form)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Value too long");
         return ESP_FAIL;
     }
-    
-    // Extract SSID
-    ssid_start += 5;
-    char *ssid_end = strchr(ssid_start, '&');
-    if (ssid_end) {
-        int len = ssid_end - ssid_start;
-        len = len > WIFI_SSID_MAX_LEN - 1 ? WIFI_SSID_MAX_LEN - 1 : len;
-        strncpy(creds.ssid, ssid_start, len);
-        url_decode(creds.ssid);
+    if (form.creds.ssid[0] == '\0' && form.remove_ssid[0] == '\0' && form.gw_mac[0] == '\0') {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "SSID required");
+        return ESP_FAIL;
     }
     
-    // Extract Password  
-    password_start += 9;
-    char *password_end = strchr(password_start, '&');
-    int len = password_end ? password_end - password_start : strlen(password_start);
-    len = len > WIFI_PASSWORD_MAX_LEN - 1 ? WIFI_PASSWORD_MAX_LEN - 1 : len;
-    strncpy(creds.password, password_start, len);
-    url_decode(creds.password);
+    // Pair the ESP-NOW gateway, independent of the networks
+    if (form.gw_mac[0] != '\0') {
+        wifi_setup_gateway_t gateway;
+        if (!portal_parse_gateway(&form, &gateway)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid gateway");
+            return ESP_FAIL;
+        }
+        if (wifi_setup_set_gateway(&gateway) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Save failed");
+            return ESP_FAIL;
+        }
+    }
     
-    // Validate credentials
-    if (strlen(creds.ssid) == 0) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "SSID required");
-        return ESP_FAIL;
+    // Remove a saved network, the others stay
+    if (form.remove_ssid[0] != '\0') {
+        esp_err_t err = wifi_setup_remove_network(form.remove_ssid);
+        if (err != ESP_OK && err != ESP_ERR_NOT_FOUND) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Save failed");
+            return ESP_FAIL;
+        }
+        if (form.creds.ssid[0] == '\0') {
+            httpd_resp_set_type(req, "text/html");
+            return httpd_resp_send(req, removed_html, HTTPD_RESP_USE_STRLEN);
+        }
+    }
+    if (form.creds.ssid[0] == '\0') {
+        httpd_resp_set_type(req, "text/html");
+        return httpd_resp_send(req, paired_html, HTTPD_RESP_USE_STRLEN);
     }
     
-    ESP_LOGI(TAG, "Received WiFi credentials: SSID='%s'", creds.ssid);
+    ESP_LOGI(TAG, "Received WiFi credentials: SSID='%s'", form.creds.ssid);
     
-    // Save to NVS
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    // Add to the stored networks
+    esp_err_t err = wifi_setup_add_network(&form.creds);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Save failed");
         return ESP_FAIL;
     }
-    
-    nvs_set_str(nvs_handle, NVS_SSID_KEY, creds.ssid);
-    nvs_set_str(nvs_handle, NVS_PASSWORD_KEY, creds.password);
-    nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
     ESP_LOGI(TAG, "WiFi credentials saved");
     
     // Send success response
     httpd_resp_set_type(req, "text/html");
     httpd_resp_send(req, success_html, strlen(success_html));
     
-    // Start WiFi connection in background task
-    wifi_credentials_t* creds_copy = malloc(sizeof(wifi_credentials_t));
-	if (creds_copy) {
-		memcpy(creds_copy, &creds, sizeof(wifi_credentials_t));
-		xTaskCreate(wifi_connect_task, "wifi_connect", 4096, creds_copy, 5, NULL);
-	} else {
-		ESP_LOGE(TAG, "Failed to allocate memory for credentials");
-		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory error");
-    return ESP_FAIL;
-	}
+    // The worker stops the portal and connects once the page is out
+    wifi_cmd_t cmd = { .type = CMD_CREDENTIALS, .time_us = esp_timer_get_time() };
+    worker_post(&cmd);
     
     return ESP_OK;
 }
 
+static uint32_t warm_ctx_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&warm_ctx, offsetof(warm_ctx_t, crc));
+}
+
+static bool warm_ctx_valid(void)
+{
+    return rtc_copy_stamp_valid(&warm_ctx.stamp, WARM_CTX_MAGIC) && warm_ctx.crc == warm_ctx_crc();
+}
+
+// Runs every command to its end before taking the next one, so the state needs no locking
+static void worker_main(void* param)
+{
+    wifi_cmd_t cmd;
+    
+    for (;;) {
+        if (xQueueReceive(worker_queue, &cmd, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        esp_err_t err = worker_execute(&cmd);
+        if (cmd.done) {
+            *cmd.result = err;
+            xSemaphoreGive(cmd.done);
+        }
+    }
+}
+
+static esp_err_t worker_start(void)
+{
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+    worker_queue = xQueueCreateStatic(WORKER_QUEUE_LEN, sizeof(wifi_cmd_t), worker_queue_storage, &worker_queue_buffer);
+    worker_task = xTaskCreateStaticPinnedToCore(worker_main, "wifi_setup", WORKER_STACK, NULL, WORKER_PRIORITY,
+                                                worker_stack, &worker_task_buffer, WORKER_CORE);
+#else
+    worker_queue = xQueueCreate(WORKER_QUEUE_LEN, sizeof(wifi_cmd_t));
+    if (worker_queue && xTaskCreatePinnedToCore(worker_main, "wifi_setup", WORKER_STACK, NULL, WORKER_PRIORITY,
+                                                &worker_task, WORKER_CORE) != pdPASS) {
+        worker_task = NULL;
+    }
+#endif
+    return worker_queue && worker_task ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Run a command on the worker and wait for its result; inline when already on the worker
+static esp_err_t worker_call(wifi_cmd_t* cmd)
+{
+    if (!worker_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cmd->time_us = esp_timer_get_time();
+    if (xTaskGetCurrentTaskHandle() == worker_task) {
+        return worker_execute(cmd);
+    }
+    
+    StaticSemaphore_t done_buffer;
+    esp_err_t result = ESP_FAIL;
+    cmd->done = xSemaphoreCreateBinaryStatic(&done_buffer);
+    cmd->result = &result;
+    xQueueSend(worker_queue, cmd, portMAX_DELAY);
+    xSemaphoreTake(cmd->done, portMAX_DELAY);
+    vSemaphoreDelete(cmd->done);
+    return result;
+}
+
+// Hand a command to the worker without waiting; for the event loop, esp_timer and httpd tasks
+static void worker_post(const wifi_cmd_t* cmd)
+{
+    if (!worker_queue || xQueueSend(worker_queue, cmd, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Worker queue full, command %d dropped", cmd->type);
+    }
+}
+
 esp_err_t wifi_setup_init(void)
 {
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+    // NVS is brought up lazily, only when credentials have to be read from or written to flash
+    if (!wifi_event_group) {
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+        wifi_event_group = xEventGroupCreateStatic(&wifi_event_group_buffer);
+#else
+        wifi_event_group = xEventGroupCreate();
+#endif
+        power_manager_lock_create(POWER_MANAGER_LOCK_CPU_MAX, "wifi_connect", &connect_pm_lock);
+        power_manager_lock_create(POWER_MANAGER_LOCK_CPU_MAX, "httpd", &httpd_pm_lock);
+    }
+    if (!worker_task) {
+        esp_err_t err = worker_start();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "No worker task");
+            return err;
+        }
     }
-    ESP_ERROR_CHECK(ret);
     
-    wifi_event_group = xEventGroupCreate();
+    if (warm_ctx_valid()) {
+        memcpy(setup_password, warm_ctx.setup_password, sizeof(setup_password));
+        ESP_LOGI(TAG, "WiFi Setup initialized (warm)");
+        return ESP_OK;
+    }
     
     // Generate setup password from MAC
-    ret = generate_setup_password(setup_password);
+    esp_err_t ret = generate_setup_password(setup_password);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to generate setup password");
         return ret;
     }
     
+    memset(&warm_ctx, 0, sizeof(warm_ctx));
+    rtc_copy_stamp(&warm_ctx.stamp, WARM_CTX_MAGIC);
+    memcpy(warm_ctx.setup_password, setup_password, sizeof(warm_ctx.setup_password));
+    warm_ctx.crc = warm_ctx_crc();
+    
     ESP_LOGI(TAG, "WiFi Setup initialized. Setup password: %s", setup_password);
     return ESP_OK;
 }
 
 bool wifi_setup_has_credentials(void)
 {
-    nvs_handle_t nvs_handle;
-    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
-        return false;
-    }
-    
-    size_t required_size;
-    esp_err_t err = nvs_get_str(nvs_handle, NVS_SSID_KEY, NULL, &required_size);
-    nvs_close(nvs_handle);
-    
-    return (err == ESP_OK && required_size > 1);
+    return cred_store_load() == ESP_OK && cred_store_count() > 0;
 }
 
 esp_err_t wifi_setup_get_credentials(wifi_credentials_t* creds)
 {
     if (!creds) return ESP_ERR_INVALID_ARG;
     
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    esp_err_t err = cred_store_load();
     if (err != ESP_OK) return err;
     
-    size_t ssid_len = sizeof(creds->ssid);
-    size_t password_len = sizeof(creds->password);
+    return wifi_setup_get_network(cred_store_preferred(), creds);
+}
+
+esp_err_t wifi_setup_add_network(const wifi_credentials_t* creds)
+{
+    if (!creds || creds->ssid[0] == '\0') return ESP_ERR_INVALID_ARG;
     
-    err = nvs_get_str(nvs_handle, NVS_SSID_KEY, creds->ssid, &ssid_len);
+    esp_err_t err = cred_store_load();
     if (err == ESP_OK) {
-        err = nvs_get_str(nvs_handle, NVS_PASSWORD_KEY, creds->password, &password_len);
+        err = cred_store_add(creds->ssid, creds->password);
+    }
+    if (err == ESP_OK && strncmp(fast_cache.ssid, creds->ssid, sizeof(fast_cache.ssid)) == 0) {
+        wifi_setup_invalidate_fast_connect();
     }
+    return err;
+}
+
+esp_err_t wifi_setup_remove_network(const char* ssid)
+{
+    if (!ssid) return ESP_ERR_INVALID_ARG;
     
-    nvs_close(nvs_handle);
+    esp_err_t err = cred_store_load();
+    if (err == ESP_OK) {
+        err = cred_store_remove(ssid);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Removed network '%s'", ssid);
+        if (strncmp(fast_cache.ssid, ssid, sizeof(fast_cache.ssid)) == 0) {
+            wifi_setup_invalidate_fast_connect();
+        }
+    }
     return err;
 }
 
-esp_err_t wifi_setup_start_portal(wifi_setup_callback_t callback)
+size_t wifi_setup_get_network_count(void)
+{
+    return (cred_store_load() == ESP_OK) ? cred_store_count() : 0;
+}
+
+esp_err_t wifi_setup_get_network(size_t index, wifi_credentials_t* creds)
+{
+    if (!creds) return ESP_ERR_INVALID_ARG;
+    
+    const cred_store_entry_t* entry = cred_store_get(index);
+    if (!entry) return ESP_ERR_NOT_FOUND;
+    
+    memcpy(creds->ssid, entry->ssid, sizeof(creds->ssid));
+    memcpy(creds->password, entry->password, sizeof(creds->password));
+    return ESP_OK;
+}
+
+static esp_err_t portal_start(wifi_setup_callback_t callback)
 {
     setup_callback = callback;
     current_state = WIFI_SETUP_STATE_PORTAL_RUNNING;
+    xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT | WIFI_PORTAL_DONE_BIT);
     stay_connected_flag = false;
     
     ESP_LOGI(TAG, "Starting secure WiFi setup portal...");
     ESP_LOGI(TAG, "Setup password: %s", setup_password);
     
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(network_init());
     
     ap_netif = esp_netif_create_default_wifi_ap();
     
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(wifi_driver_init());
     
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
@@ -492,27 +1364,58 @@ esp_err_t wifi_setup_start_portal(wifi_setup_callback_t callback)
     
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    ESP_ERROR_CHECK(wifi_radio_start());
+    radio_state(true);
+    deep_sleep_manager_portal_state(true);
     
     ESP_LOGI(TAG, "WiFi AP started: %s (Password: %s)", wifi_config.ap.ssid, setup_password);
     
-    // Start timeout for portal (5 minutes)
-    start_timeout_task(PORTAL_TIMEOUT_MS);
+    // Captive portal: DHCP hands out the AP as DNS server, which resolves every name to itself
+    esp_netif_ip_info_t ap_ip;
+    esp_netif_get_ip_info(ap_netif, &ap_ip);
+    esp_netif_dns_info_t dns_info = {0};
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    dns_info.ip.u_addr.ip4 = ap_ip.ip;
+    uint8_t dhcps_offer = OFFER_DNS;
+    esp_netif_dhcps_stop(ap_netif);
+    esp_netif_dhcps_option(ap_netif, ESP_NETIF_OP_SET, ESP_NETIF_DOMAIN_NAME_SERVER, &dhcps_offer, sizeof(dhcps_offer));
+    esp_netif_set_dns_info(ap_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+    esp_netif_dhcps_start(ap_netif);
+    captive_dns_start(ap_ip.ip);
+    
+    // Start timeout for portal (2 minutes)
+    timeout_arm(WIFI_TIMEOUT_PORTAL, PORTAL_TIMEOUT_MS);
     
     // Start HTTP server
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.stack_size = PORTAL_HTTPD_STACK;
     config.lru_purge_enable = true;
     config.server_port = 80;
+    config.max_uri_handlers = 12;
+    config.uri_match_fn = httpd_uri_match_wildcard;
     
     if (httpd_start(&server, &config) == ESP_OK) {
-        httpd_uri_t setup_uri = {.uri = "/", .method = HTTP_GET, .handler = setup_get_handler};
-        httpd_uri_t save_uri = {.uri = "/save", .method = HTTP_POST, .handler = save_post_handler};
+        httpd_uri_t setup_uri = {.uri = "/", .method = HTTP_GET, .handler = locked_handler, .user_ctx = setup_get_handler};
+        httpd_uri_t save_uri = {.uri = "/save", .method = HTTP_POST, .handler = locked_handler, .user_ctx = save_post_handler};
+        httpd_uri_t css_uri = {.uri = PORTAL_CSS_URI, .method = HTTP_GET, .handler = locked_handler, .user_ctx = css_get_handler};
         
         httpd_register_uri_handler(server, &setup_uri);
         httpd_register_uri_handler(server, &save_uri);
+        httpd_register_uri_handler(server, &css_uri);
         
-        ESP_LOGI(TAG, "Secure setup portal running at http://192.168.4.1");
-        ESP_LOGI(TAG, "Portal will timeout in 5 minutes");
+        // Connectivity checks (Android, iOS/macOS, Windows), then the wildcard - must stay last
+        static const char* redirect_uris[] = {
+            "/generate_204", "/gen_204", "/hotspot-detect.html",
+            "/connecttest.txt", "/ncsi.txt", "/redirect", "/*",
+        };
+        for (size_t i = 0; i < sizeof(redirect_uris) / sizeof(redirect_uris[0]); i++) {
+            httpd_uri_t redirect_uri = {.uri = redirect_uris[i], .method = HTTP_GET,
+                                        .handler = locked_handler, .user_ctx = redirect_get_handler};
+            httpd_register_uri_handler(server, &redirect_uri);
+        }
+        
+        ESP_LOGI(TAG, "Secure setup portal running at " PORTAL_URL);
+        ESP_LOGI(TAG, "Portal will timeout in 2 minutes");
     } else {
         return ESP_FAIL;
     }
@@ -520,17 +1423,22 @@ esp_err_t wifi_setup_start_portal(wifi_setup_callback_t callback)
     return ESP_OK;
 }
 
-void wifi_setup_stop_portal(void)
+static void portal_stop(void)
 {
-    stop_timeout_task();
+    timeout_cancel(WIFI_TIMEOUT_PORTAL);
+    captive_dns_stop();
     
     if (server) {
+        memory_sample_named(TRACK_HTTPD);
         httpd_stop(server);
         server = NULL;
     }
     
     esp_wifi_stop();
+    memory_sample_named(TRACK_WIFI);
     esp_wifi_deinit();
+    deep_sleep_manager_portal_state(false);
+    radio_state(false);
     
     if (ap_netif) {
         esp_netif_destroy_default_wifi(ap_netif);
@@ -541,89 +1449,466 @@ void wifi_setup_stop_portal(void)
     ESP_LOGI(TAG, "WiFi setup portal stopped");
 }
 
-esp_err_t wifi_setup_connect(wifi_setup_callback_t callback, bool stay_connected)
+esp_err_t wifi_setup_start_portal(wifi_setup_callback_t callback)
+{
+    wifi_cmd_t cmd = { .type = CMD_START_PORTAL, .portal_callback = callback };
+    return worker_call(&cmd);
+}
+
+void wifi_setup_stop_portal(void)
+{
+    wifi_cmd_t cmd = { .type = CMD_STOP_PORTAL };
+    worker_call(&cmd);
+}
+
+esp_err_t wifi_setup_prepare_radio(void)
+{
+    esp_err_t err;
+    
+    // Initialize networking if not already done
+    if (!esp_netif_get_default_netif()) {
+        err = network_init();
+        if (err != ESP_OK) {
+            return err;
+        }
+        
+        err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL);
+        if (err == ESP_OK) {
+            err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL);
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    
+    // Create STA interface
+    if (!sta_netif) {
+        sta_netif = esp_netif_create_default_wifi_sta();
+        if (!sta_netif) {
+            return ESP_FAIL;
+        }
+        
+        err = wifi_driver_init();
+        if (err != ESP_OK) {
+            esp_netif_destroy_default_wifi(sta_netif);
+            sta_netif = NULL;
+            return err;
+        }
+        wake_timing_mark("wifi_init");
+    }
+    
+    return ESP_OK;
+}
+
+esp_err_t wifi_setup_load_credentials(void)
+{
+    return cred_store_load();
+}
+
+static esp_err_t connect_start(wifi_setup_callback_t callback, bool stay_connected,
+                               const wifi_setup_connect_profile_t* connect_profile)
 {
     if (current_state == WIFI_SETUP_STATE_CONNECTED) {
         ESP_LOGW(TAG, "WiFi already connected");
         return ESP_ERR_INVALID_STATE;
     }
     
-    if (!wifi_setup_has_credentials()) {
+    // One nvs_get_blob() per boot for all stored networks
+    esp_err_t err = cred_store_load();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get WiFi credentials: %s", esp_err_to_name(err));
+        return err;
+    }
+    if (cred_store_count() == 0) {
         ESP_LOGE(TAG, "No WiFi credentials stored");
         return ESP_ERR_NOT_FOUND;
     }
     
-    wifi_credentials_t creds;
-    esp_err_t err = wifi_setup_get_credentials(&creds);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get WiFi credentials: %s", esp_err_to_name(err));
-        return err;
+    profile = connect_profile ? *connect_profile : (wifi_setup_connect_profile_t){0};
+    if (!profile.retry_budget_ms) {
+        profile.retry_budget_ms = RETRY_BUDGET_MS;
+    }
+    if (!profile.retry_backoff_ms) {
+        profile.retry_backoff_ms = RETRY_BACKOFF_MS;
+    }
+    if (!profile.connect_budget_ms) {
+        profile.connect_budget_ms = CONNECT_BUDGET_MS;
+    }
+    if (!profile.listen_interval) {
+        profile.listen_interval = LISTEN_INTERVAL_DEFAULT;
     }
     
     setup_callback = callback;
     stay_connected_flag = stay_connected;
     current_state = WIFI_SETUP_STATE_CONNECTING;
+    xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
     wifi_retry_num = 0;
+    candidate_count = 0;
+    candidate_pos = 0;
+    scan_pending = false;
+    const cred_store_entry_t* fast_entry = cred_store_find(fast_cache.ssid);
+    fast_attempt = fast_entry && fast_cache_valid(fast_entry->ssid);
+    for (size_t i = 0; fast_attempt && i < cred_store_count(); i++) {
+        if (cred_store_get(i) == fast_entry) {
+            fast_network = i;
+        }
+    }
     
-    ESP_LOGI(TAG, "Connecting to WiFi: %s (stay_connected: %s)", 
-             creds.ssid, stay_connected ? "true" : "false");
+    portENTER_CRITICAL(&metrics_lock);
+    memset(&metrics, 0, sizeof(metrics));
+    attempt = NULL;
+    portEXIT_CRITICAL(&metrics_lock);
+    metrics_started = true;
+    pending_scan_us = 0;
+    connect_start_us = esp_timer_get_time();
     
-    // Initialize networking if not already done
-    if (!esp_netif_get_default_netif()) {
-        ESP_ERROR_CHECK(esp_netif_init());
-        ESP_ERROR_CHECK(esp_event_loop_create_default());
-        
-        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
-        ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
-    }
+    ESP_LOGI(TAG, "Connecting to WiFi: %u stored networks (stay_connected: %s, fast: %s)", 
+             (unsigned)cred_store_count(), stay_connected ? "true" : "false", fast_attempt ? "true" : "false");
     
-    // Create STA interface
-    if (!sta_netif) {
-        sta_netif = esp_netif_create_default_wifi_sta();
-        
-        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-        ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-    }
+    // Nothing left to do if the bring-up already ran it
+    ESP_ERROR_CHECK(wifi_setup_prepare_radio());
     
-    // Configure WiFi
+    // Configure WiFi; without fast path the network is chosen on STA start
     wifi_config_t wifi_config = {};
-    strncpy((char*)wifi_config.sta.ssid, creds.ssid, sizeof(wifi_config.sta.ssid));
-    strncpy((char*)wifi_config.sta.password, creds.password, sizeof(wifi_config.sta.password));
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    
+    if (fast_attempt) {
+        strncpy((char*)wifi_config.sta.ssid, fast_entry->ssid, sizeof(wifi_config.sta.ssid));
+        strncpy((char*)wifi_config.sta.password, fast_entry->password, sizeof(wifi_config.sta.password));
+        // Skip the all-channel scan and DHCP: go straight to the cached AP
+        memcpy(wifi_config.sta.bssid, fast_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = fast_cache.channel;
+        wifi_config.sta.threshold.authmode = fast_cache.authmode;
+        if (stay_connected && profile.power_save == WIFI_SETUP_PS_MAX_MODEM) {
+            wifi_config.sta.listen_interval = profile.listen_interval;
+        }
+        esp_netif_dhcpc_stop(sta_netif);
+    } else {
+        esp_netif_dhcpc_start(sta_netif);
+    }
     
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    connect_work(true);
+    ESP_ERROR_CHECK(wifi_radio_start());
+    radio_state(true);
+    wake_timing_mark("wifi_start");
+    
+    // Both only take effect once the driver runs
+    if (profile.max_tx_power && esp_wifi_set_max_tx_power(profile.max_tx_power) != ESP_OK) {
+        ESP_LOGW(TAG, "TX power %d not accepted", profile.max_tx_power);
+    }
+    if (stay_connected && profile.power_save != WIFI_SETUP_PS_DEFAULT) {
+        static const wifi_ps_type_t ps_types[] = {
+            [WIFI_SETUP_PS_NONE] = WIFI_PS_NONE,
+            [WIFI_SETUP_PS_MIN_MODEM] = WIFI_PS_MIN_MODEM,
+            [WIFI_SETUP_PS_MAX_MODEM] = WIFI_PS_MAX_MODEM,
+        };
+        esp_wifi_set_ps(ps_types[profile.power_save]);
+    }
+    
+    if (fast_attempt) {
+        timeout_arm(WIFI_TIMEOUT_FAST, fast_connect_budget_ms);
+    }
+    timeout_arm(WIFI_TIMEOUT_BUDGET, profile.connect_budget_ms);
     
     ESP_LOGI(TAG, "WiFi connection attempt started");
     return ESP_OK;
 }
 
-void wifi_setup_disconnect(void)
+esp_err_t wifi_setup_connect(wifi_setup_callback_t callback, bool stay_connected)
+{
+    return wifi_setup_connect_ex(callback, stay_connected, NULL);
+}
+
+esp_err_t wifi_setup_connect_ex(wifi_setup_callback_t callback, bool stay_connected,
+                                const wifi_setup_connect_profile_t* connect_profile)
+{
+    wifi_cmd_t cmd = {
+        .type = CMD_CONNECT,
+        .connect = {
+            .callback = callback,
+            .stay_connected = stay_connected,
+            .has_profile = connect_profile != NULL,
+        },
+    };
+    if (connect_profile) {
+        cmd.connect.profile = *connect_profile;
+    }
+    return worker_call(&cmd);
+}
+
+esp_err_t wifi_setup_get_connect_metrics(wifi_setup_connect_metrics_t* out)
+{
+    if (!out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!metrics_started) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    portENTER_CRITICAL(&metrics_lock);
+    *out = metrics;
+    portEXIT_CRITICAL(&metrics_lock);
+    return ESP_OK;
+}
+
+esp_err_t wifi_setup_get_memory_stats(wifi_setup_memory_stats_t* stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // The DNS task samples itself before it ends
+    for (size_t i = TRACK_WORKER; i < WIFI_SETUP_MEMORY_TASKS; i++) {
+        memory_sample_named(i);
+    }
+    
+    memset(stats, 0, sizeof(*stats));
+    stats->free_heap = esp_get_free_heap_size();
+    stats->min_free_heap = esp_get_minimum_free_heap_size();
+    stats->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#if CONFIG_WIFI_SETUP_STATIC_ALLOC
+    stats->static_alloc = true;
+#endif
+    stats->task_count = WIFI_SETUP_MEMORY_TASKS;
+    
+    uint32_t dns_min_free = captive_dns_min_free_stack();
+    portENTER_CRITICAL(&memory_lock);
+    if (dns_min_free) {
+        memory_record(TRACK_DNS, dns_min_free);
+    }
+    for (size_t i = 0; i < WIFI_SETUP_MEMORY_TASKS; i++) {
+        stats->tasks[i].name = tracked_tasks[i].name;
+        stats->tasks[i].stack_size = tracked_tasks[i].stack_size;
+        stats->tasks[i].min_free_stack = task_min_free[i];
+        stats->tasks[i].sampled = task_sampled[i];
+    }
+    portEXIT_CRITICAL(&memory_lock);
+    return ESP_OK;
+}
+
+void wifi_setup_log_memory(void)
+{
+    wifi_setup_memory_stats_t stats;
+    
+    wifi_setup_get_memory_stats(&stats);
+    ESP_LOGI(TAG, "Heap %lu free, %lu min, %lu largest block (%s)", stats.free_heap, stats.min_free_heap,
+             stats.largest_free_block, stats.static_alloc ? "static tasks" : "heap tasks");
+    for (size_t i = 0; i < stats.task_count; i++) {
+        const wifi_setup_task_memory_t* task = &stats.tasks[i];
+        if (!task->sampled) {
+            continue;
+        }
+        if (task->stack_size) {
+            ESP_LOGI(TAG, "  %-12s stack %5lu / %5lu used", task->name,
+                     task->stack_size - MIN(task->min_free_stack, task->stack_size), task->stack_size);
+        } else {
+            ESP_LOGI(TAG, "  %-12s stack %5lu free min", task->name, task->min_free_stack);
+        }
+    }
+}
+
+esp_err_t wifi_setup_connect_wait(uint32_t timeout_ms, esp_netif_ip_info_t* ip_info)
+{
+    if (!wifi_event_group) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (current_state != WIFI_SETUP_STATE_CONNECTING && current_state != WIFI_SETUP_STATE_CONNECTED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                           pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    if (bits & WIFI_CONNECTED_BIT) {
+        if (ip_info && sta_netif) {
+            esp_netif_get_ip_info(sta_netif, ip_info);
+        }
+        return ESP_OK;
+    }
+    
+    return (bits & WIFI_FAIL_BIT) ? ESP_FAIL : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t wifi_setup_portal_wait(uint32_t timeout_ms)
+{
+    if (!wifi_event_group) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_PORTAL_DONE_BIT,
+                                           pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    if (!(bits & WIFI_PORTAL_DONE_BIT)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    
+    return (bits & WIFI_CONNECTED_BIT) ? ESP_OK : ESP_FAIL;
+}
+
+static void disconnect(void)
 {
     ESP_LOGI(TAG, "Disconnecting WiFi");
     cleanup_wifi_resources();
     
     if (setup_callback) {
-        setup_callback(false, NULL); // Notify disconnection
+        setup_callback(false, NULL, WIFI_SETUP_PATH_NONE); // Notify disconnection
     }
 }
 
+// Portal saved a network: keep the AP until the success page is out, then connect
+static void credentials_received(void)
+{
+    if (current_state != WIFI_SETUP_STATE_PORTAL_RUNNING) {
+        return;
+    }
+    
+    // Bridge the gap between portal shutdown and the connect attempt
+    if (handoff_token == DSM_AWAKE_TOKEN_INVALID) {
+        handoff_token = deep_sleep_manager_stay_awake("wifi_connect");
+    }
+    timeout_cancel(WIFI_TIMEOUT_PORTAL);
+    timeout_arm(WIFI_TIMEOUT_HANDOFF, HANDOFF_DELAY_MS);
+}
+
+static void handoff_connect(void)
+{
+    portal_stop();
+    
+    // Default: auto-disconnect after timeout
+    esp_err_t err = connect_start(setup_callback, false, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start WiFi connection");
+        xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT | WIFI_PORTAL_DONE_BIT);
+        if (setup_callback) {
+            setup_callback(false, NULL, WIFI_SETUP_PATH_NONE);
+        }
+    }
+    handoff_release();
+}
+
+// ESP-NOW report: station started on the gateway channel, never associated
+static esp_err_t report_send(uint8_t type, const uint8_t* payload, size_t len)
+{
+    if (current_state == WIFI_SETUP_STATE_PORTAL_RUNNING || current_state == WIFI_SETUP_STATE_CONNECTING ||
+        current_state == WIFI_SETUP_STATE_CONNECTED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    esp_err_t err = espnow_link_load();
+    if (err == ESP_OK && !espnow_link_gateway()) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    connect_work(true);
+    err = wifi_setup_prepare_radio();
+    if (err == ESP_OK) {
+        err = esp_wifi_set_mode(WIFI_MODE_STA);
+    }
+    if (err == ESP_OK) {
+        err = wifi_radio_start();
+    }
+    if (err == ESP_OK) {
+        radio_state(true);
+        wake_timing_mark("wifi_start");
+        err = espnow_link_send(type, payload, len);
+        wake_timing_mark("report");
+    }
+    
+    // Down right away; a fallback upload brings the radio up again with its own config
+    current_state = WIFI_SETUP_STATE_IDLE;
+    cleanup_wifi_resources();
+    return err;
+}
+
+static esp_err_t worker_execute(wifi_cmd_t* cmd)
+{
+    switch (cmd->type) {
+        case CMD_START_PORTAL:
+            return portal_start(cmd->portal_callback);
+        case CMD_STOP_PORTAL:
+            handoff_release();
+            portal_stop();
+            return ESP_OK;
+        case CMD_CREDENTIALS:
+            credentials_received();
+            return ESP_OK;
+        case CMD_CONNECT:
+            return connect_start(cmd->connect.callback, cmd->connect.stay_connected,
+                                 cmd->connect.has_profile ? &cmd->connect.profile : NULL);
+        case CMD_DISCONNECT:
+            disconnect();
+            return ESP_OK;
+        case CMD_TIMEOUT:
+            timeout_expired(cmd->timeout.id, cmd->timeout.generation);
+            return ESP_OK;
+        case CMD_WIFI_EVENT:
+        case CMD_GOT_IP:
+            wifi_event_process(cmd);
+            return ESP_OK;
+        case CMD_REPORT:
+            return report_send(cmd->report.type, cmd->report.payload, cmd->report.len);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+void wifi_setup_disconnect(void)
+{
+    wifi_cmd_t cmd = { .type = CMD_DISCONNECT };
+    worker_call(&cmd);
+}
+
 esp_err_t wifi_setup_clear_credentials(void)
 {
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    esp_err_t err = cred_store_clear();
     if (err != ESP_OK) return err;
-    
-    nvs_erase_key(nvs_handle, NVS_SSID_KEY);
-    nvs_erase_key(nvs_handle, NVS_PASSWORD_KEY);
-    nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
+    wifi_setup_invalidate_fast_connect();
     
     ESP_LOGI(TAG, "WiFi credentials cleared");
     return ESP_OK;
 }
 
+esp_err_t wifi_setup_set_gateway(const wifi_setup_gateway_t* gateway)
+{
+    if (!gateway || gateway->channel < 1 || gateway->channel > 13) return ESP_ERR_INVALID_ARG;
+    
+    esp_err_t err = espnow_link_pair(gateway);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Gateway " MACSTR " paired on channel %u", MAC2STR(gateway->mac), gateway->channel);
+    }
+    return err;
+}
+
+esp_err_t wifi_setup_clear_gateway(void)
+{
+    esp_err_t err = espnow_link_unpair();
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Gateway cleared");
+    }
+    return err;
+}
+
+bool wifi_setup_has_gateway(void)
+{
+    return espnow_link_load() == ESP_OK && espnow_link_gateway() != NULL;
+}
+
+esp_err_t wifi_setup_report(uint8_t type, const void* payload, size_t len)
+{
+    if (len > WIFI_SETUP_REPORT_MAX_PAYLOAD || (len > 0 && !payload)) return ESP_ERR_INVALID_ARG;
+    
+    wifi_cmd_t cmd = {
+        .type = CMD_REPORT,
+        .report = { .type = type, .len = len },
+    };
+    if (len > 0) {
+        memcpy(cmd.report.payload, payload, len);
+    }
+    return worker_call(&cmd);
+}
+
 wifi_setup_state_t wifi_setup_get_state(void)
 {
     return current_state;
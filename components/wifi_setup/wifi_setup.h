@@ -4,6 +4,8 @@
 #include "esp_err.h"
 #include "esp_netif.h"  // Add this include for esp_netif_ip_info_t
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,6 +13,9 @@ extern "C" {
 
 #define WIFI_SSID_MAX_LEN 32
 #define WIFI_PASSWORD_MAX_LEN 64
+#define WIFI_SETUP_MAX_NETWORKS 4
+#define WIFI_SETUP_GATEWAY_KEY_LEN 16
+#define WIFI_SETUP_REPORT_MAX_PAYLOAD 32
 
 /**
  * @brief WiFi credentials structure for storing network information
@@ -20,6 +25,18 @@ typedef struct {
     char password[WIFI_PASSWORD_MAX_LEN]; ///< Network password
 } wifi_credentials_t;
 
+/**
+ * @brief Mains-powered ESP-NOW gateway for wifi_setup_report()
+ *
+ * Paired through the setup portal; the same key is entered on the gateway
+ * together with the device MAC the portal shows.
+ */
+typedef struct {
+    uint8_t mac[6];                 ///< Gateway station MAC
+    uint8_t channel;                ///< WiFi channel the gateway listens on (1-13)
+    uint8_t key[WIFI_SETUP_GATEWAY_KEY_LEN]; ///< Shared HMAC-SHA256 key of the frames
+} wifi_setup_gateway_t;
+
 /**
  * @brief WiFi setup component states
  */
@@ -32,32 +49,155 @@ typedef enum {
     WIFI_SETUP_STATE_DISABLED       ///< WiFi completely disabled to save power
 } wifi_setup_state_t;
 
+/**
+ * @brief Connection path used to reach the WiFi network
+ */
+typedef enum {
+    WIFI_SETUP_PATH_NONE,           ///< No connection (failure, timeout or disconnect)
+    WIFI_SETUP_PATH_FULL,           ///< Full scan, association and DHCP
+    WIFI_SETUP_PATH_FAST            ///< Cached BSSID/channel and static IP from RTC memory
+} wifi_setup_connect_path_t;
+
 /**
  * @brief Callback function type for WiFi setup completion events
  * @param success true if WiFi connection successful, false on failure/timeout
  * @param ip_info IP address information when connected (NULL on failure)
+ * @param path Connection path that succeeded (WIFI_SETUP_PATH_NONE on failure)
+ * 
+ * @note Runs in the wifi_setup worker task; the wifi_setup API may be called from it
+ */
+typedef void (*wifi_setup_callback_t)(bool success, esp_netif_ip_info_t* ip_info,
+                                      wifi_setup_connect_path_t path);
+
+/**
+ * @brief How the station searches for the AP of a stored network
+ */
+typedef enum {
+    WIFI_SETUP_SCAN_FAST,           ///< Driver stops at the first AP with a matching SSID
+    WIFI_SETUP_SCAN_KNOWN_CHANNEL,  ///< Only the channel of the last connection, all channels if none matches
+    WIFI_SETUP_SCAN_ALL_CHANNEL     ///< All channels, AP picked by the sort method
+} wifi_setup_scan_t;
+
+/**
+ * @brief Which AP wins when several carry the same SSID
+ */
+typedef enum {
+    WIFI_SETUP_SORT_SIGNAL,         ///< Strongest RSSI
+    WIFI_SETUP_SORT_SECURITY        ///< Strongest auth mode, then RSSI
+} wifi_setup_sort_t;
+
+/**
+ * @brief Radio power save while a stay_connected session is up
+ */
+typedef enum {
+    WIFI_SETUP_PS_DEFAULT,          ///< Leave the driver default
+    WIFI_SETUP_PS_NONE,             ///< Radio always on, lowest latency
+    WIFI_SETUP_PS_MIN_MODEM,        ///< Modem sleep, wake for every DTIM beacon
+    WIFI_SETUP_PS_MAX_MODEM         ///< Modem sleep, wake every listen_interval beacons
+} wifi_setup_ps_t;
+
+/**
+ * @brief Connect profile for wifi_setup_connect_ex()
+ * 
+ * Zero-initialized fields select the defaults, which are the behaviour of
+ * wifi_setup_connect().
+ */
+typedef struct {
+    wifi_setup_scan_t scan;         ///< AP search, default WIFI_SETUP_SCAN_FAST
+    wifi_setup_sort_t sort;         ///< AP choice, default WIFI_SETUP_SORT_SIGNAL
+    int8_t min_rssi;                ///< Ignore weaker APs (dBm), 0 = no threshold
+    int8_t max_tx_power;            ///< TX power limit in 0.25 dBm (8..84), 0 = driver default
+    uint32_t retry_budget_ms;       ///< Retries per network until this has passed, 0 = 5 s
+    uint32_t retry_backoff_ms;      ///< Delay before the first retry, doubled per retry, 0 = 250 ms
+    uint32_t connect_budget_ms;     ///< All networks together, 0 = 30 s
+    wifi_setup_ps_t power_save;     ///< Only applied with stay_connected
+    uint16_t listen_interval;       ///< Beacons per wake for WIFI_SETUP_PS_MAX_MODEM, 0 = 3
+} wifi_setup_connect_profile_t;
+
+#define WIFI_SETUP_MAX_ATTEMPTS 8
+
+/**
+ * @brief One association attempt of a connect
+ * 
+ * Durations in µs. The driver reports no event between authentication and
+ * association, so both are in assoc_us; with a scanned BSSID that is all
+ * it contains, otherwise it includes the driver's own scan as well.
+ */
+typedef struct {
+    uint8_t network;                ///< Credential store index
+    uint8_t channel;                ///< Channel the attempt was pinned to, 0 = driver scan
+    int8_t rssi;                    ///< Scanned RSSI, 0 if not scanned
+    bool fast;                      ///< Fast reconnect attempt
+    uint16_t reason;                ///< wifi_err_reason_t of the disconnect, 0 if none
+    uint32_t scan_us;               ///< Candidate scan right before this attempt, 0 = none
+    uint32_t assoc_us;              ///< esp_wifi_connect() until associated, 0 if never
+    uint32_t dhcp_us;               ///< Associated until IP, 0 if never
+} wifi_setup_attempt_t;
+
+/**
+ * @brief Per-attempt metrics of the last connect
+ */
+typedef struct {
+    bool success;                   ///< Connect ended with an IP
+    bool done;                      ///< Connect has ended (success or failure)
+    uint8_t attempt_count;          ///< Valid entries in attempts
+    uint8_t dropped;                ///< Attempts beyond WIFI_SETUP_MAX_ATTEMPTS
+    uint32_t total_us;              ///< Connect call until IP or failure
+    wifi_setup_attempt_t attempts[WIFI_SETUP_MAX_ATTEMPTS];
+} wifi_setup_connect_metrics_t;
+
+#define WIFI_SETUP_MEMORY_TASKS 8
+
+/**
+ * @brief Stack high-watermark of one task the component runs on
+ */
+typedef struct {
+    const char* name;               ///< FreeRTOS task name
+    uint32_t stack_size;            ///< Configured stack in bytes, 0 = not known here
+    uint32_t min_free_stack;        ///< Lowest free stack in bytes seen this wake
+    bool sampled;                   ///< Task existed at least once when sampled
+} wifi_setup_task_memory_t;
+
+/**
+ * @brief Heap and stack low-water marks since boot (= this wake)
+ * 
+ * Short-lived tasks are sampled right before they end, the system tasks
+ * at every call and before the WiFi driver is torn down.
  */
-typedef void (*wifi_setup_callback_t)(bool success, esp_netif_ip_info_t* ip_info);
+typedef struct {
+    uint32_t free_heap;             ///< Free heap now
+    uint32_t min_free_heap;         ///< Lowest free heap since boot
+    uint32_t largest_free_block;    ///< Largest allocatable 8-bit block now, shows fragmentation
+    bool static_alloc;              ///< Built with CONFIG_WIFI_SETUP_STATIC_ALLOC
+    uint8_t task_count;             ///< Valid entries in tasks
+    wifi_setup_task_memory_t tasks[WIFI_SETUP_MEMORY_TASKS];
+} wifi_setup_memory_stats_t;
 
 /**
  * @brief Initialize the WiFi setup component
  * 
  * Performs initial setup including:
- * - NVS (Non-Volatile Storage) initialization for credential storage
  * - Generates unique setup password based on device MAC address
  * - Creates necessary FreeRTOS event groups for WiFi state management
+ * - Starts the worker task that runs portal, connect, timeouts and WiFi events
+ *   one after another; event handlers and timers only queue work for it
+ * 
+ * The setup password and the decoded credentials are kept in RTC memory,
+ * validated by CRC and firmware build ID. Wakes from deep sleep reuse them;
+ * NVS is only initialized on cold boot or when credentials change.
  * 
  * @return esp_err_t ESP_OK on successful initialization, error code otherwise
  * 
  * @note This function must be called before any other WiFi setup functions
- * @note The generated setup password will be logged for user reference
+ * @note The setup password is logged only when it is generated (cold boot)
+ * @note With PHY calibration data in NVS, starting WiFi still initializes NVS
  */
 esp_err_t wifi_setup_init(void);
 
 /**
  * @brief Check if WiFi credentials are stored in non-volatile memory
  * 
- * Queries NVS storage to determine if valid WiFi credentials have been
+ * Queries NVS storage to determine if at least one network has been
  * previously saved during a setup session.
  * 
  * @return true if valid credentials exist in storage, false otherwise
@@ -71,7 +211,8 @@ bool wifi_setup_has_credentials(void);
  * @brief Retrieve stored WiFi credentials from non-volatile memory
  * 
  * Reads previously saved WiFi network credentials from NVS storage
- * and populates the provided structure.
+ * and populates the provided structure. With several stored networks
+ * the one that connected most recently is returned.
  * 
  * @param creds Pointer to wifi_credentials_t structure to fill with stored data
  * @return esp_err_t ESP_OK if credentials retrieved successfully
@@ -84,6 +225,46 @@ bool wifi_setup_has_credentials(void);
  */
 esp_err_t wifi_setup_get_credentials(wifi_credentials_t* creds);
 
+/**
+ * @brief Add a network to the credential store or update its password
+ * 
+ * Up to WIFI_SETUP_MAX_NETWORKS networks are kept in one versioned,
+ * CRC-protected NVS blob. When the list is full, the network with the
+ * oldest successful connection is replaced. Other networks are kept.
+ * 
+ * @param creds SSID and password of the network
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_INVALID_ARG if creds is NULL or the SSID is empty
+ *                   Other ESP error codes for NVS access failures
+ */
+esp_err_t wifi_setup_add_network(const wifi_credentials_t* creds);
+
+/**
+ * @brief Remove one network from the credential store, keeping the others
+ * 
+ * @param ssid Network name
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_NOT_FOUND if the network is not stored
+ *                   Other ESP error codes for NVS access failures
+ */
+esp_err_t wifi_setup_remove_network(const char* ssid);
+
+/**
+ * @brief Get the number of stored networks
+ * 
+ * @return size_t Number of networks (0 .. WIFI_SETUP_MAX_NETWORKS)
+ */
+size_t wifi_setup_get_network_count(void);
+
+/**
+ * @brief Retrieve one stored network by index
+ * 
+ * @param index Index from 0 to wifi_setup_get_network_count() - 1
+ * @param creds Pointer to wifi_credentials_t structure to fill
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if index is out of range
+ */
+esp_err_t wifi_setup_get_network(size_t index, wifi_credentials_t* creds);
+
 /**
  * @brief Start the WiFi setup captive portal for credential input
  * 
@@ -94,7 +275,9 @@ esp_err_t wifi_setup_get_credentials(wifi_credentials_t* creds);
  * - Creates "ESP32-WiFi-Setup" network with MAC-based password protection
  * - Serves responsive web interface at http://192.168.4.1
  * - Implements CSRF protection and rate limiting for security
- * - Automatically times out after 5 minutes if unused
+ * - Answers every DNS query with the AP address and redirects OS connectivity
+ *   checks to the setup page, so phones open the captive-portal popup right away
+ * - Automatically times out after 2 minutes if unused
  * - Transitions to STA mode and connects after credential submission
  * 
  * @param callback Function to call when setup completes or times out
@@ -103,6 +286,8 @@ esp_err_t wifi_setup_get_credentials(wifi_credentials_t* creds);
  * @note Portal automatically stops and connects to submitted network
  * @note Connection attempt times out after 30 seconds unless stay_connected=true
  * @note Only one client can connect to setup portal simultaneously
+ * @note Holds a deep_sleep_manager stay-awake token while the radio is on
+ * @note Runs on the worker task; returns once the portal is up
  */
 esp_err_t wifi_setup_start_portal(wifi_setup_callback_t callback);
 
@@ -138,15 +323,164 @@ void wifi_setup_stop_portal(void);
  * @param stay_connected If true, maintain connection; if false, auto-disconnect after 30s
  * @return esp_err_t ESP_OK if connection attempt started successfully
  *                   ESP_ERR_NOT_FOUND if no credentials are stored
- *                   ESP_ERR_INVALID_STATE if already connected
+ *                   ESP_ERR_INVALID_STATE if already connected or wifi_setup_init() was not called
  *                   Other ESP error codes for initialization failures
  * 
+ * Fast reconnect:
+ * - After every successful connection the AP BSSID, channel, auth mode and
+ *   the assigned IP/gateway/netmask/DNS are cached in RTC memory (CRC protected)
+ * - The next call connects directly to that BSSID/channel with a static IP,
+ *   skipping the scan and DHCP exchange
+ * - If the fast attempt does not get an IP within the fast-connect budget the
+ *   cache is dropped and the full scan/DHCP path is used instead
+ * - The path that succeeded is reported through the callback
+ * 
  * @note Requires credentials to be stored via wifi_setup_start_portal() first
- * @note Connection attempts are retried up to 3 times before failing
+ * Multiple networks:
+ * - With more than one stored network, a scan picks the candidates in range
+ * - Candidates are ordered by RSSI, with a bonus for the network that
+ *   connected most recently; stored networks not seen in the scan go last
+ * - Candidates are tried in order within one overall connect budget
+ * 
+ * @note Each candidate is retried with backoff for up to 5 s before moving on
  * @note Callback is invoked for both success and failure scenarios
+ * @note Holds a deep_sleep_manager stay-awake token until WiFi is shut down
  */
 esp_err_t wifi_setup_connect(wifi_setup_callback_t callback, bool stay_connected);
 
+/**
+ * @brief Connect to the stored WiFi networks with a tuned profile
+ * 
+ * Same as wifi_setup_connect(), with the AP search, RSSI threshold, retry
+ * timing, TX power and power save of the attempt taken from profile.
+ * 
+ * Retries:
+ * - A disconnect before IP retries the same network after retry_backoff_ms,
+ *   doubling the delay for every further retry
+ * - Once retry_budget_ms has passed since the first attempt on a network,
+ *   the next candidate network is tried instead
+ * 
+ * Every association attempt is recorded; see wifi_setup_get_connect_metrics().
+ * 
+ * @param callback Optional connection result callback
+ * @param stay_connected Keep the connection up instead of disconnecting after a timeout
+ * @param profile Connect profile (NULL = defaults); copied, need not stay valid
+ * @return esp_err_t Same as wifi_setup_connect()
+ * 
+ * @note power_save and listen_interval only apply with stay_connected
+ */
+esp_err_t wifi_setup_connect_ex(wifi_setup_callback_t callback, bool stay_connected,
+                                const wifi_setup_connect_profile_t* profile);
+
+/**
+ * @brief Per-attempt metrics of the current or last connect
+ * 
+ * @param metrics Destination
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_INVALID_ARG if metrics is NULL
+ *                   ESP_ERR_NOT_FOUND if no connect was started since boot
+ */
+esp_err_t wifi_setup_get_connect_metrics(wifi_setup_connect_metrics_t* metrics);
+
+/**
+ * @brief Heap and per-task stack high-watermarks of this wake
+ * 
+ * Covers the component's own tasks (worker, captive DNS, HTTP server) and
+ * the system tasks its code runs in (event loop, lwIP, esp_timer, WiFi
+ * driver, main). Use it to size stacks and buffers from real data.
+ * 
+ * @param stats Destination
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_INVALID_ARG if stats is NULL
+ */
+esp_err_t wifi_setup_get_memory_stats(wifi_setup_memory_stats_t* stats);
+
+/**
+ * @brief Log wifi_setup_get_memory_stats(), one line per task
+ * 
+ * @note Call once per wake, right before sleep, to see the peaks
+ */
+void wifi_setup_log_memory(void);
+
+/**
+ * @brief Bring up netif, event loop and the WiFi driver without starting the radio
+ * 
+ * The part of wifi_setup_connect() that needs neither NVS nor credentials,
+ * split out so it can run on one core while the other loads the credentials.
+ * wifi_setup_connect() calls it itself; calling it first is optional.
+ * 
+ * @return esp_err_t ESP_OK on success or if already prepared
+ *                   Other ESP error codes for initialization failures
+ * 
+ * @note PHY calibration is not part of this; it runs when the radio starts
+ * @note Runs in the caller, not on the worker, so it may overlap wifi_setup_init()
+ */
+esp_err_t wifi_setup_prepare_radio(void);
+
+/**
+ * @brief Load the stored networks ahead of wifi_setup_connect()
+ * 
+ * Reads the RTC copy on warm wakes, otherwise NVS. Later calls that need
+ * the networks reuse the loaded copy.
+ * 
+ * @return esp_err_t ESP_OK on success (also with no networks stored)
+ *                   Other ESP error codes for NVS failures
+ */
+esp_err_t wifi_setup_load_credentials(void);
+
+/**
+ * @brief Block until the connection attempt started by wifi_setup_connect() is decided
+ * 
+ * Returns as soon as an IP address is assigned or the attempt has failed,
+ * so callers can connect, transfer and disconnect without fixed delays.
+ * Returns immediately if already connected.
+ * 
+ * @param timeout_ms Maximum time to wait in milliseconds
+ * @param ip_info Optional destination for the assigned IP configuration
+ * @return esp_err_t ESP_OK when connected
+ *                   ESP_FAIL if the attempt failed or WiFi was shut down
+ *                   ESP_ERR_TIMEOUT if no outcome within timeout_ms
+ *                   ESP_ERR_INVALID_STATE if no attempt is in progress
+ * 
+ * @note The connection stays up after return; call wifi_setup_disconnect() when done
+ */
+esp_err_t wifi_setup_connect_wait(uint32_t timeout_ms, esp_netif_ip_info_t* ip_info);
+
+/**
+ * @brief Block until the setup portal has finished
+ * 
+ * The portal is finished when it timed out or when submitted credentials
+ * led to a successful or failed connection attempt.
+ * 
+ * @param timeout_ms Maximum time to wait in milliseconds
+ * @return esp_err_t ESP_OK if credentials were submitted and the connection succeeded
+ *                   ESP_FAIL if the portal timed out or the connection failed
+ *                   ESP_ERR_TIMEOUT if the portal is still running after timeout_ms
+ *                   ESP_ERR_INVALID_STATE if wifi_setup_init() was not called
+ */
+esp_err_t wifi_setup_portal_wait(uint32_t timeout_ms);
+
+/**
+ * @brief Set the time budget for the fast reconnect attempt
+ * 
+ * The fast path (cached BSSID/channel and static IP) is abandoned in favour of
+ * the full scan/DHCP path if no IP is obtained within this budget.
+ * 
+ * @param budget_ms Budget in milliseconds, 0 disables fast reconnect
+ * 
+ * @note Default is 1500 ms
+ */
+void wifi_setup_set_fast_connect_budget(uint32_t budget_ms);
+
+/**
+ * @brief Drop the fast reconnect cache held in RTC memory
+ * 
+ * The next wifi_setup_connect() call will use the full scan/DHCP path.
+ * 
+ * @note Called automatically when credentials are saved or cleared
+ */
+void wifi_setup_invalidate_fast_connect(void);
+
 /**
  * @brief Immediately disconnect from WiFi and disable radio
  * 
@@ -163,15 +497,16 @@ esp_err_t wifi_setup_connect(wifi_setup_callback_t callback, bool stay_connected
  * @note Safe to call regardless of current WiFi state
  * @note Does not delete stored credentials - use wifi_setup_clear_credentials()
  * @note WiFi can be re-enabled later via wifi_setup_connect()
+ * @note Runs on the worker task; returns once the radio is down
  */
 void wifi_setup_disconnect(void);
 
 /**
  * @brief Delete stored WiFi credentials from non-volatile memory
  * 
- * Permanently removes saved network credentials from NVS storage.
- * Use this to reset the device to factory WiFi settings or when
- * switching to a different network.
+ * Permanently removes all saved networks from NVS storage.
+ * Use this to reset the device to factory WiFi settings. To drop a
+ * single network use wifi_setup_remove_network().
  * 
  * @return esp_err_t ESP_OK if credentials cleared successfully
  *                   Error codes for NVS access failures
@@ -182,6 +517,57 @@ void wifi_setup_disconnect(void);
  */
 esp_err_t wifi_setup_clear_credentials(void);
 
+/**
+ * @brief Pair the ESP-NOW gateway, replacing the previous one
+ * 
+ * Kept in NVS and, for wakes from deep sleep, in RTC memory. The portal
+ * calls this when its optional gateway fields are filled in.
+ * 
+ * @param gateway MAC, channel and key of the gateway
+ * @return esp_err_t ESP_OK on success
+ *                   ESP_ERR_INVALID_ARG if gateway is NULL or the channel is not 1-13
+ *                   Other ESP error codes for NVS access failures
+ */
+esp_err_t wifi_setup_set_gateway(const wifi_setup_gateway_t* gateway);
+
+/**
+ * @brief Forget the paired ESP-NOW gateway
+ * 
+ * @return esp_err_t ESP_OK on success, NVS error code otherwise
+ */
+esp_err_t wifi_setup_clear_gateway(void);
+
+/**
+ * @brief Check if an ESP-NOW gateway is paired
+ * 
+ * @return true if wifi_setup_report() has a gateway to send to
+ */
+bool wifi_setup_has_gateway(void);
+
+/**
+ * @brief Send a short event to the paired gateway over ESP-NOW
+ * 
+ * Brings the radio up in station mode on the gateway channel without
+ * associating, sends one frame signed with the gateway key and waits for the
+ * gateway's signed ACK, with a few bounded retries. The radio is torn down
+ * before returning. Takes tens of milliseconds instead of the seconds of a
+ * wifi_setup_connect().
+ * 
+ * @param type Event type, same numbering as the event queue
+ * @param payload Payload bytes
+ * @param len Payload length, at most WIFI_SETUP_REPORT_MAX_PAYLOAD
+ * @return esp_err_t ESP_OK once the gateway acknowledged the event
+ *                   ESP_ERR_TIMEOUT if no valid ACK arrived
+ *                   ESP_ERR_NOT_FOUND if no gateway is paired
+ *                   ESP_ERR_INVALID_STATE while the portal or a connection holds the radio,
+ *                   or if wifi_setup_init() was not called
+ *                   Other ESP error codes for driver or NVS failures
+ * 
+ * @note Anything but ESP_OK means the gateway may not have the event; queue it for upload
+ * @note Runs on the worker task; returns once the radio is down
+ */
+esp_err_t wifi_setup_report(uint8_t type, const void* payload, size_t len);
+
 /**
  * @brief Get current state of the WiFi setup component
  * 
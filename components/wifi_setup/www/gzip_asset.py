@@ -0,0 +1,13 @@
+#!/usr/bin/env python3
+"""Gzip a portal asset at build time (mtime 0 so the output is reproducible)."""
+import gzip
+import sys
+
+if len(sys.argv) != 3:
+    sys.exit('usage: gzip_asset.py <input> <output>')
+
+with open(sys.argv[1], 'rb') as src:
+    data = src.read()
+
+with open(sys.argv[2], 'wb') as dst:
+    dst.write(gzip.compress(data, compresslevel=9, mtime=0))
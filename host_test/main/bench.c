@@ -0,0 +1,27 @@
+#include "bench.h"
+#include <stdio.h>
+#include <time.h>
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double bench_run(const char* name, uint32_t iterations, void (*fn)(void* ctx), void* ctx)
+{
+    // Warm up caches and branch predictors before timing
+    for (uint32_t i = 0; i < iterations / 10 + 1; i++) {
+        fn(ctx);
+    }
+    
+    int64_t start = monotonic_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        fn(ctx);
+    }
+    double ns = (double)(monotonic_ns() - start) / iterations;
+    
+    printf("BENCH %-32s %10.1f ns/op (%lu runs)\n", name, ns, (unsigned long)iterations);
+    return ns;
+}
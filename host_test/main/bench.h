@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/**
+ * @brief Run fn iterations times and print the time per call
+ *
+ * Host CPU time, only comparable between runs on the same machine; the
+ * numbers are printed, never checked.
+ *
+ * @return double Nanoseconds per call
+ */
+double bench_run(const char* name, uint32_t iterations, void (*fn)(void* ctx), void* ctx);
+
+#endif // BENCH_H
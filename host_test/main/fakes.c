@@ -0,0 +1,364 @@
+#include "fakes.h"
+#include "dsm_private.h"
+#include "switch.h"
+#include "wake_timing.h"
+#include "esp_sleep.h"
+#include "esp_bit_defs.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
+#include "esp_private/esp_clk.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "ulp.h"
+#include "ulp_switch_monitor.h"
+#include <stdbool.h>
+#include <string.h>
+
+static int64_t clock_us;
+static uint64_t rtc_base_us;
+static esp_sleep_wakeup_cause_t wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+static uint64_t wakeup_ext1_pins;
+static uint64_t ext1_mask;
+// Idle levels: switch open (pull-up), everything else low
+static int gpio_levels[GPIO_NUM_MAX] = {
+    [SWITCH_GPIO] = 1,
+};
+static char trace[FAKE_TRACE_LEN];
+
+void fake_clock_set_us(int64_t now_us)
+{
+    clock_us = now_us;
+}
+
+void fake_rtc_set_base_us(uint64_t base_us)
+{
+    rtc_base_us = base_us;
+}
+
+void fake_wakeup_set(esp_sleep_wakeup_cause_t cause, uint64_t ext1_pins)
+{
+    wakeup_cause = cause;
+    wakeup_ext1_pins = ext1_pins;
+}
+
+void fake_gpio_set_level(gpio_num_t gpio, int level)
+{
+    gpio_levels[gpio] = level;
+}
+
+uint64_t fake_ext1_mask(void)
+{
+    return ext1_mask;
+}
+
+void fake_trace_reset(void)
+{
+    trace[0] = '\0';
+    ext1_mask = 0;
+}
+
+void fake_trace(const char* call)
+{
+    size_t len = strlen(trace);
+    if (len + 1 + strlen(call) < sizeof(trace)) {
+        if (len) {
+            trace[len++] = ' ';
+        }
+        strcpy(&trace[len], call);
+    }
+}
+
+const char* fake_trace_get(void)
+{
+    return trace;
+}
+
+// esp_timer, clock
+
+int64_t esp_timer_get_time(void)
+{
+    return clock_us;
+}
+
+uint64_t esp_clk_rtc_time(void)
+{
+    return rtc_base_us + clock_us;
+}
+
+// esp_sleep
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+    return wakeup_cause;
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    fake_trace("timer_wakeup");
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t gpio_num, int level)
+{
+    fake_trace("ext0_wakeup");
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup_io(uint64_t io_mask, esp_sleep_ext1_wakeup_mode_t level_mode)
+{
+    fake_trace("ext1_wakeup");
+    ext1_mask = io_mask;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ulp_wakeup(void)
+{
+    return ESP_OK;
+}
+
+uint64_t esp_sleep_get_ext1_wakeup_status(void)
+{
+    return wakeup_cause == ESP_SLEEP_WAKEUP_EXT1 ? wakeup_ext1_pins : 0;
+}
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option)
+{
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+    fake_trace("deep_sleep");
+}
+
+// GPIO, RTC GPIO
+
+esp_err_t gpio_config(const gpio_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_levels[gpio_num];
+}
+
+bool rtc_gpio_is_valid_gpio(gpio_num_t gpio_num)
+{
+    // ESP32: RTC_GPIO0..17
+    static const uint64_t rtc_pins = BIT64(0) | BIT64(2) | BIT64(4) | BIT64(12) | BIT64(13) | BIT64(14) |
+                                     BIT64(15) | BIT64(25) | BIT64(26) | BIT64(27) | BIT64(32) | BIT64(33) |
+                                     BIT64(34) | BIT64(35) | BIT64(36) | BIT64(37) | BIT64(38) | BIT64(39);
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX && (rtc_pins & BIT64(gpio_num));
+}
+
+esp_err_t rtc_gpio_init(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t rtc_gpio_deinit(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+uint32_t rtc_gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_levels[gpio_num];
+}
+
+esp_err_t rtc_gpio_set_direction(gpio_num_t gpio_num, rtc_gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t rtc_gpio_pullup_en(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t rtc_gpio_pullup_dis(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t rtc_gpio_pulldown_en(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t rtc_gpio_pulldown_dis(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+// ULP, never armed on the host
+
+uint32_t fake_rtc_slow_mem[64];
+uint32_t ulp_entry;
+uint32_t ulp_debounce_samples;
+uint32_t ulp_long_press_ticks;
+uint32_t ulp_wake_press_count;
+uint32_t ulp_tick_lo;
+uint32_t ulp_tick_hi;
+uint32_t ulp_stable_level;
+uint32_t ulp_press_start_lo;
+uint32_t ulp_press_start_hi;
+uint32_t ulp_press_count;
+uint32_t ulp_wake_reason;
+uint32_t ulp_long_press;
+uint32_t ulp_event_count;
+uint32_t ulp_events;
+const uint8_t fake_ulp_bin[4] asm("_binary_ulp_switch_monitor_bin_start");
+const uint8_t fake_ulp_bin_end[1] asm("_binary_ulp_switch_monitor_bin_end");
+
+esp_err_t ulp_load_binary(uint32_t load_addr, const uint8_t* program_binary, size_t program_size_bytes)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t ulp_run(uint32_t entry_point)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t ulp_set_wakeup_period(size_t period_index, uint32_t period_us)
+{
+    return ESP_OK;
+}
+
+void ulp_timer_stop(void)
+{
+}
+
+// NVS: one blob per key, namespaces are not told apart
+
+#define FAKE_NVS_ENTRIES 4
+#define FAKE_NVS_BLOB_MAX 256
+
+static struct {
+    char key[16];
+    size_t len;
+    uint8_t data[FAKE_NVS_BLOB_MAX];
+} nvs_entries[FAKE_NVS_ENTRIES];
+
+void fake_nvs_reset(void)
+{
+    memset(nvs_entries, 0, sizeof(nvs_entries));
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    for (size_t i = 0; i < FAKE_NVS_ENTRIES; i++) {
+        if (nvs_entries[i].key[0] && strcmp(nvs_entries[i].key, key) == 0) {
+            if (!out_value) {
+                *length = nvs_entries[i].len;
+                return ESP_OK;
+            }
+            if (*length < nvs_entries[i].len) {
+                return ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            memcpy(out_value, nvs_entries[i].data, nvs_entries[i].len);
+            *length = nvs_entries[i].len;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    if (length > FAKE_NVS_BLOB_MAX || strlen(key) >= sizeof(nvs_entries[0].key)) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    for (size_t i = 0; i < FAKE_NVS_ENTRIES; i++) {
+        if (!nvs_entries[i].key[0] || strcmp(nvs_entries[i].key, key) == 0) {
+            strcpy(nvs_entries[i].key, key);
+            memcpy(nvs_entries[i].data, value, length);
+            nvs_entries[i].len = length;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NO_FREE_PAGES;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+// Deep sleep manager parts not under test: scheduler, stub, awake tokens
+
+void dsm_scheduler_dispatch(void)
+{
+    fake_trace("jobs");
+}
+
+uint64_t dsm_scheduler_sleep_us(void)
+{
+    return 0;
+}
+
+void dsm_stub_arm(uint64_t sleep_us, const dsm_ulp_config_t* press_config)
+{
+    fake_trace("stub_arm");
+}
+
+bool dsm_stub_collect(dsm_press_stats_t* stats)
+{
+    return false;
+}
+
+void dsm_awake_init(void)
+{
+}
+
+// Switch driver and wake timing
+
+esp_err_t switch_init(void)
+{
+    return ESP_OK;
+}
+
+void switch_disable_events(void)
+{
+}
+
+void switch_journal_add(uint64_t timestamp_us, uint32_t duration_ms, switch_journal_source_t source)
+{
+    fake_trace("journal");
+}
+
+void switch_journal_skip_held_press(void)
+{
+}
+
+void wake_timing_commit(void)
+{
+    fake_trace("timing_commit");
+}
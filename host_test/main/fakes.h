@@ -0,0 +1,36 @@
+#ifndef FAKES_H
+#define FAKES_H
+
+#include "deep_sleep_manager.h"
+#include <stdint.h>
+
+/*
+ * Controls of the host stand-ins (mocks/ and fakes.c). The real sources of
+ * deep_sleep_manager.c, dsm_inputs.c and dsm_energy.c link against them;
+ * the calls of interest are recorded in a trace.
+ */
+
+#define FAKE_TRACE_LEN 256
+
+// esp_timer time since application start; RTC time runs along from fake_rtc_base_us
+void fake_clock_set_us(int64_t now_us);
+void fake_rtc_set_base_us(uint64_t base_us);
+
+// Next esp_sleep_get_wakeup_cause() and, for EXT1, the pins esp_sleep_get_ext1_wakeup_status() reports
+void fake_wakeup_set(esp_sleep_wakeup_cause_t cause, uint64_t ext1_pins);
+
+// Pin level for both the RTC and the normal GPIO driver; the switch idles high, all others low
+void fake_gpio_set_level(gpio_num_t gpio, int level);
+
+// Pins of the last esp_sleep_enable_ext1_wakeup_io() since fake_trace_reset(), 0 = EXT1 not armed
+uint64_t fake_ext1_mask(void);
+
+// Space separated names of the calls since the last fake_trace_reset()
+void fake_trace_reset(void);
+void fake_trace(const char* call);
+const char* fake_trace_get(void);
+
+// Drop the in-memory NVS contents
+void fake_nvs_reset(void);
+
+#endif // FAKES_H
@@ -0,0 +1,28 @@
+#ifndef MOCK_DRIVER_RTC_IO_H
+#define MOCK_DRIVER_RTC_IO_H
+
+// Host stand-in for the RTC GPIO driver
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    RTC_GPIO_MODE_INPUT_ONLY,
+    RTC_GPIO_MODE_OUTPUT_ONLY,
+    RTC_GPIO_MODE_INPUT_OUTPUT,
+    RTC_GPIO_MODE_DISABLED,
+} rtc_gpio_mode_t;
+
+bool rtc_gpio_is_valid_gpio(gpio_num_t gpio_num);
+esp_err_t rtc_gpio_init(gpio_num_t gpio_num);
+esp_err_t rtc_gpio_deinit(gpio_num_t gpio_num);
+uint32_t rtc_gpio_get_level(gpio_num_t gpio_num);
+esp_err_t rtc_gpio_set_direction(gpio_num_t gpio_num, rtc_gpio_mode_t mode);
+esp_err_t rtc_gpio_pullup_en(gpio_num_t gpio_num);
+esp_err_t rtc_gpio_pullup_dis(gpio_num_t gpio_num);
+esp_err_t rtc_gpio_pulldown_en(gpio_num_t gpio_num);
+esp_err_t rtc_gpio_pulldown_dis(gpio_num_t gpio_num);
+
+#endif // MOCK_DRIVER_RTC_IO_H
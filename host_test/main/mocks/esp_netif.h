@@ -0,0 +1,18 @@
+#ifndef MOCK_ESP_NETIF_H
+#define MOCK_ESP_NETIF_H
+
+// Host stand-in, only the types wifi_setup.h uses
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+#endif // MOCK_ESP_NETIF_H
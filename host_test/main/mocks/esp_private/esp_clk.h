@@ -0,0 +1,10 @@
+#ifndef MOCK_ESP_PRIVATE_ESP_CLK_H
+#define MOCK_ESP_PRIVATE_ESP_CLK_H
+
+// Host stand-in: RTC time follows the fake clock (fakes.h)
+
+#include <stdint.h>
+
+uint64_t esp_clk_rtc_time(void);
+
+#endif // MOCK_ESP_PRIVATE_ESP_CLK_H
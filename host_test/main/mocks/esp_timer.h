@@ -0,0 +1,10 @@
+#ifndef MOCK_ESP_TIMER_H
+#define MOCK_ESP_TIMER_H
+
+// Host stand-in: esp_timer time is the fake clock set by the tests (fakes.h)
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif // MOCK_ESP_TIMER_H
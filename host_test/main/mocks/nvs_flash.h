@@ -0,0 +1,10 @@
+#ifndef MOCK_NVS_FLASH_H
+#define MOCK_NVS_FLASH_H
+
+// Host stand-in, see nvs.h
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+
+#endif // MOCK_NVS_FLASH_H
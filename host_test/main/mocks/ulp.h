@@ -0,0 +1,18 @@
+#ifndef MOCK_ULP_H
+#define MOCK_ULP_H
+
+// Host stand-in for the ULP FSM loader
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+extern uint32_t fake_rtc_slow_mem[];
+#define RTC_SLOW_MEM fake_rtc_slow_mem
+
+esp_err_t ulp_load_binary(uint32_t load_addr, const uint8_t* program_binary, size_t program_size_bytes);
+esp_err_t ulp_run(uint32_t entry_point);
+esp_err_t ulp_set_wakeup_period(size_t period_index, uint32_t period_us);
+void ulp_timer_stop(void);
+
+#endif // MOCK_ULP_H
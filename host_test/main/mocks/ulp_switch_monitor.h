@@ -0,0 +1,23 @@
+#ifndef MOCK_ULP_SWITCH_MONITOR_H
+#define MOCK_ULP_SWITCH_MONITOR_H
+
+// Host stand-in for the variables exported by ulp/switch_monitor.S
+
+#include <stdint.h>
+
+extern uint32_t ulp_entry;
+extern uint32_t ulp_debounce_samples;
+extern uint32_t ulp_long_press_ticks;
+extern uint32_t ulp_wake_press_count;
+extern uint32_t ulp_tick_lo;
+extern uint32_t ulp_tick_hi;
+extern uint32_t ulp_stable_level;
+extern uint32_t ulp_press_start_lo;
+extern uint32_t ulp_press_start_hi;
+extern uint32_t ulp_press_count;
+extern uint32_t ulp_wake_reason;
+extern uint32_t ulp_long_press;
+extern uint32_t ulp_event_count;
+extern uint32_t ulp_events;
+
+#endif // MOCK_ULP_SWITCH_MONITOR_H
@@ -0,0 +1,215 @@
+#include "unity.h"
+#include "fakes.h"
+#include "dsm_private.h"
+#include "wake_timing.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Golden test of the energy model: fixed synthetic wake cycles are replayed
+ * through the firmware's own accounting (dsm_energy.c) with the default
+ * current profile, and the charge must stay at the golden value. A failure
+ * means the accounting or the current profile changed, not the wake.
+ *
+ * This is no wake-time regression gate: fixtures/model_cycles.log is written
+ * by hand in wake_timing_dump() format, so a slower wake on the board cannot
+ * show up here. The radio counts as on from "wifi_start" up to the "report"
+ * or "upload" that ends its use. After a deliberate model change, set the
+ * golden values to the printed charge.
+ */
+
+#define ENERGY_GOLDEN_TOLERANCE_PERCENT 1
+#define REPLAY_MAX_CYCLES 8
+
+static const struct {
+    const char* name;
+    double golden_uah;
+} golden[] = {
+    {"boot, no network", 0.502},
+    {"switch, ESP-NOW report", 2.014},
+    {"switch, no ACK, upload", 54.435},
+    {"door, ESP-NOW report", 1.964},
+    {"timer, daily upload", 51.229},
+    {"timer, upload and update", 77.641},
+};
+
+typedef struct {
+    char name[16];
+    uint32_t time_us;
+} replay_mark_t;
+
+typedef struct {
+    char name[32];                  // From the comment line above the record
+    dsm_wake_class_t cls;
+    uint8_t mark_count;
+    replay_mark_t marks[WAKE_TIMING_MAX_MARKS];
+} replay_cycle_t;
+
+static replay_cycle_t cycles[REPLAY_MAX_CYCLES];
+static size_t cycle_count;
+
+// The wake timing classes are kept in the same order as the energy classes
+static const dsm_wake_class_t reason_class[WAKE_TIMING_REASON_COUNT] = {
+    [WAKE_TIMING_REASON_BOOT] = DSM_WAKE_CLASS_BOOT,
+    [WAKE_TIMING_REASON_SWITCH] = DSM_WAKE_CLASS_SWITCH,
+    [WAKE_TIMING_REASON_TIMER] = DSM_WAKE_CLASS_TIMER,
+};
+
+// Reads the records of the fixture once, log prefixes and bring-up lines are skipped
+static void load_cycles(void)
+{
+    if (cycle_count) {
+        return;
+    }
+    
+    FILE* file = fopen(MODEL_CYCLES_PATH, "r");
+    TEST_ASSERT_NOT_NULL_MESSAGE(file, MODEL_CYCLES_PATH " missing");
+    
+    char line[128];
+    char name[sizeof(cycles[0].name)] = "";
+    replay_cycle_t* cycle = NULL;
+    
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#') {
+            snprintf(name, sizeof(name), "%s", &line[1 + strspn(&line[1], " ")]);
+            continue;
+        }
+        const char* text = strstr(line, "WAKE_TIMING: ");
+        text = text ? text + strlen("WAKE_TIMING: ") : line;
+        
+        unsigned reason, count;
+        char mark[sizeof(cycles[0].marks[0].name)];
+        unsigned long time_us, delta_us;
+        if (sscanf(text, "%*s wake #%*u (reason %u, %u marks", &reason, &count) == 2) {
+            TEST_ASSERT_LESS_THAN(REPLAY_MAX_CYCLES, cycle_count);
+            TEST_ASSERT_LESS_THAN(WAKE_TIMING_REASON_COUNT, reason);
+            cycle = &cycles[cycle_count++];
+            memset(cycle, 0, sizeof(*cycle));
+            strcpy(cycle->name, name);
+            cycle->cls = reason_class[reason];
+            name[0] = '\0';
+        } else if (sscanf(text, " %15s %lu us (+%lu us)", mark, &time_us, &delta_us) == 3) {
+            TEST_ASSERT_NOT_NULL_MESSAGE(cycle, "mark before the first record");
+            TEST_ASSERT_LESS_THAN(WAKE_TIMING_MAX_MARKS, cycle->mark_count);
+            replay_mark_t* entry = &cycle->marks[cycle->mark_count++];
+            strcpy(entry->name, mark);
+            entry->time_us = time_us;
+        }
+    }
+    fclose(file);
+    TEST_ASSERT_TRUE(cycle_count > 0);
+}
+
+static const replay_cycle_t* find_cycle(const char* name)
+{
+    for (size_t i = 0; i < cycle_count; i++) {
+        if (strcmp(cycles[i].name, name) == 0) {
+            return &cycles[i];
+        }
+    }
+    return NULL;
+}
+
+// Time of the first mark with that name, 0 if the cycle has none
+static uint32_t mark_us(const replay_cycle_t* cycle, const char* name)
+{
+    for (int i = 0; i < cycle->mark_count; i++) {
+        if (strcmp(cycle->marks[i].name, name) == 0) {
+            return cycle->marks[i].time_us;
+        }
+    }
+    return 0;
+}
+
+// Charge of one replayed wake, as the device would have accounted it
+static double replay(const replay_cycle_t* cycle, uint32_t* awake_ms)
+{
+    dsm_energy_stats_t before, after;
+    
+    fake_clock_set_us(0);
+    dsm_energy_on_boot(cycle->cls);
+    deep_sleep_manager_get_energy_stats(&before);
+    
+    const replay_mark_t* mark = cycle->marks;
+    const replay_mark_t* end = &cycle->marks[cycle->mark_count];
+    for (; mark < end && strcmp(mark->name, "sleep") != 0; mark++) {
+        fake_clock_set_us(mark->time_us);
+        if (strcmp(mark->name, "wifi_start") == 0) {
+            deep_sleep_manager_radio_state(true);
+        } else if (strcmp(mark->name, "report") == 0 || strcmp(mark->name, "upload") == 0) {
+            deep_sleep_manager_radio_state(false);
+        }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(mark < end, "cycle without \"sleep\" mark");
+    fake_clock_set_us(mark->time_us);
+    dsm_energy_on_sleep();
+    
+    // Next wake starts at 0 again, the finished one is in the totals now
+    fake_clock_set_us(0);
+    deep_sleep_manager_get_energy_stats(&after);
+    TEST_ASSERT_EQUAL(before.wakes[cycle->cls], after.wakes[cycle->cls]);
+    
+    *awake_ms = mark->time_us / 1000;
+    return after.wake_charge_uah[cycle->cls] - before.wake_charge_uah[cycle->cls];
+}
+
+static void test_energy_model_golden(void)
+{
+    bool mismatch = false;
+    load_cycles();
+    
+    // Every cycle in the fixture has a golden value and every golden value a cycle
+    TEST_ASSERT_EQUAL(sizeof(golden) / sizeof(golden[0]), cycle_count);
+    for (size_t i = 0; i < sizeof(golden) / sizeof(golden[0]); i++) {
+        const replay_cycle_t* cycle = find_cycle(golden[i].name);
+        TEST_ASSERT_NOT_NULL_MESSAGE(cycle, golden[i].name);
+        
+        uint32_t awake_ms;
+        double charge = replay(cycle, &awake_ms);
+        double change = (charge / golden[i].golden_uah - 1) * 100;
+        bool off = change > ENERGY_GOLDEN_TOLERANCE_PERCENT || change < -ENERGY_GOLDEN_TOLERANCE_PERCENT;
+        
+        printf("MODEL %-28s %5lu ms %8.3f uAh, golden %8.3f uAh (%+.1f%%)%s\n", golden[i].name,
+               (unsigned long)awake_ms, charge, golden[i].golden_uah, change, off ? " MISMATCH" : "");
+        mismatch |= off;
+    }
+    
+    TEST_ASSERT_FALSE_MESSAGE(mismatch, "energy model charge differs from the golden value");
+}
+
+static void test_energy_counts_wakes(void)
+{
+    load_cycles();
+    const replay_cycle_t* timer = find_cycle("timer, daily upload");
+    const replay_cycle_t* report = find_cycle("switch, ESP-NOW report");
+    TEST_ASSERT_NOT_NULL(timer);
+    TEST_ASSERT_NOT_NULL(report);
+    
+    dsm_energy_stats_t before, after;
+    uint32_t awake_ms;
+    
+    deep_sleep_manager_get_energy_stats(&before);
+    replay(timer, &awake_ms);
+    replay(report, &awake_ms);
+    fake_clock_set_us(0);
+    dsm_energy_on_boot(DSM_WAKE_CLASS_BOOT);
+    deep_sleep_manager_get_energy_stats(&after);
+    
+    TEST_ASSERT_EQUAL(before.wakes[DSM_WAKE_CLASS_TIMER] + 1, after.wakes[DSM_WAKE_CLASS_TIMER]);
+    TEST_ASSERT_EQUAL(before.wakes[DSM_WAKE_CLASS_SWITCH] + 1, after.wakes[DSM_WAKE_CLASS_SWITCH]);
+    TEST_ASSERT_EQUAL(before.radio_on_us[DSM_WAKE_CLASS_TIMER] + mark_us(timer, "upload") - mark_us(timer, "wifi_start"),
+                      after.radio_on_us[DSM_WAKE_CLASS_TIMER]);
+    TEST_ASSERT_EQUAL(before.awake_us[DSM_WAKE_CLASS_SWITCH] + mark_us(report, "sleep"),
+                      after.awake_us[DSM_WAKE_CLASS_SWITCH]);
+}
+
+void test_energy_run(void)
+{
+    fake_nvs_reset();
+    fake_rtc_set_base_us(1000000);
+    fake_clock_set_us(0);
+    dsm_energy_on_boot(DSM_WAKE_CLASS_BOOT);
+    RUN_TEST(test_energy_counts_wakes);
+    RUN_TEST(test_energy_model_golden);
+}
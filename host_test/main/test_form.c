@@ -0,0 +1,199 @@
+#include "unity.h"
+#include "bench.h"
+#include "form_parser.h"
+#include "portal.h"
+#include <string.h>
+
+// What the portal posts: all fields, escaped the way browsers do
+static const char save_body[] =
+    "setup_pwd=Ab3%24kP9q&ssid=Caf%C3%A9+Guest+%26+Co&password=p%40ss+w%3Drd%21"
+    "&remove=&gw_mac=24%3A6f%3A28%3Aa1%3Ab2%3Ac3&gw_channel=6"
+    "&gw_key=00112233445566778899aabbccddeeff&csrf=1a2b3c4d";
+
+static esp_err_t parse_chunked(portal_save_form_t* form, const char* body, size_t chunk)
+{
+    portal_save_form_init(form);
+    
+    size_t len = strlen(body);
+    esp_err_t err = ESP_OK;
+    for (size_t pos = 0; pos < len && err == ESP_OK; pos += chunk) {
+        size_t n = len - pos < chunk ? len - pos : chunk;
+        err = form_parser_feed(&form->parser, &body[pos], n);
+    }
+    if (err == ESP_OK) {
+        err = form_parser_finish(&form->parser);
+    }
+    return err;
+}
+
+static esp_err_t parse_one(const char* body, char* dest, size_t size, form_field_t* out)
+{
+    form_field_t field = {.key = "v", .dest = dest, .size = size};
+    form_parser_t parser;
+    form_parser_init(&parser, &field, 1);
+    
+    esp_err_t err = form_parser_feed(&parser, body, strlen(body));
+    if (err == ESP_OK) {
+        err = form_parser_finish(&parser);
+    }
+    if (out) {
+        *out = field;
+    }
+    return err;
+}
+
+static void test_url_decode(void)
+{
+    char value[32];
+    TEST_ASSERT_EQUAL(ESP_OK, parse_one("v=a%20b+c%2B%26%3d", value, sizeof(value), NULL));
+    TEST_ASSERT_EQUAL_STRING("a b c+&=", value);
+    
+    // '=' inside the value is data, lower and upper case hex digits both work
+    TEST_ASSERT_EQUAL(ESP_OK, parse_one("v=x=y%2f%2F", value, sizeof(value), NULL));
+    TEST_ASSERT_EQUAL_STRING("x=y//", value);
+    
+    TEST_ASSERT_EQUAL(ESP_OK, parse_one("v=", value, sizeof(value), NULL));
+    TEST_ASSERT_EQUAL_STRING("", value);
+}
+
+static void test_url_decode_malformed(void)
+{
+    char value[32];
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parse_one("v=%G1", value, sizeof(value), NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parse_one("v=%1", value, sizeof(value), NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parse_one("v=%", value, sizeof(value), NULL));
+    // An encoded NUL would cut the C string short
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parse_one("v=ab%00cd", value, sizeof(value), NULL));
+}
+
+static void test_url_decode_truncated(void)
+{
+    char value[8];
+    form_field_t field;
+    TEST_ASSERT_EQUAL(ESP_OK, parse_one("v=0123456789", value, sizeof(value), &field));
+    TEST_ASSERT_TRUE(field.found);
+    TEST_ASSERT_TRUE(field.truncated);
+    TEST_ASSERT_EQUAL_STRING("0123456", value);
+}
+
+static void test_save_form_fields(void)
+{
+    portal_save_form_t form;
+    TEST_ASSERT_EQUAL(ESP_OK, parse_chunked(&form, save_body, sizeof(save_body)));
+    
+    TEST_ASSERT_EQUAL_STRING("Ab3$kP9q", form.setup_pwd);
+    TEST_ASSERT_EQUAL_STRING("1a2b3c4d", form.csrf);
+    TEST_ASSERT_EQUAL_STRING("Caf\xC3\xA9 Guest & Co", form.creds.ssid);
+    TEST_ASSERT_EQUAL_STRING("p@ss w=rd!", form.creds.password);
+    TEST_ASSERT_TRUE(form.fields[PORTAL_FIELD_REMOVE].found);
+    TEST_ASSERT_EQUAL_STRING("", form.remove_ssid);
+    TEST_ASSERT_EQUAL_STRING("24:6f:28:a1:b2:c3", form.gw_mac);
+    TEST_ASSERT_FALSE(portal_save_form_truncated(&form));
+}
+
+static void test_save_form_any_split(void)
+{
+    // The server hands the body over in arbitrary pieces, escapes included
+    portal_save_form_t whole;
+    TEST_ASSERT_EQUAL(ESP_OK, parse_chunked(&whole, save_body, sizeof(save_body)));
+    
+    for (size_t chunk = 1; chunk < 16; chunk++) {
+        portal_save_form_t split;
+        TEST_ASSERT_EQUAL(ESP_OK, parse_chunked(&split, save_body, chunk));
+        TEST_ASSERT_EQUAL_STRING(whole.setup_pwd, split.setup_pwd);
+        TEST_ASSERT_EQUAL_STRING(whole.creds.ssid, split.creds.ssid);
+        TEST_ASSERT_EQUAL_STRING(whole.creds.password, split.creds.password);
+        TEST_ASSERT_EQUAL_STRING(whole.gw_key, split.gw_key);
+        TEST_ASSERT_EQUAL_STRING(whole.csrf, split.csrf);
+    }
+}
+
+static void test_save_form_unknown_and_repeated(void)
+{
+    portal_save_form_t form;
+    TEST_ASSERT_EQUAL(ESP_OK, parse_chunked(&form,
+        "x=1&ssid=first&a_key_much_longer_than_any_field_name_we_know=2&ssid=second&flag", 64));
+    
+    TEST_ASSERT_EQUAL_STRING("second", form.creds.ssid);
+    TEST_ASSERT_FALSE(form.fields[PORTAL_FIELD_PASSWORD].found);
+    TEST_ASSERT_EQUAL_STRING("", form.creds.password);
+}
+
+static void test_save_form_too_long(void)
+{
+    portal_save_form_t form;
+    TEST_ASSERT_EQUAL(ESP_OK, parse_chunked(&form, "ssid=0123456789012345678901234567890123456789", 64));
+    TEST_ASSERT_TRUE(portal_save_form_truncated(&form));
+    TEST_ASSERT_EQUAL(WIFI_SSID_MAX_LEN - 1, strlen(form.creds.ssid));
+}
+
+static bool gateway_from(const char* mac, const char* channel, const char* key, wifi_setup_gateway_t* gateway)
+{
+    portal_save_form_t form;
+    portal_save_form_init(&form);
+    strcpy(form.gw_mac, mac);
+    strcpy(form.gw_channel, channel);
+    strcpy(form.gw_key, key);
+    return portal_parse_gateway(&form, gateway);
+}
+
+static void test_gateway(void)
+{
+    static const char key[] = "00112233445566778899aabbccddeeff";
+    const uint8_t mac[6] = {0x24, 0x6f, 0x28, 0xa1, 0xb2, 0xc3};
+    const uint8_t key_bytes[WIFI_SETUP_GATEWAY_KEY_LEN] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+    };
+    wifi_setup_gateway_t gateway;
+    
+    TEST_ASSERT_TRUE(gateway_from("24:6F:28:a1:b2:c3", "13", key, &gateway));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(mac, gateway.mac, sizeof(mac));
+    TEST_ASSERT_EQUAL(13, gateway.channel);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(key_bytes, gateway.key, sizeof(key_bytes));
+    TEST_ASSERT_TRUE(gateway_from("24-6f-28-a1-b2-c3", "1", key, &gateway));
+    
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2", "6", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c", "6", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("246f:28:a1:b2:c3", "6", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:cg", "6", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c3", "0", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c3", "14", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c3", "6x", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c3", "", key, &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c3", "6", "00112233445566778899aabbccddeef", &gateway));
+    TEST_ASSERT_FALSE(gateway_from("24:6f:28:a1:b2:c3", "6", "00112233445566778899aabbccddeefg", &gateway));
+}
+
+static void bench_decode(void* ctx)
+{
+    char value[64];
+    parse_one(ctx, value, sizeof(value), NULL);
+}
+
+static void bench_save_form(void* ctx)
+{
+    // Chunk size of save_post_handler()
+    portal_save_form_t form;
+    parse_chunked(&form, save_body, 128);
+}
+
+static void test_form_bench(void)
+{
+    bench_run("url_decode plain (40 B)", 200000, bench_decode, "v=abcdefghijklmnopqrstuvwxyz0123456789");
+    bench_run("url_decode escaped (40 B)", 200000, bench_decode,
+              "v=%61%62%63%64%65%66%67%68%69%6A%6B%6C%6D");
+    bench_run("save form, 128 B chunks", 100000, bench_save_form, NULL);
+}
+
+void test_form_run(void)
+{
+    RUN_TEST(test_url_decode);
+    RUN_TEST(test_url_decode_malformed);
+    RUN_TEST(test_url_decode_truncated);
+    RUN_TEST(test_save_form_fields);
+    RUN_TEST(test_save_form_any_split);
+    RUN_TEST(test_save_form_unknown_and_repeated);
+    RUN_TEST(test_save_form_too_long);
+    RUN_TEST(test_gateway);
+    RUN_TEST(test_form_bench);
+}
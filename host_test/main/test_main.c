@@ -0,0 +1,26 @@
+#include "unity.h"
+#include <stdlib.h>
+
+void test_form_run(void);
+void test_portal_run(void);
+void test_wakeup_run(void);
+void test_energy_run(void);
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// Exit status is the number of failed tests
+void app_main(void)
+{
+    UNITY_BEGIN();
+    test_form_run();
+    test_portal_run();
+    test_wakeup_run();
+    test_energy_run();
+    exit(UNITY_END());
+}
@@ -0,0 +1,123 @@
+#include "unity.h"
+#include "bench.h"
+#include "portal.h"
+#include <string.h>
+
+typedef struct {
+    char data[4096];
+    size_t len;
+    uint32_t writes;
+    uint32_t fail_after;    // 0 = never fail
+} page_sink_t;
+
+static esp_err_t sink_write(void* ctx, const char* data, size_t len)
+{
+    page_sink_t* sink = ctx;
+    if (sink->fail_after && sink->writes >= sink->fail_after) {
+        return ESP_FAIL;
+    }
+    sink->writes++;
+    TEST_ASSERT_LESS_THAN(sizeof(sink->data), sink->len + len);
+    memcpy(&sink->data[sink->len], data, len);
+    sink->len += len;
+    sink->data[sink->len] = '\0';
+    return ESP_OK;
+}
+
+static const char* const networks[WIFI_SETUP_MAX_NETWORKS] = {
+    "HomeNet", "Caf\xC3\xA9 <Guest> & 'Co'", "Office-5G", "\"quoted\"",
+};
+
+static portal_setup_page_t page_with(size_t ssid_count)
+{
+    portal_setup_page_t page = {
+        .setup_password = "Ab3$kP9q",
+        .device_mac = "24:6f:28:a1:b2:c3",
+        .csrf_token = 0xabcd,
+        .ssids = networks,
+        .ssid_count = ssid_count,
+    };
+    return page;
+}
+
+static void test_render_without_networks(void)
+{
+    page_sink_t sink = {0};
+    portal_setup_page_t page = page_with(0);
+    TEST_ASSERT_EQUAL(ESP_OK, portal_render_setup(&page, sink_write, &sink));
+    
+    TEST_ASSERT_EQUAL_STRING_LEN("<!DOCTYPE html>", sink.data, strlen("<!DOCTYPE html>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "Password required: <strong>Ab3$kP9q</strong>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "This device: <strong>24:6f:28:a1:b2:c3</strong>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "name='csrf' value='0000abcd'>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "href='" PORTAL_CSS_URI "'"));
+    TEST_ASSERT_NULL(strstr(sink.data, "<select"));
+    TEST_ASSERT_EQUAL_STRING("</div></body></html>", &sink.data[sink.len - strlen("</div></body></html>")]);
+}
+
+static void test_render_escapes_networks(void)
+{
+    page_sink_t sink = {0};
+    portal_setup_page_t page = page_with(WIFI_SETUP_MAX_NETWORKS);
+    TEST_ASSERT_EQUAL(ESP_OK, portal_render_setup(&page, sink_write, &sink));
+    
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "<option value='HomeNet'>Remove HomeNet</option>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data,
+        "<option value='Caf\xC3\xA9 &lt;Guest&gt; &amp; &#39;Co&#39;'>Remove Caf\xC3\xA9 &lt;Guest&gt; &amp; &#39;Co&#39;</option>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "<option value='&quot;quoted&quot;'>"));
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, "</option></select><input type='hidden' name='csrf'"));
+    
+    // Every write is one chunked TCP send on the device
+    TEST_ASSERT_LESS_OR_EQUAL(9 + 2 + 5 * WIFI_SETUP_MAX_NETWORKS, sink.writes);
+}
+
+static void test_render_long_escaped_ssid(void)
+{
+    // 31 ampersands expand to 155 bytes, more than the escape buffer holds at once
+    char ssid[WIFI_SSID_MAX_LEN];
+    memset(ssid, '&', sizeof(ssid) - 1);
+    ssid[sizeof(ssid) - 1] = '\0';
+    const char* ssids[] = { ssid };
+    
+    page_sink_t sink = {0};
+    portal_setup_page_t page = page_with(0);
+    page.ssids = ssids;
+    page.ssid_count = 1;
+    TEST_ASSERT_EQUAL(ESP_OK, portal_render_setup(&page, sink_write, &sink));
+    
+    char expected[5 * sizeof(ssid) + 32] = "<option value='";
+    for (size_t i = 0; i < sizeof(ssid) - 1; i++) {
+        strcat(expected, "&amp;");
+    }
+    strcat(expected, "'>");
+    TEST_ASSERT_NOT_NULL(strstr(sink.data, expected));
+}
+
+static void test_render_stops_on_error(void)
+{
+    page_sink_t sink = {.fail_after = 3};
+    portal_setup_page_t page = page_with(WIFI_SETUP_MAX_NETWORKS);
+    TEST_ASSERT_EQUAL(ESP_FAIL, portal_render_setup(&page, sink_write, &sink));
+    TEST_ASSERT_EQUAL(3, sink.writes);
+}
+
+static void bench_render(void* ctx)
+{
+    page_sink_t sink = {0};
+    portal_setup_page_t page = page_with(WIFI_SETUP_MAX_NETWORKS);
+    portal_render_setup(&page, sink_write, &sink);
+}
+
+static void test_portal_bench(void)
+{
+    bench_run("setup page, 4 networks", 20000, bench_render, NULL);
+}
+
+void test_portal_run(void)
+{
+    RUN_TEST(test_render_without_networks);
+    RUN_TEST(test_render_escapes_networks);
+    RUN_TEST(test_render_long_escaped_ssid);
+    RUN_TEST(test_render_stops_on_error);
+    RUN_TEST(test_portal_bench);
+}
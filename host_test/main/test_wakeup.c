@@ -0,0 +1,240 @@
+#include "unity.h"
+#include "bench.h"
+#include "fakes.h"
+#include "deep_sleep_manager.h"
+#include "dsm_private.h"
+#include "switch.h"
+#include "esp_bit_defs.h"
+#include "esp_log.h"
+#include <string.h>
+
+// Door and tamper contact, both active HIGH and low while closed
+#define DOOR_GPIO GPIO_NUM_32
+#define TAMPER_GPIO GPIO_NUM_33
+
+static int door = -1;
+static int tamper = -1;
+
+static dsm_input_batch_t last_batch;
+
+static void input_func(const dsm_input_batch_t* batch)
+{
+    last_batch = *batch;
+    fake_trace("input");
+}
+
+static void timer_func(void)
+{
+    fake_trace("timer");
+}
+
+static void boot_func(void)
+{
+    fake_trace("boot");
+}
+
+static void switch_func(void)
+{
+    fake_trace("switch");
+}
+
+static void add_inputs(void)
+{
+    if (door >= 0) {
+        return;
+    }
+    dsm_input_config_t config = {.name = "door", .gpio = DOOR_GPIO, .level = DSM_INPUT_ACTIVE_HIGH, .pull = true};
+    TEST_ASSERT_EQUAL(ESP_OK, deep_sleep_manager_add_input(&config, &door));
+    config = (dsm_input_config_t){.name = "tamper", .gpio = TAMPER_GPIO, .level = DSM_INPUT_ACTIVE_HIGH};
+    TEST_ASSERT_EQUAL(ESP_OK, deep_sleep_manager_add_input(&config, &tamper));
+}
+
+// All inputs idle, and a reset forgets the levels of the last wake
+static void reset_inputs(void)
+{
+    add_inputs();
+    fake_gpio_set_level(SWITCH_GPIO, 1);
+    fake_gpio_set_level(DOOR_GPIO, 0);
+    fake_gpio_set_level(TAMPER_GPIO, 0);
+    
+    dsm_input_batch_t batch;
+    dsm_inputs_collect(ESP_SLEEP_WAKEUP_UNDEFINED, &batch);
+    memset(&last_batch, 0, sizeof(last_batch));
+}
+
+static const char* dispatch(esp_sleep_wakeup_cause_t cause, uint64_t ext1_pins)
+{
+    fake_wakeup_set(cause, ext1_pins);
+    fake_trace_reset();
+    handle_wakeup_inputs(input_func, timer_func, boot_func);
+    return fake_trace_get();
+}
+
+static void test_add_input(void)
+{
+    add_inputs();
+    TEST_ASSERT_EQUAL(1, door);
+    TEST_ASSERT_EQUAL(2, tamper);
+    TEST_ASSERT_EQUAL_STRING("switch", deep_sleep_manager_input_name(DSM_INPUT_SWITCH));
+    TEST_ASSERT_EQUAL_STRING("tamper", deep_sleep_manager_input_name(tamper));
+    TEST_ASSERT_NULL(deep_sleep_manager_input_name(3));
+    
+    // Not an RTC GPIO, already taken by the switch, and EXT1 can't "or" LOW inputs
+    dsm_input_config_t config = {.name = "x", .gpio = (gpio_num_t)5, .level = DSM_INPUT_ACTIVE_HIGH};
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, deep_sleep_manager_add_input(&config, NULL));
+    config.gpio = SWITCH_GPIO;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, deep_sleep_manager_add_input(&config, NULL));
+    config.gpio = GPIO_NUM_34;
+    config.level = DSM_INPUT_ACTIVE_LOW;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, deep_sleep_manager_add_input(&config, NULL));
+    TEST_ASSERT_NULL(deep_sleep_manager_input_name(3));
+}
+
+static void test_dispatch_timer(void)
+{
+    reset_inputs();
+    
+    // Inputs first, so the jobs of this wake already see them
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    TEST_ASSERT_EQUAL_STRING("input jobs timer", dispatch(ESP_SLEEP_WAKEUP_TIMER, 0));
+    TEST_ASSERT_EQUAL(ESP_SLEEP_WAKEUP_TIMER, last_batch.cause);
+    TEST_ASSERT_EQUAL_HEX32(0, last_batch.triggered);
+    TEST_ASSERT_EQUAL_HEX32(BIT(door), last_batch.changed);
+    TEST_ASSERT_EQUAL_HEX32(BIT(door), last_batch.active);
+    
+    // Still open: left out of the EXT1 mask, nothing new for the callback
+    memset(&last_batch, 0, sizeof(last_batch));
+    TEST_ASSERT_EQUAL_STRING("jobs timer", dispatch(ESP_SLEEP_WAKEUP_TIMER, 0));
+    TEST_ASSERT_EQUAL_HEX32(0, last_batch.triggered | last_batch.changed);
+    
+    // Closed again while asleep, also a change
+    fake_gpio_set_level(DOOR_GPIO, 0);
+    TEST_ASSERT_EQUAL_STRING("input jobs timer", dispatch(ESP_SLEEP_WAKEUP_TIMER, 0));
+    TEST_ASSERT_EQUAL_HEX32(BIT(door), last_batch.changed);
+    TEST_ASSERT_EQUAL_HEX32(0, last_batch.active);
+    
+    TEST_ASSERT_EQUAL_STRING("jobs timer", dispatch(ESP_SLEEP_WAKEUP_TIMER, 0));
+}
+
+static void test_dispatch_inputs(void)
+{
+    reset_inputs();
+    
+    // The switch is a trigger only, its level is no change
+    fake_gpio_set_level(SWITCH_GPIO, 0);
+    TEST_ASSERT_EQUAL_STRING("input", dispatch(ESP_SLEEP_WAKEUP_EXT0, 0));
+    TEST_ASSERT_EQUAL_HEX32(BIT(DSM_INPUT_SWITCH), last_batch.triggered);
+    TEST_ASSERT_EQUAL_HEX32(BIT(DSM_INPUT_SWITCH), last_batch.active);
+    TEST_ASSERT_EQUAL_HEX32(0, last_batch.changed);
+    fake_gpio_set_level(SWITCH_GPIO, 1);
+    
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    TEST_ASSERT_EQUAL_STRING("input", dispatch(ESP_SLEEP_WAKEUP_EXT1, BIT64(DOOR_GPIO)));
+    TEST_ASSERT_EQUAL_HEX32(BIT(door), last_batch.triggered);
+    TEST_ASSERT_EQUAL_HEX32(BIT(door), last_batch.changed);
+    
+    // Tamper while the door stays open: only the tamper contact is new
+    fake_gpio_set_level(TAMPER_GPIO, 1);
+    TEST_ASSERT_EQUAL_STRING("input", dispatch(ESP_SLEEP_WAKEUP_EXT1, BIT64(TAMPER_GPIO)));
+    TEST_ASSERT_EQUAL_HEX32(BIT(tamper), last_batch.triggered);
+    TEST_ASSERT_EQUAL_HEX32(BIT(tamper), last_batch.changed);
+    TEST_ASSERT_EQUAL_HEX32(BIT(door) | BIT(tamper), last_batch.active);
+    
+    TEST_ASSERT_EQUAL_STRING("input", dispatch(ESP_SLEEP_WAKEUP_ULP, 0));
+    TEST_ASSERT_EQUAL_HEX32(BIT(DSM_INPUT_SWITCH), last_batch.triggered);
+    TEST_ASSERT_EQUAL_HEX32(0, last_batch.changed);
+    
+    // No known pin and no level changed: no input callback for the wake
+    TEST_ASSERT_EQUAL_STRING("", dispatch(ESP_SLEEP_WAKEUP_EXT1, BIT64(GPIO_NUM_35)));
+}
+
+static void test_dispatch_boot_and_unknown(void)
+{
+    reset_inputs();
+    
+    // Without deep sleep the pins are not read
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    TEST_ASSERT_EQUAL_STRING("boot", dispatch(ESP_SLEEP_WAKEUP_UNDEFINED, 0));
+    
+    fake_gpio_set_level(DOOR_GPIO, 0);
+    TEST_ASSERT_EQUAL_STRING("", dispatch(ESP_SLEEP_WAKEUP_GPIO, 0));
+}
+
+static void test_dispatch_null_callbacks(void)
+{
+    reset_inputs();
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    fake_wakeup_set(ESP_SLEEP_WAKEUP_TIMER, 0);
+    fake_trace_reset();
+    handle_wakeup_inputs(NULL, NULL, NULL);
+    TEST_ASSERT_EQUAL_STRING("jobs", fake_trace_get());
+}
+
+static void test_dispatch_legacy(void)
+{
+    reset_inputs();
+    
+    // handle_wakeup() only ever reported the switch
+    fake_wakeup_set(ESP_SLEEP_WAKEUP_EXT0, 0);
+    fake_trace_reset();
+    handle_wakeup(switch_func, timer_func, boot_func);
+    TEST_ASSERT_EQUAL_STRING("switch", fake_trace_get());
+    
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    fake_wakeup_set(ESP_SLEEP_WAKEUP_EXT1, BIT64(DOOR_GPIO));
+    fake_trace_reset();
+    handle_wakeup(switch_func, timer_func, boot_func);
+    TEST_ASSERT_EQUAL_STRING("", fake_trace_get());
+}
+
+static void test_sleep_entry(void)
+{
+    reset_inputs();
+    fake_trace_reset();
+    enter_deep_sleep();
+    TEST_ASSERT_EQUAL_STRING("timer_wakeup ext0_wakeup ext1_wakeup stub_arm timing_commit deep_sleep",
+                             fake_trace_get());
+    TEST_ASSERT_EQUAL_HEX64(BIT64(DOOR_GPIO) | BIT64(TAMPER_GPIO), fake_ext1_mask());
+    
+    // Level triggered: an input still active would wake right away
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    fake_trace_reset();
+    enter_deep_sleep();
+    TEST_ASSERT_EQUAL_HEX64(BIT64(TAMPER_GPIO), fake_ext1_mask());
+    
+    fake_gpio_set_level(TAMPER_GPIO, 1);
+    fake_trace_reset();
+    enter_deep_sleep();
+    TEST_ASSERT_EQUAL_STRING("timer_wakeup ext0_wakeup stub_arm timing_commit deep_sleep", fake_trace_get());
+    TEST_ASSERT_EQUAL_HEX64(0, fake_ext1_mask());
+}
+
+static void bench_dispatch(void* ctx)
+{
+    fake_trace_reset();
+    handle_wakeup_inputs(input_func, timer_func, boot_func);
+}
+
+static void test_wakeup_bench(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    reset_inputs();
+    fake_gpio_set_level(DOOR_GPIO, 1);
+    fake_wakeup_set(ESP_SLEEP_WAKEUP_TIMER, 0);
+    bench_run("handle_wakeup_inputs, timer", 200000, bench_dispatch, NULL);
+    fake_wakeup_set(ESP_SLEEP_WAKEUP_EXT0, 0);
+    bench_run("handle_wakeup_inputs, switch", 200000, bench_dispatch, NULL);
+    esp_log_level_set("*", ESP_LOG_INFO);
+}
+
+void test_wakeup_run(void)
+{
+    RUN_TEST(test_add_input);
+    RUN_TEST(test_dispatch_timer);
+    RUN_TEST(test_dispatch_inputs);
+    RUN_TEST(test_dispatch_boot_and_unknown);
+    RUN_TEST(test_dispatch_null_callbacks);
+    RUN_TEST(test_dispatch_legacy);
+    RUN_TEST(test_sleep_entry);
+    RUN_TEST(test_wakeup_bench);
+}
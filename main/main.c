@@ -1,53 +1,359 @@
 #include <stdio.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "deep_sleep_manager.h"
 #include "switch.h"
 #include "wifi_setup.h"
+#include "log_store.h"
+#include "wake_timing.h"
+#include "telemetry.h"
+#include "event_queue.h"
+#include "time_service.h"
+#include "bringup.h"
+#include "power_manager.h"
 
 static const char *TAG = "MAIN";
 
+// Wake scheduler cadence of the daily upload
+#define UPLOAD_PERIOD_S (24 * 60 * 60)
+
+// Upper bound for staying awake, covers the 2 minute portal timeout
+#define AWAKE_DEADLINE_MS (3 * 60 * 1000)
+
+#define UPLOAD_CONNECT_TIMEOUT_MS (15 * 1000)
+
+#define PORTAL_WAIT_MS (2 * 60 * 1000 + 30 * 1000)
+
+// Radio time an update download may add to the daily upload, the rest follows on later days
+#define OTA_BUDGET_MS (20 * 1000)
+
+// SNTP only when the wall clock may be this far off; with a drift estimate
+// that is every two days or so, not on every upload
+#define TIME_MAX_ERROR_MS (10 * 1000)
+#define SNTP_WAIT_MS (5 * 1000)
+
+// DFS range; between locked work the CPU idles at the XTAL clock or in light sleep
+#define CPU_MAX_FREQ_MHZ 160
+#define CPU_MIN_FREQ_MHZ 40
+
+// Presses held this long are uploaded right away instead of with the daily upload
+#define URGENT_PRESS_MS 3000
+
+// Door and tamper contacts next to the switch: open pulls the pin high, wake via EXT1
+#define DOOR_INPUT_GPIO GPIO_NUM_32
+#define TAMPER_INPUT_GPIO GPIO_NUM_33
+
+// Event queue record types, kept until the next successful upload
+enum {
+    EVENT_UPLOAD_FAILED = 1,    // int32 esp_err_t of the failed step
+    EVENT_WIFI_ATTEMPT,         // wifi_attempt_event_t, one per association attempt
+    EVENT_INPUT,                // input_event_t, door or tamper seen on a wake
+    EVENT_URGENT_PRESS,         // urgent_press_event_t, ESP-NOW only; the switch journal keeps the press
+};
+
+// Input masks of one wake, bit = deep_sleep_manager input index (0 switch, 1 door, 2 tamper)
+typedef struct __attribute__((packed)) {
+    uint8_t triggered;
+    uint8_t active;
+    uint8_t changed;            // level changed since the last wake, e.g. door closed again
+} input_event_t;
+
+// Urgent press as sent to the ESP-NOW gateway
+typedef struct __attribute__((packed)) {
+    uint64_t timestamp_us;
+    uint32_t duration_ms;
+    uint8_t source;
+} urgent_press_event_t;
+
+// Compact wifi_setup_attempt_t for the event queue, durations in ms
+typedef struct __attribute__((packed)) {
+    uint8_t network;
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t flags;              // BIT0 fast path, BIT1 connect succeeded with this attempt
+    uint16_t reason;
+    uint16_t scan_ms;
+    uint16_t assoc_ms;
+    uint16_t dhcp_ms;
+} wifi_attempt_event_t;
+
+// Upload wakes: one-channel scan first when the fast path fails
+static const wifi_setup_connect_profile_t upload_profile = {
+    .scan = WIFI_SETUP_SCAN_KNOWN_CHANNEL,
+};
+
 // WiFi callback function to handle connection results
-static void wifi_callback(bool success, esp_netif_ip_info_t* ip_info)
+static void wifi_callback(bool success, esp_netif_ip_info_t* ip_info, wifi_setup_connect_path_t path)
 {
+    // IP configuration is logged by wifi_setup itself on every STA connect
     if (success && ip_info) {
-        ESP_LOGI(TAG, "WiFi connected successfully!");
-        ESP_LOGI(TAG, "IP Address: " IPSTR, IP2STR(&ip_info->ip));
-        ESP_LOGI(TAG, "Gateway: " IPSTR, IP2STR(&ip_info->gw));
-        ESP_LOGI(TAG, "Netmask: " IPSTR, IP2STR(&ip_info->netmask));
+        LOG_STORE_LOGI(TAG, "WiFi connected successfully! (%s reconnect)",
+                       path == WIFI_SETUP_PATH_FAST ? "fast" : "full");
     } else {
         ESP_LOGW(TAG, "WiFi connection failed or timed out");
     }
 }
 
-void func_switch(void)
+// Upload finished: tear the radio down right away, the awake token goes with it
+static void telemetry_done(esp_err_t result)
 {
-    ESP_LOGI(TAG, "### START SWITCH ROUTINE ###");
+    LOG_STORE_LOGI(TAG, "Telemetry upload finished: %s", esp_err_to_name(result));
+    if (result != ESP_OK) {
+        int32_t code = result;
+        event_queue_push(EVENT_UPLOAD_FAILED, &code, sizeof(code));
+    } else {
+        // The server took the payload, so an updated image can still reach it;
+        // unconfirmed, the next wake rolls it back
+        telemetry_ota_confirm();
+    }
+    // An SNTP exchange started on connect usually finished during the upload
+    time_service_wait(SNTP_WAIT_MS);
+    wifi_setup_disconnect();
     
-    //###TODO###
+    telemetry_ota_status_t ota;
+    if (telemetry_get_ota_status(&ota) == ESP_OK && ota.state != TELEMETRY_OTA_IDLE) {
+        LOG_STORE_LOGI(TAG, "Update: state %d, %lu/%lu blocks, %lu bytes this wake", ota.state, ota.blocks_done,
+                       ota.block_count, ota.bytes_received);
+    }
     
-    while(switch_is_closed())
-    {
-        //do nothing
+    // Heap and stack peaks of this wake, sampled before the driver went down
+    wifi_setup_log_memory();
+}
+
+// Bring-up graph of an upload wake; the index is the bit in the after masks
+enum {
+    STEP_SETUP,
+    STEP_RADIO,
+    STEP_CREDS,
+    STEP_CONNECT,
+    STEP_IP,
+    STEP_PREWORK,
+    STEP_COUNT
+};
+
+static esp_err_t step_setup(void* arg)
+{
+    return wifi_setup_init();
+}
+
+static esp_err_t step_radio(void* arg)
+{
+    return wifi_setup_prepare_radio();
+}
+
+static esp_err_t step_creds(void* arg)
+{
+    return wifi_setup_load_credentials();
+}
+
+static esp_err_t step_connect(void* arg)
+{
+    return wifi_setup_connect_ex(NULL, true, &upload_profile);
+}
+
+// Per-attempt connect metrics go out with the next upload, for tuning the profile per site
+static void queue_connect_metrics(void)
+{
+    wifi_setup_connect_metrics_t metrics;
+    if (wifi_setup_get_connect_metrics(&metrics) != ESP_OK) {
+        return;
     }
     
-    ESP_LOGI(TAG, "### END SWITCH ROUTINE ###");
+    for (uint8_t i = 0; i < metrics.attempt_count; i++) {
+        const wifi_setup_attempt_t* a = &metrics.attempts[i];
+        wifi_attempt_event_t event = {
+            .network = a->network,
+            .channel = a->channel,
+            .rssi = a->rssi,
+            .flags = (a->fast ? BIT0 : 0) | (metrics.success && i + 1 == metrics.attempt_count ? BIT1 : 0),
+            .reason = a->reason,
+            .scan_ms = MIN(a->scan_us / 1000, UINT16_MAX),
+            .assoc_ms = MIN(a->assoc_us / 1000, UINT16_MAX),
+            .dhcp_ms = MIN(a->dhcp_us / 1000, UINT16_MAX),
+        };
+        event_queue_push(EVENT_WIFI_ATTEMPT, &event, sizeof(event));
+    }
 }
 
-void func_scheduled(void)
+static esp_err_t step_ip(void* arg)
+{
+    esp_netif_ip_info_t ip_info;
+    esp_err_t ret = wifi_setup_connect_wait(UPLOAD_CONNECT_TIMEOUT_MS, &ip_info);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "No connection for upload: %s", esp_err_to_name(ret));
+    }
+    queue_connect_metrics();
+    return ret;
+}
+
+static esp_err_t step_none(void* arg)
+{
+    return ESP_OK;
+}
+
+// Connect and upload, with update the OTA stage follows on the same connection;
+// telemetry_done() tears down without slack time.
+// The WiFi stack comes up on core 0 while core 1 loads the credentials;
+// prework shares core 1 and overlaps the radio start and the IP assignment.
+static void start_upload(bringup_fn_t prework, bool update)
+{
+    const bringup_step_t steps[STEP_COUNT] = {
+        [STEP_SETUP]   = { "setup",   step_setup,   NULL, 0, 1 },
+        [STEP_RADIO]   = { "radio",   step_radio,   NULL, 0, 0 },
+        [STEP_CREDS]   = { "creds",   step_creds,   NULL, 0, 1 },
+        [STEP_CONNECT] = { "connect", step_connect, NULL, BIT(STEP_SETUP) | BIT(STEP_RADIO) | BIT(STEP_CREDS), 0 },
+        [STEP_IP]      = { "ip",      step_ip,      NULL, BIT(STEP_CONNECT), 0 },
+        // Float formatting and the payload size pass need more than the default stack
+        [STEP_PREWORK] = { "prework", prework ? prework : step_none, NULL, 0, 1, 6144 },
+    };
+    bringup_report_t report;
+    
+    esp_err_t ret = bringup_run(steps, STEP_COUNT, &report);
+    if (ret == ESP_ERR_INVALID_ARG) {
+        ESP_LOGE(TAG, "Invalid bring-up graph");
+    } else {
+        // Only the WiFi chain gates the upload; a failure in it is the lowest-index one in ret
+        if (report.result[STEP_IP] == ESP_OK) {
+            ret = telemetry_start_ex(telemetry_done, update);
+        }
+        // The attempt holds the radio until it is torn down
+        if (ret != ESP_OK && report.result[STEP_CONNECT] == ESP_OK) {
+            wifi_setup_disconnect();
+        }
+    }
+    if (ret != ESP_OK) {
+        // Reported with the next upload that gets through
+        int32_t code = ret;
+        event_queue_push(EVENT_UPLOAD_FAILED, &code, sizeof(code));
+    }
+}
+
+// A few bytes to the paired gateway in tens of ms instead of a full association;
+// false without gateway or ACK, the caller falls back to the queue and the upload
+static bool report_fast(uint8_t type, const void* payload, size_t len)
+{
+    if (wifi_setup_init() != ESP_OK || !wifi_setup_has_gateway()) {
+        return false;
+    }
+    esp_err_t ret = wifi_setup_report(type, payload, len);
+    if (ret != ESP_OK) {
+        LOG_STORE_LOGW(TAG, "ESP-NOW report failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+// Everything that fired during one wake arrives here at once, so it costs one upload at most
+void func_inputs(const dsm_input_batch_t* batch)
+{
+    LOG_STORE_LOGI(TAG, "### START INPUT ROUTINE ###");
+    
+    // A door left open stays active without being new: only the switch
+    // press itself and level changes of the other inputs count
+    uint32_t inputs = batch->triggered | batch->changed;
+    bool urgent = false;
+    
+    if (inputs & BIT(DSM_INPUT_SWITCH)) {
+        //###TODO###
+        
+        // Presses the ULP filtered out during deep sleep (ULP wake mode only)
+        dsm_press_stats_t stats;
+        if (deep_sleep_manager_get_press_stats(&stats) == ESP_OK) {
+            LOG_STORE_LOGI(TAG, "Presses while asleep: %lu (ULP wake reason %d)", stats.press_count, stats.wake_reason);
+        }
+        
+        // Blocks on the release event instead of spinning on the pin
+        int64_t press_us = 0;
+        if (switch_wait_for_release(SWITCH_WAIT_FOREVER, &press_us) == ESP_OK) {
+            LOG_STORE_LOGI(TAG, "Switch released after %lld ms", press_us / 1000);
+        }
+        
+        // Presses wait in the switch journal for the daily upload, urgent ones go now;
+        // the journal still carries an ESP-NOW delivered press with the next upload
+        switch_journal_entry_t entry;
+        if (switch_journal_take_urgent() &&
+            switch_journal_get(switch_journal_count() - 1, &entry) == ESP_OK) {
+            urgent_press_event_t event = {
+                .timestamp_us = entry.timestamp_us,
+                .duration_ms = entry.duration_ms,
+                .source = entry.source,
+            };
+            urgent = !report_fast(EVENT_URGENT_PRESS, &event, sizeof(event));
+        }
+    }
+    
+    // Door and tamper are rare, they always go out right away
+    if (inputs & ~BIT(DSM_INPUT_SWITCH)) {
+        input_event_t event = {
+            .triggered = batch->triggered,
+            .active = batch->active,
+            .changed = batch->changed,
+        };
+        if (!report_fast(EVENT_INPUT, &event, sizeof(event))) {
+            event_queue_push(EVENT_INPUT, &event, sizeof(event));
+            urgent = true;
+        }
+    }
+    
+    // On a timer wake the upload job runs right after this and takes everything along;
+    // without a server the events just stay queued
+    if (urgent && batch->cause != ESP_SLEEP_WAKEUP_TIMER && telemetry_enabled()) {
+        LOG_STORE_LOGI(TAG, "Urgent input, uploading %lu journaled presses now", switch_journal_count());
+        start_upload(NULL, false);
+    }
+    
+    LOG_STORE_LOGI(TAG, "### END INPUT ROUTINE ###");
+}
+
+// Pre-upload work of the scheduled wake, runs on core 1 while WiFi comes up
+static esp_err_t scheduled_prework(void* arg)
 {
-    ESP_LOGI(TAG, "### START SCHEDULED ROUTINE ###");
+    // Boot-to-sleep phase timings of the last wakes per wake reason
+    wake_timing_dump();
+    
+    // Clock and light sleep residency of this wake so far
+    power_manager_dump();
     
+    // Battery budget: charge per wake class since first boot
+    dsm_energy_stats_t energy;
+    if (deep_sleep_manager_get_energy_stats(&energy) == ESP_OK) {
+        LOG_STORE_LOGI(TAG, "Energy: %.1f uAh total, boot %.1f / switch %.1f / timer %.1f uAh, radio on %llu ms",
+                       energy.charge_uah, energy.wake_charge_uah[DSM_WAKE_CLASS_BOOT],
+                       energy.wake_charge_uah[DSM_WAKE_CLASS_SWITCH], energy.wake_charge_uah[DSM_WAKE_CLASS_TIMER],
+                       (energy.radio_on_us[DSM_WAKE_CLASS_BOOT] + energy.radio_on_us[DSM_WAKE_CLASS_SWITCH] +
+                        energy.radio_on_us[DSM_WAKE_CLASS_TIMER]) / 1000);
+    }
 
-    //###TODO###
+    // Logs, timing records, presses and counters in one payload
+    LOG_STORE_LOGI(TAG, "Telemetry payload: %u bytes", (unsigned)telemetry_payload_size());
     
+    LOG_STORE_LOGI(TAG, "Queued events: %u bytes, %lu dropped", (unsigned)event_queue_pending(), event_queue_get_dropped());
+    return ESP_OK;
+}
+
+void func_scheduled(void)
+{
+    LOG_STORE_LOGI(TAG, "### START SCHEDULED ROUTINE ###");
+    
+    // Updates only with the daily upload, input wakes stay short
+    start_upload(scheduled_prework, true);
     
-    ESP_LOGI(TAG, "### END SCHEDULED ROUTINE ###");
+    LOG_STORE_LOGI(TAG, "### END SCHEDULED ROUTINE ###");
 }
 
 void func_boot_rst(void)
 {
+    // The restart into an update: it has to prove itself with an upload, not
+    // sit in the setup portal; telemetry_done() confirms it
+    if (telemetry_enabled() && telemetry_ota_pending_verify()) {
+        LOG_STORE_LOGI(TAG, "Updated image on probation, uploading instead of the portal");
+        start_upload(NULL, false);
+        return;
+    }
+    
     esp_err_t ret = wifi_setup_init();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "WiFi setup initialization failed: %s", esp_err_to_name(ret));
@@ -65,7 +371,7 @@ void func_boot_rst(void)
 		ESP_LOGI(TAG, "No WiFi credentials saved, starting setup portal...");
     }
     
-    // Start the WiFi setup portal - it will auto-timeout after 5 minutes
+    // Start the WiFi setup portal - it will auto-timeout after 2 minutes
 	ret = wifi_setup_start_portal(wifi_callback);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG, "Failed to start WiFi setup portal: %s", esp_err_to_name(ret));
@@ -75,13 +381,14 @@ void func_boot_rst(void)
     ESP_LOGI(TAG, "WiFi setup portal started successfully!");
     ESP_LOGI(TAG, "WiFi test instructions:");
     ESP_LOGI(TAG, "1. Connect to 'ESP32-WiFi-Setup' network (check logs for password)");
-    ESP_LOGI(TAG, "2. Open browser to http://192.168.4.1");
+    ESP_LOGI(TAG, "2. The setup page opens automatically (or browse to http://192.168.4.1)");
     ESP_LOGI(TAG, "3. Enter setup password and your WiFi credentials");
-    ESP_LOGI(TAG, "4. Portal will auto-timeout after 5 minutes if unused");
+    ESP_LOGI(TAG, "4. Portal will auto-timeout after 2 minutes if unused");
     
-    // Wait for the portal to complete or timeout (5 minutes max)
+    // Blocks until the portal timed out or the submitted credentials connected
     ESP_LOGI(TAG, "Waiting for WiFi setup to complete...");
-    
+    ret = wifi_setup_portal_wait(PORTAL_WAIT_MS);
+    ESP_LOGI(TAG, "Portal finished: %s", esp_err_to_name(ret));
     
     // Check final state
     wifi_setup_state_t final_state = wifi_setup_get_state();
@@ -95,25 +402,111 @@ void func_boot_rst(void)
     // ESP_LOGI(TAG, "Clearing WiFi credentials for testing...");
     // wifi_setup_clear_credentials();
     
+    // Portal sessions are the largest heap users, see what they left behind
+    wifi_setup_log_memory();
+    
     ESP_LOGI(TAG, "### END BOOT/RESET ROUTINE ###");
 }
 
 void app_main(void)
 {
-    ESP_LOGI(TAG, "=== dev_00 GESTARTET (WiFi Test Mode) ===");
+    wake_timing_init();
+    wake_timing_mark("app_start");
+    
+    esp_err_t ret = log_store_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Log store initialization failed: %s", esp_err_to_name(ret));
+    }
+    wake_timing_mark("log_init");
     
-    esp_err_t ret = deep_sleep_manager_init();
+    ret = event_queue_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Event queue initialization failed: %s", esp_err_to_name(ret));
+    }
+    
+    LOG_STORE_LOGI(TAG, "=== dev_00 GESTARTET (WiFi Test Mode) ===");
+    
+    // Portal and connect waits are mostly idle: DFS and light sleep until a lock asks for more
+    static const power_manager_config_t pm_config = {
+        .max_freq_mhz = CPU_MAX_FREQ_MHZ,
+        .min_freq_mhz = CPU_MIN_FREQ_MHZ,
+        .light_sleep = true,
+    };
+    power_manager_init(&pm_config);
+    
+    // Before deep_sleep_manager_init(), which journals the presses recorded while asleep
+    switch_journal_set_urgent_ms(URGENT_PRESS_MS);
+    
+    ret = deep_sleep_manager_init();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Deep Sleep Manager Initialisierung fehlgeschlagen: %s", esp_err_to_name(ret));
         return;
     }
+    wake_timing_mark("dsm_init");
+    
+    // System time from the RTC estimate; SNTP later only if it drifted too far
+    static const time_service_config_t time_config = {
+        .max_error_ms = TIME_MAX_ERROR_MS,
+    };
+    ret = time_service_init(&time_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Time service initialization failed: %s", esp_err_to_name(ret));
+    }
+    
+    static const telemetry_config_t telemetry_config = {
+        .host = CONFIG_TELEMETRY_HOST,
+        .path = CONFIG_TELEMETRY_PATH,
+        .events_path = CONFIG_TELEMETRY_EVENTS_PATH,
+        .ota_path = CONFIG_TELEMETRY_OTA_PATH,
+        .ota_budget_ms = OTA_BUDGET_MS,
+    };
+    ret = telemetry_init(&telemetry_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Telemetry disabled (no server configured?): %s", esp_err_to_name(ret));
+    }
+    
+    // Periodic jobs must be registered before handle_wakeup() dispatches them;
+    // without a server there is nothing to upload and no reason to connect
+    if (telemetry_enabled()) {
+        deep_sleep_manager_add_job("upload", UPLOAD_PERIOD_S, func_scheduled);
+    }
+    
+    // Wake inputs besides the switch, same for the input table
+    static const dsm_input_config_t door_input = {
+        .name = "door",
+        .gpio = DOOR_INPUT_GPIO,
+        .level = DSM_INPUT_ACTIVE_HIGH,
+        .pull = true,
+    };
+    static const dsm_input_config_t tamper_input = {
+        .name = "tamper",
+        .gpio = TAMPER_INPUT_GPIO,
+        .level = DSM_INPUT_ACTIVE_HIGH,
+        .pull = true,
+    };
+    deep_sleep_manager_add_input(&door_input, NULL);
+    deep_sleep_manager_add_input(&tamper_input, NULL);
     
     // Handle wakeup reasons and run appropriate functions
-    handle_wakeup(func_switch, func_scheduled, func_boot_rst);
+    handle_wakeup_inputs(func_inputs, NULL, func_boot_rst);
+    wake_timing_mark("callback");
+    
+    LOG_STORE_LOGI(TAG, "System setup completed.");
+    
+    // Sleep as soon as all async work (portal, WiFi, uploads) has released its token
+    if (deep_sleep_manager_wait_idle(AWAKE_DEADLINE_MS) != ESP_OK) {
+        ESP_LOGW(TAG, "Awake deadline expired, going to Deep Sleep anyway");
+    }
+    wake_timing_mark("idle");
+    
+    log_store_flush();
     
-    ESP_LOGI(TAG, "System setup completed.");
-    ESP_LOGI(TAG, "Going to Deep Sleep in 5 seconds...");
-    vTaskDelay(pdMS_TO_TICKS(5000));
+    // A new image needs a real reset: its RTC data layout differs from the running one
+    telemetry_ota_status_t ota;
+    if (telemetry_get_ota_status(&ota) == ESP_OK && ota.state == TELEMETRY_OTA_READY) {
+        LOG_STORE_LOGI(TAG, "Restarting into the updated image");
+        esp_restart();
+    }
     
     enter_deep_sleep();
     
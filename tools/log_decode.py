@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Print the stored log, expanding the tokenized records of LOG_STORE_LOGx.
+
+The log (TELEMETRY_KEY_LOG of an upload, or a dump of the "logs" partition
+payloads) mixes text lines with records starting with 0xFF (see
+log_store.h). A record names its format string by the address of an entry
+in the .log_tokens section, which only the ELF of the exact build has;
+pick it by the image SHA-256 the device reported (TELEMETRY_KEY_APP).
+
+    log_decode.py build/00_dev.elf log.bin
+"""
+import argparse
+import re
+import struct
+import sys
+
+TOKEN_MARKER = 0xFF
+TOKEN_SECTION = '.log_tokens'
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+
+ARG_INT, ARG_INT64, ARG_DOUBLE, ARG_STRING = range(4)
+
+SECTION = struct.Struct('<IIIIIIIIII')
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGcsp%])')
+
+
+class Elf:
+    """Just enough of an ELF32 little endian file to read sections by address."""
+
+    def __init__(self, data):
+        if data[:4] != b'\x7fELF' or data[4] != 1 or data[5] != 1:
+            raise ValueError('not a 32-bit little endian ELF')
+        self.data = data
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+        headers = [SECTION.unpack_from(data, shoff + i * shentsize) for i in range(shnum)]
+        strtab = headers[shstrndx][4]
+
+        self.sections = {}
+        self.loaded = []
+        for header in headers:
+            name_off, type_, flags, addr, offset, size = header[:6]
+            end = data.index(b'\0', strtab + name_off)
+            name = data[strtab + name_off:end].decode()
+            self.sections[name] = (addr, offset, size)
+            if flags & SHF_ALLOC and type_ != SHT_NOBITS and size > 0:
+                self.loaded.append((addr, offset, size))
+
+    def section(self, name):
+        addr, offset, size = self.sections[name]
+        return addr, self.data[offset:offset + size]
+
+    def read(self, addr, length):
+        for start, offset, size in self.loaded:
+            if start <= addr and addr + length <= start + size:
+                pos = offset + addr - start
+                return self.data[pos:pos + length]
+        raise KeyError(f'0x{addr:08x} not in a loaded section')
+
+    def cstring(self, addr):
+        for start, offset, size in self.loaded:
+            if start <= addr < start + size:
+                pos = offset + addr - start
+                return self.data[pos:self.data.index(b'\0', pos)].decode(errors='replace')
+        raise KeyError(f'0x{addr:08x} not in a loaded section')
+
+
+class Tokens:
+    """Entries of LOG_STORE_TOKEN(): tag variable address, types, level, format."""
+
+    def __init__(self, elf):
+        self.elf = elf
+        self.base, self.data = elf.section(TOKEN_SECTION)
+
+    def lookup(self, token_id):
+        pos = token_id - self.base
+        if not 0 <= pos < len(self.data) - 9:
+            raise KeyError(f'unknown token 0x{token_id:x}')
+        tag_ref, types = struct.unpack_from('<II', self.data, pos)
+        level = chr(self.data[pos + 8])
+        end = self.data.index(b'\0', pos + 9)
+        fmt = self.data[pos + 9:end].decode(errors='replace')
+
+        # tag_ref is &TAG, the string is wherever TAG points to
+        tag_ptr, = struct.unpack('<I', self.elf.read(tag_ref, 4))
+        return self.elf.cstring(tag_ptr), level, types, fmt
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return value, pos
+
+
+def decode_args(types, data):
+    """Values in argument order; missing ones (truncated on the device) are None."""
+    args = []
+    pos = 0
+    for i in range(types & 0xF):
+        kind = (types >> (4 + 2 * i)) & 0x3
+        if pos >= len(data):
+            args.append(None)
+        elif kind in (ARG_INT, ARG_INT64):
+            value, pos = varint(data, pos)
+            args.append(value)
+        elif kind == ARG_DOUBLE:
+            args.append(struct.unpack_from('<d', data, pos)[0])
+            pos += 8
+        else:
+            length = data[pos]
+            args.append(data[pos + 1:pos + 1 + length].decode(errors='replace'))
+            pos += 1 + length
+    return args
+
+
+def format_message(fmt, args):
+    """C printf formatting of fmt with the raw argument values."""
+    values = iter(args)
+
+    def convert(match):
+        flags, length, conv = match.groups()
+        if conv == '%':
+            return '%'
+        value = next(values, None)
+        if value is None:
+            return '?'
+        if conv in 'di':
+            bits = 64 if length in ('ll', 'j') else 32
+            if value >= 1 << (bits - 1):
+                value -= 1 << bits
+        elif conv == 'p':
+            return f'0x{value:x}'
+        elif conv == 'c':
+            return chr(value & 0xFF)
+        elif conv == 'u':
+            conv = 'd'
+        return ('%' + flags + conv) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(log, tokens, out):
+    pos = 0
+    while pos < len(log):
+        if log[pos] != TOKEN_MARKER:
+            end = log.find(b'\n', pos)
+            end = len(log) if end < 0 else end + 1
+            out.write(log[pos:end].decode(errors='replace'))
+            pos = end
+            continue
+
+        try:
+            token_id, p = varint(log, pos + 1)
+            timestamp, p = varint(log, p)
+            length = log[p]
+            args = log[p + 1:p + 1 + length]
+            pos = p + 1 + length
+        except IndexError:
+            out.write('<truncated record>\n')
+            break
+
+        try:
+            tag, level, types, fmt = tokens.lookup(token_id)
+            message = format_message(fmt, decode_args(types, args))
+        except (KeyError, ValueError, TypeError) as e:
+            out.write(f'? ({timestamp}) <{e}>\n')
+            continue
+        out.write(f'{level} ({timestamp}) {tag}: {message}\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('elf', help='ELF of the build the device was running')
+    parser.add_argument('log', nargs='?', help='stored log bytes, default stdin')
+    args = parser.parse_args()
+
+    tokens = Tokens(Elf(open(args.elf, 'rb').read()))
+    log = open(args.log, 'rb').read() if args.log else sys.stdin.buffer.read()
+    decode(log, tokens, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
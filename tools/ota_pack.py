@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Build the update container the telemetry OTA stage downloads from ota_path.
+
+The layout is telemetry_ota_header_t followed by one telemetry_ota_block_t
+and a raw deflate stream per 16 KB block of the image (see telemetry.h).
+With --base every block may use a range of the image running on the device
+as preset dictionary, which turns the container into a delta; serve it only
+to devices that reported that image (TELEMETRY_KEY_APP).
+
+Both images must be app binaries as written by esptool, with the SHA-256
+appended (the default); that digest identifies them.
+
+    ota_pack.py build/00_dev.bin firmware.tota --base released/00_dev.bin
+"""
+import argparse
+import struct
+import zlib
+
+MAGIC = 0x41544F54
+BLOCK_SIZE = 16 * 1024
+DICT_MAX = 16 * 1024
+SHA_LEN = 32
+PROBE_LEN = 64
+
+HEADER = struct.Struct('<IIIII32s32s')
+BLOCK = struct.Struct('<III')
+
+
+def deflate(data, zdict=None):
+    if zdict:
+        c = zlib.compressobj(9, zlib.DEFLATED, -15, 9, zdict=zdict)
+    else:
+        c = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+    return c.compress(data) + c.flush()
+
+
+def dictionary_starts(base, block, offset):
+    """Same place in the base, shortly before it, and where the block start shows up."""
+    starts = {offset, offset - DICT_MAX // 2}
+    probe = block[:PROBE_LEN]
+    pos = base.find(probe)
+    for _ in range(4):
+        if pos < 0:
+            break
+        starts.add(pos)
+        pos = base.find(probe, pos + 1)
+    return sorted(s for s in starts if 0 <= s < len(base))
+
+
+def pack_block(block, base, offset):
+    """Smallest of plain deflate and the dictionary candidates."""
+    best = (deflate(block), 0, 0)
+    if base:
+        for start in dictionary_starts(base, block, offset):
+            zdict = base[start:start + DICT_MAX]
+            data = deflate(block, zdict)
+            if len(data) < len(best[0]):
+                best = (data, start, len(zdict))
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('image', help='new app binary')
+    parser.add_argument('output', help='container to serve at ota_path')
+    parser.add_argument('--base', help='app binary running on the devices, for a delta')
+    args = parser.parse_args()
+
+    image = open(args.image, 'rb').read()
+    base = open(args.base, 'rb').read() if args.base else b''
+
+    blocks = []
+    for offset in range(0, len(image), BLOCK_SIZE):
+        data, start, length = pack_block(image[offset:offset + BLOCK_SIZE], base, offset)
+        blocks.append(BLOCK.pack(len(data), start, length) + data)
+
+    header = HEADER.pack(MAGIC, HEADER.size, BLOCK_SIZE, len(image), len(blocks),
+                         image[-SHA_LEN:], base[-SHA_LEN:] if base else bytes(SHA_LEN))
+    with open(args.output, 'wb') as f:
+        f.write(header)
+        for block in blocks:
+            f.write(block)
+
+    size = HEADER.size + sum(len(b) for b in blocks)
+    print(f'{args.output}: {len(blocks)} blocks, {len(image)} -> {size} bytes '
+          f'({size * 100 // len(image)}%){" delta" if base else ""}')
+
+
+if __name__ == '__main__':
+    main()